@@ -0,0 +1,728 @@
+// BCDecode.cpp
+//
+// CPU decoding of block compressed (BC1 to BC5 and BC7) and packed dds pixel formats to RGBA. No graphics context is
+// needed so it is safe to call from any thread. Large images are split across multiple threads.
+//
+// Copyright (c) 2020 Tristan Grimmer.
+// Permission to use, copy, modify, and/or distribute this software for any purpose with or without fee is hereby
+// granted, provided that the above copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+// INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN
+// AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+// PERFORMANCE OF THIS SOFTWARE.
+
+#include <thread>
+#include <atomic>
+#include <Foundation/tStandard.h>
+#include <Foundation/tFundamentals.h>
+#include <System/tMachine.h>
+#include "BCDecode.h"
+
+// The palette maths for the colour and alpha blocks is done 8 lanes at a time when SSE2 is available. Everything else
+// is table lookups which don't benefit from it.
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && (_M_IX86_FP >= 2))
+#define BCDECODE_SSE2
+#include <emmintrin.h>
+#endif
+using namespace tImage;
+
+
+namespace Viewer
+{
+	// Images with fewer blocks than this are not worth starting threads for. The number of threads grows with the
+	// number of blocks up to the number of cores.
+	const int MinBlocksPerThread = 4096;
+
+	// The work is handed out in runs of this many block rows.
+	const int JobBlockRows = 16;
+
+	struct BC7ModeInfo
+	{
+		int NumSubsets;
+		int PartitionBits;
+		int RotationBits;
+		int IndexSelBits;
+		int ColourBits;
+		int AlphaBits;
+		int EndpointPBits;
+		int SharedPBits;
+		int IndexBits;
+		int IndexBits2;
+	};
+
+	const BC7ModeInfo BC7Modes[8] =
+	{
+		{ 3, 4, 0, 0, 4, 0, 1, 0, 3, 0 },
+		{ 2, 6, 0, 0, 6, 0, 0, 1, 3, 0 },
+		{ 3, 6, 0, 0, 5, 0, 0, 0, 2, 0 },
+		{ 2, 6, 0, 0, 7, 0, 1, 0, 2, 0 },
+		{ 1, 0, 2, 1, 5, 6, 0, 0, 2, 3 },
+		{ 1, 0, 2, 0, 7, 8, 0, 0, 2, 2 },
+		{ 1, 0, 0, 0, 7, 7, 1, 0, 4, 0 },
+		{ 2, 6, 0, 0, 5, 5, 1, 0, 2, 0 }
+	};
+
+	// Bit n is the subset of pixel n.
+	const uint16 BC7Partitions2[64] =
+	{
+		0xCCCC, 0x8888, 0xEEEE, 0xECC8, 0xC880, 0xFEEC, 0xFEC8, 0xEC80, 0xC800, 0xFFEC, 0xFE80, 0xE800, 0xFFE8, 0xFF00, 0xFFF0, 0xF000,
+		0xF710, 0x008E, 0x7100, 0x08CE, 0x008C, 0x7310, 0x3100, 0x8CCE, 0x088C, 0x3110, 0x6666, 0x366C, 0x17E8, 0x0FF0, 0x718E, 0x399C,
+		0xAAAA, 0xF0F0, 0x5A5A, 0x33CC, 0x3C3C, 0x55AA, 0x9696, 0xA55A, 0x73CE, 0x13C8, 0x324C, 0x3BDC, 0x6996, 0xC33C, 0x9966, 0x0660,
+		0x0272, 0x04E4, 0x4E40, 0x2720, 0xC936, 0x936C, 0x39C6, 0x639C, 0x9336, 0x9CC6, 0x817E, 0xE718, 0xCCF0, 0x0FCC, 0x7744, 0xEE22
+	};
+
+	// Two bits per pixel. Bits 2n and 2n+1 are the subset of pixel n.
+	const uint32 BC7Partitions3[64] =
+	{
+		0xAA685050, 0x6A5A5040, 0x5A5A4200, 0x5450A0A8, 0xA5A50000, 0xA0A05050, 0x5555A0A0, 0x5A5A5050,
+		0xAA550000, 0xAA555500, 0xAAAA5500, 0x90909090, 0x94949494, 0xA4A4A4A4, 0xA9A59450, 0x2A0A4250,
+		0xA5945040, 0x0A425054, 0xA5A5A500, 0x55A0A0A0, 0xA8A85454, 0x6A6A4040, 0xA4A45000, 0x1A1A0500,
+		0x0050A4A4, 0xAAA59090, 0x14696914, 0x69691400, 0xA08585A0, 0xAA821414, 0x50A4A450, 0x6A5A0200,
+		0xA9A58000, 0x5090A0A8, 0xA8A09050, 0x24242424, 0x00AA5500, 0x24924924, 0x24499224, 0x50A50A50,
+		0x500AA550, 0xAAAA4444, 0x66660000, 0xA5A0A5A0, 0x50A050A0, 0x69286928, 0x44AAAA44, 0x66666600,
+		0xAA444444, 0x54A854A8, 0x95809580, 0x96969600, 0xA85454A8, 0x80959580, 0xAA141414, 0x96960000,
+		0xAAAA1414, 0xA05050A0, 0xA0A5A5A0, 0x96000000, 0x40804080, 0xA9A8A9A8, 0xAAAAAA44, 0x2A4A5254
+	};
+
+	// The pixels whose indices have an implied zero high bit. Pixel 0 is always one of them.
+	const uint8 BC7Anchors2[64] =
+	{
+		15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15,
+		15,  2,  8,  2,  2,  8,  8, 15,  2,  8,  2,  2,  8,  8,  2,  2,
+		15, 15,  6,  8,  2,  8, 15, 15,  2,  8,  2,  2,  2, 15, 15,  6,
+		 6,  2,  6,  8, 15, 15,  2,  2, 15, 15, 15, 15, 15,  2,  2, 15
+	};
+
+	const uint8 BC7Anchors3a[64] =
+	{
+		 3,  3, 15, 15,  8,  3, 15, 15,  8,  8,  6,  6,  6,  5,  3,  3,
+		 3,  3,  8, 15,  3,  3,  6, 10,  5,  8,  8,  6,  8,  5, 15, 15,
+		 8, 15,  3,  5,  6, 10,  8, 15, 15,  3, 15,  5, 15, 15, 15, 15,
+		 3, 15,  5,  5,  5,  8,  5, 10,  5, 10,  8, 13, 15, 12,  3,  3
+	};
+
+	const uint8 BC7Anchors3b[64] =
+	{
+		15,  8,  8,  3, 15, 15,  3,  8, 15, 15, 15, 15, 15, 15, 15,  8,
+		15,  8, 15,  3, 15,  8, 15,  8,  3, 15,  6, 10, 15, 15, 10,  8,
+		15,  3, 15, 10, 10,  8,  9, 10,  6, 15,  8, 15,  3,  6,  6,  8,
+		15,  3, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15,  3, 15, 15,  8
+	};
+
+	const int BC7Weights2[4]	= { 0, 21, 43, 64 };
+	const int BC7Weights3[8]	= { 0, 9, 18, 27, 37, 46, 55, 64 };
+	const int BC7Weights4[16]	= { 0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64 };
+
+	// Reads little-endian bit fields out of a 128 bit block.
+	class BC7Bits
+	{
+	public:
+		BC7Bits(const uint8* block);
+		int Read(int numBits);
+
+	private:
+		uint64 Lo, Hi;
+		int Pos = 0;
+	};
+
+	bool IsBlockCompressed(tPixelFormat);
+	int GetBlockBytes(tPixelFormat);
+	int GetPackedPixelBytes(tPixelFormat);
+	bool IsLayerDecodable(const tLayer&);
+
+	void DecodeBlockRows(tPixel* dest, const tLayer&, int firstBlockRow, int numBlockRows);
+	void DecodeBlock(tPixelFormat, const uint8* src, tPixel* dest);
+	void DecodePackedPixel(tPixelFormat, const uint8* src, tPixel& dest);
+	void DecodeColourBC1(const uint8* src, tPixel* dest, bool alwaysFourColour, bool punchThroughAlpha);
+	void DecodeAlphaBC2(const uint8* src, tPixel* dest);
+	void DecodeChannelBC4(const uint8* src, uint8* dest);
+	void DecodeBlockBC7(const uint8* src, tPixel* dest);
+	int GetBC7Subset(int numSubsets, int partition, int pixel);
+	bool IsBC7Anchor(int numSubsets, int partition, int pixel);
+	int GetBC7Weight(int numBits, int index);
+}
+
+
+bool Viewer::CanDecodeToRGBA(tPixelFormat format)
+{
+	return IsBlockCompressed(format) || (GetPackedPixelBytes(format) > 0);
+}
+
+
+bool Viewer::IsBlockCompressed(tPixelFormat format)
+{
+	return GetBlockBytes(format) > 0;
+}
+
+
+int Viewer::GetBlockBytes(tPixelFormat format)
+{
+	switch (format)
+	{
+		case tPixelFormat::BC1_DXT1:
+		case tPixelFormat::BC1_DXT1BA:
+		case tPixelFormat::BC4_ATI1:
+			return 8;
+
+		case tPixelFormat::BC2_DXT3:
+		case tPixelFormat::BC3_DXT5:
+		case tPixelFormat::BC5_ATI2:
+		case tPixelFormat::BC7:
+			return 16;
+	}
+	return 0;
+}
+
+
+int Viewer::GetPackedPixelBytes(tPixelFormat format)
+{
+	switch (format)
+	{
+		case tPixelFormat::G3B5R5G3:
+		case tPixelFormat::G4B4A4R4:
+		case tPixelFormat::G3B5A1R5G2:
+			return 2;
+
+		case tPixelFormat::R8G8B8:
+		case tPixelFormat::B8G8R8:
+			return 3;
+
+		case tPixelFormat::R8G8B8A8:
+		case tPixelFormat::B8G8R8A8:
+			return 4;
+	}
+	return 0;
+}
+
+
+bool Viewer::IsLayerDecodable(const tLayer& layer)
+{
+	if (!layer.Data || (layer.Width <= 0) || (layer.Height <= 0))
+		return false;
+
+	int64 requiredBytes = 0;
+	int blockBytes = GetBlockBytes(layer.PixelFormat);
+	int pixelBytes = GetPackedPixelBytes(layer.PixelFormat);
+	if (blockBytes)
+		requiredBytes = int64((layer.Width + 3) / 4) * int64((layer.Height + 3) / 4) * blockBytes;
+	else if (pixelBytes)
+		requiredBytes = int64(layer.Width) * int64(layer.Height) * pixelBytes;
+	else
+		return false;
+
+	return int64(layer.GetDataSize()) >= requiredBytes;
+}
+
+
+bool Viewer::DecodeLayerToRGBA(tPixel* dest, const tLayer& layer)
+{
+	if (!dest || !IsLayerDecodable(layer))
+		return false;
+
+	DecodeBlockRows(dest, layer, 0, (layer.Height + 3) / 4);
+	return true;
+}
+
+
+bool Viewer::DecodePixelToRGBA(tPixel& dest, const tLayer& layer, int x, int y)
+{
+	if (!IsLayerDecodable(layer) || (x < 0) || (y < 0) || (x >= layer.Width) || (y >= layer.Height))
+		return false;
+
+	int pixelBytes = GetPackedPixelBytes(layer.PixelFormat);
+	if (pixelBytes)
+	{
+		DecodePackedPixel(layer.PixelFormat, layer.Data + (int64(y)*layer.Width + x)*pixelBytes, dest);
+		return true;
+	}
+
+	int blockBytes = GetBlockBytes(layer.PixelFormat);
+	int blocksWide = (layer.Width + 3) / 4;
+	tPixel block[16];
+	DecodeBlock(layer.PixelFormat, layer.Data + (int64(y/4)*blocksWide + x/4)*blockBytes, block);
+	dest = block[4*(y%4) + (x%4)];
+	return true;
+}
+
+
+bool Viewer::DecodeLayersToRGBA(tPixel** dests, const tLayer** layers, int numLayers)
+{
+	struct Job
+	{
+		int Layer;
+		int FirstBlockRow;
+		int NumBlockRows;
+	};
+
+	int numJobs = 0;
+	int64 numBlocks = 0;
+	for (int l = 0; l < numLayers; l++)
+	{
+		if (!dests[l] || !layers[l] || !IsLayerDecodable(*layers[l]))
+			return false;
+
+		int blockRows = (layers[l]->Height + 3) / 4;
+		numJobs += (blockRows + JobBlockRows - 1) / JobBlockRows;
+		numBlocks += int64(blockRows) * int64((layers[l]->Width + 3) / 4);
+	}
+
+	if (numJobs == 0)
+		return true;
+
+	// Jobs are ordered biggest layer first so the small mipmaps fill in the gaps at the end.
+	Job* jobs = new Job[numJobs];
+	int jobIndex = 0;
+	for (int l = 0; l < numLayers; l++)
+	{
+		int blockRows = (layers[l]->Height + 3) / 4;
+		for (int row = 0; row < blockRows; row += JobBlockRows)
+			jobs[jobIndex++] = { l, row, tMath::tMin(JobBlockRows, blockRows - row) };
+	}
+
+	std::atomic<int> nextJob(0);
+	auto decodeJobs = [dests, layers, jobs, numJobs, &nextJob]()
+	{
+		for (int j = nextJob++; j < numJobs; j = nextJob++)
+			DecodeBlockRows(dests[jobs[j].Layer], *layers[jobs[j].Layer], jobs[j].FirstBlockRow, jobs[j].NumBlockRows);
+	};
+
+	int numThreads = int(tMath::tMin(numBlocks / MinBlocksPerThread, int64(tSystem::tGetNumCores())));
+	numThreads = tMath::tClamp(numThreads, 1, numJobs);
+	int numHelpers = numThreads - 1;
+	std::thread* helpers = numHelpers ? new std::thread[numHelpers] : nullptr;
+	for (int h = 0; h < numHelpers; h++)
+		helpers[h] = std::thread(decodeJobs);
+	decodeJobs();
+	for (int h = 0; h < numHelpers; h++)
+		helpers[h].join();
+
+	delete[] helpers;
+	delete[] jobs;
+	return true;
+}
+
+
+void Viewer::DecodeBlockRows(tPixel* dest, const tLayer& layer, int firstBlockRow, int numBlockRows)
+{
+	int width = layer.Width;
+	int height = layer.Height;
+	int endRow = tMath::tMin((firstBlockRow + numBlockRows) * 4, height);
+
+	int pixelBytes = GetPackedPixelBytes(layer.PixelFormat);
+	if (pixelBytes)
+	{
+		for (int y = firstBlockRow*4; y < endRow; y++)
+		{
+			const uint8* src = layer.Data + int64(y)*width*pixelBytes;
+			tPixel* row = dest + int64(y)*width;
+			for (int x = 0; x < width; x++, src += pixelBytes)
+				DecodePackedPixel(layer.PixelFormat, src, row[x]);
+		}
+		return;
+	}
+
+	int blockBytes = GetBlockBytes(layer.PixelFormat);
+	int blocksWide = (width + 3) / 4;
+	const uint8* src = layer.Data + int64(firstBlockRow)*blocksWide*blockBytes;
+	tPixel block[16];
+	for (int y0 = firstBlockRow*4; y0 < endRow; y0 += 4)
+	{
+		int blockHeight = tMath::tMin(4, height - y0);
+		for (int x0 = 0; x0 < width; x0 += 4, src += blockBytes)
+		{
+			DecodeBlock(layer.PixelFormat, src, block);
+
+			// Blocks on the right and bottom edges may hang off the image.
+			int blockWidth = tMath::tMin(4, width - x0);
+			for (int y = 0; y < blockHeight; y++)
+				tMemcpy(dest + int64(y0+y)*width + x0, block + 4*y, blockWidth*sizeof(tPixel));
+		}
+	}
+}
+
+
+void Viewer::DecodePackedPixel(tPixelFormat format, const uint8* src, tPixel& dest)
+{
+	int packed = src[0] | (src[1] << 8);
+	switch (format)
+	{
+		case tPixelFormat::R8G8B8:
+			dest = tPixel(src[0], src[1], src[2], 255);
+			break;
+
+		case tPixelFormat::R8G8B8A8:
+			dest = tPixel(src[0], src[1], src[2], src[3]);
+			break;
+
+		case tPixelFormat::B8G8R8:
+			dest = tPixel(src[2], src[1], src[0], 255);
+			break;
+
+		case tPixelFormat::B8G8R8A8:
+			dest = tPixel(src[2], src[1], src[0], src[3]);
+			break;
+
+		case tPixelFormat::G3B5R5G3:
+		{
+			// Little-endian 16 bit R5 G6 B5 from high bit to low bit.
+			int r = (packed >> 11) & 0x1F;
+			int g = (packed >> 5) & 0x3F;
+			int b = packed & 0x1F;
+			dest = tPixel((r << 3) | (r >> 2), (g << 2) | (g >> 4), (b << 3) | (b >> 2), 255);
+			break;
+		}
+
+		case tPixelFormat::G4B4A4R4:
+		{
+			// Little-endian 16 bit A4 R4 G4 B4 from high bit to low bit.
+			dest = tPixel(((packed >> 8) & 0xF) * 17, ((packed >> 4) & 0xF) * 17, (packed & 0xF) * 17, ((packed >> 12) & 0xF) * 17);
+			break;
+		}
+
+		case tPixelFormat::G3B5A1R5G2:
+		{
+			// Little-endian 16 bit A1 R5 G5 B5 from high bit to low bit.
+			int r = (packed >> 10) & 0x1F;
+			int g = (packed >> 5) & 0x1F;
+			int b = packed & 0x1F;
+			dest = tPixel((r << 3) | (r >> 2), (g << 3) | (g >> 2), (b << 3) | (b >> 2), (packed & 0x8000) ? 255 : 0);
+			break;
+		}
+	}
+}
+
+
+void Viewer::DecodeBlock(tPixelFormat format, const uint8* src, tPixel* dest)
+{
+	switch (format)
+	{
+		case tPixelFormat::BC1_DXT1:
+			DecodeColourBC1(src, dest, false, false);
+			break;
+
+		case tPixelFormat::BC1_DXT1BA:
+			DecodeColourBC1(src, dest, false, true);
+			break;
+
+		case tPixelFormat::BC2_DXT3:
+			DecodeColourBC1(src+8, dest, true, false);
+			DecodeAlphaBC2(src, dest);
+			break;
+
+		case tPixelFormat::BC3_DXT5:
+		{
+			uint8 alpha[16];
+			DecodeColourBC1(src+8, dest, true, false);
+			DecodeChannelBC4(src, alpha);
+			for (int p = 0; p < 16; p++)
+				dest[p].A = alpha[p];
+			break;
+		}
+
+		case tPixelFormat::BC4_ATI1:
+		{
+			uint8 red[16];
+			DecodeChannelBC4(src, red);
+			for (int p = 0; p < 16; p++)
+				dest[p] = tPixel(red[p], 0, 0, 255);
+			break;
+		}
+
+		case tPixelFormat::BC5_ATI2:
+		{
+			uint8 red[16];
+			uint8 green[16];
+			DecodeChannelBC4(src, red);
+			DecodeChannelBC4(src+8, green);
+			for (int p = 0; p < 16; p++)
+				dest[p] = tPixel(red[p], green[p], 0, 255);
+			break;
+		}
+
+		case tPixelFormat::BC7:
+			DecodeBlockBC7(src, dest);
+			break;
+	}
+}
+
+
+void Viewer::DecodeColourBC1(const uint8* src, tPixel* dest, bool alwaysFourColour, bool punchThroughAlpha)
+{
+	int c0 = src[0] | (src[1] << 8);
+	int c1 = src[2] | (src[3] << 8);
+
+	int r0 = (c0 >> 11) & 0x1F;		r0 = (r0 << 3) | (r0 >> 2);
+	int g0 = (c0 >> 5) & 0x3F;		g0 = (g0 << 2) | (g0 >> 4);
+	int b0 = c0 & 0x1F;				b0 = (b0 << 3) | (b0 >> 2);
+	int r1 = (c1 >> 11) & 0x1F;		r1 = (r1 << 3) | (r1 >> 2);
+	int g1 = (c1 >> 5) & 0x3F;		g1 = (g1 << 2) | (g1 >> 4);
+	int b1 = c1 & 0x1F;				b1 = (b1 << 3) | (b1 >> 2);
+
+	// Bc2 and bc3 always use the four colour mode. In bc1 it depends on the order of the endpoints.
+	tPixel palette[4];
+	palette[0] = tPixel(r0, g0, b0, 255);
+	palette[1] = tPixel(r1, g1, b1, 255);
+	if (alwaysFourColour || (c0 > c1))
+	{
+		#ifdef BCDECODE_SSE2
+		// Lanes are the RGBA of the colour 1/3 of the way along followed by the one 2/3 of the way along. Multiplying
+		// by 65536/3 and keeping the high half is an exact divide by 3 for sums this small.
+		__m128i e0 = _mm_setr_epi16(r0, g0, b0, 255, r0, g0, b0, 255);
+		__m128i e1 = _mm_setr_epi16(r1, g1, b1, 255, r1, g1, b1, 255);
+		__m128i sum = _mm_add_epi16(_mm_mullo_epi16(e0, _mm_setr_epi16(2, 2, 2, 2, 1, 1, 1, 1)), _mm_mullo_epi16(e1, _mm_setr_epi16(1, 1, 1, 1, 2, 2, 2, 2)));
+		sum = _mm_add_epi16(sum, _mm_set1_epi16(1));
+		__m128i quotient = _mm_mulhi_epu16(sum, _mm_set1_epi16(21846));
+		_mm_storel_epi64((__m128i*)(palette + 2), _mm_packus_epi16(quotient, quotient));
+		#else
+		palette[2] = tPixel((2*r0 + r1 + 1) / 3, (2*g0 + g1 + 1) / 3, (2*b0 + b1 + 1) / 3, 255);
+		palette[3] = tPixel((r0 + 2*r1 + 1) / 3, (g0 + 2*g1 + 1) / 3, (b0 + 2*b1 + 1) / 3, 255);
+		#endif
+	}
+	else
+	{
+		palette[2] = tPixel((r0 + r1 + 1) / 2, (g0 + g1 + 1) / 2, (b0 + b1 + 1) / 2, 255);
+		palette[3] = tPixel(0, 0, 0, punchThroughAlpha ? 0 : 255);
+	}
+
+	uint32 indices = src[4] | (src[5] << 8) | (src[6] << 16) | (uint32(src[7]) << 24);
+	for (int p = 0; p < 16; p++, indices >>= 2)
+		dest[p] = palette[indices & 0x03];
+}
+
+
+void Viewer::DecodeAlphaBC2(const uint8* src, tPixel* dest)
+{
+	for (int p = 0; p < 16; p++)
+		dest[p].A = ((src[p >> 1] >> ((p & 1) * 4)) & 0x0F) * 17;
+}
+
+
+void Viewer::DecodeChannelBC4(const uint8* src, uint8* dest)
+{
+	int v0 = src[0];
+	int v1 = src[1];
+
+	// With v0 > v1 there are 6 interpolated values. Otherwise 4, plus 0 and 255.
+	uint8 palette[8];
+	#ifdef BCDECODE_SSE2
+	__m128i e0 = _mm_set1_epi16(v0);
+	__m128i e1 = _mm_set1_epi16(v1);
+	if (v0 > v1)
+	{
+		// The high half of a multiply by 65536/7 (rounded up) is an exact divide by 7 here.
+		__m128i sum = _mm_add_epi16(_mm_mullo_epi16(e0, _mm_setr_epi16(7, 0, 6, 5, 4, 3, 2, 1)), _mm_mullo_epi16(e1, _mm_setr_epi16(0, 7, 1, 2, 3, 4, 5, 6)));
+		__m128i quotient = _mm_mulhi_epu16(_mm_add_epi16(sum, _mm_set1_epi16(3)), _mm_set1_epi16(9363));
+		_mm_storel_epi64((__m128i*)palette, _mm_packus_epi16(quotient, quotient));
+	}
+	else
+	{
+		__m128i sum = _mm_add_epi16(_mm_mullo_epi16(e0, _mm_setr_epi16(5, 0, 4, 3, 2, 1, 0, 0)), _mm_mullo_epi16(e1, _mm_setr_epi16(0, 5, 1, 2, 3, 4, 0, 0)));
+		__m128i quotient = _mm_mulhi_epu16(_mm_add_epi16(sum, _mm_set1_epi16(2)), _mm_set1_epi16(13108));
+		_mm_storel_epi64((__m128i*)palette, _mm_packus_epi16(quotient, quotient));
+		palette[6] = 0;
+		palette[7] = 255;
+	}
+	#else
+	palette[0] = v0;
+	palette[1] = v1;
+	if (v0 > v1)
+	{
+		for (int i = 1; i < 7; i++)
+			palette[i+1] = ((7-i)*v0 + i*v1 + 3) / 7;
+	}
+	else
+	{
+		for (int i = 1; i < 5; i++)
+			palette[i+1] = ((5-i)*v0 + i*v1 + 2) / 5;
+		palette[6] = 0;
+		palette[7] = 255;
+	}
+	#endif
+
+	uint64 indices = 0;
+	for (int b = 0; b < 6; b++)
+		indices |= uint64(src[2+b]) << (8*b);
+
+	for (int p = 0; p < 16; p++, indices >>= 3)
+		dest[p] = palette[indices & 0x07];
+}
+
+
+Viewer::BC7Bits::BC7Bits(const uint8* block) :
+	Lo(0),
+	Hi(0)
+{
+	for (int b = 0; b < 8; b++)
+	{
+		Lo |= uint64(block[b]) << (8*b);
+		Hi |= uint64(block[b+8]) << (8*b);
+	}
+}
+
+
+int Viewer::BC7Bits::Read(int numBits)
+{
+	uint32 value = 0;
+	if (Pos >= 64)
+	{
+		value = uint32(Hi >> (Pos - 64));
+	}
+	else
+	{
+		value = uint32(Lo >> Pos);
+		if (Pos + numBits > 64)
+			value |= uint32(Hi << (64 - Pos));
+	}
+
+	Pos += numBits;
+	return int(value & ((1u << numBits) - 1));
+}
+
+
+int Viewer::GetBC7Subset(int numSubsets, int partition, int pixel)
+{
+	if (numSubsets == 2)
+		return (BC7Partitions2[partition] >> pixel) & 0x01;
+
+	if (numSubsets == 3)
+		return (BC7Partitions3[partition] >> (2*pixel)) & 0x03;
+
+	return 0;
+}
+
+
+bool Viewer::IsBC7Anchor(int numSubsets, int partition, int pixel)
+{
+	if (pixel == 0)
+		return true;
+
+	if (numSubsets == 2)
+		return pixel == BC7Anchors2[partition];
+
+	if (numSubsets == 3)
+		return (pixel == BC7Anchors3a[partition]) || (pixel == BC7Anchors3b[partition]);
+
+	return false;
+}
+
+
+int Viewer::GetBC7Weight(int numBits, int index)
+{
+	switch (numBits)
+	{
+		case 2:		return BC7Weights2[index];
+		case 3:		return BC7Weights3[index];
+		case 4:		return BC7Weights4[index];
+	}
+	return 0;
+}
+
+
+void Viewer::DecodeBlockBC7(const uint8* src, tPixel* dest)
+{
+	// The mode is the position of the lowest set bit. A block with none of the first 8 bits set is invalid and decodes
+	// to transparent black.
+	int mode = 0;
+	while ((mode < 8) && !(src[0] & (1 << mode)))
+		mode++;
+
+	if (mode == 8)
+	{
+		for (int p = 0; p < 16; p++)
+			dest[p] = tPixel::transparent;
+		return;
+	}
+
+	const BC7ModeInfo& info = BC7Modes[mode];
+	BC7Bits bits(src);
+	bits.Read(mode + 1);
+	int partition = bits.Read(info.PartitionBits);
+	int rotation = bits.Read(info.RotationBits);
+	int indexSel = bits.Read(info.IndexSelBits);
+
+	// Endpoints are stored channel by channel. Modes without alpha are opaque.
+	int numEndpoints = info.NumSubsets * 2;
+	int endpoints[6][4];
+	for (int c = 0; c < 3; c++)
+		for (int e = 0; e < numEndpoints; e++)
+			endpoints[e][c] = bits.Read(info.ColourBits);
+
+	for (int e = 0; e < numEndpoints; e++)
+		endpoints[e][3] = info.AlphaBits ? bits.Read(info.AlphaBits) : 255;
+
+	int pBits[6] = { 0, 0, 0, 0, 0, 0 };
+	if (info.EndpointPBits)
+	{
+		for (int e = 0; e < numEndpoints; e++)
+			pBits[e] = bits.Read(1);
+	}
+	else if (info.SharedPBits)
+	{
+		for (int s = 0; s < info.NumSubsets; s++)
+			pBits[2*s] = pBits[2*s + 1] = bits.Read(1);
+	}
+
+	// Append the p-bit and expand to 8 bits by replicating the high bits into the low ones.
+	bool hasPBits = info.EndpointPBits || info.SharedPBits;
+	for (int e = 0; e < numEndpoints; e++)
+	{
+		for (int c = 0; c < 4; c++)
+		{
+			if ((c == 3) && !info.AlphaBits)
+				continue;
+
+			int numBits = (c < 3) ? info.ColourBits : info.AlphaBits;
+			int value = endpoints[e][c];
+			if (hasPBits)
+			{
+				value = (value << 1) | pBits[e];
+				numBits++;
+			}
+			value <<= (8 - numBits);
+			endpoints[e][c] = value | (value >> numBits);
+		}
+	}
+
+	int indices[16];
+	for (int p = 0; p < 16; p++)
+		indices[p] = bits.Read(info.IndexBits - (IsBC7Anchor(info.NumSubsets, partition, p) ? 1 : 0));
+
+	int indices2[16];
+	if (info.IndexBits2)
+	{
+		for (int p = 0; p < 16; p++)
+			indices2[p] = bits.Read(info.IndexBits2 - ((p == 0) ? 1 : 0));
+	}
+
+	for (int p = 0; p < 16; p++)
+	{
+		int subset = GetBC7Subset(info.NumSubsets, partition, p);
+		const int* e0 = endpoints[2*subset];
+		const int* e1 = endpoints[2*subset + 1];
+
+		// Modes 4 and 5 have separate colour and alpha indices. In mode 4 the index selection bit swaps them.
+		int colourWeight = GetBC7Weight(info.IndexBits, indices[p]);
+		int alphaWeight = colourWeight;
+		if (info.IndexBits2)
+		{
+			alphaWeight = GetBC7Weight(info.IndexBits2, indices2[p]);
+			if (indexSel)
+				tMath::tSwap(colourWeight, alphaWeight);
+		}
+
+		int channels[4];
+		for (int c = 0; c < 4; c++)
+		{
+			int weight = (c < 3) ? colourWeight : alphaWeight;
+			channels[c] = (e0[c]*(64 - weight) + e1[c]*weight + 32) >> 6;
+		}
+
+		// Rotation swaps alpha with one of the colour channels.
+		if (rotation)
+			tMath::tSwap(channels[3], channels[rotation-1]);
+
+		dest[p] = tPixel(channels[0], channels[1], channels[2], channels[3]);
+	}
+}
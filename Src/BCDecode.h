@@ -0,0 +1,39 @@
+// BCDecode.h
+//
+// CPU decoding of block compressed (BC1 to BC5 and BC7) and packed dds pixel formats to RGBA. No graphics context is
+// needed so it is safe to call from any thread. Large images are split across multiple threads.
+//
+// Copyright (c) 2020 Tristan Grimmer.
+// Permission to use, copy, modify, and/or distribute this software for any purpose with or without fee is hereby
+// granted, provided that the above copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+// INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN
+// AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+// PERFORMANCE OF THIS SOFTWARE.
+
+#pragma once
+#include <Math/tColour.h>
+#include <Image/tLayer.h>
+#include <Image/tPixelFormat.h>
+
+
+namespace Viewer
+{
+	bool CanDecodeToRGBA(tImage::tPixelFormat);
+
+	// Decodes all the layers into the supplied destination buffers. Each dest must hold width*height pixels of the
+	// corresponding layer. Rows are written in the same order they are stored in the layer, which is what reading the
+	// texture back from OpenGL used to give us. The work for all layers is shared between the available cores.
+	// BC4 and BC5 decode to red and red/green like they do on the GPU. Returns false if any layer has a format that
+	// can't be decoded, in which case nothing is written.
+	bool DecodeLayersToRGBA(tPixel** dests, const tImage::tLayer** layers, int numLayers);
+
+	// Single threaded decode of one layer.
+	bool DecodeLayerToRGBA(tPixel* dest, const tImage::tLayer&);
+
+	// Decodes the single pixel at (x, y). Only the block holding the pixel is decoded so this is cheap enough to call
+	// every frame. The coordinates are in the same row order as DecodeLayerToRGBA writes.
+	bool DecodePixelToRGBA(tPixel& dest, const tImage::tLayer&, int x, int y);
+}
@@ -45,6 +45,7 @@ void Viewer::DoContactSheetModalDialog(bool justOpened)
 	static int finalWidth = 2048;
 	static int finalHeight = 2048;
 	tAssert(CurrImage);
+	CurrImage->RequireFullResolution();
 	tPicture* picture = CurrImage->GetCurrentPic();
 	tAssert(picture);
 	int picW = picture->GetWidth();
@@ -237,6 +238,7 @@ void Viewer::SaveContactSheetTo
 
 		tPrintf("Processing frame %d : %s at (%d, %d).\n", frame, currImg->Filename.Chars(), ix, iy);
 		frame++;
+		currImg->RequireFullResolution();
 		tImage::tPicture* currPic = currImg->GetCurrentPic();
 
 		tImage::tPicture resampled;
@@ -19,6 +19,67 @@
 #include "TacentView.h"
 #include "Image.h"
 using namespace tMath;
+using namespace Viewer;
+
+
+namespace
+{
+	// Images is a linked list. The rows in view are found through this array instead, which is rebuilt whenever the
+	// list changes. It is sized to the current list so it shrinks again after a large folder, and it is freed when
+	// the dialog closes.
+	Image** Items		= nullptr;
+	int NumItems		= 0;
+	int MaxItems		= 0;
+	uint ItemsVersion	= 0;
+
+	int UpdateItems()
+	{
+		int numImages = Images.GetNumItems();
+		if ((ItemsVersion == ImagesVersion) && (NumItems == numImages))
+			return NumItems;
+
+		int wantItems = tClampMin(numImages, 256);
+		if ((numImages > MaxItems) || (MaxItems > 2*wantItems))
+		{
+			delete[] Items;
+			MaxItems = wantItems;
+			Items = new Image*[MaxItems];
+		}
+
+		NumItems = 0;
+		for (Image* i = Images.First(); i; i = i->Next())
+			Items[NumItems++] = i;
+		ItemsVersion = ImagesVersion;
+		return NumItems;
+	}
+
+	// Anything not requested again since the last call is no longer in view. The current image's thumbnail is the
+	// main view's placeholder while it loads, so it stays queued even when it is scrolled out of view, collapsed or
+	// closed. It is only queued if LoadCurrImage found it in the thumbnail cache.
+	void DropStaleRequests()
+	{
+		if (CurrImage && CurrImage->IsLoading() && CurrImage->IsThumbnailWorkerActive())
+			CurrImage->RequestThumbnail();
+		Image::DropStaleThumbnailRequests();
+	}
+}
+
+
+void Viewer::FreeContentViewItems()
+{
+	delete[] Items;
+	Items = nullptr;
+	NumItems = 0;
+	MaxItems = 0;
+	ItemsVersion = 0;
+}
+
+
+void Viewer::HideContentViewDialog()
+{
+	FreeContentViewItems();
+	DropStaleRequests();
+}
 
 
 void Viewer::ShowContentViewDialog(bool* popen)
@@ -32,6 +93,7 @@ void Viewer::ShowContentViewDialog(bool* popen)
 	if (!ImGui::Begin("Content View", popen, windowFlags))
 	{
 		ImGui::End();
+		DropStaleRequests();
 		return;
 	}
 
@@ -47,38 +109,98 @@ void Viewer::ShowContentViewDialog(bool* popen)
 	float extra = ImGui::GetWindowContentRegionMax().x - (float(numPerRow) * (Config.ThumbnailWidth + minSpacing));
 	ImGui::PushStyleVar(ImGuiStyleVar_ItemSpacing, tVector2(minSpacing + extra/float(numPerRow), minSpacing));
 	tVector2 thumbButtonSize(Config.ThumbnailWidth, Config.ThumbnailWidth*9.0f/16.0f); // 64 36, 32 18,
-	int thumbNum = 0;
-	for (Image* i = Images.First(); i; i = i->Next(), thumbNum++)
-	{
-		tVector2 cursor = ImGui::GetCursorPos();
-		if ((thumbNum % numPerRow) == 0)
-			ImGui::SetCursorPos(tVector2(0.5f*extra/float(numPerRow), cursor.y));
+	tVector2 thumbItemSize = thumbButtonSize + tVector2(0.0f, 32.0f);
+
+	// Thumbnails are made in priority order. Visible items go first, closest to the centre of the view first. Then
+	// come the rows just past the edge we are scrolling towards. Requests that aren't renewed this frame are dropped
+	// by the thumbnail workers, so items that scrolled away are never visited.
+	static float lastScrollY = 0.0f;
+	static int scrollDir = 1;
+	float scrollY = ImGui::GetScrollY();
+	if (scrollY != lastScrollY)
+		scrollDir = (scrollY > lastScrollY) ? 1 : -1;
+	lastScrollY = scrollY;
+
+	// The grid is laid out from the item count so only the visible rows are iterated. Rows are placed explicitly so
+	// they are exactly rowHeight apart no matter how ImGui rounds item positions.
+	int numItems = UpdateItems();
+	int numRows = (numItems + numPerRow - 1) / numPerRow;
+	const int aheadRows = 4;
+	const float aheadPriority = 1.0e9f;
+	float startX = 0.5f*extra/float(numPerRow);
+	float startY = ImGui::GetCursorPosY();
+	float rowHeight = thumbItemSize.y + minSpacing;
+	float viewHeight = ImGui::GetWindowHeight();
+	int firstVisibleRow = tClampMin(int((scrollY - startY) / rowHeight), 0);
+	int lastVisibleRow = tMin(int((scrollY + viewHeight - startY) / rowHeight), numRows-1);
+	tVector2 viewCentre(0.5f*ImGui::GetWindowWidth(), scrollY + 0.5f*viewHeight);
 
-		ImGui::PushID(thumbNum);
-		ImGui::PushStyleVar(ImGuiStyleVar_WindowPadding, tVector2::zero);
-		bool isCurr = (i == CurrImage);
+	// Items are drawn straight into this window rather than each getting a child window, which would mean a draw list
+	// each. Frames, thumbnails and names go in separate channels so the thumbnails sharing an atlas page end up in one
+	// draw command, and so do the names.
+	enum Channel { Channel_Frame, Channel_Thumb, Channel_Name, Channel_NumChannels };
+	ImDrawList* drawList = ImGui::GetWindowDrawList();
+	drawList->ChannelsSplit(Channel_NumChannels);
+	float textHeight = ImGui::GetTextLineHeight();
 
-		// Unlike other widgets, BeginChild ALWAYS needs a corresponding EndChild, even if it's invisible.
-		bool visible = ImGui::BeginChild("ThumbItem", thumbButtonSize+tVector2(0.0, 32.0f), false, ImGuiWindowFlags_NoDecoration);
-		if (visible)
+	for (int row = firstVisibleRow; row <= lastVisibleRow; row++)
+	{
+		ImGui::SetCursorPos(tVector2(startX, startY + float(row)*rowHeight));
+		for (int col = 0; col < numPerRow; col++)
 		{
-			i->RequestThumbnail();
-			uint64 thumbnailTexID = i->BindThumbnail();
+			int thumbNum = row*numPerRow + col;
+			if (thumbNum >= numItems)
+				break;
+			if (col)
+				ImGui::SameLine();
+
+			Image* i = Items[thumbNum];
+			tVector2 itemOffset = tVector2(ImGui::GetCursorPos()) + thumbItemSize*0.5f - viewCentre;
+			ImGui::PushID(thumbNum);
+			bool isCurr = (i == CurrImage);
+
+			i->RequestThumbnail(itemOffset.x*itemOffset.x + itemOffset.y*itemOffset.y);
+			tVector2 uv0, uv1;
+			uint64 thumbnailTexID = i->BindThumbnailAtlas(int(Config.ThumbnailWidth), uv0, uv1);
 			if (!thumbnailTexID)
+			{
 				thumbnailTexID = DefaultThumbnailImage.Bind();
-			if
-			(
-				thumbnailTexID &&
-				ImGui::ImageButton(ImTextureID(thumbnailTexID), thumbButtonSize, tVector2(0,1), tVector2(1,0), 0,
-				ColourBG, ColourEnabledTint)
-			)
+				uv0 = tVector2(0.0f, 1.0f);
+				uv1 = tVector2(1.0f, 0.0f);
+			}
+
+			ImGui::BeginGroup();
+			if (ImGui::InvisibleButton("Thumb", thumbButtonSize))
 			{
 				CurrImage = i;
 				LoadCurrImage();
 			}
+			bool hovered = ImGui::IsItemHovered();
+			ImGuiCol frameCol = ImGui::IsItemActive() ? ImGuiCol_ButtonActive : (hovered ? ImGuiCol_ButtonHovered : ImGuiCol_Button);
+			tVector2 thumbMin = ImGui::GetItemRectMin();
+			tVector2 thumbMax = ImGui::GetItemRectMax();
 
+			// The item under the mouse is a good guess for what will be clicked on next.
+			if (hovered && (i != CurrImage))
+				RequestPrefetch(i);
+
+			drawList->ChannelsSetCurrent(Channel_Frame);
+			drawList->AddRectFilled(thumbMin, thumbMax, ImGui::GetColorU32(frameCol), style.FrameRounding);
+			if (ColourBG.w > 0.0f)
+				drawList->AddRectFilled(thumbMin, thumbMax, ImGui::GetColorU32(ColourBG));
+			if (thumbnailTexID)
+			{
+				drawList->ChannelsSetCurrent(Channel_Thumb);
+				drawList->AddImage(ImTextureID(thumbnailTexID), thumbMin, thumbMax, uv0, uv1, ImGui::GetColorU32(ColourEnabledTint));
+			}
+
+			// Names are clipped to the item on the cpu. Pushing a clip rect per item would split the draw command.
+			ImGui::Dummy(tVector2(thumbButtonSize.x, thumbItemSize.y - thumbButtonSize.y - minSpacing));
+			tVector2 nameMin = ImGui::GetItemRectMin();
+			ImVec4 nameClip(nameMin.x, nameMin.y, nameMin.x + thumbButtonSize.x, nameMin.y + textHeight);
 			tString filename = tSystem::tGetFileName(i->Filename);
-			ImGui::Text(filename.Chars());
+			drawList->ChannelsSetCurrent(Channel_Name);
+			drawList->AddText(nullptr, 0.0f, nameMin, ImGui::GetColorU32(ImGuiCol_Text), filename.Chars(), nullptr, 0.0f, &nameClip);
 
 			tString ttStr;
 			tsPrintf(ttStr, "%s\n%s\n%'d Bytes", 
@@ -88,24 +210,31 @@ void Viewer::ShowContentViewDialog(bool* popen)
 
 			// We use a separator to indicate the current item.
 			if (isCurr)
-				ImGui::Separator(2.0f);
-		}
-		else
-		{
-			// We need to keep calling bind even if the image is not visible. It frees up the worker threads.
-			if (i->IsThumbnailWorkerActive())
-				i->BindThumbnail();
-			else
-				i->UnrequestThumbnail();
+			{
+				float sepY = nameMin.y + textHeight + minSpacing;
+				drawList->ChannelsSetCurrent(Channel_Frame);
+				drawList->AddRectFilled(tVector2(nameMin.x, sepY), tVector2(nameMin.x + thumbButtonSize.x, sepY + 2.0f), ImGui::GetColorU32(ImGuiCol_Separator));
+			}
+			ImGui::EndGroup();
+			ImGui::PopID();
 		}
-		ImGui::EndChild();
-		ImGui::PopStyleVar();
+	}
+	drawList->ChannelsMerge();
 
-		if ((thumbNum+1) % numPerRow)
-			ImGui::SameLine();
+	for (int rowsAhead = 1; rowsAhead <= aheadRows; rowsAhead++)
+	{
+		int row = (scrollDir > 0) ? (lastVisibleRow + rowsAhead) : (firstVisibleRow - rowsAhead);
+		if ((row < 0) || (row >= numRows))
+			continue;
 
-		ImGui::PopID();
+		for (int col = 0; (col < numPerRow) && (row*numPerRow + col < numItems); col++)
+			Items[row*numPerRow + col]->RequestThumbnail(aheadPriority + float(rowsAhead*numPerRow + col));
 	}
+
+	DropStaleRequests();
+
+	// The scroll range covers every row even though only the visible ones were laid out.
+	ImGui::SetCursorPos(tVector2(0.0f, startY + float(numRows)*rowHeight));
 	ImGui::PopStyleVar();
 	ImGui::EndChild();
 
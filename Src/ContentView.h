@@ -18,4 +18,10 @@
 namespace Viewer
 {
 	void ShowContentViewDialog(bool* popen);
+
+	// The dialog keeps an array of the images in view. This frees it.
+	void FreeContentViewItems();
+
+	// Call every frame the dialog isn't shown. Frees the array and drops the thumbnail requests still queued for it.
+	void HideContentViewDialog();
 }
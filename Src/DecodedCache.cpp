@@ -0,0 +1,332 @@
+// DecodedCache.cpp
+//
+// A disk cache of fully decoded pictures for formats that are slow to decode, like multi-part exr, hdr and 16 bit
+// tiff. The files hold raw pixels with a small header so reading one back is a mapping and a copy. Files too big to map
+// are read with plain reads instead.
+//
+// Copyright (c) 2020 Tristan Grimmer.
+// Permission to use, copy, modify, and/or distribute this software for any purpose with or without fee is hereby
+// granted, provided that the above copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+// INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN
+// AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+// PERFORMANCE OF THIS SOFTWARE.
+
+#ifdef PLATFORM_WINDOWS
+#include <windows.h>
+#else
+#include <utime.h>
+#endif
+#include <cstring>
+#include <Foundation/tFundamentals.h>
+#include <System/tFile.h>
+#include <System/tPrint.h>
+#include "DecodedCache.h"
+#include "MappedFile.h"
+using namespace tSystem;
+using namespace tImage;
+
+
+namespace
+{
+	// The header and part table are a multiple of 16 bytes so the pixels that follow stay aligned.
+	struct FileHeader
+	{
+		char Magic[4];
+		int32 Version;
+		int32 NumParts;
+		int32 SrcPixelFormat;
+	};
+
+	struct PartHeader
+	{
+		int32 Width;
+		int32 Height;
+		float Duration;
+		int32 Reserved;
+	};
+
+	const char Magic[4] = { 'T', 'V', 'D', 'C' };
+	const int32 Version = 1;
+
+	// The file reads and writes take an int so big transfers are split up.
+	const int MaxChunkBytes = 1 << 30;
+	bool ReadChunked(tFileHandle, void* dest, int64 numBytes);
+	bool WriteChunked(tFileHandle, const void* src, int64 numBytes);
+	bool LoadLargeDecodedCache(tList<tPicture>&, tPixelFormat&, const tString& cacheFile);
+	void TouchFile(const tString& filename);
+
+	// Cache files are small in number and large so the ordering is by how recently they were read or written.
+	// Each file is looked at once up front rather than on every compare while sorting.
+	struct CacheFile : public tLink<CacheFile>
+	{
+		tString Name;
+		int64 Size;
+		std::time_t ModTime;
+	};
+
+	bool Compare_FileModTimeAscending(const CacheFile& a, const CacheFile& b)
+	{
+		return a.ModTime < b.ModTime;
+	}
+
+	bool ReadChunked(tFileHandle handle, void* dest, int64 numBytes)
+	{
+		uint8* data = (uint8*)dest;
+		while (numBytes > 0)
+		{
+			int chunk = int(tMath::tMin(numBytes, int64(MaxChunkBytes)));
+			if (tReadFile(handle, data, chunk) != chunk)
+				return false;
+			data += chunk;
+			numBytes -= chunk;
+		}
+		return true;
+	}
+
+	bool WriteChunked(tFileHandle handle, const void* src, int64 numBytes)
+	{
+		const uint8* data = (const uint8*)src;
+		while (numBytes > 0)
+		{
+			int chunk = int(tMath::tMin(numBytes, int64(MaxChunkBytes)));
+			if (tWriteFile(handle, data, chunk) != chunk)
+				return false;
+			data += chunk;
+			numBytes -= chunk;
+		}
+		return true;
+	}
+
+	// Spill files of big edited images are usually the ones that end up here.
+	bool LoadLargeDecodedCache(tList<tPicture>& pictures, tPixelFormat& srcFormat, const tString& cacheFile)
+	{
+		tFileHandle handle = tOpenFile(cacheFile.Chars(), "rb");
+		if (!handle)
+			return false;
+
+		FileHeader header;
+		bool ok = tReadFile(handle, &header, sizeof(header)) == sizeof(header);
+		ok = ok && !memcmp(header.Magic, Magic, sizeof(Magic)) && (header.Version == Version);
+		ok = ok && (header.NumParts > 0) && (header.NumParts <= 65536);
+		PartHeader* parts = ok ? new PartHeader[header.NumParts] : nullptr;
+		ok = ok && ReadChunked(handle, parts, int64(header.NumParts) * int64(sizeof(PartHeader)));
+		for (int p = 0; ok && (p < header.NumParts); p++)
+			ok = (parts[p].Width > 0) && (parts[p].Height > 0);
+
+		tList<tPicture> loaded;
+		for (int p = 0; ok && (p < header.NumParts); p++)
+		{
+			int64 numPixels = int64(parts[p].Width) * int64(parts[p].Height);
+			tPixel* pixels = new tPixel[numPixels];
+			ok = ReadChunked(handle, pixels, numPixels*int64(sizeof(tPixel)));
+			if (!ok)
+			{
+				delete[] pixels;
+				break;
+			}
+
+			tPicture* picture = new tPicture(parts[p].Width, parts[p].Height, pixels, false);
+			picture->Duration = parts[p].Duration;
+			loaded.Append(picture);
+		}
+
+		// The file must end exactly where the last part does.
+		uint8 extra;
+		ok = ok && (tReadFile(handle, &extra, 1) == 0);
+		tCloseFile(handle);
+		delete[] parts;
+		if (!ok)
+			return false;
+
+		while (tPicture* picture = loaded.Remove())
+			pictures.Append(picture);
+		srcFormat = tPixelFormat(header.SrcPixelFormat);
+		TouchFile(cacheFile);
+		return true;
+	}
+
+	void TouchFile(const tString& filename)
+	{
+		#ifdef PLATFORM_WINDOWS
+		HANDLE file = CreateFileA(filename.Chars(), FILE_WRITE_ATTRIBUTES, FILE_SHARE_READ, nullptr, OPEN_EXISTING, 0, nullptr);
+		if (file == INVALID_HANDLE_VALUE)
+			return;
+		FILETIME now;
+		GetSystemTimeAsFileTime(&now);
+		SetFileTime(file, nullptr, nullptr, &now);
+		CloseHandle(file);
+		#else
+		utime(filename.Chars(), nullptr);
+		#endif
+	}
+}
+
+
+bool Viewer::LoadDecodedCache(tList<tPicture>& pictures, tPixelFormat& srcFormat, const tString& cacheFile)
+{
+	if (!tFileExists(cacheFile))
+		return false;
+
+	MappedFile file;
+	if (!file.Open(cacheFile, MappedFile::Access::Sequential))
+		return LoadLargeDecodedCache(pictures, srcFormat, cacheFile);
+
+	if (file.GetSize() < int(sizeof(FileHeader)))
+		return false;
+
+	const uint8* data = file.GetData();
+	FileHeader header;
+	memcpy(&header, data, sizeof(header));
+	if (memcmp(header.Magic, Magic, sizeof(Magic)) || (header.Version != Version) || (header.NumParts <= 0))
+		return false;
+
+	// The whole file is checked before anything is allocated.
+	int64 offset = int64(sizeof(FileHeader)) + int64(header.NumParts) * int64(sizeof(PartHeader));
+	if (offset > file.GetSize())
+		return false;
+
+	const uint8* partData = data + sizeof(FileHeader);
+	int64 expectedSize = offset;
+	for (int p = 0; p < header.NumParts; p++)
+	{
+		PartHeader part;
+		memcpy(&part, partData + p*sizeof(PartHeader), sizeof(part));
+		if ((part.Width <= 0) || (part.Height <= 0))
+			return false;
+		expectedSize += int64(part.Width) * int64(part.Height) * int64(sizeof(tPixel));
+	}
+	if (expectedSize != file.GetSize())
+		return false;
+
+	for (int p = 0; p < header.NumParts; p++)
+	{
+		PartHeader part;
+		memcpy(&part, partData + p*sizeof(PartHeader), sizeof(part));
+		int64 numPixels = int64(part.Width) * int64(part.Height);
+		tPixel* pixels = new tPixel[numPixels];
+		memcpy(pixels, data + offset, numPixels*sizeof(tPixel));
+		offset += numPixels*sizeof(tPixel);
+
+		tPicture* picture = new tPicture(part.Width, part.Height, pixels, false);
+		picture->Duration = part.Duration;
+		pictures.Append(picture);
+	}
+
+	srcFormat = tPixelFormat(header.SrcPixelFormat);
+	file.Close();
+	TouchFile(cacheFile);
+	return true;
+}
+
+
+bool Viewer::SaveDecodedCache(const tString& cacheFile, const tList<tPicture>& pictures, tPixelFormat srcFormat, int64 maxBytes)
+{
+	int numParts = pictures.Count();
+	if (numParts <= 0)
+		return false;
+
+	int64 totalSize = int64(sizeof(FileHeader)) + int64(numParts) * int64(sizeof(PartHeader));
+	for (tPicture* picture = pictures.First(); picture; picture = picture->Next())
+	{
+		if (!picture->IsValid())
+			return false;
+		totalSize += int64(picture->GetNumPixels()) * int64(sizeof(tPixel));
+	}
+	if (totalSize > maxBytes)
+		return false;
+
+	// Writing to a temporary name first means other instances never pick up a half written file.
+	tString tempFile = cacheFile + ".tmp";
+	tFileHandle handle = tOpenFile(tempFile.Chars(), "wb");
+	if (!handle)
+		return false;
+
+	FileHeader header;
+	memcpy(header.Magic, Magic, sizeof(Magic));
+	header.Version = Version;
+	header.NumParts = numParts;
+	header.SrcPixelFormat = int32(srcFormat);
+	bool ok = tWriteFile(handle, &header, sizeof(header)) == sizeof(header);
+	for (tPicture* picture = pictures.First(); picture && ok; picture = picture->Next())
+	{
+		PartHeader part;
+		part.Width = picture->GetWidth();
+		part.Height = picture->GetHeight();
+		part.Duration = picture->Duration;
+		part.Reserved = 0;
+		ok = tWriteFile(handle, &part, sizeof(part)) == sizeof(part);
+	}
+
+	for (tPicture* picture = pictures.First(); picture && ok; picture = picture->Next())
+	{
+		int64 numBytes = int64(picture->GetNumPixels()) * int64(sizeof(tPixel));
+		ok = WriteChunked(handle, picture->GetPixelPointer(), numBytes);
+	}
+	tCloseFile(handle);
+
+	if (ok)
+	{
+		tDeleteFile(cacheFile);
+		ok = tRenameFile(tGetDir(tempFile), tGetFileName(tempFile), tGetFileName(cacheFile));
+	}
+	if (!ok)
+	{
+		tPrintf("Warning: Could not write decoded cache file %s\n", cacheFile.Chars());
+		tDeleteFile(tempFile);
+	}
+
+	return ok;
+}
+
+
+int Viewer::RemoveOldDecodedFiles(const tString& cacheDir, int64 maxBytes)
+{
+	// Temporary files are only left behind if we went down while writing one.
+	int deletedCount = 0;
+	tList<tStringItem> tempFiles;
+	tFindFiles(tempFiles, cacheDir, "tmp");
+	for (tStringItem* file = tempFiles.First(); file; file = file->Next())
+		if (tDeleteFile(*file))
+			deletedCount++;
+
+	tList<tStringItem> foundFiles;
+	tFindFiles(foundFiles, cacheDir, "raw");
+	tList<CacheFile> cacheFiles;
+	int64 totalSize = 0;
+	for (tStringItem* file = foundFiles.First(); file; file = file->Next())
+	{
+		tFileInfo info;
+		if (!tGetFileInfo(info, *file))
+			continue;
+
+		CacheFile* cacheFile = new CacheFile;
+		cacheFile->Name = *file;
+		cacheFile->Size = int64(info.FileSize);
+		cacheFile->ModTime = info.ModificationTime;
+		cacheFiles.Append(cacheFile);
+		totalSize += cacheFile->Size;
+	}
+
+	if (totalSize <= maxBytes)
+		return deletedCount;
+
+	cacheFiles.Sort(Compare_FileModTimeAscending);
+	while (totalSize > maxBytes)
+	{
+		CacheFile* head = cacheFiles.Remove();
+		if (!head)
+			break;
+
+		if (tDeleteFile(head->Name))
+		{
+			totalSize -= head->Size;
+			deletedCount++;
+		}
+		delete head;
+	}
+
+	return deletedCount;
+}
@@ -0,0 +1,36 @@
+// DecodedCache.h
+//
+// A disk cache of fully decoded pictures for formats that are slow to decode, like multi-part exr, hdr and 16 bit
+// tiff. The files hold raw pixels with a small header so reading one back is a mapping and a copy.
+//
+// Copyright (c) 2020 Tristan Grimmer.
+// Permission to use, copy, modify, and/or distribute this software for any purpose with or without fee is hereby
+// granted, provided that the above copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+// INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN
+// AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+// PERFORMANCE OF THIS SOFTWARE.
+
+#pragma once
+#include <Foundation/tString.h>
+#include <Foundation/tList.h>
+#include <Image/tPicture.h>
+#include <Image/tPixelFormat.h>
+
+
+namespace Viewer
+{
+	// Appends a picture for every part in the cache file and sets srcFormat to the pixel format of the original file.
+	// A hit marks the file as recently used. Returns false if the file is missing or not a valid cache file, in which
+	// case nothing is appended.
+	bool LoadDecodedCache(tList<tImage::tPicture>& pictures, tImage::tPixelFormat& srcFormat, const tString& cacheFile);
+
+	// Writes the pictures to the cache file. The file only appears once it is complete so a reader never sees a partial
+	// one. Nothing is written if the pictures would need more than maxBytes. Safe to call from any thread.
+	bool SaveDecodedCache(const tString& cacheFile, const tList<tImage::tPicture>& pictures, tImage::tPixelFormat srcFormat, int64 maxBytes);
+
+	// Deletes the least recently used cache files until the rest fit in maxBytes. Returns the number removed.
+	int RemoveOldDecodedFiles(const tString& cacheDir, int64 maxBytes);
+}
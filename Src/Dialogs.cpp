@@ -21,6 +21,8 @@
 #include "Dialogs.h"
 #include "Settings.h"
 #include "Image.h"
+#include "ThumbnailCache.h"
+#include "MemoryBudget.h"
 #include "TacentView.h"
 #include "Version.cmake.h"
 using namespace tMath;
@@ -72,7 +74,10 @@ void Viewer::ShowImageDetailsOverlay(bool* popen, float x, float y, float w, flo
 			int bpp = tImage::tGetBitsPerPixel(info.SrcPixelFormat);
 			if (info.IsValid())
 			{
-				ImGui::Text("Size: %dx%d", CurrImage->GetWidth(), CurrImage->GetHeight());
+				if (CurrImage->GetLoadScale() > 1)
+					ImGui::Text("Size: %dx%d (1/%d)", CurrImage->GetWidth(), CurrImage->GetHeight(), CurrImage->GetLoadScale());
+				else
+					ImGui::Text("Size: %dx%d", CurrImage->GetWidth(), CurrImage->GetHeight());
 				ImGui::Text("Format: %s", tImage::tGetPixelFormatName(info.SrcPixelFormat));
 				if (bpp > 0)
 					ImGui::Text("Bits Per Pixel: %d", bpp);
@@ -521,12 +526,55 @@ void Viewer::ShowPreferencesWindow(bool* popen)
 	ImGui::Text("System");
 	ImGui::Indent();
 	ImGui::PushItemWidth(110);
-	ImGui::InputInt("Max Mem (MB)", &Config.MaxImageMemMB); ImGui::SameLine();
-	ShowHelpMark("Approx memory use limit of this app. Minimum 256 MB.");
-	tMath::tiClampMin(Config.MaxImageMemMB, 256);
-	ImGui::InputInt("Max Cache Files", &Config.MaxCacheFiles); ImGui::SameLine();
-	ShowHelpMark("Maximum number of cache files that may be created. Minimum 200.");
-	tMath::tiClampMin(Config.MaxCacheFiles, 200);
+	ImGui::Checkbox("Auto Max Mem", &Config.AutoImageMem); ImGui::SameLine();
+	ShowHelpMark("Sizes the image memory limit from free system memory and any container limit. Images are unloaded early when the system is under memory pressure.");
+	if (Config.AutoImageMem)
+	{
+		ImGui::Text("Max Mem %d MB", int(GetImageMemBudget() / (1024 * 1024)));
+	}
+	else
+	{
+		ImGui::InputInt("Max Mem (MB)", &Config.MaxImageMemMB); ImGui::SameLine();
+		ShowHelpMark("Approx memory use limit of this app. Minimum 256 MB.");
+		tMath::tiClampMin(Config.MaxImageMemMB, 256);
+	}
+	ImGui::InputInt("Max VRAM (MB)", &Config.MaxVRAMMB); ImGui::SameLine();
+	ShowHelpMark("Approx video memory use limit for textures. Textures not drawn recently are freed and uploaded again when needed. Minimum 128 MB.");
+	tMath::tiClampMin(Config.MaxVRAMMB, 128);
+	ImGui::InputInt("Max Thumb VRAM (MB)", &Config.MaxThumbVRAMMB); ImGui::SameLine();
+	ShowHelpMark("Video memory for drawing thumbnails. No more than half of Max VRAM is used. Minimum 32 MB.");
+	tMath::tiClamp(Config.MaxThumbVRAMMB, 32, 4096);
+	ImGui::InputInt("Max Packed Mem (MB)", &Config.MaxPackedMemMB); ImGui::SameLine();
+	ShowHelpMark("Memory for compressed copies of images that were unloaded. They load again much faster than decoding the file. 0 disables.");
+	tMath::tiClamp(Config.MaxPackedMemMB, 0, 65536);
+	ImGui::Checkbox("GPU Resident Images", &Config.GPUResident); ImGui::SameLine();
+	ShowHelpMark("Frees the pixels of a single frame image once it is in video memory. They are read back when saving or editing. The texture then counts towards Max Mem.");
+	ImGui::InputInt("Prefetch Ahead", &Config.PrefetchAhead); ImGui::SameLine();
+	ShowHelpMark("Number of images to decode in the background in the direction you are browsing. 0 disables prefetching.");
+	tMath::tiClamp(Config.PrefetchAhead, 0, 8);
+	ImGui::InputInt("Max Thumb Cache (MB)", &Config.MaxThumbCacheMB); ImGui::SameLine();
+	ShowHelpMark("Disk space for cached thumbnails. The least recently used are removed in the background while the app runs. Minimum 16 MB.");
+	tMath::tiClamp(Config.MaxThumbCacheMB, 16, 65536);
+	ImGui::InputInt("Max Thumb Mem (MB)", &Config.MaxThumbMemMB); ImGui::SameLine();
+	ShowHelpMark("Memory for thumbnail pixels. Those furthest from view are freed and read back from the thumbnail cache when scrolled to again. Minimum 32 MB.");
+	tMath::tiClamp(Config.MaxThumbMemMB, 32, 16384);
+	ThumbnailCache::Stats thumbStats;
+	Image::ThumbCache.GetStats(thumbStats);
+	int64 thumbLookups = thumbStats.NumHits + thumbStats.NumMisses;
+	ImGui::Text
+	(
+		"Thumbs %d  Used %d/%d MB  File %d MB  Hits %d%%",
+		thumbStats.NumEntries, int(thumbStats.LiveBytes / (1024 * 1024)), int(thumbStats.MaxBytes / (1024 * 1024)),
+		int(thumbStats.FileBytes / (1024 * 1024)), thumbLookups ? int(thumbStats.NumHits * 100 / thumbLookups) : 0
+	);
+	ImGui::Checkbox("Decoded Cache", &Config.DecodedCache); ImGui::SameLine();
+	ShowHelpMark("Keeps decoded exr, hdr and tiff images on disk so they open without decoding next time. They are written in the background when unloaded. Turning it off clears it on exit.");
+	if (Config.DecodedCache)
+	{
+		ImGui::InputInt("Max Decoded (MB)", &Config.MaxDecodedCacheMB); ImGui::SameLine();
+		ShowHelpMark("Disk space for decoded images. The least recently used are removed on exit. Minimum 256 MB.");
+		tMath::tiClamp(Config.MaxDecodedCacheMB, 256, 1048576);
+	}
 	if (!DeleteAllCacheFilesOnExit)
 	{
 		if (ImGui::Button("Clear Cache"))
@@ -544,6 +592,9 @@ void Viewer::ShowPreferencesWindow(bool* popen)
 	ImGui::Checkbox("Detect APNG Inside PNG", &Config.DetectAPNGInsidePNG); ImGui::SameLine();
 	ShowHelpMark("Some png image files are really apng files. If detecton is true these png files will be displayed animated.");
 
+	ImGui::Checkbox("Reduced JPG Load", &Config.ReducedJPGLoad); ImGui::SameLine();
+	ShowHelpMark("Large jpg files are decoded at 1/2, 1/4 or 1/8 size when fit to the screen. The full image is loaded when zooming in.");
+
 	ImGui::PopItemWidth();
 	ImGui::Unindent();
 
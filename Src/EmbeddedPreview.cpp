@@ -0,0 +1,366 @@
+// EmbeddedPreview.cpp
+//
+// Finds the jpg previews that cameras embed in jpg and tiff files. The exif thumbnail (IFD1) and multi-picture
+// (MPF) previews of jpgs are supported, as are reduced resolution IFDs and SubIFDs of tiffs. Only the headers and the
+// chosen preview are read from disk.
+//
+// Copyright (c) 2020 Tristan Grimmer.
+// Permission to use, copy, modify, and/or distribute this software for any purpose with or without fee is hereby
+// granted, provided that the above copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+// INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN
+// AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+// PERFORMANCE OF THIS SOFTWARE.
+
+#include <cstdio>
+#include <Foundation/tStandard.h>
+#include "EmbeddedPreview.h"
+#include "MultiPart.h"
+#include "ScaledJPG.h"
+using namespace tSystem;
+
+
+namespace Viewer
+{
+	// Sanity limits so a corrupt file can't make us read too much or loop forever.
+	const int MaxPreviews = 16;
+	const int MaxPreviewBytes = 32*1024*1024;
+	const int MaxPreviewHeaderBytes = 64*1024;
+	const int MaxJPGSegments = 256;
+	const int MaxTIFFIFDs = 32;
+	const int MaxTIFFSubIFDs = 8;
+
+	struct Preview
+	{
+		long Offset;
+		int NumBytes;
+		int Width;
+		int Height;
+	};
+
+	// Tiff structured data is found at the start of tiff files and inside the exif and mpf segments of jpgs. All the
+	// offsets inside it are relative to where its header is.
+	struct TIFFBlock
+	{
+		FILE* File;
+		long Base;
+		bool BigEndian;
+
+		bool ReadU16(uint32 offset, uint16& value)		{ return (fseek(File, Base + long(offset), SEEK_SET) == 0) && ReadFileU16(File, value, BigEndian); }
+		bool ReadU32(uint32 offset, uint32& value)		{ return (fseek(File, Base + long(offset), SEEK_SET) == 0) && ReadFileU32(File, value, BigEndian); }
+	};
+
+	// Returns the offset of the first IFD or 0 if the header is bad. Classic tiff only.
+	uint32 ReadTIFFHeader(FILE*, long base, TIFFBlock&);
+
+	// Reads one IFD and adds the jpg it points to. Returns the offset of the next IFD. If subIFDs is not null the
+	// SubIFD offsets are returned in it.
+	uint32 ReadTIFFIFD(TIFFBlock&, uint32 ifdOffset, bool mustBeReduced, Preview* previews, int& numPreviews, int& width, int& height, uint32* subIFDs, int& numSubIFDs);
+
+	void FindJPGPreviews(FILE*, Preview* previews, int& numPreviews, int& width, int& height);
+	void FindTIFFPreviews(FILE*, Preview* previews, int& numPreviews, int& width, int& height);
+	void AddEXIFPreview(FILE*, long base, Preview* previews, int& numPreviews);
+	void AddMPFPreviews(FILE*, long base, Preview* previews, int& numPreviews);
+	void AddPreview(Preview* previews, int& numPreviews, long offset, uint32 numBytes);
+	bool ReadPreviewSize(FILE*, Preview&);
+}
+
+
+uint32 Viewer::ReadTIFFHeader(FILE* file, long base, TIFFBlock& tiff)
+{
+	uint8 order[2];
+	if ((fseek(file, base, SEEK_SET) != 0) || !ReadFileBytes(file, order, 2))
+		return 0;
+
+	tiff.File = file;
+	tiff.Base = base;
+	tiff.BigEndian = (order[0] == 'M') && (order[1] == 'M');
+	if (!tiff.BigEndian && ((order[0] != 'I') || (order[1] != 'I')))
+		return 0;
+
+	uint16 version = 0;
+	uint32 ifdOffset = 0;
+	if (!tiff.ReadU16(2, version) || (version != 42) || !tiff.ReadU32(4, ifdOffset))
+		return 0;
+
+	return ifdOffset;
+}
+
+
+uint32 Viewer::ReadTIFFIFD(TIFFBlock& tiff, uint32 ifdOffset, bool mustBeReduced, Preview* previews, int& numPreviews, int& width, int& height, uint32* subIFDs, int& numSubIFDs)
+{
+	uint16 numEntries = 0;
+	if (!tiff.ReadU16(ifdOffset, numEntries))
+		return 0;
+
+	uint32 subfileType = 0, compression = 0;
+	uint32 jpgOffset = 0, jpgBytes = 0;
+	uint32 stripOffset = 0, stripBytes = 0, numStrips = 0;
+	uint32 subIFDCount = 0, subIFDValue = 0;
+	for (int e = 0; e < numEntries; e++)
+	{
+		// Each entry is a 16 bit tag and type, a 32 bit count, and 4 bytes holding the value or an offset to it.
+		uint32 entry = ifdOffset + 2 + 12*e;
+		uint16 tag = 0, type = 0;
+		uint32 count = 0, value = 0;
+		if (!tiff.ReadU16(entry, tag) || !tiff.ReadU16(entry+2, type) || !tiff.ReadU32(entry+4, count))
+			return 0;
+
+		// Short values sit in the first two bytes of the value field whatever the byte order.
+		uint16 shortValue = 0;
+		bool ok = (type == 3) ? tiff.ReadU16(entry+8, shortValue) : tiff.ReadU32(entry+8, value);
+		if (!ok)
+			return 0;
+		if (type == 3)
+			value = shortValue;
+
+		switch (tag)
+		{
+			case 0x00FE:	subfileType = value;						break;
+			case 0x0100:	width = int(value);							break;
+			case 0x0101:	height = int(value);						break;
+			case 0x0103:	compression = value;						break;
+			case 0x0111:	stripOffset = value; numStrips = count;		break;
+			case 0x0117:	stripBytes = value;							break;
+			case 0x0201:	jpgOffset = value;							break;
+			case 0x0202:	jpgBytes = value;							break;
+			case 0x014A:	subIFDValue = value; subIFDCount = count;	break;
+		}
+	}
+
+	uint32 nextIFD = 0;
+	if (!tiff.ReadU32(ifdOffset + 2 + 12*numEntries, nextIFD))
+		nextIFD = 0;
+
+	// A single SubIFD offset is stored in the entry itself. More than one and the entry points to a list of them.
+	if (subIFDs)
+	{
+		numSubIFDs = tMath::tMin(int(subIFDCount), MaxTIFFSubIFDs);
+		for (int s = 0; s < numSubIFDs; s++)
+		{
+			if (subIFDCount == 1)
+				subIFDs[s] = subIFDValue;
+			else if (!tiff.ReadU32(subIFDValue + 4*s, subIFDs[s]))
+				numSubIFDs = s;
+		}
+	}
+
+	if (mustBeReduced && !(subfileType & 1))
+		return nextIFD;
+
+	// Old style jpg compression (6) points at a complete jpg. New style (7) is only self-contained if there is a
+	// single strip, and even then it might depend on shared tables. The decode will tell us.
+	if (jpgOffset && jpgBytes)
+		AddPreview(previews, numPreviews, tiff.Base + long(jpgOffset), jpgBytes);
+	else if ((compression == 7) && (numStrips == 1) && stripBytes)
+		AddPreview(previews, numPreviews, tiff.Base + long(stripOffset), stripBytes);
+
+	return nextIFD;
+}
+
+
+void Viewer::AddPreview(Preview* previews, int& numPreviews, long offset, uint32 numBytes)
+{
+	if ((numPreviews >= MaxPreviews) || (numBytes == 0) || (numBytes > uint32(MaxPreviewBytes)))
+		return;
+
+	previews[numPreviews++] = { offset, int(numBytes), 0, 0 };
+}
+
+
+void Viewer::FindJPGPreviews(FILE* file, Preview* previews, int& numPreviews, int& width, int& height)
+{
+	uint8 soi[2];
+	if (!ReadFileBytes(file, soi, 2) || (soi[0] != 0xFF) || (soi[1] != 0xD8))
+		return;
+
+	// Everything we want is in the segments before the first scan.
+	long pos = 2;
+	for (int segment = 0; segment < MaxJPGSegments; segment++)
+	{
+		uint8 header[4];
+		if ((fseek(file, pos, SEEK_SET) != 0) || !ReadFileBytes(file, header, 4) || (header[0] != 0xFF))
+			return;
+
+		int marker = header[1];
+		if (marker == 0xFF)
+		{
+			pos++;
+			continue;
+		}
+
+		int length = (header[2] << 8) | header[3];
+		if ((marker == 0xDA) || (marker == 0xD9) || (length < 2))
+			return;
+
+		uint8 id[6];
+		if (IsJPGFrameMarker(marker))
+		{
+			uint8 frame[5];
+			if (ReadFileBytes(file, frame, 5))
+			{
+				height = (frame[1] << 8) | frame[2];
+				width = (frame[3] << 8) | frame[4];
+			}
+		}
+		else if ((marker == 0xE1) && (length >= 8) && ReadFileBytes(file, id, 6) && !tMemcmp(id, "Exif\0\0", 6))
+		{
+			AddEXIFPreview(file, pos + 10, previews, numPreviews);
+		}
+		else if ((marker == 0xE2) && (length >= 6) && ReadFileBytes(file, id, 4) && !tMemcmp(id, "MPF\0", 4))
+		{
+			AddMPFPreviews(file, pos + 8, previews, numPreviews);
+		}
+
+		pos += 2 + length;
+	}
+}
+
+
+void Viewer::AddEXIFPreview(FILE* file, long base, Preview* previews, int& numPreviews)
+{
+	// The thumbnail is described by IFD1, the second IFD in the chain.
+	TIFFBlock tiff;
+	uint32 ifd0 = ReadTIFFHeader(file, base, tiff);
+	if (!ifd0)
+		return;
+
+	uint16 numEntries = 0;
+	uint32 ifd1 = 0;
+	if (!tiff.ReadU16(ifd0, numEntries) || !tiff.ReadU32(ifd0 + 2 + 12*numEntries, ifd1) || !ifd1)
+		return;
+
+	int width = 0, height = 0, numSubIFDs = 0;
+	ReadTIFFIFD(tiff, ifd1, false, previews, numPreviews, width, height, nullptr, numSubIFDs);
+}
+
+
+void Viewer::AddMPFPreviews(FILE* file, long base, Preview* previews, int& numPreviews)
+{
+	TIFFBlock tiff;
+	uint32 ifd = ReadTIFFHeader(file, base, tiff);
+	uint16 numEntries = 0;
+	if (!ifd || !tiff.ReadU16(ifd, numEntries))
+		return;
+
+	// The MP entry tag holds a 16 byte record per image. The first image is the primary one so it is skipped.
+	for (int e = 0; e < numEntries; e++)
+	{
+		uint32 entry = ifd + 2 + 12*e;
+		uint16 tag = 0;
+		uint32 count = 0, listOffset = 0;
+		if (!tiff.ReadU16(entry, tag) || !tiff.ReadU32(entry+4, count) || !tiff.ReadU32(entry+8, listOffset))
+			return;
+
+		if (tag != 0xB002)
+			continue;
+
+		int numImages = tMath::tMin(int(count / 16), MaxPreviews + 1);
+		for (int i = 1; i < numImages; i++)
+		{
+			uint32 size = 0, offset = 0;
+			if (!tiff.ReadU32(listOffset + 16*i + 4, size) || !tiff.ReadU32(listOffset + 16*i + 8, offset))
+				return;
+			AddPreview(previews, numPreviews, base + long(offset), size);
+		}
+		return;
+	}
+}
+
+
+void Viewer::FindTIFFPreviews(FILE* file, Preview* previews, int& numPreviews, int& width, int& height)
+{
+	TIFFBlock tiff;
+	uint32 ifdOffset = ReadTIFFHeader(file, 0, tiff);
+
+	// The first IFD is the main image. Later IFDs are more pages unless they are marked as reduced resolution.
+	// SubIFDs of the first IFD are where dng style files keep their previews.
+	uint32 subIFDs[MaxTIFFSubIFDs];
+	int numSubIFDs = 0;
+	for (int i = 0; (i < MaxTIFFIFDs) && ifdOffset; i++)
+	{
+		int w = 0, h = 0;
+		ifdOffset = ReadTIFFIFD(tiff, ifdOffset, true, previews, numPreviews, w, h, (i == 0) ? subIFDs : nullptr, numSubIFDs);
+		if (i == 0)
+		{
+			width = w;
+			height = h;
+		}
+	}
+
+	for (int s = 0; s < numSubIFDs; s++)
+	{
+		int w = 0, h = 0, numNested = 0;
+		ReadTIFFIFD(tiff, subIFDs[s], true, previews, numPreviews, w, h, nullptr, numNested);
+	}
+}
+
+
+bool Viewer::ReadPreviewSize(FILE* file, Preview& preview)
+{
+	int numBytes = tMath::tMin(preview.NumBytes, MaxPreviewHeaderBytes);
+	uint8* header = new uint8[numBytes];
+	bool ok = (fseek(file, preview.Offset, SEEK_SET) == 0) && ReadFileBytes(file, header, numBytes);
+	ok = ok && GetJPGSize(header, numBytes, preview.Width, preview.Height);
+	delete[] header;
+	return ok;
+}
+
+
+tPixel* Viewer::LoadEmbeddedPreview(const tString& filename, tFileType fileType, int minWidth, int minHeight, int& width, int& height)
+{
+	width = height = 0;
+	if ((fileType != tFileType::JPG) && (fileType != tFileType::TIFF))
+		return nullptr;
+
+	FILE* file = fopen(filename.Chars(), "rb");
+	if (!file)
+		return nullptr;
+
+	Preview previews[MaxPreviews];
+	int numPreviews = 0;
+	int imageWidth = 0, imageHeight = 0;
+	if (fileType == tFileType::JPG)
+		FindJPGPreviews(file, previews, numPreviews, imageWidth, imageHeight);
+	else
+		FindTIFFPreviews(file, previews, numPreviews, imageWidth, imageHeight);
+
+	// Pick the smallest preview that is big enough and the same shape as the image, to within rounding.
+	int best = -1;
+	float imageAspect = (imageHeight > 0) ? float(imageWidth) / float(imageHeight) : 0.0f;
+	for (int p = 0; (p < numPreviews) && (imageAspect > 0.0f); p++)
+	{
+		Preview& preview = previews[p];
+		if (!ReadPreviewSize(file, preview) || ((preview.Width < minWidth) && (preview.Height < minHeight)))
+			continue;
+
+		float aspect = float(preview.Width) / float(preview.Height);
+		if (tMath::tAbs(aspect - imageAspect) > 0.02f*imageAspect)
+			continue;
+
+		if ((best == -1) || (preview.Width*preview.Height < previews[best].Width*previews[best].Height))
+			best = p;
+	}
+
+	uint8* jpgData = nullptr;
+	if (best != -1)
+	{
+		jpgData = new uint8[previews[best].NumBytes];
+		if ((fseek(file, previews[best].Offset, SEEK_SET) != 0) || !ReadFileBytes(file, jpgData, previews[best].NumBytes))
+		{
+			delete[] jpgData;
+			jpgData = nullptr;
+		}
+	}
+	fclose(file);
+	if (!jpgData)
+		return nullptr;
+
+	// The preview itself may be big enough to be decoded at a reduced scale.
+	int scaleDenom = 1;
+	tPixel* pixels = DecodeScaledJPG(jpgData, previews[best].NumBytes, minWidth, minHeight, width, height, scaleDenom, false);
+	delete[] jpgData;
+	return pixels;
+}
@@ -0,0 +1,30 @@
+// EmbeddedPreview.h
+//
+// Finds the jpg previews that cameras embed in jpg and tiff files. The exif thumbnail (IFD1) and multi-picture
+// (MPF) previews of jpgs are supported, as are reduced resolution IFDs and SubIFDs of tiffs. Only the headers and the
+// chosen preview are read from disk.
+//
+// Copyright (c) 2020 Tristan Grimmer.
+// Permission to use, copy, modify, and/or distribute this software for any purpose with or without fee is hereby
+// granted, provided that the above copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+// INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN
+// AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+// PERFORMANCE OF THIS SOFTWARE.
+
+#pragma once
+#include <Foundation/tString.h>
+#include <Math/tColour.h>
+#include <System/tFile.h>
+
+
+namespace Viewer
+{
+	// Decodes the smallest embedded preview that can fill a minWidth by minHeight box at its own aspect without being
+	// scaled up. Previews that don't have the same shape as the image are ignored since some cameras pad them with
+	// black bars. The pixels are in tPicture (bottom-up) row order and the caller must delete[] them. Returns nullptr
+	// if there is no suitable preview.
+	tPixel* LoadEmbeddedPreview(const tString& filename, tSystem::tFileType, int minWidth, int minHeight, int& width, int& height);
+}
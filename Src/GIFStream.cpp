@@ -0,0 +1,506 @@
+// GIFStream.cpp
+//
+// A gif decoder that produces frames on demand instead of decoding the whole animation up front. The file is indexed
+// once and individual frames are composited when asked for. Snapshots of the canvas are kept at regular intervals so
+// random access only needs to replay a bounded number of frames.
+//
+// Copyright (c) 2020 Tristan Grimmer.
+// Permission to use, copy, modify, and/or distribute this software for any purpose with or without fee is hereby
+// granted, provided that the above copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+// INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN
+// AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+// PERFORMANCE OF THIS SOFTWARE.
+
+#include <Foundation/tStandard.h>
+#include <Foundation/tFundamentals.h>
+#include <System/tFile.h>
+#include "GIFStream.h"
+using namespace tImage;
+
+
+namespace Viewer
+{
+	// Keyframes are at least this many frames apart. Long animations space them further so there are never more
+	// than MaxKeyframes of them. Together these bound both the memory used and the work needed for a seek.
+	const int MinKeyframeInterval	= 8;
+	const int MaxKeyframes			= 16;
+
+	// Sanity limit on canvas and frame sizes. Anything bigger is treated as a corrupt file.
+	const int64 MaxGIFArea			= 1 << 28;
+
+	const int MaxLZWCodes			= 4096;
+
+	// Returns the canvas row of decoded row r of an interlaced image of the given height.
+	int GetInterlacedRow(int r, int height);
+}
+
+
+int Viewer::GetInterlacedRow(int r, int height)
+{
+	int pass1 = (height + 7) / 8;
+	if (r < pass1)
+		return r * 8;
+	r -= pass1;
+
+	int pass2 = (height + 3) / 8;
+	if (r < pass2)
+		return 4 + r * 8;
+	r -= pass2;
+
+	int pass3 = (height + 1) / 4;
+	if (r < pass3)
+		return 2 + r * 4;
+	r -= pass3;
+
+	return 1 + r * 2;
+}
+
+
+bool Viewer::GIFStream::Load(const tString& filename)
+{
+	Clear();
+	File.Open(filename, MappedFile::Access::Random);
+	FileData = File.GetData();
+	FileSize = File.GetSize();
+	if (!FileData || (FileSize < 13) || tMemcmp(FileData, "GIF8", 4))
+	{
+		Clear();
+		return false;
+	}
+
+	const uint8* data = FileData;
+	Width = data[6] | (data[7] << 8);
+	Height = data[8] | (data[9] << 8);
+	if ((Width <= 0) || (Height <= 0) || (int64(Width)*int64(Height) > MaxGIFArea))
+	{
+		Clear();
+		return false;
+	}
+
+	int pos = 13;
+	int globalOffset = -1;
+	int globalSize = 0;
+	if (data[10] & 0x80)
+	{
+		globalSize = 1 << ((data[10] & 0x07) + 1);
+		globalOffset = pos;
+		pos += 3*globalSize;
+	}
+
+	// The graphic control extension applies to the next image descriptor only.
+	int disposal = 0;
+	int transparentIndex = -1;
+	int delay = 0;
+	int maxFrameArea = 0;
+	while (pos < FileSize)
+	{
+		uint8 block = data[pos++];
+		if (block == 0x3B)
+			break;
+
+		if (block == 0x21)
+		{
+			if (pos >= FileSize)
+				break;
+
+			uint8 label = data[pos++];
+			if ((label == 0xF9) && (pos + 4 < FileSize) && (data[pos] == 4))
+			{
+				disposal = (data[pos+1] >> 2) & 0x07;
+				delay = data[pos+2] | (data[pos+3] << 8);
+				transparentIndex = (data[pos+1] & 0x01) ? data[pos+4] : -1;
+			}
+
+			// Skip the extension sub-blocks.
+			while (pos < FileSize)
+			{
+				int length = data[pos++];
+				if (length == 0)
+					break;
+				pos += length;
+			}
+			continue;
+		}
+
+		if (block != 0x2C)
+			break;
+
+		if (pos + 9 > FileSize)
+			break;
+
+		Frame frame;
+		frame.Left				= data[pos+0] | (data[pos+1] << 8);
+		frame.Top				= data[pos+2] | (data[pos+3] << 8);
+		frame.Width				= data[pos+4] | (data[pos+5] << 8);
+		frame.Height			= data[pos+6] | (data[pos+7] << 8);
+		uint8 flags				= data[pos+8];
+		frame.Interlaced		= (flags & 0x40) ? true : false;
+		frame.PaletteOffset		= globalOffset;
+		frame.PaletteSize		= globalSize;
+		frame.TransparentIndex	= transparentIndex;
+		frame.Disposal			= disposal;
+
+		// Browsers show frames with a 0 or 10ms delay for 100ms. So do we, otherwise they play way too fast.
+		frame.Duration			= (delay > 1) ? float(delay) / 100.0f : 0.1f;
+		pos += 9;
+
+		if (flags & 0x80)
+		{
+			frame.PaletteSize = 1 << ((flags & 0x07) + 1);
+			frame.PaletteOffset = pos;
+			pos += 3*frame.PaletteSize;
+		}
+		if (pos >= FileSize)
+			break;
+
+		frame.MinCodeSize = data[pos++];
+		frame.DataOffset = pos;
+		while (pos < FileSize)
+		{
+			int length = data[pos++];
+			if (length == 0)
+				break;
+			pos += length;
+		}
+
+		// A frame we can't decode ends the animation. A truncated frame is kept and decodes as far as the data goes.
+		int64 frameArea = int64(frame.Width)*int64(frame.Height);
+		if ((frame.MinCodeSize < 1) || (frame.MinCodeSize > 8) || (frameArea > MaxGIFArea))
+			break;
+
+		AppendFrame(frame);
+		maxFrameArea = tMath::tMax(maxFrameArea, int(frameArea));
+		if (pos >= FileSize)
+			break;
+
+		disposal = 0;
+		transparentIndex = -1;
+		delay = 0;
+	}
+
+	if (NumFrames == 0)
+	{
+		Clear();
+		return false;
+	}
+
+	int area = Width*Height;
+	Canvas = new tPixel[area];
+	PrevCanvas = new tPixel[area];
+	Indices = new uint8[tMath::tMax(maxFrameArea, 1)];
+	CanvasFrame = -1;
+
+	KeyframeInterval = tMath::tMax(MinKeyframeInterval, (NumFrames + MaxKeyframes - 1) / MaxKeyframes);
+	NumKeyframes = (NumFrames + KeyframeInterval - 1) / KeyframeInterval;
+	Keyframes = new tPixel*[NumKeyframes];
+	for (int k = 0; k < NumKeyframes; k++)
+		Keyframes[k] = nullptr;
+
+	SrcPixelFormat = tPixelFormat::PAL8BIT;
+	return true;
+}
+
+
+void Viewer::GIFStream::Clear()
+{
+	for (int k = 0; k < NumKeyframes; k++)
+		delete[] Keyframes[k];
+	delete[] Keyframes;
+	Keyframes = nullptr;
+	NumKeyframes = 0;
+	KeyframeInterval = 1;
+
+	delete[] Canvas;
+	Canvas = nullptr;
+	delete[] PrevCanvas;
+	PrevCanvas = nullptr;
+	delete[] Indices;
+	Indices = nullptr;
+	CanvasFrame = -1;
+
+	delete[] Frames;
+	Frames = nullptr;
+	NumFrames = 0;
+	MaxFrames = 0;
+
+	File.Close();
+	FileData = nullptr;
+	FileSize = 0;
+	Width = 0;
+	Height = 0;
+	SrcPixelFormat = tPixelFormat::Invalid;
+}
+
+
+void Viewer::GIFStream::AppendFrame(const Frame& frame)
+{
+	if (NumFrames >= MaxFrames)
+	{
+		int maxFrames = tMath::tMax(MaxFrames*2, 64);
+		Frame* frames = new Frame[maxFrames];
+		for (int f = 0; f < NumFrames; f++)
+			frames[f] = Frames[f];
+		delete[] Frames;
+		Frames = frames;
+		MaxFrames = maxFrames;
+	}
+
+	Frames[NumFrames++] = frame;
+}
+
+
+float Viewer::GIFStream::GetFrameDuration(int frame) const
+{
+	if ((frame < 0) || (frame >= NumFrames))
+		return 0.0f;
+
+	return Frames[frame].Duration;
+}
+
+
+int64 Viewer::GIFStream::GetMemSizeBytes() const
+{
+	if (!IsValid())
+		return 0;
+
+	// Canvas, previous canvas, and all keyframes except the first which is never stored. A mapped file lives in the
+	// page cache and is not ours to count.
+	int64 area = int64(Width)*int64(Height);
+	int64 numCanvases = 2 + NumKeyframes - 1;
+	int64 fileBytes = File.IsMapped() ? 0 : FileSize;
+	return fileBytes + numCanvases*area*int64(sizeof(tPixel)) + area;
+}
+
+
+bool Viewer::GIFStream::DecodeFrame(int frame, tPixel* dest)
+{
+	if (!IsValid() || (frame < 0) || (frame >= NumFrames) || !dest)
+		return false;
+
+	int area = Width*Height;
+	if (frame != CanvasFrame)
+	{
+		int key = frame / KeyframeInterval;
+		while ((key > 0) && !Keyframes[key])
+			key--;
+		int keyFrame = key * KeyframeInterval;
+
+		// Keep going from the current canvas if it is between the keyframe and the frame we want.
+		if ((CanvasFrame < keyFrame) || (CanvasFrame > frame))
+		{
+			if (key > 0)
+				tMemcpy(Canvas, Keyframes[key], area*sizeof(tPixel));
+			else
+				ClearCanvas(Canvas);
+
+			DrawFrame(keyFrame);
+			CanvasFrame = keyFrame;
+		}
+
+		while (CanvasFrame < frame)
+		{
+			DisposeFrame(CanvasFrame);
+			int next = CanvasFrame + 1;
+			if ((next % KeyframeInterval) == 0)
+			{
+				tPixel*& keyframe = Keyframes[next / KeyframeInterval];
+				if (!keyframe)
+				{
+					keyframe = new tPixel[area];
+					tMemcpy(keyframe, Canvas, area*sizeof(tPixel));
+				}
+			}
+
+			DrawFrame(next);
+			CanvasFrame = next;
+		}
+	}
+
+	tMemcpy(dest, Canvas, area*sizeof(tPixel));
+	return true;
+}
+
+
+void Viewer::GIFStream::ClearCanvas(tPixel* canvas)
+{
+	int area = Width*Height;
+	for (int p = 0; p < area; p++)
+		canvas[p] = tPixel::transparent;
+}
+
+
+void Viewer::GIFStream::DisposeFrame(int frameNum)
+{
+	const Frame& frame = Frames[frameNum];
+	switch (frame.Disposal)
+	{
+		case 2:
+		{
+			// Restore to background. Like most viewers we use transparent for the background.
+			int x0 = tMath::tMin(frame.Left, Width);
+			int x1 = tMath::tMin(frame.Left + frame.Width, Width);
+			int y0 = tMath::tMin(frame.Top, Height);
+			int y1 = tMath::tMin(frame.Top + frame.Height, Height);
+			for (int y = y0; y < y1; y++)
+				for (int x = x0; x < x1; x++)
+					Canvas[(Height-1-y)*Width + x] = tPixel::transparent;
+			break;
+		}
+
+		case 3:
+			tMemcpy(Canvas, PrevCanvas, Width*Height*sizeof(tPixel));
+			break;
+	}
+}
+
+
+void Viewer::GIFStream::DrawFrame(int frameNum)
+{
+	const Frame& frame = Frames[frameNum];
+	if (frame.Disposal == 3)
+		tMemcpy(PrevCanvas, Canvas, Width*Height*sizeof(tPixel));
+
+	if ((frame.PaletteSize == 0) || (frame.Width == 0))
+		return;
+
+	int numIndices = DecodeIndices(frame);
+	const uint8* palette = FileData + frame.PaletteOffset;
+	int numRows = (numIndices + frame.Width - 1) / frame.Width;
+	for (int r = 0; r < numRows; r++)
+	{
+		int y = frame.Top + (frame.Interlaced ? GetInterlacedRow(r, frame.Height) : r);
+		if (y >= Height)
+			continue;
+
+		// Gif rows go top to bottom. Pictures go bottom to top.
+		tPixel* row = Canvas + (Height-1-y)*Width;
+		const uint8* indices = Indices + r*frame.Width;
+		int numCols = tMath::tMin(frame.Width, numIndices - r*frame.Width);
+		for (int c = 0; c < numCols; c++)
+		{
+			int x = frame.Left + c;
+			int index = indices[c];
+			if ((x >= Width) || (index == frame.TransparentIndex) || (index >= frame.PaletteSize))
+				continue;
+
+			const uint8* rgb = palette + 3*index;
+			row[x] = tPixel(rgb[0], rgb[1], rgb[2], 255);
+		}
+	}
+}
+
+
+int Viewer::GIFStream::DecodeIndices(const Frame& frame)
+{
+	const int area = frame.Width*frame.Height;
+	const int clearCode = 1 << frame.MinCodeSize;
+	const int endCode = clearCode + 1;
+
+	// Reads LSB-first variable width codes out of the sub-blocks. Returns false at the end of the data.
+	int pos = frame.DataOffset;
+	int blockRemaining = 0;
+	uint32 bits = 0;
+	int numBits = 0;
+	auto readCode = [&](int codeSize, int& code) -> bool
+	{
+		while (numBits < codeSize)
+		{
+			if (blockRemaining == 0)
+			{
+				if (pos >= FileSize)
+					return false;
+				blockRemaining = FileData[pos++];
+				if (blockRemaining == 0)
+					return false;
+			}
+			if (pos >= FileSize)
+				return false;
+
+			bits |= uint32(FileData[pos++]) << numBits;
+			numBits += 8;
+			blockRemaining--;
+		}
+
+		code = int(bits & ((1 << codeSize) - 1));
+		bits >>= codeSize;
+		numBits -= codeSize;
+		return true;
+	};
+
+	uint16 prefix[MaxLZWCodes];
+	uint8 suffix[MaxLZWCodes];
+	uint8 stack[MaxLZWCodes+1];
+	for (int c = 0; c < clearCode; c++)
+	{
+		prefix[c] = 0;
+		suffix[c] = uint8(c);
+	}
+
+	int codeSize = frame.MinCodeSize + 1;
+	int nextCode = endCode + 1;
+	int prevCode = -1;
+	uint8 firstChar = 0;
+	int numIndices = 0;
+	int code = 0;
+	while ((numIndices < area) && readCode(codeSize, code))
+	{
+		if (code == clearCode)
+		{
+			codeSize = frame.MinCodeSize + 1;
+			nextCode = endCode + 1;
+			prevCode = -1;
+			continue;
+		}
+
+		if (code == endCode)
+			break;
+
+		if (prevCode < 0)
+		{
+			if (code >= clearCode)
+				break;
+
+			Indices[numIndices++] = uint8(code);
+			firstChar = uint8(code);
+			prevCode = code;
+			continue;
+		}
+
+		// Unwind the string for the code onto the stack. The code one past the table end is the previous string plus
+		// its own first character.
+		int inCode = code;
+		int sp = 0;
+		if (code >= nextCode)
+		{
+			if (code > nextCode)
+				break;
+			stack[sp++] = firstChar;
+			code = prevCode;
+		}
+		while (code >= clearCode)
+		{
+			stack[sp++] = suffix[code];
+			code = prefix[code];
+		}
+		firstChar = uint8(code);
+		stack[sp++] = firstChar;
+
+		while ((sp > 0) && (numIndices < area))
+			Indices[numIndices++] = stack[--sp];
+
+		if (nextCode < MaxLZWCodes)
+		{
+			prefix[nextCode] = uint16(prevCode);
+			suffix[nextCode] = firstChar;
+			nextCode++;
+			if ((nextCode == (1 << codeSize)) && (codeSize < 12))
+				codeSize++;
+		}
+		prevCode = inCode;
+	}
+
+	return numIndices;
+}
@@ -0,0 +1,99 @@
+// GIFStream.h
+//
+// A gif decoder that produces frames on demand instead of decoding the whole animation up front. The file is indexed
+// once and individual frames are composited when asked for. Snapshots of the canvas are kept at regular intervals so
+// random access only needs to replay a bounded number of frames.
+//
+// Copyright (c) 2020 Tristan Grimmer.
+// Permission to use, copy, modify, and/or distribute this software for any purpose with or without fee is hereby
+// granted, provided that the above copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+// INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN
+// AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+// PERFORMANCE OF THIS SOFTWARE.
+
+#pragma once
+#include <Foundation/tString.h>
+#include <Math/tColour.h>
+#include <Image/tPixelFormat.h>
+#include "MappedFile.h"
+namespace Viewer
+{
+
+
+class GIFStream
+{
+public:
+	GIFStream()																											{ }
+	~GIFStream()																										{ Clear(); }
+
+	// Reads the file and indexes the frames. No frames are decoded. Returns false if the file is not a gif or has no
+	// frames. A truncated file is accepted and decodes as far as the data goes.
+	bool Load(const tString& filename);
+	void Clear();
+	bool IsValid() const																								{ return NumFrames > 0; }
+
+	int GetWidth() const																								{ return Width; }
+	int GetHeight() const																								{ return Height; }
+	int GetNumFrames() const																							{ return NumFrames; }
+	float GetFrameDuration(int frame) const;
+
+	// Writes the fully composited frame into dest, which must hold width*height pixels. Pixels are stored in the same
+	// bottom-up row order as tPicture. Decoding the frame after the last one decoded is cheap. Any other frame starts
+	// from the closest keyframe at or before it.
+	bool DecodeFrame(int frame, tPixel* dest);
+
+	// The most memory this object will use once all keyframes are stored. Does not include the frames handed out.
+	int64 GetMemSizeBytes() const;
+
+	tImage::tPixelFormat SrcPixelFormat = tImage::tPixelFormat::Invalid;
+
+private:
+	struct Frame
+	{
+		int DataOffset;				// Offset of the first lzw sub-block.
+		int MinCodeSize;
+		int Left, Top, Width, Height;
+		bool Interlaced;
+		int PaletteOffset;			// Offset of the colour table. The global one if the frame has no local one.
+		int PaletteSize;			// Number of colours. 0 if there is no table at all.
+		int TransparentIndex;		// -1 if none.
+		int Disposal;
+		float Duration;
+	};
+
+	void AppendFrame(const Frame&);
+	void ClearCanvas(tPixel* canvas);
+	void DrawFrame(int frame);
+	void DisposeFrame(int frame);
+	int DecodeIndices(const Frame&);			// Returns the number of indices decoded.
+
+	// Frames are decoded straight out of the file so it stays open for the life of the stream.
+	MappedFile File;
+	const uint8* FileData = nullptr;
+	int FileSize		= 0;
+	int Width			= 0;
+	int Height			= 0;
+
+	Frame* Frames		= nullptr;
+	int NumFrames		= 0;
+	int MaxFrames		= 0;
+
+	// The canvas holds the composite of CanvasFrame. PrevCanvas holds what was under it if the frame's disposal
+	// method says to restore the previous contents.
+	tPixel* Canvas		= nullptr;
+	tPixel* PrevCanvas	= nullptr;
+	uint8* Indices		= nullptr;
+	int CanvasFrame		= -1;
+
+	// Keyframe k is the canvas just before frame k*KeyframeInterval is drawn. Keyframe 0 is always the cleared canvas
+	// and is never stored. They are stored lazily the first time playback passes them.
+	tPixel** Keyframes	= nullptr;
+	int NumKeyframes	= 0;
+	int KeyframeInterval = 1;
+};
+
+
+}
@@ -12,10 +12,11 @@
 // AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
 // PERFORMANCE OF THIS SOFTWARE.
 
+#include <climits>
+#include <cstring>
 #include <mutex>
 #include <chrono>
 #include <glad/glad.h>
-#include <GLFW/glfw3.h>				// Include glfw3.h after our OpenGL definitions.
 #include <Foundation/tHash.h>
 #include <Foundation/tFundamentals.h>
 #include <Image/tTexture.h>
@@ -29,20 +30,95 @@
 #include <System/tMachine.h>
 #include <System/tChunk.h>
 #include "Image.h"
+#include "BCDecode.h"
+#include "DecodedCache.h"
+#include "GIFStream.h"
+#include "ImageCache.h"
+#include "MappedDecode.h"
+#include "MemoryBudget.h"
+#include "TextureCache.h"
+#include "TextureReadback.h"
+#include "EmbeddedPreview.h"
+#include "MultiPart.h"
+#include "PackedImage.h"
+#include "ScaledJPG.h"
+#include "TilePyramid.h"
+#include "ThumbnailAtlas.h"
+#include "ThumbnailCache.h"
+#include "ThumbnailPool.h"
+#include "ThumbnailResidency.h"
 #include "Settings.h"
 using namespace tStd;
 using namespace tSystem;
 using namespace tImage;
 using namespace tMath;
 using namespace Viewer;
-int Image::ThumbnailNumThreadsRunning = 0;
+ThumbnailPool Image::ThumbnailWorkers;
+int Image::MaxTextureSize = 4096;
 tString Image::ThumbCacheDir;
-namespace Viewer { extern Settings Config; }
+ThumbnailCache Image::ThumbCache;
+tString Image::DecodedCacheDir;
+tString Image::SpillDir;
+namespace Viewer { extern Settings Config; extern TextureCache TexturesCache; extern ThumbnailAtlas ThumbnailsAtlas; extern ThumbnailResidency ThumbnailsResidency; }
+
+
+// The loader only knows about OpenGL 2.1 and s3tc. These come from the rgtc and bptc extensions which are checked for
+// at runtime before they are used.
+#ifndef GL_COMPRESSED_RED_RGTC1
+#define GL_COMPRESSED_RED_RGTC1 0x8DBB
+#endif
+#ifndef GL_COMPRESSED_RG_RGTC2
+#define GL_COMPRESSED_RG_RGTC2 0x8DBD
+#endif
+#ifndef GL_COMPRESSED_RGBA_BPTC_UNORM
+#define GL_COMPRESSED_RGBA_BPTC_UNORM 0x8E8C
+#endif
+
+
+namespace
+{
+	// We want the front (+Z) of a cubemap to be the first part.
+	const tCubemap::tSide CubemapSideOrder[int(tCubemap::tSide::NumSides)] =
+	{
+		tCubemap::tSide::PosZ,
+		tCubemap::tSide::NegZ,
+		tCubemap::tSide::PosX,
+		tCubemap::tSide::NegX,
+		tCubemap::tSide::PosY,
+		tCubemap::tSide::NegY
+	};
+
+	// Helper threads for decoding file parts are shared by every load. Prefetch workers loading multi-part files at
+	// the same time split them between themselves instead of each starting one per core.
+	std::atomic<int> NumPartHelpers(0);
+
+	// Returns how many helpers the caller may start, which may be 0. Give them back with ReleasePartHelpers.
+	int ReservePartHelpers(int wanted)
+	{
+		int maxHelpers = tMax(tSystem::tGetNumCores() - 1, 0);
+		int inUse = NumPartHelpers;
+		for (;;)
+		{
+			int count = tClamp(maxHelpers - inUse, 0, wanted);
+			if (!count || NumPartHelpers.compare_exchange_weak(inUse, inUse + count))
+				return count;
+		}
+	}
+
+	// The image whose tiles are bound. Set when tiles are drawn and cleared when they are unbound.
+	Image* TilesBoundImage = nullptr;
+
+	void ReleasePartHelpers(int count)
+	{
+		NumPartHelpers -= count;
+	}
+}
 
 
 const int Image::ThumbWidth			= 256;
 const int Image::ThumbHeight		= 144;
 const int Image::ThumbMinDispWidth	= 64;
+const int Image::ThumbNumMips;
 
 
 Image::Image() :
@@ -78,21 +154,18 @@ Image::Image(const tString& filename) :
 
 Image::~Image()
 {
-	// If we're being destroyed before the thumbnail thread is done, we have to wait because that thread
+	// A queued thumbnail is simply dropped. If a worker is already making it we have to wait because the worker
 	// accesses the thumbnail picture of this object... so 'this' must be valid.
-	if (ThumbnailThread.joinable())
-		ThumbnailThread.join();
-
-	// It is important that the thread count decrements if necessary since Images can be deleted
-	// when changing folders. The threads need to be available to do more work in a new folder.
-	if (ThumbnailRequested && ThumbnailThreadRunning)
-	{
-		ThumbnailNumThreadsRunning--;
-		tiClampMin(ThumbnailNumThreadsRunning, 0);
-	}
+	if (ThumbnailThreadRunning && !ThumbnailWorkers.Cancel(this))
+		ThumbnailWorkers.Wait(this);
 
-	// Free GPU image mem and texture IDs.
+	// Free GPU image mem and texture IDs. This also waits for any load or pack worker since they access 'this' too.
 	Unload(true);
+	DeleteTexture(TexIDThumbnail);
+	ThumbnailsAtlas.Remove(ThumbnailAtlasCell);
+	ThumbnailsResidency.Remove(this);
+	if (Cache)
+		Cache->Remove(this);
 }
 
 
@@ -127,20 +200,185 @@ bool Image::Load(const tString& filename)
 
 bool Image::Load()
 {
+	// LoadData reads the packed copy so it has to be finished.
+	CompletePack(true);
+
+	// If a worker is already decoding this image we wait for it rather than decoding a second time. We want its
+	// result so any cancel request is withdrawn first.
+	if (LoadThreadRunning)
+	{
+		LoadCancelRequested = false;
+		JoinLoadThread();
+		if (LoadThreadSucceeded)
+			return FinalizeLoad();
+	}
+
 	if (IsLoaded() && !Dirty)
 	{
 		LoadedTime = tSystem::tGetTime();
+		if (Cache)
+			Cache->Touch(this);
+		return true;
+	}
+
+	if (Filetype == tFileType::Unknown)
+		return false;
+
+	if (!LoadData())
+	{
+		NotifyCache();
+		return false;
+	}
+
+	return FinalizeLoad();
+}
+
+
+bool Image::RequestLoad()
+{
+	if (LoadThreadRunning)
+	{
+		LoadCancelRequested = false;
+		return true;
+	}
+
+	// A loaded image is good to go even if it is dirty. We don't want to lose the edits.
+	if (IsLoaded())
+	{
+		LoadedTime = tSystem::tGetTime();
+		if (Cache)
+			Cache->Touch(this);
 		return true;
 	}
 
 	if (Filetype == tFileType::Unknown)
 		return false;
 
+	// Only happens if the image is gone back to right after it was evicted, so the wait is rare.
+	CompletePack(true);
+	LoadThreadRunning = true;
+	LoadThreadSucceeded = false;
+	LoadThreadDiscarded = false;
+	LoadCancelRequested = false;
+	LoadThreadFlag.test_and_set();
+	LoadThread = std::thread
+	(
+		[this]
+		{
+			LoadThreadSucceeded = LoadData();
+			if (LoadCancelRequested)
+			{
+				ClearData();
+				LoadThreadSucceeded = false;
+				LoadThreadDiscarded = true;
+			}
+			LoadThreadFlag.clear();
+		}
+	);
+
+	return true;
+}
+
+
+void Image::CancelLoad()
+{
+	if (LoadThreadRunning)
+		LoadCancelRequested = true;
+}
+
+
+bool Image::CompleteLoad()
+{
+	if (!LoadThreadRunning)
+		return false;
+
+	// The flag is only clear once the worker is completely done with this object.
+	if (LoadThreadFlag.test_and_set())
+		return false;
+
+	JoinLoadThread();
+	if (LoadThreadSucceeded)
+	{
+		FinalizeLoad();
+		return true;
+	}
+	NotifyCache();
+
+	// If the result was discarded but the load was re-requested after the worker checked, we need to go again.
+	if (LoadThreadDiscarded && !LoadCancelRequested)
+		return !RequestLoad();
+
+	return true;
+}
+
+
+void Image::JoinLoadThread()
+{
+	if (LoadThread.joinable())
+		LoadThread.join();
+
+	LoadThreadRunning = false;
+
+	// The placeholder of a full resolution reload is no longer needed. This is always the main thread.
+	if (TexIDPreview != 0)
+	{
+		glDeleteTextures(1, &TexIDPreview);
+		TexIDPreview = 0;
+	}
+}
+
+
+void Image::ClearData()
+{
+	DDSTexture2D.Clear();
+	DDSCubemap.Clear();
+	Pictures.Clear();
+
+	// Any tile textures were deleted by Unbind. This may be the load worker so OpenGL can't be used here.
+	delete Tiles;
+	Tiles = nullptr;
+
+	GPUResident = false;
+	ClearReadbackTile();
+
+	delete AnimStream;
+	AnimStream = nullptr;
+	for (int s = 0; s < AnimRingSize; s++)
+	{
+		AnimRing[s] = nullptr;
+		AnimRingFrames[s] = -1;
+	}
+}
+
+
+bool Image::LoadData()
+{
 	Info.SrcPixelFormat = tPixelFormat::Invalid;
+	LoadScale = 1;
 	bool success = false;
+	bool decoded = true;
 	try
 	{
-		if (Filetype == tSystem::tFileType::DDS)
+		// The edits of a spilled image are the image. Nothing else may be loaded in its place.
+		if (!SpillFile.IsEmpty())
+		{
+			success = LoadDecodedCache(Pictures, Info.SrcPixelFormat, SpillFile);
+			decoded = false;
+		}
+
+		// An image that was packed when it was evicted comes straight back out of memory.
+		else if (Packed && Packed->Unpack(Pictures))
+		{
+			Info.SrcPixelFormat = Packed->SrcPixelFormat;
+			success = true;
+			decoded = false;
+		}
+		else if (UseDecodedCache() && LoadDecodedCache(Pictures, Info.SrcPixelFormat, GetDecodedCacheFile()))
+		{
+			success = true;
+			decoded = false;
+		}
+		else if (Filetype == tSystem::tFileType::DDS)
 		{
 			success = DDSCubemap.Load(Filename);
 			if (success)
@@ -152,6 +390,14 @@ bool Image::Load()
 				success = DDSTexture2D.Load(Filename);
 				Info.SrcPixelFormat = DDSTexture2D.GetPixelFormat();
 			}
+
+			// Nothing is decoded here. The pictures stay empty until their pixels are needed.
+			if (success)
+				success = CreateDDSPictures();
+		}
+		else if ((Filetype == tSystem::tFileType::GIF) && LoadStreamedGIF())
+		{
+			success = true;
 		}
 		else if (Filetype == tSystem::tFileType::GIF)
 		{
@@ -175,8 +421,15 @@ bool Image::Load()
 			Info.SrcPixelFormat = gif.SrcPixelFormat;
 			success = true;
 		}
+		else if ((Filetype == tSystem::tFileType::WEBP) && LoadMappedPicture())
+		{
+			success = true;
+		}
 		else if (Filetype == tSystem::tFileType::WEBP)
 		{
+			if (!AnimFramesFit())
+				return false;
+
 			tImageWEBP webp;
 			bool ok = webp.Load(Filename.Chars());
 			if (!ok)
@@ -199,6 +452,9 @@ bool Image::Load()
 		}
 		else if (Filetype == tSystem::tFileType::APNG)
 		{
+			if (!AnimFramesFit())
+				return false;
+
 			tImageAPNG apng;
 			bool ok = apng.Load(Filename.Chars());
 			if (!ok)
@@ -241,6 +497,14 @@ bool Image::Load()
 			}
 			success = true;
 		}
+		else if ((Filetype == tSystem::tFileType::JPG) && LoadReducedJPG())
+		{
+			success = true;
+		}
+		else if ((Filetype == tSystem::tFileType::JPG) && LoadMappedPicture())
+		{
+			success = true;
+		}
 		else if (Filetype == tSystem::tFileType::JPG)
 		{
 			tImageJPG jpg;
@@ -273,6 +537,10 @@ bool Image::Load()
 			Pictures.Append(picture);
 			success = true;
 		}
+		else if ((Filetype == tSystem::tFileType::PNG) && LoadMappedPicture())
+		{
+			success = true;
+		}
 		else if (Filetype == tSystem::tFileType::PNG)
 		{
 			tImagePNG png;
@@ -290,9 +558,18 @@ bool Image::Load()
 			success = true;
 		}
 
-		// @todo Lets also handle EXR directly here. This is more efficient than using tPicture method below
-		// where the same file is loaded multiple times in order to extract each frame.
-		else
+		// Exr and tiff files may store multiple images in one file. If the header tells us how many parts there are we
+		// can decode them all in parallel rather than one after the other with a failing probe at the end.
+		else if ((Filetype == tSystem::tFileType::EXR) || (Filetype == tSystem::tFileType::TIFF))
+		{
+			int numParts = GetNumFileParts(Filename, Filetype);
+			if ((numParts == 1) && (Filetype == tSystem::tFileType::TIFF) && LoadMappedPicture())
+				success = true;
+			else if (numParts > 0)
+				success = LoadPartsParallel(numParts);
+		}
+
+		if (!success && (Pictures.Count() == 0) && !DDSTexture2D.IsValid() && !DDSCubemap.IsValid())
 		{
 			// Some image files (like tiff and exr files) may store multiple images in one file. These are called 'parts'.
 			int partNum = 0;
@@ -306,7 +583,11 @@ bool Image::Load()
 					Pictures.Append(picture);
 					partNum++;
 				}
-			} while (ok);
+				else
+				{
+					delete picture;
+				}
+			} while (ok && !LoadCancelRequested);
 
 			if (Pictures.NumItems() > 0)
 			{
@@ -320,167 +601,814 @@ bool Image::Load()
 		success = false;
 	}
 
-	if (!success)
-		return false;
+	// Writing the decoded cache file can take seconds so it is left until the image is evicted.
+	DecodedCachePending = success && decoded && DecodedCacheWrite && UseDecodedCache() && (LoadScale == 1);
 
-	if (Filetype == tSystem::tFileType::DDS)
-	{
-		if (DDSCubemap.IsValid())
-			ConvertCubemapToPicture();
-		else if (DDSTexture2D.IsValid())
-			ConvertTexture2DToPicture();
-	}
+	// Building the reduced levels is a big chunk of work so it is best done here on the worker.
+	if (success && !LoadCancelRequested)
+		CreateTiles();
 
-	LoadedTime = tSystem::tGetTime();
+	return success;
+}
 
-	// Fill in rest of info struct.
-	Info.Opaque				= IsOpaque();
-	Info.FileSizeBytes		= tSystem::tGetFileSize(Filename);
-	Info.MemSizeBytes		= GetMemSizeBytes();
 
-	// Create alt image if possible.
-	if (DDSCubemap.IsValid())
-		CreateAltPictureFromDDS_Cubemap();
+void Image::CreateTiles()
+{
+	delete Tiles;
+	Tiles = nullptr;
 
-	else if (DDSTexture2D.IsValid() && (DDSTexture2D.GetNumMipmaps() > 1))
-		CreateAltPictureFromDDS_2DMipmaps();
+	// Only single pictures are tiled. Dds files are already limited to texture sizes and animation frames are never
+	// this big.
+	if (!TilesAllowed || (Pictures.Count() != 1) || AnimStream || DDSTexture2D.IsValid() || DDSCubemap.IsValid())
+		return;
 
-	ClearDirty();
-	return true;
+	tPicture* picture = Pictures.First();
+	if (!picture->IsValid() || !TilePyramid::IsNeeded(picture->GetWidth(), picture->GetHeight(), MaxTextureSize))
+		return;
+
+	int overviewSize = tMin(MaxTextureSize, TilePyramid::OverviewSize);
+	Tiles = new TilePyramid(picture->GetPixelPointer(), picture->GetWidth(), picture->GetHeight(), overviewSize);
+
+	// The pyramid pages its own tiles. Half the budget leaves the other textures room. Only the image being drawn keeps
+	// its tiles so this is never in use more than once.
+	Tiles->SetVRAMBudget(int64(Config.MaxVRAMMB) * 1024 * 1024 / 2);
 }
 
 
-int Image::GetMemSizeBytes() const
+void Image::ReleaseTiles()
 {
-	int numBytes = 0;
-	for (tPicture* pic = Pictures.First(); pic; pic = pic->Next())
-		numBytes += pic->GetNumPixels() * sizeof(tPixel);
+	if (!Tiles)
+		return;
 
-	numBytes += AltPicture.IsValid() ? AltPicture.GetNumPixels()*sizeof(tPixel) : 0;
-	return numBytes;
+	Tiles->Unbind();
+	if (TilesBoundImage == this)
+		TilesBoundImage = nullptr;
+	delete Tiles;
+	Tiles = nullptr;
 }
 
 
-void Image::CreateAltPictureFromDDS_2DMipmaps()
+bool Image::LoadPartsParallel(int numParts)
 {
-	int width = 0;
-	for (tPicture* layer = Pictures.First(); layer; layer = layer->Next())
-		width += layer->GetWidth();
-	int height = GetHeight();
-
-	AltPicture.Set(width, height, tPixel::transparent);
-	int originY = 0;
-	int originX = 0;
-	for (tPicture* layer = Pictures.First(); layer; layer = layer->Next())
+	tAssert(numParts > 0);
+	tPicture** parts = new tPicture*[numParts];
+	for (int p = 0; p < numParts; p++)
+		parts[p] = nullptr;
+
+	// Workers pull part numbers from a shared counter so each part is decoded exactly once. The calling thread is one
+	// of the workers. Tacent's exr and tiff loaders only take a filename, so each part opens the file itself and reads
+	// the header again before decoding its own part. The loaders keep all their state per call and only read the file,
+	// so running several on the same file at once is safe.
+	std::atomic<int> nextPart(0);
+	auto decodeParts = [this, parts, numParts, &nextPart]()
 	{
-		for (int y = 0; y < layer->GetHeight(); y++)
+		for (int p = nextPart++; (p < numParts) && !LoadCancelRequested; p = nextPart++)
 		{
-			for (int x = 0; x < layer->GetWidth(); x++)
-			{
-				tPixel pixel = layer->GetPixel(x, y);
-				AltPicture.SetPixel(originX + x, y, pixel);
-			}
+			tPicture* picture = new tPicture();
+			if (picture->Load(Filename, p, LoadParams))
+				parts[p] = picture;
+			else
+				delete picture;
 		}
-		originX += layer->GetWidth();
+	};
+
+	int numHelpers = ReservePartHelpers(numParts - 1);
+	std::thread* helpers = numHelpers ? new std::thread[numHelpers] : nullptr;
+	for (int h = 0; h < numHelpers; h++)
+		helpers[h] = std::thread(decodeParts);
+	decodeParts();
+	for (int h = 0; h < numHelpers; h++)
+		helpers[h].join();
+	delete[] helpers;
+	ReleasePartHelpers(numHelpers);
+
+	// Part numbers must stay contiguous so we stop at the first one that failed.
+	bool contiguous = true;
+	for (int p = 0; p < numParts; p++)
+	{
+		if (parts[p] && contiguous)
+			Pictures.Append(parts[p]);
+		else
+			delete parts[p];
+
+		contiguous = contiguous && parts[p];
 	}
+	delete[] parts;
+
+	if (Pictures.Count() == 0)
+		return false;
+
+	Info.SrcPixelFormat = Pictures.First()->SrcPixelFormat;
+	return true;
 }
 
 
-void Image::CreateAltPictureFromDDS_Cubemap()
+bool Image::LoadReducedJPG()
 {
-	int width = Pictures.First()->GetWidth();
-	int height = Pictures.First()->GetHeight();
-
-	AltPicture.Set(width*4, height*3, tPixel::transparent);
-	int originX, originY;
-	
-	// PosZ
-	tPicture* pic = Pictures.First();
-	originX = width; originY = height;
-	for (int y = 0; y < pic->GetHeight(); y++)
-		for (int x = 0; x < pic->GetWidth(); x++)
-			AltPicture.SetPixel(originX + x, originY + y, pic->GetPixel(x, y));
+	if ((ReducedLoadWidth <= 0) || (ReducedLoadHeight <= 0))
+		return false;
 
-	// NegZ
-	pic = pic->Next();
-	originX = 3*width; originY = height;
-	for (int y = 0; y < pic->GetHeight(); y++)
-		for (int x = 0; x < pic->GetWidth(); x++)
-			AltPicture.SetPixel(originX + x, originY + y, pic->GetPixel(x, y));
+	// If libjpeg-turbo can't be used directly we return false and the regular full size load happens.
+	int width = 0, height = 0, scale = 1;
+	tPixel* pixels = LoadScaledJPG(Filename, ReducedLoadWidth, ReducedLoadHeight, width, height, scale, Viewer::Config.StrictLoading);
+	if (!pixels)
+		return false;
 
-	// PosX
-	pic = pic->Next();
-	originX = 2*width; originY = height;
-	for (int y = 0; y < pic->GetHeight(); y++)
-		for (int x = 0; x < pic->GetWidth(); x++)
-			AltPicture.SetPixel(originX + x, originY + y, pic->GetPixel(x, y));
+	LoadScale = scale;
+	Info.SrcPixelFormat = tPixelFormat::R8G8B8;
+	Pictures.Append(new tPicture(width, height, pixels, false));
+	return true;
+}
 
-	// NegX
-	pic = pic->Next();
-	originX = 0; originY = height;
-	for (int y = 0; y < pic->GetHeight(); y++)
-		for (int x = 0; x < pic->GetWidth(); x++)
-			AltPicture.SetPixel(originX + x, originY + y, pic->GetPixel(x, y));
 
-	// PosY
-	pic = pic->Next();
-	originX = width; originY = 2*height;
-	for (int y = 0; y < pic->GetHeight(); y++)
-		for (int x = 0; x < pic->GetWidth(); x++)
-			AltPicture.SetPixel(originX + x, originY + y, pic->GetPixel(x, y));
+bool Image::LoadMappedPicture()
+{
+	// Tacent's loaders read the whole file into memory before decoding. Decoding from the mapping skips that copy. If
+	// the file can't be done this way, or the library can't be used directly, we return false and Tacent's loader is
+	// used.
+	int width = 0, height = 0;
+	tPixelFormat srcFormat = tPixelFormat::R8G8B8;
+	tPixel* pixels = nullptr;
+	switch (Filetype)
+	{
+		case tSystem::tFileType::JPG:	pixels = LoadJPG(Filename, width, height, Viewer::Config.StrictLoading);	break;
+		case tSystem::tFileType::PNG:	pixels = LoadMappedPNG(Filename, width, height, srcFormat);				break;
+		case tSystem::tFileType::WEBP:	pixels = LoadMappedWEBP(Filename, width, height, srcFormat);				break;
+		case tSystem::tFileType::TIFF:	pixels = LoadMappedTIFF(Filename, width, height, srcFormat);				break;
+		default:																									break;
+	}
+	if (!pixels)
+		return false;
 
-	// NegY
-	pic = pic->Next();
-	originX = width; originY = 0;
-	for (int y = 0; y < pic->GetHeight(); y++)
-		for (int x = 0; x < pic->GetWidth(); x++)
-			AltPicture.SetPixel(originX + x, originY + y, pic->GetPixel(x, y));
+	Info.SrcPixelFormat = srcFormat;
+	Pictures.Append(new tPicture(width, height, pixels, false));
+	return true;
 }
 
 
-bool Image::Unload(bool force)
+bool Image::RequestFullResolution()
 {
-	if (!IsLoaded())
-		return true;
-
-	// Not allowed to unload if dirty (modified).
-	if (Dirty && !force)
+	if (LoadThreadRunning || !IsLoaded() || (LoadScale == 1) || Dirty)
 		return false;
 
+	// Jpgs only have the one picture. Its texture becomes the placeholder so the image doesn't drop back to the
+	// thumbnail while the full one decodes. Bind deletes it once the worker is done.
+	tPicture* picture = Pictures.First();
+	if (TexIDPreview != 0)
+		glDeleteTextures(1, &TexIDPreview);
+	TexturesCache.Remove(this, &picture->TextureID);
+	TexIDPreview = picture->TextureID;
+	PreviewWidth = GetWidth();
+	PreviewHeight = GetHeight();
+	picture->TextureID = 0;
+
+	GPUResident = false;
 	Unbind();
-	DDSTexture2D.Clear();
-	DDSCubemap.Clear();
-	AltPicture.Clear();
-	AltPictureEnabled = false;
-	Pictures.Clear();
-	Info.MemSizeBytes = 0;
-
-	LoadedTime = -1.0f;
-	return true;
+	ClearData();
+	ReducedLoadWidth = ReducedLoadHeight = 0;
+	return RequestLoad();
 }
 
 
-void Image::Unbind()
+bool Image::RequireFullResolution(bool allParts)
 {
-	for (tPicture* pic = Pictures.First(); pic; pic = pic->Next())
-	{
-		if (pic->TextureID != 0)
-		{
-			glDeleteTextures(1, &pic->TextureID);
-			pic->TextureID = 0;
-		}
-	}
+	// Waits for any worker. A full resolution reload that was already going is all we need.
+	if (LoadThreadRunning)
+		Load();
 
-	if (TexIDAlt != 0)
+	if (IsLoaded() && (LoadScale > 1) && !Dirty)
 	{
-		glDeleteTextures(1, &TexIDAlt);
-		TexIDAlt = 0;
+		// The pixels are about to be reloaded so there is no point reading back a released picture.
+		GPUResident = false;
+		Unbind();
+		ClearData();
+		ReducedLoadWidth = ReducedLoadHeight = 0;
+		Load();
 	}
+
+	return RequirePictures(allParts);
+}
+
+
+bool Image::LoadStreamedGIF()
+{
+	GIFStream* stream = new GIFStream();
+	if (!stream->Load(Filename))
+	{
+		delete stream;
+		return false;
+	}
+
+	AnimStream = stream;
+	Info.SrcPixelFormat = stream->SrcPixelFormat;
+	int numFrames = stream->GetNumFrames();
+	for (int f = 0; f < numFrames; f++)
+	{
+		tPicture* picture = new tPicture();
+		picture->Duration = stream->GetFrameDuration(f);
+		Pictures.Append(picture);
+	}
+
+	for (int s = 0; s < AnimRingSize; s++)
+	{
+		AnimRing[s] = nullptr;
+		AnimRingFrames[s] = -1;
+	}
+
+	// Only animations that would take a big bite out of the image memory budget are streamed. The rest are decoded
+	// up front from the index we already have, which is simpler and plays back for free.
+	int64 frameBytes = int64(stream->GetWidth()) * int64(stream->GetHeight()) * int64(sizeof(tPixel));
+	int64 budgetBytes = GetImageMemBudget();
+	bool streamed = (numFrames > AnimRingSize) && (frameBytes*numFrames > budgetBytes/4);
+	if (streamed ? !StreamFrame(0) : !DecodeAllFrames())
+	{
+		ClearData();
+		return false;
+	}
+
+	return true;
+}
+
+
+bool Image::DecodeAllFrames()
+{
+	if (!AnimStream)
+		return true;
+
+	int width = AnimStream->GetWidth();
+	int height = AnimStream->GetHeight();
+	int numFrames = AnimStream->GetNumFrames();
+	int64 numPixels = int64(width) * int64(height);
+	if (numPixels*int64(sizeof(tPixel))*numFrames > GetImageMemBudget())
+		return false;
+
+	// In order each frame only costs drawing itself over the one before. Frames already in the ring are kept.
+	int frame = 0;
+	for (tPicture* picture = Pictures.First(); picture; picture = picture->Next(), frame++)
+	{
+		if (picture->IsValid())
+			continue;
+
+		tPixel* pixels = new tPixel[numPixels];
+		if (!AnimStream->DecodeFrame(frame, pixels))
+		{
+			delete[] pixels;
+			return false;
+		}
+		picture->Set(width, height, pixels, false);
+	}
+
+	delete AnimStream;
+	AnimStream = nullptr;
+	for (int s = 0; s < AnimRingSize; s++)
+	{
+		AnimRing[s] = nullptr;
+		AnimRingFrames[s] = -1;
+	}
+	return true;
+}
+
+
+bool Image::AnimFramesFit() const
+{
+	// Tacent decodes every frame of a webp or apng up front. There is no streaming decoder for them so one that
+	// wouldn't fit is refused before any are decoded. If the header can't be read Tacent's loader decides.
+	int width = 0, height = 0, numFrames = 0;
+	if (!GetAnimFrameInfo(Filename, Filetype, width, height, numFrames))
+		return true;
+
+	int64 frameBytes = int64(width) * int64(height) * int64(sizeof(tPixel));
+	if (frameBytes*int64(numFrames) <= GetImageMemBudget())
+		return true;
+
+	tPrintf("Warning: Can't load %s. Its %d frames don't fit in the image memory limit.\n", tSystem::tGetFileName(Filename).Chars(), numFrames);
+	return false;
+}
+
+
+bool Image::RequireAllFrames()
+{
+	if (DecodeAllFrames())
+		return true;
+
+	tPrintf("Warning: Can't edit %s. Its frames don't fit in the image memory limit.\n", tSystem::tGetFileName(Filename).Chars());
+	return false;
+}
+
+
+tPicture* Image::GetPart(int partNum) const
+{
+	tPicture* picture = Pictures.First();
+	for (int p = 0; (p < partNum) && picture; p++)
+		picture = picture->Next();
+
+	return picture;
+}
+
+
+bool Image::StreamFrame(int frame)
+{
+	tPicture* picture = GetPart(frame);
+	if (!picture)
+		return false;
+
+	if (picture->IsValid())
+		return true;
+
+	// Use an empty slot if there is one, otherwise the one furthest behind the play position.
+	int numFrames = AnimStream->GetNumFrames();
+	int slot = -1;
+	int maxDist = -1;
+	for (int s = 0; s < AnimRingSize; s++)
+	{
+		if (!AnimRing[s])
+		{
+			slot = s;
+			break;
+		}
+
+		int ahead = PartPlayRev ? (PartNum - AnimRingFrames[s]) : (AnimRingFrames[s] - PartNum);
+		int dist = ((ahead % numFrames) + numFrames) % numFrames;
+		if (dist > maxDist)
+		{
+			maxDist = dist;
+			slot = s;
+		}
+	}
+
+	// The recycled picture becomes an empty placeholder again and we reuse its pixel memory.
+	int width = AnimStream->GetWidth();
+	int height = AnimStream->GetHeight();
+	tPicture* recycled = AnimRing[slot];
+	tPixel* pixels = nullptr;
+	if (recycled)
+	{
+		DeleteTexture(recycled->TextureID);
+		pixels = recycled->StealPixels();
+	}
+	else
+	{
+		pixels = new tPixel[width*height];
+	}
+
+	AnimRing[slot] = nullptr;
+	AnimRingFrames[slot] = -1;
+	if (!AnimStream->DecodeFrame(frame, pixels))
+	{
+		delete[] pixels;
+		return false;
+	}
+
+	picture->Set(width, height, pixels, false);
+	AnimRing[slot] = picture;
+	AnimRingFrames[slot] = frame;
+	return true;
+}
+
+
+void Image::UpdateAnimStream()
+{
+	if (!AnimStream)
+		return;
+
+	StreamFrame(PartNum);
+
+	// Forwards the stream decodes the next frames sequentially which is cheap. Backwards, every frame would be a seek
+	// from a keyframe, so when the next frame is missing we decode the whole run leading up to it in one go.
+	int numFrames = AnimStream->GetNumFrames();
+	if (!PartPlayRev)
+	{
+		for (int a = 1; a <= AnimLookAhead; a++)
+		{
+			int frame = PartNum + a;
+			if (frame >= numFrames)
+			{
+				if (!PartPlayLooping)
+					break;
+				frame -= numFrames;
+			}
+			StreamFrame(frame);
+		}
+	}
+	else
+	{
+		int next = PartNum - 1;
+		if (next < 0)
+		{
+			if (!PartPlayLooping)
+				return;
+			next += numFrames;
+		}
+
+		tPicture* nextPic = GetPart(next);
+		if (nextPic && !nextPic->IsValid())
+		{
+			for (int frame = tClampMin(next - (AnimRingSize-2), 0); frame <= next; frame++)
+				StreamFrame(frame);
+		}
+	}
+}
+
+
+bool Image::FinalizeLoad()
+{
+	LoadedTime = tSystem::tGetTime();
+
+	// Fill in rest of info struct.
+	Info.Opaque				= IsOpaque();
+	Info.FileSizeBytes		= tSystem::tGetFileSize(Filename);
+	Info.MemSizeBytes		= GetMemSizeBytes();
+
+	// A spilled image comes back with its edits so it is still dirty.
+	Dirty = !SpillFile.IsEmpty();
+	DropSpill();
+
+	// Once loaded the packed copy is stale as soon as the image is edited. It is made again on the next eviction.
+	DropPacked();
+	NotifyCache();
+	return true;
+}
+
+
+int64 Image::GetMemSizeBytes() const
+{
+	// For streamed animations we count the full ring since it fills up as soon as playback starts.
+	if (AnimStream)
+	{
+		int64 frameBytes = int64(AnimStream->GetWidth()) * int64(AnimStream->GetHeight()) * int64(sizeof(tPixel));
+		return AnimRingSize*frameBytes + AnimStream->GetMemSizeBytes();
+	}
+
+	int64 numBytes = 0;
+	if (DDSCubemap.IsValid())
+	{
+		for (int s = 0; s < int(tCubemap::tSide::NumSides); s++)
+		{
+			tTexture* sideTex = DDSCubemap.GetSide(tCubemap::tSide(s));
+			for (const tLayer* layer = sideTex ? sideTex->GetLayers().First() : nullptr; layer; layer = layer->Next())
+				numBytes += layer->GetDataSize();
+		}
+	}
+	else if (DDSTexture2D.IsValid())
+	{
+		for (const tLayer* layer = DDSTexture2D.GetLayers().First(); layer; layer = layer->Next())
+			numBytes += layer->GetDataSize();
+	}
+
+	// Dds pictures only count once they have been decoded.
+	for (tPicture* pic = Pictures.First(); pic; pic = pic->Next())
+		numBytes += int64(pic->GetNumPixels()) * int64(sizeof(tPixel));
+
+	numBytes += AltPicture.IsValid() ? int64(AltPicture.GetNumPixels()) * int64(sizeof(tPixel)) : 0;
+	numBytes += Tiles ? Tiles->GetMemSizeBytes() : 0;
+	numBytes += GPUResident ? int64(ResidentWidth) * int64(ResidentHeight) * int64(sizeof(tPixel)) : 0;
+	return numBytes;
+}
+
+
+void Image::UpdateMemSize()
+{
+	Info.MemSizeBytes = GetMemSizeBytes();
+	NotifyCache();
+}
+
+
+void Image::NotifyCache()
+{
+	if (Cache)
+		Cache->Update(this);
+}
+
+
+void Image::EnableAltPicture(bool enabled)
+{
+	AltPictureEnabled = enabled;
+	if (!enabled || AltPicture.IsValid())
+		return;
+
+	// The alt views show every part so they all need to be decoded.
+	if (IsAltCubemapPictureAvail() && RequirePictures(true))
+		CreateAltPictureFromDDS_Cubemap();
+
+	else if (IsAltMipmapsPictureAvail() && RequirePictures(true))
+		CreateAltPictureFromDDS_2DMipmaps();
+
+	if (!AltPicture.IsValid())
+		AltPictureEnabled = false;
+	UpdateMemSize();
+}
+
+
+void Image::CreateAltPictureFromDDS_2DMipmaps()
+{
+	int width = 0;
+	for (tPicture* layer = Pictures.First(); layer; layer = layer->Next())
+		width += layer->GetWidth();
+	int height = GetHeight();
+
+	AltPicture.Set(width, height, tPixel::transparent);
+	int originY = 0;
+	int originX = 0;
+	for (tPicture* layer = Pictures.First(); layer; layer = layer->Next())
+	{
+		for (int y = 0; y < layer->GetHeight(); y++)
+		{
+			for (int x = 0; x < layer->GetWidth(); x++)
+			{
+				tPixel pixel = layer->GetPixel(x, y);
+				AltPicture.SetPixel(originX + x, y, pixel);
+			}
+		}
+		originX += layer->GetWidth();
+	}
+}
+
+
+void Image::CreateAltPictureFromDDS_Cubemap()
+{
+	int width = Pictures.First()->GetWidth();
+	int height = Pictures.First()->GetHeight();
+
+	AltPicture.Set(width*4, height*3, tPixel::transparent);
+	int originX, originY;
+	
+	// PosZ
+	tPicture* pic = Pictures.First();
+	originX = width; originY = height;
+	for (int y = 0; y < pic->GetHeight(); y++)
+		for (int x = 0; x < pic->GetWidth(); x++)
+			AltPicture.SetPixel(originX + x, originY + y, pic->GetPixel(x, y));
+
+	// NegZ
+	pic = pic->Next();
+	originX = 3*width; originY = height;
+	for (int y = 0; y < pic->GetHeight(); y++)
+		for (int x = 0; x < pic->GetWidth(); x++)
+			AltPicture.SetPixel(originX + x, originY + y, pic->GetPixel(x, y));
+
+	// PosX
+	pic = pic->Next();
+	originX = 2*width; originY = height;
+	for (int y = 0; y < pic->GetHeight(); y++)
+		for (int x = 0; x < pic->GetWidth(); x++)
+			AltPicture.SetPixel(originX + x, originY + y, pic->GetPixel(x, y));
+
+	// NegX
+	pic = pic->Next();
+	originX = 0; originY = height;
+	for (int y = 0; y < pic->GetHeight(); y++)
+		for (int x = 0; x < pic->GetWidth(); x++)
+			AltPicture.SetPixel(originX + x, originY + y, pic->GetPixel(x, y));
+
+	// PosY
+	pic = pic->Next();
+	originX = width; originY = 2*height;
+	for (int y = 0; y < pic->GetHeight(); y++)
+		for (int x = 0; x < pic->GetWidth(); x++)
+			AltPicture.SetPixel(originX + x, originY + y, pic->GetPixel(x, y));
+
+	// NegY
+	pic = pic->Next();
+	originX = width; originY = 0;
+	for (int y = 0; y < pic->GetHeight(); y++)
+		for (int x = 0; x < pic->GetWidth(); x++)
+			AltPicture.SetPixel(originX + x, originY + y, pic->GetPixel(x, y));
+}
+
+
+bool Image::Unload(bool force)
+{
+	// An image that is still loading is unloaded by cancelling. When forced we wait for the worker.
+	if (LoadThreadRunning)
+	{
+		CancelLoad();
+		if (!force)
+			return true;
+
+		JoinLoadThread();
+		ClearData();
+	}
+	CompletePack(true);
+
+	// Explicit unloads come before reloads, for example after a save or a change to the load parameters, so the packed
+	// copy must not be used again. A spill file holds unsaved edits so it only goes when forced.
+	DropPacked();
+	if (force || !Dirty)
+		DropSpill();
+	if (!IsLoaded())
+		return true;
+
+	// Not allowed to unload if dirty (modified).
+	if (Dirty && !force)
+		return false;
+
+	// Everything is going so a released picture isn't read back first.
+	GPUResident = false;
+	Unbind();
+	AltPicture.Clear();
+	AltPictureEnabled = false;
+	ClearData();
+	Info.MemSizeBytes = 0;
+	NotifyCache();
+
+	LoadedTime = -1.0f;
+	return true;
+}
+
+
+bool Image::UnloadPacked()
+{
+	if (AnimStream || DDSTexture2D.IsValid() || DDSCubemap.IsValid() || (LoadScale != 1))
+		return false;
+
+	return UnloadToWorker(true, tString());
+}
+
+
+bool Image::UnloadWritingCache()
+{
+	if (!DecodedCachePending)
+		return false;
+
+	return UnloadToWorker(false, tString());
+}
+
+
+bool Image::UnloadToWorker(bool pack, const tString& spillFile)
+{
+	// Edits only leave memory by being spilled.
+	bool spill = !spillFile.IsEmpty();
+	if (!IsLoaded() || (Dirty && !spill))
+		return false;
+
+	// Reading a gpu resident picture back would stall the frame, so those are unloaded without a packed copy.
+	if (GPUResident || PackThreadRunning)
+		return false;
+
+	for (tPicture* pic = Pictures.First(); pic; pic = pic->Next())
+		if (!pic->IsValid())
+			return false;
+
+	tString cacheFile;
+	if (DecodedCachePending && !spill)
+		cacheFile = GetDecodedCacheFile();
+	DecodedCachePending = false;
+	int64 maxCacheBytes = int64(Config.MaxDecodedCacheMB) * 1024 * 1024;
+
+	// The same as Unload except the pictures go to the worker rather than being deleted.
+	DropPacked();
+	DropSpill();
+	Unbind();
+	AltPicture.Clear();
+	AltPictureEnabled = false;
+	while (tPicture* pic = Pictures.Remove())
+		PackPictures.Append(pic);
+	tPixelFormat srcFormat = Info.SrcPixelFormat;
+	ClearData();
+	Info.MemSizeBytes = 0;
+	LoadedTime = -1.0f;
+
+	PackSpillFile = spillFile;
+	PackSpilled = false;
+	PackThreadRunning = true;
+	PackThreadFlag.test_and_set();
+	PackThread = std::thread
+	(
+		[this, srcFormat, pack, cacheFile, maxCacheBytes]
+		{
+			if (!PackSpillFile.IsEmpty())
+				PackSpilled = SaveDecodedCache(PackSpillFile, PackPictures, srcFormat, LLONG_MAX);
+
+			if (!cacheFile.IsEmpty())
+				SaveDecodedCache(cacheFile, PackPictures, srcFormat, maxCacheBytes);
+
+			if (pack)
+			{
+				PackResult = new PackedImage(PackPictures);
+				PackResult->SrcPixelFormat = srcFormat;
+			}
+			PackThreadFlag.clear();
+		}
+	);
+
+	NotifyCache();
+	if (Cache)
+		Cache->AddPacking(this);
+	return true;
+}
+
+
+bool Image::CompletePack(bool wait)
+{
+	if (!PackThreadRunning)
+		return true;
+
+	if (!wait && PackThreadFlag.test_and_set())
+		return false;
+
+	PackThread.join();
+	PackThreadRunning = false;
+
+	// A spill that couldn't be written puts the pictures back since they hold the only copy of the edits.
+	if (!PackSpillFile.IsEmpty())
+	{
+		if (PackSpilled)
+		{
+			SpillFile = PackSpillFile;
+		}
+		else
+		{
+			tPrintf("Warning: Could not spill %s. It stays in memory.\n", tSystem::tGetFileName(Filename).Chars());
+			while (tPicture* pic = PackPictures.Remove())
+				Pictures.Append(pic);
+			CreateTiles();
+			UpdateMemSize();
+			LoadedTime = tSystem::tGetTime();
+		}
+		PackSpillFile.Clear();
+	}
+	PackPictures.Clear();
+	if (PackResult && PackResult->IsValid())
+		Packed = PackResult;
+	else
+		delete PackResult;
+	PackResult = nullptr;
+
+	NotifyCache();
+	return true;
+}
+
+
+bool Image::UnloadSpilled()
+{
+	if (!IsLoaded() || !Dirty || AnimStream || SpillDir.IsEmpty())
+		return false;
+
+	if (!ReadbackPixels() || !RequirePictures(true))
+		return false;
+
+	// The names only need to be unique while this instance runs. The start time keeps instances apart.
+	static int spillCount = 0;
+	static uint64 sessionID = tSystem::tGetHardwareTimerCount();
+	tString spillFile;
+	tsPrintf(spillFile, "%s%016|64X_%d.raw", SpillDir.Chars(), sessionID, spillCount++);
+
+	// Writing full size pictures takes a while so the pack worker does it. The dirty flag stays set.
+	return UnloadToWorker(false, spillFile);
+}
+
+
+void Image::DropSpill()
+{
+	if (SpillFile.IsEmpty())
+		return;
+
+	tDeleteFile(SpillFile);
+	SpillFile.Clear();
+}
+
+
+int64 Image::GetPackedSizeBytes() const
+{
+	return Packed ? Packed->GetNumBytes() : 0;
+}
+
+
+void Image::DropPacked()
+{
+	if (!Packed)
+		return;
+
+	delete Packed;
+	Packed = nullptr;
+	NotifyCache();
+}
+
+
+void Image::Unbind()
+{
+	// Deleting the texture of a released picture would lose the pixels. If they can't be read back the texture is the
+	// only copy so everything stays bound.
+	if (!ReadbackPixels())
+		return;
+
+	for (tPicture* pic = Pictures.First(); pic; pic = pic->Next())
+		DeleteTexture(pic->TextureID);
+
+	DeleteTexture(TexIDAlt);
+
+	if (Tiles)
+		Tiles->Unbind();
+	if (TilesBoundImage == this)
+		TilesBoundImage = nullptr;
 }
 
 
 bool Image::IsOpaque() const
 {
+	if (LoadThreadRunning)
+		return true;
+
 	if (DDSCubemap.IsValid())
 		return DDSCubemap.AllSidesOpaque();
 
@@ -491,32 +1419,68 @@ bool Image::IsOpaque() const
 	if (picture && picture->IsValid())
 		return picture->IsOpaque();
 
+	// Worked out when the image loaded, before the pixels were released.
+	if (GPUResident)
+		return Info.Opaque;
+
 	return true;
 }
 
 
 int Image::GetWidth() const
 {
+	// While loading we report the size of the placeholder.
+	if (LoadThreadRunning)
+		return TexIDPreview ? PreviewWidth : ThumbWidth;
+
 	if (AltPicture.IsValid() && AltPictureEnabled)
 		return AltPicture.GetWidth();
 
+	// The current frame of a streamed animation may not be decoded yet. They are all the same size.
+	if (AnimStream)
+		return AnimStream->GetWidth();
+
 	tPicture* picture = GetCurrentPic();
 	if (picture && picture->IsValid())
 		return picture->GetWidth();
 
+	if (GPUResident)
+		return ResidentWidth;
+
+	// Dds pictures may not be decoded yet.
+	const tLayer* layer = GetDDSLayer(PartNum);
+	if (layer)
+		return layer->Width;
+
 	return 0;
 }
 
 
 int Image::GetHeight() const
 {
+	// While loading we report the size of the placeholder.
+	if (LoadThreadRunning)
+		return TexIDPreview ? PreviewHeight : ThumbHeight;
+
 	if (AltPicture.IsValid() && AltPictureEnabled)
 		return AltPicture.GetHeight();
 
+	// The current frame of a streamed animation may not be decoded yet. They are all the same size.
+	if (AnimStream)
+		return AnimStream->GetHeight();
+
 	tPicture* picture = GetCurrentPic();
 	if (picture && picture->IsValid())
 		return picture->GetHeight();
 
+	if (GPUResident)
+		return ResidentHeight;
+
+	// Dds pictures may not be decoded yet.
+	const tLayer* layer = GetDDSLayer(PartNum);
+	if (layer)
+		return layer->Height;
+
 	return 0;
 }
 
@@ -530,36 +1494,76 @@ tColouri Image::GetPixel(int x, int y) const
 	if (picture && picture->IsValid())
 		return picture->GetPixel(x, y);
 
-	// Generally the PictureImage should always be valid. When dds files (tTextures) are loaded, they get
-	// uncompressed into valid PictureImage files so the pixel info can be read.
+	if (GPUResident)
+		return GetResidentPixel(x, y);
+
+	// Undecoded dds parts are read straight from the layer. Only the block under the pixel gets decoded.
+	const tLayer* layer = GetDDSLayer(PartNum);
+	tPixel pixel;
+	if (layer && DecodePixelToRGBA(pixel, *layer, x, y))
+		return pixel;
+
 	return tColouri::black;
 }
 
 
 void Image::Rotate90(bool antiClockWise)
 {
+	// Streamed animations decode frames from the file on demand so edits would not stick. They have to be
+	// decoded in full first.
+	if (LoadThreadRunning || !ReadbackPixels() || !RequireAllFrames())
+		return;
+
+	RequireFullResolution(true);
+	ReleaseDDSData();
+	ReleaseTiles();
 	for (tPicture* picture = Pictures.First(); picture; picture = picture->Next())
 		picture->Rotate90(antiClockWise);
 
+	CreateTiles();
+	UpdateMemSize();
 	Dirty = true;
+	DecodedCachePending = false;
 }
 
 
 void Image::Flip(bool horizontal)
 {
+	// Streamed animations decode frames from the file on demand so edits would not stick. They have to be
+	// decoded in full first.
+	if (LoadThreadRunning || !ReadbackPixels() || !RequireAllFrames())
+		return;
+
+	RequireFullResolution(true);
+	ReleaseDDSData();
+	ReleaseTiles();
 	for (tPicture* picture = Pictures.First(); picture; picture = picture->Next())
 		picture->Flip(horizontal);
 
+	CreateTiles();
+	UpdateMemSize();
 	Dirty = true;
+	DecodedCachePending = false;
 }
 
 
 void Image::Crop(int newWidth, int newHeight, int originX, int originY)
 {
+	// Streamed animations decode frames from the file on demand so edits would not stick. They have to be
+	// decoded in full first.
+	if (LoadThreadRunning || !ReadbackPixels() || !RequireAllFrames())
+		return;
+
+	RequireFullResolution(true);
+	ReleaseDDSData();
+	ReleaseTiles();
 	for (tPicture* picture = Pictures.First(); picture; picture = picture->Next())
 		picture->Crop(newWidth, newHeight, originX, originY);
 
+	CreateTiles();
+	UpdateMemSize();
 	Dirty = true;
+	DecodedCachePending = false;
 }
 
 
@@ -577,22 +1581,34 @@ void Image::PrintInfo()
 	{
 		tPicture* picture = Pictures.First();
 		if (picture)
-			format = picture->IsOpaque() ? tPixelFormat::R8G8B8 : tPixelFormat::R8G8B8A8;
+			format = IsOpaque() ? tPixelFormat::R8G8B8 : tPixelFormat::R8G8B8A8;
 	}
 }
 
 
 uint64 Image::Bind()
 {
+	// Until the load worker is done we show the thumbnail. It may be 0 if there isn't one. A full resolution reload
+	// keeps showing the reduced picture instead.
+	CompleteLoad();
+	if (LoadThreadRunning && TexIDPreview)
+	{
+		glBindTexture(GL_TEXTURE_2D, TexIDPreview);
+		return TexIDPreview;
+	}
+	if (LoadThreadRunning)
+		return BindThumbnail();
+
 	if (AltPictureEnabled && AltPicture.IsValid())
 	{
 		if (TexIDAlt != 0)
 		{
+			TouchTexture(TexIDAlt);
 			glBindTexture(GL_TEXTURE_2D, TexIDAlt);
 			return TexIDAlt;
 		}
 
-		glGenTextures(1, &TexIDAlt);
+		CreateTexture(TexIDAlt, int64(AltPicture.GetNumPixels()) * int64(sizeof(tPixel)));
 		if (TexIDAlt == 0)
 			return 0;
 
@@ -606,40 +1622,218 @@ uint64 Image::Bind()
 			)
 		);
 
-		BindLayers(layers, TexIDAlt);
-		return TexIDAlt;
-	}
+		BindLayers(layers, TexIDAlt);
+		return TexIDAlt;
+	}
+
+	if (AnimStream)
+		StreamFrame(PartNum);
+
+	tPicture* currPic = GetCurrentPic();
+	if (currPic && (currPic->TextureID != 0))
+	{
+		TouchTexture(currPic->TextureID);
+		glBindTexture(GL_TEXTURE_2D, currPic->TextureID);
+		return currPic->TextureID;
+	}
+
+	if (!IsLoaded())
+		return 0;
+
+	// The texture of a tiled picture holds its overview. The tiles themselves are bound by DrawTiled.
+	if (Tiles && currPic)
+	{
+		CreateTexture(currPic->TextureID, Tiles->GetOverviewBytes());
+		Tiles->BindOverview(currPic->TextureID);
+		return currPic->TextureID;
+	}
+
+	// Dds parts go to VRAM in their own format, compressed or not. Only if the GPU can't take the format do we need
+	// the RGBA pixels.
+	const tLayer* ddsLayer = GetDDSLayer(PartNum);
+	if (currPic && ddsLayer && IsFormatSupportedByGPU(ddsLayer->PixelFormat))
+	{
+		CreateTexture(currPic->TextureID, ddsLayer->GetDataSize());
+		BindLayer(*ddsLayer, currPic->TextureID);
+		return currPic->TextureID;
+	}
+	else if (ddsLayer)
+	{
+		RequirePictures();
+	}
+
+	// Only the part being shown is uploaded. The other parts of an animation go up as playback reaches them, and the
+	// texture cache frees the ones that haven't been shown for a while.
+	currPic = GetCurrentPic();
+	if (currPic && currPic->IsValid())
+	{
+		CreateTexture(currPic->TextureID, int64(currPic->GetNumPixels()) * int64(sizeof(tPixel)));
+
+		tList<tLayer> layers;
+		layers.Append
+		(
+			new tLayer
+			(
+				tPixelFormat::R8G8B8A8, currPic->GetWidth(), currPic->GetHeight(),
+				(uint8*)currPic->GetPixelPointer()
+			)
+		);
+
+		BindLayers(layers, currPic->TextureID);
+		ReleasePixels();
+	}
+
+	currPic = GetCurrentPic();
+	return currPic ? currPic->TextureID : 0;
+}
+
+
+void Image::DrawTiled(float originX, float originY, float scale, float clipL, float clipR, float clipB, float clipT)
+{
+	uint overviewTexID = uint(Bind());
+	if (!Tiles)
+		return;
+
+	// Tiles aren't in the texture cache so the ones of an image that is no longer shown would never be freed.
+	if (TilesBoundImage && (TilesBoundImage != this) && TilesBoundImage->Tiles)
+		TilesBoundImage->Tiles->Unbind();
+	TilesBoundImage = this;
+
+	Tiles->Draw(originX, originY, scale, clipL, clipR, clipB, clipT, overviewTexID);
+}
+
+
+int64 Image::GetTileVRAMBytes()
+{
+	return (TilesBoundImage && TilesBoundImage->Tiles) ? TilesBoundImage->Tiles->GetVRAMBytes() : 0;
+}
+
+
+void Image::ReleasePixels()
+{
+	// Animation frames and tiles are uploaded again later from the pixels so only plain single pictures qualify. Edited
+	// pixels are kept in memory since a failed readback would lose them.
+	if (!Config.GPUResident || GPUResident || Dirty || !IsTextureReadbackSupported())
+		return;
+
+	if ((Pictures.Count() != 1) || Tiles || AnimStream || DDSTexture2D.IsValid() || DDSCubemap.IsValid() || AltPictureEnabled)
+		return;
+
+	tPicture* picture = Pictures.First();
+	if (!picture->IsValid() || (picture->TextureID == 0))
+		return;
+
+	ResidentWidth = picture->GetWidth();
+	ResidentHeight = picture->GetHeight();
+	uint texID = picture->TextureID;
+	picture->Clear();
+	picture->TextureID = texID;
+	TexturesCache.SetPinned(this, &picture->TextureID, true);
+
+	GPUResident = true;
+	UpdateMemSize();
+}
+
+
+bool Image::ReadbackPixels()
+{
+	if (!GPUResident)
+		return true;
+
+	tPicture* picture = Pictures.First();
+	if (!picture || (picture->TextureID == 0))
+		return false;
+
+	tPixel* pixels = new tPixel[int64(ResidentWidth) * int64(ResidentHeight)];
+	if (!ReadTexture(pixels, picture->TextureID))
+	{
+		tPrintf("Warning: Could not read back the pixels of %s\n", Filename.Chars());
+		delete[] pixels;
+		return false;
+	}
+
+	uint texID = picture->TextureID;
+	picture->Set(ResidentWidth, ResidentHeight, pixels, false);
+	picture->TextureID = texID;
+	TexturesCache.SetPinned(this, &picture->TextureID, false);
+
+	GPUResident = false;
+	ClearReadbackTile();
+	UpdateMemSize();
+	return true;
+}
+
 
-	tPicture* currPic = GetCurrentPic();
-	if (currPic && (currPic->TextureID != 0))
+tColouri Image::GetResidentPixel(int x, int y) const
+{
+	tPicture* picture = Pictures.First();
+	if (!picture || (picture->TextureID == 0) || (x < 0) || (y < 0) || (x >= ResidentWidth) || (y >= ResidentHeight))
+		return tColouri::black;
+
+	// The reticle usually stays in the same area so reading a tile at a time saves stalling on every frame.
+	int tileX = x - (x % ReadbackTileSize);
+	int tileY = y - (y % ReadbackTileSize);
+	if (!ReadbackTile || (tileX != ReadbackX) || (tileY != ReadbackY))
 	{
-		glBindTexture(GL_TEXTURE_2D, currPic->TextureID);
-		return currPic->TextureID;
+		if (!ReadbackTile)
+			ReadbackTile = new tPixel[ReadbackTileSize*ReadbackTileSize];
+
+		int tileW = tMin(ReadbackTileSize, ResidentWidth - tileX);
+		int tileH = tMin(ReadbackTileSize, ResidentHeight - tileY);
+		if (!ReadTextureRect(ReadbackTile, picture->TextureID, tileX, tileY, tileW, tileH))
+		{
+			ReadbackX = ReadbackY = -1;
+			return tColouri::black;
+		}
+		ReadbackX = tileX;
+		ReadbackY = tileY;
+		ReadbackW = tileW;
 	}
 
-	if (!IsLoaded())
-		return 0;
+	return ReadbackTile[(y - ReadbackY)*ReadbackW + (x - ReadbackX)];
+}
 
-	for (tPicture* picture = Pictures.First(); picture; picture = picture->Next())
-	{
-		if (!picture->IsValid())
-			continue;
 
-		glGenTextures(1, &picture->TextureID);
+void Image::ClearReadbackTile() const
+{
+	delete[] ReadbackTile;
+	ReadbackTile = nullptr;
+	ReadbackX = ReadbackY = -1;
+	ReadbackW = 0;
+}
 
-		tList<tLayer> layers;
-		layers.Append
-		(
-			new tLayer
-			(
-				tPixelFormat::R8G8B8A8, picture->GetWidth(), picture->GetHeight(),
-				(uint8*)picture->GetPixelPointer()
-			)
-		);
 
-		BindLayers(layers, picture->TextureID);
-	}
-	return GetCurrentPic()->TextureID;
+void Image::CreateTexture(uint& texID, int64 numBytes)
+{
+	glGenTextures(1, &texID);
+	if (texID != 0)
+		TexturesCache.Add(this, &texID, numBytes);
+}
+
+
+void Image::DeleteTexture(uint& texID)
+{
+	if (texID == 0)
+		return;
+
+	TexturesCache.Remove(this, &texID);
+	glDeleteTextures(1, &texID);
+	texID = 0;
+}
+
+
+void Image::TouchTexture(uint& texID)
+{
+	TexturesCache.Touch(this, &texID);
+}
+
+
+void Image::BindLayer(const tLayer& layer, uint texID)
+{
+	// The layer data is not copied. Only the layer object itself.
+	tList<tLayer> layers;
+	layers.Append(new tLayer(layer.PixelFormat, layer.Width, layer.Height, layer.Data));
+	BindLayers(layers, texID);
 }
 
 
@@ -752,6 +1946,24 @@ void Image::GetGLFormatInfo(GLint& srcFormat, GLenum& srcType, GLint& dstFormat,
 			compressed = true;
 			break;
 
+		case tPixelFormat::BC4_ATI1:
+			srcFormat = GL_COMPRESSED_RED_RGTC1;
+			dstFormat = GL_COMPRESSED_RED_RGTC1;
+			compressed = true;
+			break;
+
+		case tPixelFormat::BC5_ATI2:
+			srcFormat = GL_COMPRESSED_RG_RGTC2;
+			dstFormat = GL_COMPRESSED_RG_RGTC2;
+			compressed = true;
+			break;
+
+		case tPixelFormat::BC7:
+			srcFormat = GL_COMPRESSED_RGBA_BPTC_UNORM;
+			dstFormat = GL_COMPRESSED_RGBA_BPTC_UNORM;
+			compressed = true;
+			break;
+
 		case tPixelFormat::G3B5A1R5G2:
 			srcFormat = GL_BGRA;								// The type reverses this order to ARGB, just like the PixelFormat. Cuz GL_UNSIGNED_SHORT is to be interpreted as little endian, the type swaps the bytes yielding the proper G3B5A1R5G2.
 			srcType = GL_UNSIGNED_SHORT_1_5_5_5_REV;			// This type is a special case and applies to the entire BGRA group (unlike GL_UNSIGNED_BYTE).
@@ -773,217 +1985,351 @@ void Image::GetGLFormatInfo(GLint& srcFormat, GLenum& srcType, GLint& dstFormat,
 }
 
 
-bool Image::ConvertTexture2DToPicture()
+bool Image::CreateDDSPictures()
 {
-	if (!DDSTexture2D.IsValid() || !(Pictures.Count() <= 0))
+	if (Pictures.Count() > 0)
 		return false;
 
-	int w = DDSTexture2D.GetWidth();
-	int h = DDSTexture2D.GetHeight();
+	// One empty picture per part. They are decoded later by RequirePictures. We check here that they can be so that
+	// features needing the pixels never find out too late.
+	int numParts = 0;
+	if (DDSCubemap.IsValid())
+		numParts = int(tCubemap::tSide::NumSides);
+	else if (DDSTexture2D.IsValid())
+		numParts = DDSTexture2D.GetNumMipmaps();
 
-	// We need to get the data into the GPU so we cat read the uncompressed version back.
-	uint tempTexID = 0;
-	glGenTextures(1, &tempTexID);
-	if (tempTexID == 0)
-		return false;
+	for (int part = 0; part < numParts; part++)
+	{
+		const tLayer* layer = GetDDSLayer(part);
+		if (!layer || !CanDecodeToRGBA(layer->PixelFormat))
+		{
+			Pictures.Clear();
+			return false;
+		}
+		Pictures.Append(new tPicture());
+	}
+
+	return numParts > 0;
+}
+
+
+const tLayer* Image::GetDDSLayer(int partNum) const
+{
+	if (DDSCubemap.IsValid())
+	{
+		if ((partNum < 0) || (partNum >= int(tCubemap::tSide::NumSides)))
+			return nullptr;
 
-	const tList<tLayer>& layers = DDSTexture2D.GetLayers();
-	BindLayers(layers, tempTexID);
+		// Only the top mipmap of each side is displayed.
+		tTexture* sideTex = DDSCubemap.GetSide(CubemapSideOrder[partNum]);
+		return sideTex ? sideTex->GetLayers().First() : nullptr;
+	}
 
-	int numMipmaps = DDSTexture2D.GetNumLayers();
-	for (int level = 0; level < numMipmaps; level++)
+	if (DDSTexture2D.IsValid())
 	{
-		int mipW = w >> level;
-		tiClampMin(mipW, 1);
-		int mipH = h >> level;
-		tiClampMin(mipH, 1);
-		uint8* rgbaData = new uint8[mipW * mipH * 4];
-		glGetTexImage(GL_TEXTURE_2D, level, GL_RGBA, GL_UNSIGNED_BYTE, rgbaData);
-		Pictures.Append(new tPicture(mipW, mipH, (tPixel*)rgbaData, false));
+		const tLayer* layer = DDSTexture2D.GetLayers().First();
+		for (int level = 0; layer && (level < partNum); level++)
+			layer = layer->Next();
+		return (partNum >= 0) ? layer : nullptr;
 	}
 
-	glDeleteTextures(1, &tempTexID);
-	return true;
+	return nullptr;
 }
 
 
-bool Image::ConvertCubemapToPicture()
+bool Image::RequirePictures(bool allParts)
 {
-	if (!DDSCubemap.IsValid() || !(Pictures.Count() <= 0))
+	if (!IsLoaded())
+		return false;
+
+	// Saving, editing and the contact sheet all come through here so this is where a released picture is read back.
+	if (!ReadbackPixels())
 		return false;
 
-	tTexture* tex = DDSCubemap.GetSide(tCubemap::tSide::PosX);
-	int w = tex->GetWidth();
-	int h = tex->GetHeight();
+	if (!DDSTexture2D.IsValid() && !DDSCubemap.IsValid())
+		return true;
 
-	// We want the front (+Z) to be the first image.
-	int sideOrder[int(tCubemap::tSide::NumSides)] =
+	// All the parts that need decoding are done together so the work can be spread over the cores.
+	int numParts = Pictures.Count();
+	const tLayer** layers = new const tLayer*[numParts];
+	tPixel** pixels = new tPixel*[numParts];
+	tPicture** pictures = new tPicture*[numParts];
+	int numToDecode = 0;
+	int part = 0;
+	for (tPicture* pic = Pictures.First(); pic; pic = pic->Next(), part++)
 	{
-		int(tCubemap::tSide::PosZ),
-		int(tCubemap::tSide::NegZ),
-		int(tCubemap::tSide::PosX),
-		int(tCubemap::tSide::NegX),
-		int(tCubemap::tSide::PosY),
-		int(tCubemap::tSide::NegY)
-	};
+		if (pic->IsValid() || (!allParts && (part != PartNum)))
+			continue;
+
+		const tLayer* layer = GetDDSLayer(part);
+		if (!layer)
+			continue;
+
+		layers[numToDecode] = layer;
+		pictures[numToDecode] = pic;
+		pixels[numToDecode] = new tPixel[layer->Width * layer->Height];
+		numToDecode++;
+	}
 
-	for (int s = 0; s < int(tCubemap::tSide::NumSides); s++)
+	bool decoded = DecodeLayersToRGBA(pixels, layers, numToDecode);
+	for (int d = 0; d < numToDecode; d++)
 	{
-		int side = sideOrder[s];
-		uint tempTexID = 0;
-		glGenTextures(1, &tempTexID);
+		if (!decoded)
+		{
+			delete[] pixels[d];
+			continue;
+		}
+
+		// The part may already be in VRAM from its compressed layer. That texture stays.
+		uint texID = pictures[d]->TextureID;
+		pictures[d]->Set(layers[d]->Width, layers[d]->Height, pixels[d], false);
+		pictures[d]->TextureID = texID;
+	}
+
+	delete[] pictures;
+	delete[] pixels;
+	delete[] layers;
+	UpdateMemSize();
+	return decoded;
+}
+
+
+void Image::ReleaseDDSData()
+{
+	if (!DDSTexture2D.IsValid() && !DDSCubemap.IsValid())
+		return;
+
+	// Once edited the pictures are the image and the layers are stale.
+	RequirePictures(true);
+	DDSTexture2D.Clear();
+	DDSCubemap.Clear();
+	UpdateMemSize();
+}
 
-		tTexture* tex = DDSCubemap.GetSide(tCubemap::tSide(side));
-		tList<tLayer> layers;
-		layers.Append(new tLayer(*tex->GetLayers().First()));
-		BindLayers(layers, tempTexID);
 
-		uint8* rgbaData = new uint8[w * h * 4];
-		glGetTexImage(GL_TEXTURE_2D, 0, GL_RGBA, GL_UNSIGNED_BYTE, rgbaData);
-		Pictures.Append(new tPicture(w, h, (tPixel*)rgbaData, false));
+bool Image::IsFormatSupportedByGPU(tPixelFormat format)
+{
+	// Extension queries need a current context so we only look them up on first use.
+	static int rgtcSupported = -1;
+	static int bptcSupported = -1;
+	switch (format)
+	{
+		case tPixelFormat::BC1_DXT1:
+		case tPixelFormat::BC1_DXT1BA:
+		case tPixelFormat::BC2_DXT3:
+		case tPixelFormat::BC3_DXT5:
+			return GLAD_GL_EXT_texture_compression_s3tc ? true : false;
+
+		case tPixelFormat::BC4_ATI1:
+		case tPixelFormat::BC5_ATI2:
+			if (rgtcSupported < 0)
+				rgtcSupported = (HasGLExtension("GL_ARB_texture_compression_rgtc") || HasGLExtension("GL_EXT_texture_compression_rgtc")) ? 1 : 0;
+			return rgtcSupported == 1;
+
+		case tPixelFormat::BC7:
+			if (bptcSupported < 0)
+				bptcSupported = HasGLExtension("GL_ARB_texture_compression_bptc") ? 1 : 0;
+			return bptcSupported == 1;
 
-		layers.Empty();
-		glDeleteTextures(1, &tempTexID);
+		case tPixelFormat::R8G8B8:
+		case tPixelFormat::R8G8B8A8:
+		case tPixelFormat::B8G8R8:
+		case tPixelFormat::B8G8R8A8:
+		case tPixelFormat::G3B5R5G3:
+		case tPixelFormat::G4B4A4R4:
+		case tPixelFormat::G3B5A1R5G2:
+			return true;
 	}
-	return true;
+
+	return false;
 }
 
 
-uint64 Image::BindThumbnail()
+bool Image::UpdateThumbnail()
 {
 	if (!ThumbnailRequested)
-		return 0;
+		return false;
 
-	if (!ThumbnailThreadFlag.test_and_set())
-	{
-		ThumbnailThread.join();
+	if (ThumbnailThreadRunning && !ThumbnailThreadFlag.test_and_set())
 		ThumbnailThreadRunning = false;
-		ThumbnailNumThreadsRunning--;
-	}
 
 	if (ThumbnailThreadRunning)
-		return 0;
+		return false;
 
-	// We only ever access ThumbnailPicture once the worker thread is completed,
-	// If the worker thread failed, ThumbnailPicture will be invalid and we return 0.
+	// We only ever access ThumbnailPicture once the worker is completed,
+	// If the worker failed, ThumbnailPicture will be invalid and we return 0.
 	if (ThumbnailInvalidateRequested)
 	{
+		// The file may have been saved without its modification time changing as far as we know, so nothing cached
+		// under the current key is trusted. An earlier failure may also have been for a file being written at the time.
+		ThumbnailKey key;
+		GetThumbnailKey(key);
+		ThumbCache.Remove(key, ThumbnailKind::Full);
+		ThumbCache.Remove(key, ThumbnailKind::Preview);
+		ThumbCache.Remove(key, ThumbnailKind::Failed);
 		ThumbnailRequested = false;
 		ThumbnailInvalidateRequested = false;
+		ThumbnailFailed = false;
 		ThumbnailPicture.Clear();
-		if (TexIDThumbnail != 0)
-		{
-			glDeleteTextures(1, &TexIDThumbnail);
-			TexIDThumbnail = 0;
-		}
-		return 0;
+		for (int m = 0; m < ThumbNumMips-1; m++)
+			ThumbnailMips[m].Clear();
+		DeleteTexture(TexIDThumbnail);
+		ThumbnailsAtlas.Remove(ThumbnailAtlasCell);
+		ThumbnailAtlasCell = -1;
+		ThumbnailsResidency.Remove(this);
+		return false;
 	}
 
-	if (ThumbnailPicture.IsValid())
-	{
-		if (TexIDThumbnail != 0)
-		{
-			glBindTexture(GL_TEXTURE_2D, TexIDThumbnail);
-			return TexIDThumbnail;
-		}
+	return ThumbnailPicture.IsValid();
+}
 
-		glGenTextures(1, &TexIDThumbnail);
-		if (TexIDThumbnail == 0)
-			return 0;
 
-		tList<tLayer> layers;
-		layers.Append
-		(
-			new tLayer
-			(
-				tPixelFormat::R8G8B8A8, ThumbnailPicture.GetWidth(), ThumbnailPicture.GetHeight(),
-				(uint8*)ThumbnailPicture.GetPixelPointer()
-			)
-		);
+int Image::GetThumbnailLevel(int dispWidth) const
+{
+	int level = 0;
+	while ((level < ThumbNumMips-1) && ThumbnailMips[level].IsValid() && (ThumbnailMips[level].GetWidth() >= dispWidth))
+		level++;
+	return level;
+}
+
 
-		BindLayers(layers, TexIDThumbnail);
+uint64 Image::BindThumbnail(int dispWidth)
+{
+	// An evicted thumbnail keeps drawing with its texture, whatever the level, until the pixels are read back.
+	bool havePicture = UpdateThumbnail();
+	int level = havePicture ? GetThumbnailLevel(dispWidth) : -1;
+	if ((TexIDThumbnail != 0) && ((level < 0) || (level == ThumbnailTexLevel)))
+	{
+		TouchTexture(TexIDThumbnail);
+		glBindTexture(GL_TEXTURE_2D, TexIDThumbnail);
 		return TexIDThumbnail;
 	}
 
-	return 0;
+	if (!havePicture)
+		return 0;
+
+	// The levels differ in size so a new texture is made rather than respecifying the old one. This keeps the
+	// texture cache's byte count right.
+	DeleteTexture(TexIDThumbnail);
+	tPicture& picture = level ? ThumbnailMips[level-1] : ThumbnailPicture;
+	CreateTexture(TexIDThumbnail, int64(picture.GetNumPixels()) * int64(sizeof(tPixel)));
+	if (TexIDThumbnail == 0)
+		return 0;
+	ThumbnailTexLevel = level;
+
+	tList<tLayer> layers;
+	layers.Append
+	(
+		new tLayer
+		(
+			tPixelFormat::R8G8B8A8, picture.GetWidth(), picture.GetHeight(),
+			(uint8*)picture.GetPixelPointer()
+		)
+	);
+
+	BindLayers(layers, TexIDThumbnail);
+	return TexIDThumbnail;
 }
 
 
-void Image::GenerateThumbnailBridge(Image* img)
+uint64 Image::BindThumbnailAtlas(int dispWidth, tVector2& uv0, tVector2& uv1)
 {
-	img->GenerateThumbnail();
+	uv0 = tVector2(0.0f, 1.0f);
+	uv1 = tVector2(1.0f, 0.0f);
+	bool havePicture = UpdateThumbnail();
+	int level = havePicture ? GetThumbnailLevel(dispWidth) : -1;
+	if (!havePicture)
+	{
+		if (ThumbnailAtlasCell >= 0)
+			return ThumbnailsAtlas.Touch(ThumbnailAtlasCell, uv0, uv1);
+		return BindThumbnail(dispWidth);
+	}
+
+	if ((ThumbnailAtlasCell >= 0) && (ThumbnailsAtlas.GetLevel(ThumbnailAtlasCell) != level))
+	{
+		ThumbnailsAtlas.Remove(ThumbnailAtlasCell);
+		ThumbnailAtlasCell = -1;
+	}
+
+	if (ThumbnailAtlasCell < 0)
+		ThumbnailAtlasCell = ThumbnailsAtlas.Add(this, level, level ? ThumbnailMips[level-1] : ThumbnailPicture);
+
+	// The atlas only runs out of room when more thumbnails are on screen than it has cells. The rest get their own.
+	if (ThumbnailAtlasCell < 0)
+		return BindThumbnail(dispWidth);
+
+	// The thumbnail's own texture isn't needed any more.
+	DeleteTexture(TexIDThumbnail);
+	return ThumbnailsAtlas.Touch(ThumbnailAtlasCell, uv0, uv1);
 }
 
 
 void Image::GenerateThumbnail()
 {
 	// This thread (only) is allowed to access ThumbnailPicture. The main thread will leave it alone until GenerateThumbnail is complete.
-	if (ThumbnailPicture.IsValid())
+	if (ThumbnailPicture.IsValid() || ThumbnailFailed)
 		return;
 
 	// Retrieve from cache if possible.
-	tuint256 hash = 0;
-	int thumbVersion = 1;
-	tFileInfo fileInfo;
-	tGetFileInfo(fileInfo, Filename);
-	hash = tHash::tHashData256((uint8*)&thumbVersion, sizeof(thumbVersion));
-	hash = tHash::tHashString256(Filename, hash);
-	hash = tHash::tHashData256((uint8*)&fileInfo.FileSize, sizeof(fileInfo.FileSize), hash);
-	hash = tHash::tHashData256((uint8*)&fileInfo.CreationTime, sizeof(fileInfo.CreationTime), hash);
-	hash = tHash::tHashData256((uint8*)&fileInfo.ModificationTime, sizeof(fileInfo.ModificationTime), hash);
-	hash = tHash::tHashData256((uint8*)&ThumbWidth, sizeof(ThumbWidth), hash);
-	hash = tHash::tHashData256((uint8*)&ThumbHeight, sizeof(ThumbHeight), hash);
-	tString hashFile;
-	tsPrintf(hashFile, "%s%032|256X.bin", ThumbCacheDir.Chars(), hash);
-	if (tFileExists(hashFile))
+	ThumbnailKey key;
+	GetThumbnailKey(key);
+	if (ThumbCache.Read(ThumbnailPicture, key, ThumbnailKind::Full))
 	{
-		tChunkReader chunk(hashFile);
-		ThumbnailPicture.Load(chunk.First());
+		ThumbnailFromPreview = false;
+		MakeThumbnailMips();
 		return;
 	}
 
-	// We need an opengl context if we are processing dds files (for now... opengl is used for decompression). GLFW doesn't support creating
-	// contexts without an associated window. However, contexts with hidden windows can be created with the GLFW_VISIBLE window hint.
-	GLFWwindow* offscreenContext = nullptr;
-	if (Filetype == tFileType::DDS)
+	if (ThumbnailPreviewAllowed && ThumbCache.Read(ThumbnailPicture, key, ThumbnailKind::Preview))
 	{
-		glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
-		offscreenContext = glfwCreateWindow(32, 32, "placeholdertitle", nullptr, nullptr);
-		if (!offscreenContext)
-			return;
+		ThumbnailFromPreview = true;
+		MakeThumbnailMips();
+		return;
+	}
 
-		glfwMakeContextCurrent(offscreenContext);
+	// Most camera jpgs and many tiffs carry a preview that is big enough. Using it saves decoding the image.
+	tPicture preview;
+	int previewW = 0, previewH = 0;
+	tPixel* previewPixels = nullptr;
+	if (ThumbnailPreviewAllowed)
+		previewPixels = LoadEmbeddedPreview(Filename, Filetype, ThumbWidth, ThumbHeight, previewW, previewH);
+
+	// Files that failed before are not decoded again. The key includes the modification time so a file that gets
+	// fixed or replaced is tried again.
+	if (!previewPixels && ThumbCache.Contains(key, ThumbnailKind::Failed))
+	{
+		ThumbnailFailed = true;
+		return;
 	}
 
+	// No OpenGL context is needed here, not even for dds files. They are decoded on the cpu. Jpgs only need to be
+	// decoded at the smallest scale that still covers the thumbnail.
 	Image thumbLoader;
-	int maxLoadAttempts = 5;
-	for (int attempt = 0; attempt < maxLoadAttempts; attempt++)
+	thumbLoader.TilesAllowed = false;
+	thumbLoader.DecodedCacheWrite = false;
+	tPicture* srcPic = nullptr;
+	if (previewPixels)
 	{
-		bool thumbLoaded = thumbLoader.Load(Filename);
-		if (thumbLoaded)
-		{
-			if (attempt > 0)
-				tPrintf("Loading of thumbnail %s succeeded on attempt %d.\n", Filename.Chars(), attempt+1);
-			break;
-		}
-		else
-		{
-			tPrintf("Warning: Loading of thumbnail %s failed on attempt %d.\n", Filename.Chars(), attempt+1);
-			tSystem::tSleep(250);
-		}	
+		preview.Set(previewW, previewH, previewPixels, false);
+		srcPic = &preview;
 	}
-
-	if (Filetype == tFileType::DDS)
+	else
 	{
-		glfwMakeContextCurrent(nullptr);
-		glfwDestroyWindow(offscreenContext);
+		thumbLoader.SetReducedLoadSize(ThumbWidth, ThumbHeight);
+		if (thumbLoader.Load(Filename))
+		{
+			// Thumbnails are generated from the primary (first) picture in the picture list.
+			thumbLoader.RequirePictures();
+			srcPic = thumbLoader.GetPrimaryPic();
+		}
 	}
 
-	// Thumbnails are generated from the primary (first) picture in the picture list.
-	tPicture* srcPic = thumbLoader.GetPrimaryPic();
-	if (!srcPic)
+	ThumbnailFromPreview = (srcPic == &preview);
+	if (!srcPic || !srcPic->IsValid())
 	{
 		tPrintf("Warning: Generation of thumbnail %s failed.\n", Filename.Chars());
+		ThumbCache.Write(key, ThumbnailKind::Failed, nullptr, 0, 0);
+		ThumbnailFailed = true;
 		return;
 	}
 
@@ -1012,46 +2358,189 @@ void Image::GenerateThumbnail()
 	srcPic->Crop(ThumbWidth, ThumbHeight);
 
 	ThumbnailPicture.Set(*srcPic);
+	MakeThumbnailMips();
 
-	// Write to cache file.
-	tChunkWriter writer(hashFile);
-	ThumbnailPicture.Save(writer);
+	// Write to cache. A full thumbnail replaces any made from the preview.
+	ThumbnailKind kind = ThumbnailFromPreview ? ThumbnailKind::Preview : ThumbnailKind::Full;
+	ThumbCache.Write(key, kind, ThumbnailPicture.GetPixelPointer(), ThumbnailPicture.GetWidth(), ThumbnailPicture.GetHeight());
+	if (!ThumbnailFromPreview)
+		ThumbCache.Remove(key, ThumbnailKind::Preview);
 	// std::this_thread::sleep_for(std::chrono::milliseconds(100));
 }
 
 
-void Image::RequestThumbnail()
+void Image::MakeThumbnailMips()
 {
-	if (ThumbnailRequested)
-		return;
+	// Only the full size level is cached. Halving is a lot cheaper than decompressing more levels would be. Colours are
+	// weighted by alpha so the transparent padding around a cropped thumbnail doesn't darken its edges.
+	const tPicture* src = &ThumbnailPicture;
+	for (int m = 0; m < ThumbNumMips-1; m++)
+	{
+		int srcW = src->GetWidth();
+		int srcH = src->GetHeight();
+		int w = tMax(srcW/2, 1);
+		int h = tMax(srcH/2, 1);
+		const tPixel* srcPixels = src->GetPixelPointer();
+		tPixel* pixels = new tPixel[w*h];
+		for (int y = 0; y < h; y++)
+		{
+			int y0 = tMin(y*2, srcH-1), y1 = tMin(y*2+1, srcH-1);
+			for (int x = 0; x < w; x++)
+			{
+				int x0 = tMin(x*2, srcW-1), x1 = tMin(x*2+1, srcW-1);
+				const tPixel* quad[4] = { &srcPixels[y0*srcW + x0], &srcPixels[y0*srcW + x1], &srcPixels[y1*srcW + x0], &srcPixels[y1*srcW + x1] };
+				int r = 0, g = 0, b = 0, a = 0;
+				for (int q = 0; q < 4; q++)
+				{
+					r += quad[q]->R * quad[q]->A;
+					g += quad[q]->G * quad[q]->A;
+					b += quad[q]->B * quad[q]->A;
+					a += quad[q]->A;
+				}
+
+				tPixel& dest = pixels[y*w + x];
+				dest.R = a ? uint8((r + a/2) / a) : 0;
+				dest.G = a ? uint8((g + a/2) / a) : 0;
+				dest.B = a ? uint8((b + a/2) / a) : 0;
+				dest.A = uint8((a + 2) / 4);
+			}
+		}
+
+		ThumbnailMips[m].Set(w, h, pixels, false);
+		src = &ThumbnailMips[m];
+	}
+}
+
+
+void Image::GetThumbnailKey(ThumbnailKey& key) const
+{
+	// The file size and time were read when the image was created so making the key doesn't touch the file system.
+	tuint256 hash = 0;
+	int thumbVersion = 2;
+	hash = tHash::tHashData256((uint8*)&thumbVersion, sizeof(thumbVersion));
+	hash = tHash::tHashString256(Filename, hash);
+	hash = tHash::tHashData256((uint8*)&FileSizeB, sizeof(FileSizeB), hash);
+	hash = tHash::tHashData256((uint8*)&FileModTime, sizeof(FileModTime), hash);
+	hash = tHash::tHashData256((uint8*)&ThumbWidth, sizeof(ThumbWidth), hash);
+	hash = tHash::tHashData256((uint8*)&ThumbHeight, sizeof(ThumbHeight), hash);
+	tStaticAssert(sizeof(hash) == sizeof(ThumbnailKey));
+	memcpy(&key, &hash, sizeof(ThumbnailKey));
+}
+
+
+bool Image::IsThumbnailCached() const
+{
+	ThumbnailKey key;
+	GetThumbnailKey(key);
+	return ThumbCache.Contains(key, ThumbnailKind::Full) || ThumbCache.Contains(key, ThumbnailKind::Preview);
+}
+
+
+bool Image::UseDecodedCache() const
+{
+	if (!Config.DecodedCache || DecodedCacheDir.IsEmpty())
+		return false;
+
+	return (Filetype == tFileType::EXR) || (Filetype == tFileType::HDR) || (Filetype == tFileType::TIFF);
+}
+
+
+tString Image::GetDecodedCacheFile() const
+{
+	// Everything in the load parameters that changes the decoded pixels is part of the key. Like the thumbnail key the
+	// file size and time are the ones read when the image was created.
+	tuint256 hash = 0;
+	int decodedVersion = 2;
+	hash = tHash::tHashData256((uint8*)&decodedVersion, sizeof(decodedVersion));
+	hash = tHash::tHashString256(Filename, hash);
+	hash = tHash::tHashData256((uint8*)&FileSizeB, sizeof(FileSizeB), hash);
+	hash = tHash::tHashData256((uint8*)&FileModTime, sizeof(FileModTime), hash);
+	hash = tHash::tHashData256((uint8*)&LoadParams.GammaValue, sizeof(LoadParams.GammaValue), hash);
+	hash = tHash::tHashData256((uint8*)&LoadParams.HDR_Exposure, sizeof(LoadParams.HDR_Exposure), hash);
+	hash = tHash::tHashData256((uint8*)&LoadParams.EXR_Exposure, sizeof(LoadParams.EXR_Exposure), hash);
+	hash = tHash::tHashData256((uint8*)&LoadParams.EXR_Defog, sizeof(LoadParams.EXR_Defog), hash);
+	hash = tHash::tHashData256((uint8*)&LoadParams.EXR_KneeLow, sizeof(LoadParams.EXR_KneeLow), hash);
+	hash = tHash::tHashData256((uint8*)&LoadParams.EXR_KneeHigh, sizeof(LoadParams.EXR_KneeHigh), hash);
+	tString cacheFile;
+	tsPrintf(cacheFile, "%s%032|256X.raw", DecodedCacheDir.Chars(), hash);
+	return cacheFile;
+}
 
-	// Leave two cores free unless we are on a three core or lower machine, in which case we always use a min of 2 threads.
-	int numThreadsMax = tClampMin((tSystem::tGetNumCores()) - 2, 2);
-	if (ThumbnailNumThreadsRunning >= numThreadsMax)
+
+void Image::RequestThumbnail(float priority)
+{
+	// Everything requested is near the viewport, so this is what keeps the thumbnail pixels in memory.
+	ThumbnailsResidency.Touch(this);
+
+	// While queued a new request only moves it in the queue.
+	if (ThumbnailRequested)
+	{
+		if (ThumbnailThreadRunning)
+			ThumbnailWorkers.Reprioritise(this, priority);
 		return;
+	}
 
 	ThumbnailRequested = true;
 	ThumbnailThreadRunning = true;
-	ThumbnailNumThreadsRunning++;
 	ThumbnailThreadFlag.test_and_set();
-	ThumbnailThread = std::thread
-	(
-		[this]
-		{
-			GenerateThumbnailBridge(this);
-			ThumbnailThreadFlag.clear();
-		}
-	);
+	ThumbnailWorkers.Queue(this, priority);
 }
 
 
 void Image::UnrequestThumbnail()
 {
-	if (ThumbnailRequested && !ThumbnailThreadRunning && !ThumbnailPicture.IsValid())
+	if (ThumbnailThreadRunning && ThumbnailWorkers.Cancel(this))
+	{
+		ThumbnailCancelled();
+		return;
+	}
+
+	if (ThumbnailRequested && !ThumbnailThreadRunning && !ThumbnailPicture.IsValid() && !ThumbnailFailed)
 		ThumbnailRequested = false;
 }
 
 
+void Image::StopThumbnailWorkers()
+{
+	ThumbnailWorkers.Stop();
+}
+
+
+void Image::DropStaleThumbnailRequests()
+{
+	ThumbnailWorkers.DropStale();
+}
+
+
+void Image::ThumbnailCancelled()
+{
+	ThumbnailThreadFlag.clear();
+	ThumbnailThreadRunning = false;
+	ThumbnailRequested = false;
+}
+
+
+void Image::ThumbnailEvicted()
+{
+	ThumbnailPicture.Clear();
+	for (int m = 0; m < ThumbNumMips-1; m++)
+		ThumbnailMips[m].Clear();
+
+	// A failure isn't forgotten. Asking again only reads the failed entry back from the cache.
+	ThumbnailRequested = false;
+	ThumbnailFailed = false;
+}
+
+
+int64 Image::GetThumbnailMemSize()
+{
+	int64 numBytes = 0;
+	for (int m = 0; m < ThumbNumMips; m++)
+		numBytes += int64(ThumbWidth >> m) * int64(ThumbHeight >> m) * int64(sizeof(tPixel));
+	return numBytes;
+}
+
+
 void Image::RequestInvalidateThumbnail()
 {
 	if (!ThumbnailRequested)
@@ -1061,6 +2550,16 @@ void Image::RequestInvalidateThumbnail()
 }
 
 
+void Image::RequestFullThumbnail()
+{
+	if (!ThumbnailPreviewAllowed)
+		return;
+
+	ThumbnailPreviewAllowed = false;
+	RequestInvalidateThumbnail();
+}
+
+
 void Image::Play()
 {
 	PartCurrCountdown = PartDurationOverrideEnabled ? PartDurationOverride : GetCurrentPic()->Duration;
@@ -1119,4 +2618,6 @@ void Image::UpdatePlaying(float dt)
 		else
 			PartCurrCountdown = GetCurrentPic()->Duration;
 	}
+
+	UpdateAnimStream();
 }
@@ -18,12 +18,14 @@
 #include <glad/glad.h>
 #include <Foundation/tList.h>
 #include <Foundation/tString.h>
+#include <Math/tVector2.h>
 #include <System/tFile.h>
 #include <Image/tPicture.h>
 #include <Image/tTexture.h>
 #include <Image/tCubemap.h>
 #include <Image/tImageHDR.h>
 #include "Settings.h"
+namespace Viewer { class GIFStream; class TilePyramid; class ImageCache; class TextureCache; struct TextureEntry; class PackedImage; class ThumbnailPool; class ThumbnailCache; struct ThumbnailKey; class ThumbnailResidency; }
 namespace Viewer
 {
 
@@ -55,11 +57,62 @@ public:
 
 	bool Load(const tString& filename);
 	bool Load();						// Load into main memory.
-	bool IsLoaded() const																								{ return (Pictures.Count() > 0); }
-	int GetNumParts() const																								{ return Pictures.Count(); }
+
+	// Asynchronous loading. RequestLoad starts a worker thread that decodes the file into main memory. While the worker
+	// is going the main thread must leave the picture data alone. IsLoaded returns false, GetWidth/GetHeight report the
+	// thumbnail size, and Bind binds the thumbnail (if one is available) as a placeholder. CompleteLoad joins a
+	// finished worker and finalizes the load on the main thread. Bind calls it for you. Calling the synchronous Load
+	// while an asynchronous load is in progress waits for the worker.
+	bool RequestLoad();
+
+	// Cancelling does not block. The worker discards what it decoded and the image ends up unloaded. A RequestLoad
+	// before the worker finishes un-cancels it.
+	void CancelLoad();
+	bool IsLoading() const																								{ return LoadThreadRunning; }
+
+	// Returns true if an outstanding asynchronous load finished (successfully or not) during this call.
+	bool CompleteLoad();
+
+	// Jpg files can be decoded at 1/2, 1/4 or 1/8 size. If a reduced load size is set the smallest of these that is
+	// still at least that big is used. Zero loads full size, which is the default. Has no effect while loading.
+	void SetReducedLoadSize(int minWidth, int minHeight)																{ if (!LoadThreadRunning) { ReducedLoadWidth = minWidth; ReducedLoadHeight = minHeight; } }
+
+	// Returns 1 for an image loaded at full resolution, otherwise the denominator of the reduction.
+	int GetLoadScale() const																							{ return LoadThreadRunning ? 1 : LoadScale; }
+
+	// Reloads a reduced image at full resolution on the load worker. Until the worker is done the reduced picture
+	// stays bound as the placeholder. Returns false if there was nothing to do.
+	bool RequestFullResolution();
+
+	bool IsLoaded() const																								{ return !LoadThreadRunning && (Pictures.Count() > 0); }
+	int GetNumParts() const																								{ return LoadThreadRunning ? 0 : Pictures.Count(); }
 
 	bool IsOpaque() const;
 	bool Unload(bool force = false);
+
+	// Unloads but keeps a compressed copy of the pictures in memory so loading again doesn't need the file decoded.
+	// Only clean, fully loaded, non-dds, non-streamed images whose pixels are in main memory can be packed. Returns
+	// false if the image could not be packed, in which case it is still loaded. The image unloads straight away and
+	// the packing is done on a worker thread. CompletePack publishes the packed copy once the worker is done and
+	// returns false if it isn't yet. The image cache calls it for you. Loading or unloading the image while it is
+	// being packed waits for the worker. An explicit Unload drops the packed copy.
+	bool UnloadPacked();
+
+	// The same worker writes the decoded cache file of an image that was decoded from the file, so the load itself
+	// never waits on the disk. UnloadPacked does it too. This unloads without packing and returns false, leaving the
+	// image loaded, if there is no cache file to write.
+	bool UnloadWritingCache();
+	bool CompletePack(bool wait = false);
+	bool IsPacked() const																								{ return Packed != nullptr; }
+	bool IsPacking() const																								{ return PackThreadRunning; }
+
+	// Unloads a dirty image, handing its pictures to the pack worker to write to a file in the spill dir. The next load
+	// waits for the write and reads them back, and the image is still dirty. Returns false if the image isn't dirty.
+	// If the write fails the pictures are put back when the worker completes, so the image is loaded again. The spill
+	// file is deleted when the image loads again or is force unloaded.
+	bool UnloadSpilled();
+	bool IsSpilled() const																								{ return !SpillFile.IsEmpty(); }
+	int64 GetPackedSizeBytes() const;
 	float GetLoadedTime() const																							{ return LoadedTime; }
 
 	// Bind to a texture ID and load into VRAM. If already in VRAM, it makes the texture current. Since some ImGui
@@ -68,14 +121,38 @@ public:
 	// Returns 0 (invalid id) if there was a problem.
 	uint64 Bind();
 	void Unbind();
+
+	// Pictures too big for a single texture are tiled. Bind still works for them but only gives a reduced overview.
+	// DrawTiled draws the visible tiles at the resolution that suits the zoom. Image pixel (0,0) goes to screen
+	// position (originX, originY) and each image pixel covers scale screen pixels. Only the clip rect is drawn to.
+	// Only the image drawn most recently keeps its tiles. Drawing another tiled image deletes them, so at most one
+	// pyramid's tile budget is ever in use. GetTileVRAMBytes is what those tiles use, which the texture budget should
+	// leave room for.
+	bool IsTiled() const																								{ return !LoadThreadRunning && Tiles; }
+	void DrawTiled(float originX, float originY, float scale, float clipL, float clipR, float clipB, float clipT);
+	static int64 GetTileVRAMBytes();
+
+	// Set from the OpenGL context once it exists. Until then a limit every driver supports is assumed.
+	static int MaxTextureSize;
+
 	int GetWidth() const;
 	int GetHeight() const;
 	tColouri GetPixel(int x, int y) const;
 
 	// Some images can store multiple complete images inside a single file (multiple parts).
-	// The primary one is the first one.
-	tImage::tPicture* GetPrimaryPic() const																				{ return Pictures.First(); }
-	tImage::tPicture* GetCurrentPic() const																				{ tImage::tPicture* pic = Pictures.First(); for (int i = 0; i < PartNum; i++) pic = pic ? pic->Next() : nullptr; return pic; }
+	// The primary one is the first one. For dds files the pictures start out empty since the image is displayed
+	// straight from its compressed layers. Call RequirePictures before using the pixels of a picture.
+	tImage::tPicture* GetPrimaryPic() const																				{ return LoadThreadRunning ? nullptr : Pictures.First(); }
+	tImage::tPicture* GetCurrentPic() const																				{ tImage::tPicture* pic = GetPrimaryPic(); for (int i = 0; i < PartNum; i++) pic = pic ? pic->Next() : nullptr; return pic; }
+
+	// Decodes the RGBA pixels of the current part (or all parts) if they are not already. This is needed for dds files
+	// and for pictures whose pixels were released after upload, which are read back from the texture. Returns false if
+	// the pixels are not available.
+	bool RequirePictures(bool allParts = false);
+
+	// Same as RequirePictures except a reduced image is first reloaded at full resolution. This blocks so it is for
+	// things like saving and editing that must not work on the reduced pixels.
+	bool RequireFullResolution(bool allParts = false);
 
 	// Functions that edit and cause dirty flag to be set.
 	void Rotate90(bool antiClockWise);
@@ -92,29 +169,56 @@ public:
 		tImage::tPixelFormat SrcPixelFormat	= tImage::tPixelFormat::Invalid;
 		bool Opaque							= false;
 		int FileSizeBytes					= 0;
-		int MemSizeBytes					= 0;
+		int64 MemSizeBytes					= 0;
 	};
 	void PrintInfo();
 
-	bool IsAltMipmapsPictureAvail() const																				{ return DDSTexture2D.IsValid() && AltPicture.IsValid(); }
-	bool IsAltCubemapPictureAvail() const																				{ return DDSCubemap.IsValid() && AltPicture.IsValid(); }
-	void EnableAltPicture(bool enabled)																					{ AltPictureEnabled = enabled; }
+	// The alt picture is created the first time it is enabled.
+	bool IsAltMipmapsPictureAvail() const																				{ return DDSTexture2D.IsValid() && (DDSTexture2D.GetNumMipmaps() > 1); }
+	bool IsAltCubemapPictureAvail() const																				{ return DDSCubemap.IsValid(); }
+	void EnableAltPicture(bool enabled);
 	bool IsAltPictureEnabled() const																					{ return AltPictureEnabled; }
 
-	// Thumbnail generation is done on a seperate thread. Calling RequestThumbnail starts the thread. You should call it
-	// over and over as it will only ever start one thread, and it may not start it if too mnay threads are already
-	// working. BindThumbnail will at some point return a non-zero texture ID, but not necessarily right away. Just keep
-	// calling it. Unloaded images remain unloaded after thumbnail generation.
-	void RequestThumbnail();
+	// Thumbnail generation is done by a pool of worker threads. RequestThumbnail queues the image. Call it every frame
+	// the item is wanted, with a priority that says how soon. Lower values are made first and calling it again just
+	// updates the priority. BindThumbnail will at some point return a non-zero texture ID, but not necessarily right
+	// away. Just keep calling it. Unloaded images remain unloaded after thumbnail generation. Files that fail to make a
+	// thumbnail are remembered in the cache directory and not tried again until they change.
+	void RequestThumbnail(float priority = 0.0f);
 
 	// Call this if you need to invaidate the thumbnail. For example, if the file was saved/edited this should be called
 	// to force regeneration.
 	void RequestInvalidateThumbnail();
 
-	// You are allowed to unrequest. It will succeed if a worker was never assigned.
+	// You are allowed to unrequest. It will succeed if a worker has not picked the request up yet.
 	void UnrequestThumbnail();
 	bool IsThumbnailWorkerActive() const { return ThumbnailThreadRunning; }
-	uint64 BindThumbnail();
+
+	// Thumbnails have full, half and quarter size levels. Only the smallest level at least dispWidth wide is uploaded,
+	// so small thumbnails in the content view take a fraction of the texture memory. Changing the width across a level
+	// boundary uploads the other level.
+	uint64 BindThumbnail(int dispWidth = ThumbWidth);
+
+	// Same as BindThumbnail but the thumbnail is put in the shared thumbnail atlas so many can be drawn with one
+	// texture. Draw it with the returned texture coordinates. Falls back to the thumbnail's own texture, with the usual
+	// coordinates, when the atlas is full.
+	uint64 BindThumbnailAtlas(int dispWidth, tMath::tVector2& uv0, tMath::tVector2& uv1);
+
+	// Waits for thumbnails being made and drops the queue. Call before exiting.
+	static void StopThumbnailWorkers();
+
+	// Cancels every queued thumbnail that wasn't requested since the last call. A view that requests the items it
+	// wants every frame calls this afterwards instead of unrequesting the rest.
+	static void DropStaleThumbnailRequests();
+
+	// Returns true if a thumbnail for the current version of the file is in the thumbnail cache. Requesting a cached
+	// thumbnail is cheap since no decode of the image file is needed.
+	bool IsThumbnailCached() const;
+
+	// Thumbnails are made from the preview embedded in the file when there is a big enough one. They are cached
+	// separately so they can be told apart. RequestFullThumbnail regenerates one from the image itself.
+	bool IsThumbnailFromPreview() const																					{ return !ThumbnailThreadRunning && ThumbnailFromPreview; }
+	void RequestFullThumbnail();
 
 	ImgInfo Info;						// Info is only valid AFTER loading.
 	tString Filename;					// Valid before load.
@@ -125,14 +229,26 @@ public:
 	const static int ThumbWidth;		// = 256;
 	const static int ThumbHeight;		// = 144;
 	const static int ThumbMinDispWidth;	// = 64;
+	const static int ThumbNumMips = 3;	// The smallest level is ThumbMinDispWidth wide.
 	static tString ThumbCacheDir;
+	static ThumbnailCache ThumbCache;	// Opened in ThumbCacheDir at startup.
+	static tString DecodedCacheDir;
+	static tString SpillDir;
 
 	bool TypeSupportsProperties() const;
 
 private:
+	friend class ImageCache;
+	friend class TextureCache;
+	friend class ThumbnailPool;
+	friend class ThumbnailAtlas;
+	friend class ThumbnailResidency;
+
 	// Dds files are special and already in HW ready format. The tTexture can store dds files, while tPicture stores
-	// other types (tga, gif, jpg, bmp, tif, png, etc). If the image is a dds file, the tTexture is valid and in order
-	// to read pixel data, the image is fetched from the framebuffer to ALSO make a valid PictureImage.
+	// other types (tga, gif, jpg, bmp, tif, png, etc). If the image is a dds file, the tTexture is valid and the
+	// Pictures list has one empty picture per part (mipmap or cubemap side). The part's layer is uploaded to VRAM as-is
+	// when the GPU supports the format, and the picture only gets RGBA pixels when something needs to read them.
+	// Edits work on the pictures, so the first edit decodes them all and releases the dds data.
 	//
 	// Note: A tTexture contains all mipmap levels while a tPicture does not. That's why we have a list of tPictures.
 	tImage::tTexture DDSTexture2D;
@@ -147,26 +263,173 @@ private:
 
 	bool ThumbnailRequested = false;			// True if ever requested.
 	bool ThumbnailInvalidateRequested = false;
-	bool ThumbnailThreadRunning = false;		// Only true while worker thread going.
-	static int ThumbnailNumThreadsRunning;		// How many worker threads active.
-	std::thread ThumbnailThread;
+	bool ThumbnailThreadRunning = false;		// True while queued or being made.
+	static ThumbnailPool ThumbnailWorkers;
+	int ThumbnailQueueIndex = -1;				// Owned by the pool. Only valid while queued.
 	std::atomic_flag ThumbnailThreadFlag = ATOMIC_FLAG_INIT;
 	tImage::tPicture ThumbnailPicture;
-
-	// These 2 functions run on a helper thread.
-	static void GenerateThumbnailBridge(Image*);
+	tImage::tPicture ThumbnailMips[ThumbNumMips-1];	// Half size and smaller. Made by the worker from ThumbnailPicture.
+	int ThumbnailTexLevel = 0;					// The level currently in TexIDThumbnail.
+	int ThumbnailAtlasCell = -1;				// Owned by the atlas. It may take the cell back between frames.
+	bool ThumbnailFromPreview = false;			// Written by the thumbnail worker.
+	bool ThumbnailFailed = false;				// Written by the thumbnail worker.
+	bool ThumbnailPreviewAllowed = true;
+
+	// Called on the main thread once a queued request has been taken out of the queue.
+	void ThumbnailCancelled();
+
+	// Owned by the thumbnail residency list. ThumbnailEvicted frees the thumbnail pixels but leaves any texture made
+	// from them so it can still be drawn. The next request reads them back from the thumbnail cache.
+	Image* ThumbPrev = nullptr;
+	Image* ThumbNext = nullptr;
+	int64 ThumbTouchFrame = 0;
+	bool ThumbResident = false;
+	void ThumbnailEvicted();
+	static int64 GetThumbnailMemSize();		// Of the thumbnail picture and its levels.
+
+	// Runs on a thumbnail worker.
 	void GenerateThumbnail();
-
-	// Zero is invalid and means texture has never been bound and loaded into VRAM.
+	void MakeThumbnailMips();
+
+	// Picks up a finished thumbnail and handles invalidation. Returns true if there is a thumbnail to draw.
+	bool UpdateThumbnail();
+	int GetThumbnailLevel(int dispWidth) const;
+	void GetThumbnailKey(ThumbnailKey&) const;
+
+	// The decoded cache is only used for formats that are slow to decode. Thumbnail loaders read it but don't add to it
+	// since they would fill it with every image in the folder.
+	bool UseDecodedCache() const;
+	tString GetDecodedCacheFile() const;
+	bool DecodedCacheWrite = true;
+	bool DecodedCachePending = false;			// The pictures were decoded from the file and are unedited.
+	bool UnloadToWorker(bool pack, const tString& spillFile);
+
+	int ReducedLoadWidth = 0;
+	int ReducedLoadHeight = 0;
+	int LoadScale = 1;							// Written by LoadData.
+
+	// The reduced picture's texture is kept while the full resolution reload is in progress.
+	uint TexIDPreview = 0;
+	int PreviewWidth = 0;
+	int PreviewHeight = 0;
+
+	bool LoadThreadRunning = false;				// True from RequestLoad until the worker is joined.
+	bool LoadThreadSucceeded = false;			// Written by the worker. Only read after it is joined.
+	bool LoadThreadDiscarded = false;			// Written by the worker. Only read after it is joined.
+	std::atomic<bool> LoadCancelRequested		{ false };
+	std::thread LoadThread;
+	std::atomic_flag LoadThreadFlag = ATOMIC_FLAG_INIT;
+
+	// LoadData decodes the file and does not touch OpenGL so it may run on the load worker thread. FinalizeLoad must
+	// be called on the main thread afterwards. Load is just LoadData followed by FinalizeLoad.
+	bool LoadData();
+	bool LoadPartsParallel(int numParts);
+	bool LoadStreamedGIF();
+	bool LoadReducedJPG();
+	bool LoadMappedPicture();
+	bool FinalizeLoad();
+	void JoinLoadThread();
+	void ClearData();
+
+	// Long gif animations are streamed. Every frame still has a picture in the Pictures list so the parts interface is
+	// unchanged, but only the pictures in the ring hold pixels. The rest are empty and just carry their durations.
+	// When a frame is needed the slot furthest behind the play position is recycled.
+	GIFStream* AnimStream = nullptr;
+	static const int AnimRingSize = 8;
+	static const int AnimLookAhead = 4;
+	tImage::tPicture* AnimRing[AnimRingSize] = { };
+	int AnimRingFrames[AnimRingSize] = { };
+	void UpdateAnimStream();
+	bool StreamFrame(int frame);
+
+	// Decodes every frame into its picture and stops streaming. Edits need all the frames in memory. Returns false,
+	// leaving the stream as it was, if they don't fit in the image memory budget or a frame fails to decode.
+	bool DecodeAllFrames();
+	bool RequireAllFrames();				// Same but prints a warning if it fails. Called before edits.
+	bool AnimFramesFit() const;				// For webps and apngs, which are always decoded in full.
+	tImage::tPicture* GetPart(int partNum) const;
+
+	// Zero is invalid and means texture has never been bound and loaded into VRAM, or that it was evicted.
 	uint TexIDAlt			= 0;
 	uint TexIDThumbnail		= 0;
 
-	// Returns the approx main mem size of this image. Considers the Pictures list and the AltPicture.
-	int GetMemSizeBytes() const;
-	bool ConvertTexture2DToPicture();
-	bool ConvertCubemapToPicture();
+	// All textures except the full resolution placeholder go through these so the texture cache can keep VRAM use
+	// within budget. It may delete any of them between frames, after which Bind uploads them again.
+	void CreateTexture(uint& texID, int64 numBytes);
+	void DeleteTexture(uint& texID);
+	void TouchTexture(uint& texID);
+	TextureEntry* TexEntries = nullptr;			// Owned by the texture cache.
+
+	// Only made for images that are not a thumbnail loader. The first level is the picture's pixels so the pyramid must
+	// be released before they change.
+	TilePyramid* Tiles = nullptr;
+	bool TilesAllowed = true;
+	void CreateTiles();
+	void ReleaseTiles();
+
+	// In gpu resident mode a plain single picture gives up its pixels once uploaded and the texture is the only copy.
+	// The texture is pinned in the texture cache. GetPixel reads small tiles back and RequirePictures reads back the
+	// lot. The picture stays in the list, empty, holding the texture id.
+	bool GPUResident = false;
+	int ResidentWidth = 0;
+	int ResidentHeight = 0;
+	void ReleasePixels();
+	bool ReadbackPixels();
+	tColouri GetResidentPixel(int x, int y) const;
+
+	static const int ReadbackTileSize = 64;
+	mutable tPixel* ReadbackTile = nullptr;
+	mutable int ReadbackX = -1;
+	mutable int ReadbackY = -1;
+	mutable int ReadbackW = 0;
+	void ClearReadbackTile() const;
+
+	// Returns the approx main mem size of this image. Considers the dds layers, the Pictures list, the AltPicture, the
+	// reduced levels of a tiled picture, and a gpu resident texture since it holds the only copy of the pixels.
+	int64 GetMemSizeBytes() const;
+
+	// Sets Info.MemSizeBytes and tells the cache. NotifyCache is also called whenever the image loads or unloads.
+	void UpdateMemSize();
+	void NotifyCache();
+
+	// Owned by the cache the image was added to, if any. Prev and next run from least to most recently used.
+	ImageCache* Cache = nullptr;
+	Image* CachePrev = nullptr;
+	Image* CacheNext = nullptr;
+	int64 CacheBytes = 0;						// What the cache has counted for this image.
+	bool CacheLoaded = false;
+	bool CachePinned = false;
+
+	// The packed copy is read by LoadData so it may only be dropped when no load worker is running. Packed images are
+	// kept in a second list by the cache.
+	PackedImage* Packed = nullptr;
+	void DropPacked();
+	Image* PackedPrev = nullptr;
+	Image* PackedNext = nullptr;
+	int64 PackedBytes = 0;						// What the cache has counted for the packed copy.
+	bool CachePacked = false;
+	bool CachePacking = false;
+
+	// The pack worker owns PackPictures and PackResult until it clears the flag. The pictures aren't counted by the
+	// cache. They are only kept for as long as packing takes.
+	std::thread PackThread;
+	std::atomic_flag PackThreadFlag = ATOMIC_FLAG_INIT;
+	bool PackThreadRunning = false;
+	tList<tImage::tPicture> PackPictures;
+	PackedImage* PackResult = nullptr;
+	tString PackSpillFile;						// Set if the worker is spilling the pictures.
+	bool PackSpilled = false;
+
+	// Like the packed copy this is read by LoadData so it is only deleted when no load worker is running.
+	tString SpillFile;
+	void DropSpill();
+	bool CreateDDSPictures();
+	const tImage::tLayer* GetDDSLayer(int partNum) const;
+	void ReleaseDDSData();
+	bool IsFormatSupportedByGPU(tImage::tPixelFormat);
 	void GetGLFormatInfo(GLint& srcFormat, GLenum& srcType, GLint& dstFormat, bool& compressed, tImage::tPixelFormat);
 	void BindLayers(const tList<tImage::tLayer>&, uint texID);
+	void BindLayer(const tImage::tLayer&, uint texID);
 	void CreateAltPictureFromDDS_2DMipmaps();
 	void CreateAltPictureFromDDS_Cubemap();
 
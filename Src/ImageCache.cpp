@@ -0,0 +1,342 @@
+// ImageCache.cpp
+//
+// Keeps track of which images are in main memory and how much they use. Loaded images are kept in least recently used
+// order in a list that runs through the images themselves, so touching and evicting are constant time no matter how
+// many images are in the folder.
+//
+// Copyright (c) 2020 Tristan Grimmer.
+// Permission to use, copy, modify, and/or distribute this software for any purpose with or without fee is hereby
+// granted, provided that the above copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+// INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN
+// AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+// PERFORMANCE OF THIS SOFTWARE.
+
+#include <System/tFile.h>
+#include <System/tPrint.h>
+#include "ImageCache.h"
+#include "Image.h"
+using namespace Viewer;
+
+
+void ImageCache::Add(Image* img)
+{
+	if (!img || (img->Cache == this))
+		return;
+
+	if (img->Cache)
+		img->Cache->Remove(img);
+
+	img->Cache = this;
+	Update(img);
+}
+
+
+void ImageCache::Remove(Image* img)
+{
+	if (!img || (img->Cache != this))
+		return;
+
+	if (img->CacheLoaded)
+		Unlink(img);
+
+	if (img->CachePacked)
+		UnlinkPacked(img);
+
+	if (img->CachePinned)
+	{
+		for (int p = 0; p < NumPinned; p++)
+		{
+			if (Pinned[p] == img)
+			{
+				Pinned[p] = Pinned[--NumPinned];
+				break;
+			}
+		}
+		img->CachePinned = false;
+	}
+
+	if (img->CachePacking)
+	{
+		for (int p = 0; p < NumPacking; p++)
+		{
+			if (Packing[p] == img)
+			{
+				Packing[p] = Packing[--NumPacking];
+				break;
+			}
+		}
+		img->CachePacking = false;
+	}
+
+	img->Cache = nullptr;
+}
+
+
+void ImageCache::Clear()
+{
+	while (Oldest)
+		Remove(Oldest);
+
+	while (OldestPacked)
+		Remove(OldestPacked);
+
+	// Pinned images that aren't loaded aren't in the list.
+	while (NumPinned > 0)
+		Remove(Pinned[NumPinned-1]);
+
+	delete[] Pinned;
+	Pinned = nullptr;
+	MaxPinned = 0;
+
+	while (NumPacking > 0)
+		Remove(Packing[NumPacking-1]);
+
+	delete[] Packing;
+	Packing = nullptr;
+	MaxPacking = 0;
+}
+
+
+void ImageCache::Update(Image* img)
+{
+	if (!img || (img->Cache != this))
+		return;
+
+	bool loaded = img->IsLoaded();
+	if (loaded && img->CacheLoaded)
+	{
+		UsedBytes += img->Info.MemSizeBytes - img->CacheBytes;
+		img->CacheBytes = img->Info.MemSizeBytes;
+	}
+	else if (loaded)
+	{
+		Link(img);
+	}
+	else if (img->CacheLoaded)
+	{
+		Unlink(img);
+	}
+
+	// Only unloaded images count their packed copy. A loaded image drops it anyway.
+	bool packed = !loaded && img->Packed;
+	if (packed && !img->CachePacked)
+		LinkPacked(img);
+	else if (!packed && img->CachePacked)
+		UnlinkPacked(img);
+}
+
+
+void ImageCache::Touch(Image* img)
+{
+	if (!img || (img->Cache != this) || !img->CacheLoaded || (img == Newest))
+		return;
+
+	Unlink(img);
+	Link(img);
+}
+
+
+void ImageCache::Access(Image* img)
+{
+	if (!img || (img->Cache != this))
+		return;
+
+	if (img->CacheLoaded)
+		NumHits++;
+	else if (img->CachePacked)
+		NumPackedHits++;
+	else
+		NumMisses++;
+
+	Touch(img);
+}
+
+
+void ImageCache::SetPinned(Image** images, int numImages)
+{
+	for (int p = 0; p < NumPinned; p++)
+		Pinned[p]->CachePinned = false;
+	NumPinned = 0;
+
+	if (numImages > MaxPinned)
+	{
+		delete[] Pinned;
+		MaxPinned = numImages;
+		Pinned = new Image*[MaxPinned];
+	}
+
+	for (int i = 0; i < numImages; i++)
+	{
+		Image* img = images[i];
+		if (!img || (img->Cache != this) || img->CachePinned)
+			continue;
+
+		img->CachePinned = true;
+		Pinned[NumPinned++] = img;
+	}
+}
+
+
+void ImageCache::AddPacking(Image* img)
+{
+	if (!img || (img->Cache != this) || img->CachePacking)
+		return;
+
+	if (NumPacking == MaxPacking)
+	{
+		MaxPacking = MaxPacking ? MaxPacking*2 : 8;
+		Image** packing = new Image*[MaxPacking];
+		for (int p = 0; p < NumPacking; p++)
+			packing[p] = Packing[p];
+		delete[] Packing;
+		Packing = packing;
+	}
+
+	img->CachePacking = true;
+	Packing[NumPacking++] = img;
+}
+
+
+void ImageCache::CompletePacking()
+{
+	// An image that was loaded or unloaded meanwhile has already waited for its worker and returns true here.
+	for (int p = 0; p < NumPacking; )
+	{
+		Image* img = Packing[p];
+		if (!img->CompletePack())
+		{
+			p++;
+			continue;
+		}
+
+		img->CachePacking = false;
+		Packing[p] = Packing[--NumPacking];
+	}
+}
+
+
+int ImageCache::Evict(int64 maxBytes, int64 maxPackedBytes)
+{
+	// Only pinned images, and dirty ones that can't be spilled, are skipped over so this doesn't walk the whole list.
+	int numEvicted = 0;
+	Image* img = Oldest;
+	while (img && (UsedBytes > maxBytes))
+	{
+		// Unloading unlinks the image so we need the next one first.
+		Image* next = img->CacheNext;
+		if (!img->CachePinned && !img->IsLoading() && !img->IsPacking())
+		{
+			int64 memSize = img->CacheBytes;
+			bool packed = !img->IsDirty() && (maxPackedBytes > 0) && img->UnloadPacked();
+			if (img->IsDirty())
+			{
+				if (img->UnloadSpilled())
+				{
+					tPrintf("Spilling %s freeing %|64d Bytes\n", tSystem::tGetFileName(img->Filename).Chars(), memSize);
+					numEvicted++;
+				}
+			}
+			else if (packed)
+			{
+				tPrintf("Packing %s freeing %|64d Bytes\n", tSystem::tGetFileName(img->Filename).Chars(), memSize);
+				numEvicted++;
+			}
+			else if (img->UnloadWritingCache() || img->Unload())
+			{
+				tPrintf("Unloading %s freeing %|64d Bytes\n", tSystem::tGetFileName(img->Filename).Chars(), memSize);
+				numEvicted++;
+			}
+		}
+		img = next;
+	}
+
+	// Packed copies of pinned images are about to be needed so they are kept.
+	img = OldestPacked;
+	while (img && (PackedBytes > maxPackedBytes))
+	{
+		Image* next = img->PackedNext;
+		if (!img->CachePinned && !img->IsLoading())
+			img->DropPacked();
+		img = next;
+	}
+
+	NumEvictions += numEvicted;
+	return numEvicted;
+}
+
+
+void ImageCache::Link(Image* img)
+{
+	img->CachePrev = Newest;
+	img->CacheNext = nullptr;
+	if (Newest)
+		Newest->CacheNext = img;
+	else
+		Oldest = img;
+	Newest = img;
+
+	img->CacheLoaded = true;
+	img->CacheBytes = img->Info.MemSizeBytes;
+	UsedBytes += img->CacheBytes;
+	NumLoaded++;
+}
+
+
+void ImageCache::Unlink(Image* img)
+{
+	if (img->CachePrev)
+		img->CachePrev->CacheNext = img->CacheNext;
+	else
+		Oldest = img->CacheNext;
+
+	if (img->CacheNext)
+		img->CacheNext->CachePrev = img->CachePrev;
+	else
+		Newest = img->CachePrev;
+
+	img->CachePrev = img->CacheNext = nullptr;
+	img->CacheLoaded = false;
+	UsedBytes -= img->CacheBytes;
+	img->CacheBytes = 0;
+	NumLoaded--;
+}
+
+
+void ImageCache::LinkPacked(Image* img)
+{
+	img->PackedPrev = NewestPacked;
+	img->PackedNext = nullptr;
+	if (NewestPacked)
+		NewestPacked->PackedNext = img;
+	else
+		OldestPacked = img;
+	NewestPacked = img;
+
+	img->CachePacked = true;
+	img->PackedBytes = img->GetPackedSizeBytes();
+	PackedBytes += img->PackedBytes;
+	NumPacked++;
+}
+
+
+void ImageCache::UnlinkPacked(Image* img)
+{
+	if (img->PackedPrev)
+		img->PackedPrev->PackedNext = img->PackedNext;
+	else
+		OldestPacked = img->PackedNext;
+
+	if (img->PackedNext)
+		img->PackedNext->PackedPrev = img->PackedPrev;
+	else
+		NewestPacked = img->PackedPrev;
+
+	img->PackedPrev = img->PackedNext = nullptr;
+	img->CachePacked = false;
+	PackedBytes -= img->PackedBytes;
+	img->PackedBytes = 0;
+	NumPacked--;
+}
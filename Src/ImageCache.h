@@ -0,0 +1,101 @@
+// ImageCache.h
+//
+// Keeps track of which images are in main memory and how much they use. Loaded images are kept in least recently used
+// order in a list that runs through the images themselves, so touching and evicting are constant time no matter how
+// many images are in the folder.
+//
+// Copyright (c) 2020 Tristan Grimmer.
+// Permission to use, copy, modify, and/or distribute this software for any purpose with or without fee is hereby
+// granted, provided that the above copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+// INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN
+// AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+// PERFORMANCE OF THIS SOFTWARE.
+
+#pragma once
+#include <Foundation/tStandard.h>
+namespace Viewer { class Image; }
+namespace Viewer
+{
+
+
+class ImageCache
+{
+public:
+	ImageCache()																										{ }
+	~ImageCache()																										{ Clear(); }
+
+	// Only added images are tracked. They should be added before they are loaded. An image removes itself when it is
+	// deleted. All functions must be called from the main thread.
+	void Add(Image*);
+	void Remove(Image*);
+	void Clear();
+
+	// Images call this whenever they load, unload, or change size. An image that just loaded becomes the most
+	// recently used. Otherwise the order is not changed.
+	void Update(Image*);
+
+	// Makes a loaded image the most recently used. Access does the same but also counts a hit if the image was loaded,
+	// a packed hit if only its packed copy was, and a miss otherwise. It is for when the user goes to an image.
+	void Touch(Image*);
+	void Access(Image*);
+
+	// Pinned images are never evicted. The set replaces whatever was pinned before. Images being reloaded aren't
+	// evicted either. Dirty images are spilled to disk so their edits survive.
+	void SetPinned(Image** images, int numImages);
+
+	// Unloads the least recently used images until no more than maxBytes are used or nothing else can go. Returns the
+	// number of images unloaded. If maxPackedBytes is above 0 evicted images keep a packed copy where they can, and the
+	// oldest packed copies are dropped until no more than maxPackedBytes are used by them.
+	int Evict(int64 maxBytes, int64 maxPackedBytes = 0);
+
+	// Images are packed on a worker thread once they have unloaded. They add themselves here and CompletePacking
+	// publishes the packed copies of those whose workers are done. Call it once a frame.
+	void AddPacking(Image*);
+	void CompletePacking();
+
+	int64 GetUsedBytes() const																							{ return UsedBytes; }
+	int GetNumLoaded() const																							{ return NumLoaded; }
+	int64 GetAverageBytes() const																						{ return NumLoaded ? UsedBytes / NumLoaded : 0; }
+	int GetNumHits() const																								{ return NumHits; }
+	int GetNumMisses() const																							{ return NumMisses; }
+	int GetNumEvictions() const																							{ return NumEvictions; }
+
+	int64 GetPackedBytes() const																						{ return PackedBytes; }
+	int GetNumPacked() const																							{ return NumPacked; }
+	int GetNumPackedHits() const																						{ return NumPackedHits; }
+
+private:
+	void Link(Image*);				// Appends as most recently used.
+	void Unlink(Image*);
+	void LinkPacked(Image*);
+	void UnlinkPacked(Image*);
+
+	Image* Oldest			= nullptr;
+	Image* Newest			= nullptr;
+	int NumLoaded			= 0;
+	int64 UsedBytes			= 0;
+
+	Image* OldestPacked		= nullptr;
+	Image* NewestPacked		= nullptr;
+	int NumPacked			= 0;
+	int64 PackedBytes		= 0;
+
+	Image** Pinned			= nullptr;
+	int NumPinned			= 0;
+	int MaxPinned			= 0;
+
+	Image** Packing			= nullptr;
+	int NumPacking			= 0;
+	int MaxPacking			= 0;
+
+	int NumHits				= 0;
+	int NumPackedHits		= 0;
+	int NumMisses			= 0;
+	int NumEvictions		= 0;
+};
+
+
+}
@@ -0,0 +1,237 @@
+// MappedDecode.cpp
+//
+// Decoding png, webp and tiff files straight from a mapping of the file. Tacent's loaders read the whole file into
+// memory before decoding so for large images the file is held twice. These call the same libraries Tacent uses on the
+// mapped bytes instead.
+//
+// Copyright (c) 2020 Tristan Grimmer.
+// Permission to use, copy, modify, and/or distribute this software for any purpose with or without fee is hereby
+// granted, provided that the above copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+// INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN
+// AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+// PERFORMANCE OF THIS SOFTWARE.
+
+#include <cstring>
+#ifdef VIEWER_LIBPNG
+#include <png.h>
+#endif
+#ifdef VIEWER_LIBWEBP
+#include <webp/decode.h>
+#endif
+#ifdef VIEWER_LIBTIFF
+#include <tiffio.h>
+#endif
+#include "MappedDecode.h"
+#include "MappedFile.h"
+using namespace tImage;
+
+
+namespace
+{
+	// Anything bigger than this is left to Tacent's loaders.
+	const int64 MaxPixels = int64(1) << 30;
+
+	bool IsSizeOk(int64 width, int64 height)
+	{
+		return (width > 0) && (height > 0) && (width*height <= MaxPixels);
+	}
+
+	#ifdef VIEWER_LIBTIFF
+	// libtiff reads through these. The map procs hand it the mapping itself so strips are decoded without being copied.
+	struct TIFFSource
+	{
+		const uint8* Data;
+		int64 Size;
+		int64 Pos;
+	};
+
+	tmsize_t ReadTIFF(thandle_t handle, void* dest, tmsize_t numBytes)
+	{
+		TIFFSource* src = (TIFFSource*)handle;
+		int64 avail = src->Size - src->Pos;
+		int64 count = (int64(numBytes) < avail) ? int64(numBytes) : avail;
+		if (count <= 0)
+			return 0;
+
+		memcpy(dest, src->Data + src->Pos, size_t(count));
+		src->Pos += count;
+		return tmsize_t(count);
+	}
+
+	tmsize_t WriteTIFF(thandle_t, void*, tmsize_t)																		{ return 0; }
+
+	toff_t SeekTIFF(thandle_t handle, toff_t offset, int whence)
+	{
+		TIFFSource* src = (TIFFSource*)handle;
+		int64 pos = int64(offset);
+		if (whence == SEEK_CUR)
+			pos += src->Pos;
+		else if (whence == SEEK_END)
+			pos += src->Size;
+		if (pos < 0)
+			return toff_t(-1);
+
+		src->Pos = pos;
+		return toff_t(pos);
+	}
+
+	int CloseTIFF(thandle_t)																							{ return 0; }
+	toff_t SizeTIFF(thandle_t handle)																					{ return toff_t(((TIFFSource*)handle)->Size); }
+
+	int MapTIFF(thandle_t handle, void** base, toff_t* size)
+	{
+		TIFFSource* src = (TIFFSource*)handle;
+		*base = (void*)src->Data;
+		*size = toff_t(src->Size);
+		return 1;
+	}
+
+	void UnmapTIFF(thandle_t, void*, toff_t)																			{ }
+	#endif
+}
+
+
+tPixel* Viewer::LoadMappedPNG(const tString& filename, int& width, int& height, tPixelFormat& srcFormat)
+{
+	width = height = 0;
+
+	#ifdef VIEWER_LIBPNG
+	MappedFile file(filename);
+	if (!file.IsValid())
+		return nullptr;
+
+	png_image image;
+	memset(&image, 0, sizeof(image));
+	image.version = PNG_IMAGE_VERSION;
+	if (!png_image_begin_read_from_memory(&image, file.GetData(), size_t(file.GetSize())))
+		return nullptr;
+
+	// 16 bit pngs are left to Tacent so they are reduced to 8 bits exactly the way they always have been.
+	if ((image.format & PNG_FORMAT_FLAG_LINEAR) || !IsSizeOk(image.width, image.height))
+	{
+		png_image_free(&image);
+		return nullptr;
+	}
+
+	srcFormat = (image.format & PNG_FORMAT_FLAG_ALPHA) ? tPixelFormat::R8G8B8A8 : tPixelFormat::R8G8B8;
+	image.format = PNG_FORMAT_RGBA;
+	tPixel* pixels = new tPixel[int64(image.width) * int64(image.height)];
+
+	// A negative stride has libpng write the rows bottom-up. It frees the image whether or not it succeeds.
+	int stride = -int(PNG_IMAGE_ROW_STRIDE(image));
+	if (!png_image_finish_read(&image, nullptr, pixels, stride, nullptr))
+	{
+		delete[] pixels;
+		return nullptr;
+	}
+
+	width = int(image.width);
+	height = int(image.height);
+	return pixels;
+
+	#else
+	return nullptr;
+	#endif
+}
+
+
+tPixel* Viewer::LoadMappedWEBP(const tString& filename, int& width, int& height, tPixelFormat& srcFormat)
+{
+	width = height = 0;
+
+	#ifdef VIEWER_LIBWEBP
+	MappedFile file(filename);
+	if (!file.IsValid())
+		return nullptr;
+
+	WebPDecoderConfig config;
+	if (!WebPInitDecoderConfig(&config))
+		return nullptr;
+
+	const uint8* data = file.GetData();
+	size_t numBytes = size_t(file.GetSize());
+	if ((WebPGetFeatures(data, numBytes, &config.input) != VP8_STATUS_OK) || config.input.has_animation)
+		return nullptr;
+
+	int w = config.input.width;
+	int h = config.input.height;
+	if (!IsSizeOk(w, h))
+		return nullptr;
+
+	int64 numPixels = int64(w) * int64(h);
+	tPixel* pixels = new tPixel[numPixels];
+	config.options.flip = 1;
+	config.output.colorspace = MODE_RGBA;
+	config.output.is_external_memory = 1;
+	config.output.u.RGBA.rgba = (uint8_t*)pixels;
+	config.output.u.RGBA.stride = w * int(sizeof(tPixel));
+	config.output.u.RGBA.size = size_t(numPixels) * sizeof(tPixel);
+	bool ok = (WebPDecode(data, numBytes, &config) == VP8_STATUS_OK);
+	WebPFreeDecBuffer(&config.output);
+	if (!ok)
+	{
+		delete[] pixels;
+		return nullptr;
+	}
+
+	srcFormat = config.input.has_alpha ? tPixelFormat::R8G8B8A8 : tPixelFormat::R8G8B8;
+	width = w;
+	height = h;
+	return pixels;
+
+	#else
+	return nullptr;
+	#endif
+}
+
+
+tPixel* Viewer::LoadMappedTIFF(const tString& filename, int& width, int& height, tPixelFormat& srcFormat)
+{
+	width = height = 0;
+
+	#ifdef VIEWER_LIBTIFF
+	MappedFile file(filename);
+	if (!file.IsValid())
+		return nullptr;
+
+	TIFFSource source = { file.GetData(), int64(file.GetSize()), 0 };
+	TIFF* tiff = TIFFClientOpen
+	(
+		filename.Chars(), "r", (thandle_t)&source,
+		ReadTIFF, WriteTIFF, SeekTIFF, CloseTIFF, SizeTIFF, MapTIFF, UnmapTIFF
+	);
+	if (!tiff)
+		return nullptr;
+
+	uint32 w = 0, h = 0;
+	uint16 samplesPerPixel = 0;
+	char message[1024];
+	bool ok =
+		(TIFFNumberOfDirectories(tiff) == 1) && TIFFRGBAImageOK(tiff, message) &&
+		TIFFGetField(tiff, TIFFTAG_IMAGEWIDTH, &w) && TIFFGetField(tiff, TIFFTAG_IMAGELENGTH, &h) &&
+		TIFFGetFieldDefaulted(tiff, TIFFTAG_SAMPLESPERPIXEL, &samplesPerPixel) && IsSizeOk(w, h);
+
+	// The packed raster is ABGR from the low byte up, which is the same as tPixel in memory.
+	tPixel* pixels = ok ? new tPixel[int64(w) * int64(h)] : nullptr;
+	if (ok)
+		ok = TIFFReadRGBAImageOriented(tiff, w, h, (uint32*)pixels, ORIENTATION_BOTLEFT, 0) != 0;
+	TIFFClose(tiff);
+
+	if (!ok)
+	{
+		delete[] pixels;
+		return nullptr;
+	}
+
+	srcFormat = ((samplesPerPixel == 2) || (samplesPerPixel >= 4)) ? tPixelFormat::R8G8B8A8 : tPixelFormat::R8G8B8;
+	width = int(w);
+	height = int(h);
+	return pixels;
+
+	#else
+	return nullptr;
+	#endif
+}
@@ -0,0 +1,31 @@
+// MappedDecode.h
+//
+// Decoding png, webp and tiff files straight from a mapping of the file. Tacent's loaders read the whole file into
+// memory before decoding so for large images the file is held twice. These call the same libraries Tacent uses on the
+// mapped bytes instead.
+//
+// Copyright (c) 2020 Tristan Grimmer.
+// Permission to use, copy, modify, and/or distribute this software for any purpose with or without fee is hereby
+// granted, provided that the above copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+// INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN
+// AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+// PERFORMANCE OF THIS SOFTWARE.
+
+#pragma once
+#include <Foundation/tString.h>
+#include <Math/tColour.h>
+#include <Image/tPixelFormat.h>
+
+
+namespace Viewer
+{
+	// Each returns the pixels in tPicture (bottom-up) row order and the caller must delete[] them. They return nullptr
+	// if the file could not be decoded here or if the build has no direct access to the library, in which case the
+	// caller should use Tacent's loader. Animated webps and multi-page tiffs are left to Tacent.
+	tPixel* LoadMappedPNG(const tString& filename, int& width, int& height, tImage::tPixelFormat& srcFormat);
+	tPixel* LoadMappedWEBP(const tString& filename, int& width, int& height, tImage::tPixelFormat& srcFormat);
+	tPixel* LoadMappedTIFF(const tString& filename, int& width, int& height, tImage::tPixelFormat& srcFormat);
+}
@@ -0,0 +1,195 @@
+// MappedFile.cpp
+//
+// Read-only access to the whole contents of a file without copying it to the heap. Local files are memory mapped so the
+// decoders read straight from the page cache. Files on network mounts are read into a buffer instead since a mapping
+// there can fault at any time if the server goes away.
+//
+// Copyright (c) 2020 Tristan Grimmer.
+// Permission to use, copy, modify, and/or distribute this software for any purpose with or without fee is hereby
+// granted, provided that the above copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+// INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN
+// AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+// PERFORMANCE OF THIS SOFTWARE.
+
+#ifdef PLATFORM_WINDOWS
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/vfs.h>
+#endif
+#include <climits>
+#include <System/tFile.h>
+#include "MappedFile.h"
+
+
+bool Viewer::MappedFile::Open(const tString& filename, Access access)
+{
+	Close();
+	if (((access == Access::Persistent) || !IsOnNetworkMount(filename)) && Map(filename, access))
+		return true;
+
+	if (access == Access::Persistent)
+		return false;
+
+	// Buffered fallback. Also taken if the mapping fails for any other reason.
+	int fileSize = 0;
+	uint8* fileData = tSystem::tLoadFile(filename, nullptr, &fileSize);
+	if (!fileData || (fileSize <= 0))
+	{
+		delete[] fileData;
+		return false;
+	}
+
+	Data = fileData;
+	Size = fileSize;
+	Mapped = false;
+	return true;
+}
+
+
+void Viewer::MappedFile::Close()
+{
+	if (Data)
+	{
+		#ifdef PLATFORM_WINDOWS
+		if (Mapped)
+			UnmapViewOfFile(Data);
+		#else
+		if (Mapped)
+			munmap((void*)Data, size_t(Size));
+		#endif
+		else
+			delete[] Data;
+	}
+
+	Data = nullptr;
+	Size = 0;
+	Mapped = false;
+}
+
+
+#ifdef PLATFORM_WINDOWS
+
+
+bool Viewer::MappedFile::Map(const tString& filename, Access access)
+{
+	// The scan hint also applies to the cache manager reads that back the view.
+	DWORD flags = (access == Access::Sequential) ? FILE_FLAG_SEQUENTIAL_SCAN : FILE_FLAG_RANDOM_ACCESS;
+	DWORD share = (access == Access::Persistent) ? (FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE) : FILE_SHARE_READ;
+	HANDLE file = CreateFileA(filename.Chars(), GENERIC_READ, share, nullptr, OPEN_EXISTING, flags, nullptr);
+	if (file == INVALID_HANDLE_VALUE)
+		return false;
+
+	LARGE_INTEGER fileSize;
+	if (!GetFileSizeEx(file, &fileSize) || (fileSize.QuadPart <= 0) || (fileSize.QuadPart > INT_MAX))
+	{
+		CloseHandle(file);
+		return false;
+	}
+
+	// The view keeps the mapping object and file alive so both handles can be closed straight away.
+	HANDLE mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+	CloseHandle(file);
+	if (!mapping)
+		return false;
+
+	void* view = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+	CloseHandle(mapping);
+	if (!view)
+		return false;
+
+	Data = (const uint8*)view;
+	Size = int(fileSize.QuadPart);
+	Mapped = true;
+	return true;
+}
+
+
+bool Viewer::MappedFile::IsOnNetworkMount(const tString& filename)
+{
+	const char* path = filename.Chars();
+	if (!path)
+		return false;
+
+	// UNC paths are always remote. Otherwise ask about the drive letter.
+	if (((path[0] == '\\') || (path[0] == '/')) && ((path[1] == '\\') || (path[1] == '/')))
+		return true;
+
+	if (path[0] && (path[1] == ':'))
+	{
+		char root[4] = { path[0], ':', '\\', 0 };
+		return GetDriveTypeA(root) == DRIVE_REMOTE;
+	}
+
+	return false;
+}
+
+
+#else
+
+
+bool Viewer::MappedFile::Map(const tString& filename, Access access)
+{
+	int fd = open(filename.Chars(), O_RDONLY);
+	if (fd == -1)
+		return false;
+
+	struct stat st;
+	if ((fstat(fd, &st) != 0) || !S_ISREG(st.st_mode) || (st.st_size <= 0) || (st.st_size > INT_MAX))
+	{
+		close(fd);
+		return false;
+	}
+
+	// The mapping holds its own reference to the file.
+	void* view = mmap(nullptr, size_t(st.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (view == MAP_FAILED)
+		return false;
+
+	// Sequential lets the kernel read ahead aggressively and drop pages behind us. Either way we want the whole file so
+	// start reading it in now rather than faulting it in a page at a time. Persistent files are only read in part.
+	madvise(view, size_t(st.st_size), (access == Access::Sequential) ? MADV_SEQUENTIAL : MADV_RANDOM);
+	if (access != Access::Persistent)
+		madvise(view, size_t(st.st_size), MADV_WILLNEED);
+
+	Data = (const uint8*)view;
+	Size = int(st.st_size);
+	Mapped = true;
+	return true;
+}
+
+
+bool Viewer::MappedFile::IsOnNetworkMount(const tString& filename)
+{
+	struct statfs fs;
+	if (statfs(filename.Chars(), &fs) != 0)
+		return false;
+
+	// Magic numbers from linux/magic.h. Not all of them are in older headers so they are spelled out here.
+	switch (uint32(fs.f_type))
+	{
+		case 0x00006969:			// NFS
+		case 0x0000517B:			// SMB
+		case 0xFF534D42:			// CIFS
+		case 0xFE534D42:			// SMB2
+		case 0x65735546:			// FUSE. Mostly sshfs and friends.
+		case 0x01021997:			// 9P
+		case 0x73757245:			// Coda
+		case 0x5346414F:			// AFS
+		case 0x6B414653:			// kAFS
+		case 0x00C36400:			// Ceph
+			return true;
+	}
+
+	return false;
+}
+
+
+#endif
@@ -0,0 +1,64 @@
+// MappedFile.h
+//
+// Read-only access to the whole contents of a file without copying it to the heap. Local files are memory mapped so the
+// decoders read straight from the page cache. Files on network mounts are read into a buffer instead since a mapping
+// there can fault at any time if the server goes away.
+//
+// Copyright (c) 2020 Tristan Grimmer.
+// Permission to use, copy, modify, and/or distribute this software for any purpose with or without fee is hereby
+// granted, provided that the above copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+// INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN
+// AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+// PERFORMANCE OF THIS SOFTWARE.
+
+#pragma once
+#include <Foundation/tString.h>
+namespace Viewer
+{
+
+
+class MappedFile
+{
+public:
+	enum class Access
+	{
+		Sequential,				// The file is read front to back once. Pages behind the reader may be dropped early.
+		Random,					// The file is kept around and read in any order.
+		Persistent				// A large file we own and read small parts of, like a cache store. It is always mapped,
+								// even on network mounts, since reading it all in would be far worse. Other handles
+								// may be appending to it.
+	};
+
+	MappedFile()																										{ }
+	MappedFile(const tString& filename, Access access = Access::Sequential)												{ Open(filename, access); }
+	~MappedFile()																										{ Close(); }
+
+	// Returns false if the file can't be opened, is empty, or is too big to address with an int.
+	bool Open(const tString& filename, Access access = Access::Sequential);
+	void Close();
+
+	bool IsValid() const																								{ return Data != nullptr; }
+	const uint8* GetData() const																						{ return Data; }
+	int GetSize() const																									{ return Size; }
+
+	// True if the data is a view of the file rather than a heap copy. Mapped pages are shared with the page cache so
+	// they don't count towards the memory we own.
+	bool IsMapped() const																								{ return Mapped; }
+
+private:
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator=(const MappedFile&) = delete;
+
+	bool Map(const tString& filename, Access);
+	static bool IsOnNetworkMount(const tString& filename);
+
+	const uint8* Data	= nullptr;
+	int Size			= 0;
+	bool Mapped			= false;
+};
+
+
+}
@@ -0,0 +1,281 @@
+// MemoryBudget.cpp
+//
+// Works out how much memory decoded images may use. In auto mode the budget follows what the system and any
+// container limit have free, and shrinks when the kernel reports memory pressure. A background thread samples about
+// once a second so nothing here blocks the main thread.
+//
+// Copyright (c) 2020 Tristan Grimmer.
+// Permission to use, copy, modify, and/or distribute this software for any purpose with or without fee is hereby
+// granted, provided that the above copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+// INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN
+// AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+// PERFORMANCE OF THIS SOFTWARE.
+
+#ifdef PLATFORM_WINDOWS
+#include <windows.h>
+#endif
+#include <thread>
+#include <atomic>
+#include <cstdio>
+#include <cstring>
+#include <cstdlib>
+#include <Foundation/tFundamentals.h>
+#include <System/tTime.h>
+#include "MemoryBudget.h"
+#include "Settings.h"
+using namespace tMath;
+
+
+namespace
+{
+	const int64 MB = 1024 * 1024;
+	const int64 MinBudget = 256 * MB;
+	const int SampleIntervalMS = 1000;
+
+	std::thread MonitorThread;
+	std::atomic<bool> MonitorStop(false);
+
+	// Written by the monitor thread.
+	std::atomic<int64> AvailableBytes(-1);
+	std::atomic<int64> LimitBytes(-1);			// The most we could ever have. Physical memory or the cgroup limit.
+	std::atomic<int> PressureHundredths(0);
+	std::atomic<int> NumSamples(0);
+
+	// Written by the main thread.
+	std::atomic<int64> AutoBudget(1024 * MB);
+	int NumSamplesSeen = 0;
+
+	// Pressure is a 10 second average so it stays up for several samples after a single stall. The budget is cut once
+	// when an episode starts and held there until pressure has properly dropped. It is only cut again if pressure
+	// climbs well past where it was at the last cut.
+	const float PressureEnter = 5.0f;
+	const float PressureLeave = 2.0f;
+	const float PressureEscalate = 10.0f;
+	bool UnderPressure = false;
+	float PressureAtCut = 0.0f;
+	int64 PressureBudget = 0;
+
+	#ifdef PLATFORM_LINUX
+	// Files in /proc and /sys report a size of 0 so they are read until they run out.
+	bool ReadTextFile(const char* filename, char* text, int maxLen)
+	{
+		FILE* file = fopen(filename, "rb");
+		if (!file)
+			return false;
+
+		int numRead = int(fread(text, 1, maxLen-1, file));
+		fclose(file);
+		text[numRead] = '\0';
+		return numRead > 0;
+	}
+
+	// Returns the value in bytes of a /proc/meminfo line like "MemAvailable:  123456 kB", or -1.
+	int64 GetMemInfoBytes(const char* text, const char* key)
+	{
+		const char* found = strstr(text, key);
+		if (!found)
+			return -1;
+
+		return int64(strtoll(found + strlen(key), nullptr, 10)) * 1024;
+	}
+
+	// Cgroup files hold a byte count or "max". Both missing files and "max" return -1.
+	int64 GetCGroupBytes(const char* dir, const char* name)
+	{
+		char filename[512];
+		snprintf(filename, sizeof(filename), "%s/%s", dir, name);
+		char text[64];
+		if (!ReadTextFile(filename, text, sizeof(text)) || !strncmp(text, "max", 3))
+			return -1;
+
+		return int64(strtoll(text, nullptr, 10));
+	}
+
+	void SampleSystem()
+	{
+		char text[4096];
+		int64 available = -1;
+		int64 limit = -1;
+		if (ReadTextFile("/proc/meminfo", text, sizeof(text)))
+		{
+			available = GetMemInfoBytes(text, "MemAvailable:");
+			limit = GetMemInfoBytes(text, "MemTotal:");
+		}
+
+		// With cgroup v2 the line is "0::/path". A limit may be set on any ancestor so we walk up to the root. In a
+		// container the path is usually just "/".
+		char pressureFile[512];
+		snprintf(pressureFile, sizeof(pressureFile), "/proc/pressure/memory");
+		if (ReadTextFile("/proc/self/cgroup", text, sizeof(text)))
+		{
+			const char* path = strstr(text, "0::");
+			if (path)
+			{
+				char dir[512];
+				snprintf(dir, sizeof(dir), "/sys/fs/cgroup%s", path + 3);
+				char* end = strchr(dir, '\n');
+				if (end)
+					*end = '\0';
+
+				// Under a limit it is our own cgroup's stalls that matter, not the whole system's.
+				char ownPressureFile[512];
+				snprintf(ownPressureFile, sizeof(ownPressureFile), "%s/memory.pressure", dir);
+				bool limited = false;
+
+				while (true)
+				{
+					int64 max = GetCGroupBytes(dir, "memory.max");
+					int64 high = GetCGroupBytes(dir, "memory.high");
+					int64 cgroupLimit = ((max >= 0) && (high >= 0)) ? tMin(max, high) : tMax(max, high);
+					int64 current = GetCGroupBytes(dir, "memory.current");
+					if ((cgroupLimit >= 0) && (current >= 0))
+					{
+						limited = true;
+						int64 headroom = tMax(cgroupLimit - current, int64(0));
+						available = (available >= 0) ? tMin(available, headroom) : headroom;
+						limit = (limit >= 0) ? tMin(limit, cgroupLimit) : cgroupLimit;
+					}
+
+					char* slash = strrchr(dir, '/');
+					if (!slash || (slash - dir) <= int(strlen("/sys/fs/cgroup")))
+						break;
+					*slash = '\0';
+				}
+
+				if (limited)
+					snprintf(pressureFile, sizeof(pressureFile), "%s", ownPressureFile);
+			}
+		}
+
+		// The line we want is "some avg10=1.23 avg60=...". Not all kernels have pressure stall information.
+		int pressure = 0;
+		if (ReadTextFile(pressureFile, text, sizeof(text)))
+		{
+			const char* avg10 = strstr(text, "some avg10=");
+			if (avg10)
+				pressure = int(strtod(avg10 + strlen("some avg10="), nullptr) * 100.0);
+		}
+
+		AvailableBytes = available;
+		LimitBytes = limit;
+		PressureHundredths = pressure;
+	}
+
+	#elif defined(PLATFORM_WINDOWS)
+	void SampleSystem()
+	{
+		MEMORYSTATUSEX status;
+		status.dwLength = sizeof(status);
+		if (!GlobalMemoryStatusEx(&status))
+			return;
+
+		AvailableBytes = int64(status.ullAvailPhys);
+		LimitBytes = int64(status.ullTotalPhys);
+	}
+
+	#else
+	void SampleSystem()
+	{
+	}
+	#endif
+
+	void MonitorLoop()
+	{
+		while (!MonitorStop)
+		{
+			SampleSystem();
+			NumSamples++;
+
+			// Short sleeps so stopping doesn't hold up shutdown.
+			for (int ms = 0; (ms < SampleIntervalMS) && !MonitorStop; ms += 100)
+				tSystem::tSleep(100);
+		}
+	}
+}
+
+
+void Viewer::StartMemoryMonitor()
+{
+	if (MonitorThread.joinable())
+		return;
+
+	MonitorStop = false;
+	MonitorThread = std::thread(MonitorLoop);
+}
+
+
+void Viewer::StopMemoryMonitor()
+{
+	if (!MonitorThread.joinable())
+		return;
+
+	MonitorStop = true;
+	MonitorThread.join();
+}
+
+
+bool Viewer::UpdateAutoImageMemBudget(int64 usedImageBytes)
+{
+	int numSamples = NumSamples;
+	if (numSamples == NumSamplesSeen)
+		return false;
+	NumSamplesSeen = numSamples;
+
+	// The images we already have aren't part of what is available. We take half of what is left and leave the rest
+	// for everything else, and never more than three quarters of the limit.
+	int64 available = AvailableBytes;
+	int64 limit = LimitBytes;
+	if (available < 0)
+		return false;
+
+	int64 budget = usedImageBytes + available/2;
+	if (limit > 0)
+		budget = tMin(budget, limit/4*3);
+
+	// Under pressure we give some back straight away rather than waiting to be killed. The more time tasks spend
+	// stalled the more goes, up to half.
+	float pressure = GetMemPressure();
+	bool cut = UnderPressure ? (pressure > PressureAtCut + PressureEscalate) : (pressure > PressureEnter);
+	if (cut)
+	{
+		float shrink = tClamp(pressure / 50.0f, 0.1f, 0.5f);
+		int64 base = UnderPressure ? tMin(PressureBudget, usedImageBytes) : usedImageBytes;
+		PressureBudget = int64(float(base) * (1.0f - shrink));
+		PressureAtCut = pressure;
+		UnderPressure = true;
+	}
+	else if (UnderPressure && (pressure < PressureLeave))
+	{
+		UnderPressure = false;
+	}
+
+	if (UnderPressure)
+		budget = tMin(budget, PressureBudget);
+
+	AutoBudget = tMax(budget, MinBudget);
+	return true;
+}
+
+
+int64 Viewer::GetImageMemBudget()
+{
+	if (Config.AutoImageMem)
+		return AutoBudget;
+
+	return int64(Config.MaxImageMemMB) * MB;
+}
+
+
+int64 Viewer::GetAvailableMemBytes()
+{
+	return AvailableBytes;
+}
+
+
+float Viewer::GetMemPressure()
+{
+	return float(PressureHundredths) / 100.0f;
+}
@@ -0,0 +1,37 @@
+// MemoryBudget.h
+//
+// Works out how much memory decoded images may use. In auto mode the budget follows what the system and any
+// container limit have free, and shrinks when the kernel reports memory pressure. A background thread samples about
+// once a second so nothing here blocks the main thread.
+//
+// Copyright (c) 2020 Tristan Grimmer.
+// Permission to use, copy, modify, and/or distribute this software for any purpose with or without fee is hereby
+// granted, provided that the above copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+// INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN
+// AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+// PERFORMANCE OF THIS SOFTWARE.
+
+#pragma once
+#include <Foundation/tStandard.h>
+
+
+namespace Viewer
+{
+	void StartMemoryMonitor();
+	void StopMemoryMonitor();
+
+	// Call from the main thread with the bytes used by loaded images. Returns true if there was a new sample, in which
+	// case the auto budget was recomputed and should be enforced.
+	bool UpdateAutoImageMemBudget(int64 usedImageBytes);
+
+	// The auto budget if enabled, otherwise the configured one. Safe to call from any thread.
+	int64 GetImageMemBudget();
+
+	// Latest samples. Available is the smaller of free system memory and the headroom under any cgroup limit. It is -1
+	// if unknown. Pressure is the percentage of the last 10 seconds some task was stalled waiting for memory.
+	int64 GetAvailableMemBytes();
+	float GetMemPressure();
+}
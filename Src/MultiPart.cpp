@@ -0,0 +1,303 @@
+// MultiPart.cpp
+//
+// Functions to inspect image files that may contain more than one image (part). Only the file headers are read so
+// the parts can be enumerated without decoding anything.
+//
+// Copyright (c) 2020 Tristan Grimmer.
+// Permission to use, copy, modify, and/or distribute this software for any purpose with or without fee is hereby
+// granted, provided that the above copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+// INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN
+// AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+// PERFORMANCE OF THIS SOFTWARE.
+
+#include <cstdio>
+#include <cstring>
+#include <Foundation/tStandard.h>
+#include <Foundation/tFundamentals.h>
+#include "MultiPart.h"
+using namespace tSystem;
+
+
+namespace Viewer
+{
+	// The part counts are sanity limits. Anything bigger is treated as a corrupt header. Animations may have far more
+	// frames than files have parts, but each frame chunk costs a seek to count.
+	const int MaxFileParts = 4096;
+	const int MaxFileFrames = 1 << 20;
+
+	bool SkipFileString(FILE*, int& length);
+}
+
+
+bool Viewer::ReadFileBytes(FILE* file, void* dest, int numBytes)
+{
+	return fread(dest, 1, numBytes, file) == size_t(numBytes);
+}
+
+
+bool Viewer::ReadFileU16(FILE* file, uint16& value, bool bigEndian)
+{
+	uint8 b[2];
+	if (!ReadFileBytes(file, b, 2))
+		return false;
+
+	value = bigEndian ? uint16((b[0] << 8) | b[1]) : uint16((b[1] << 8) | b[0]);
+	return true;
+}
+
+
+bool Viewer::ReadFileU32(FILE* file, uint32& value, bool bigEndian)
+{
+	uint8 b[4];
+	if (!ReadFileBytes(file, b, 4))
+		return false;
+
+	if (bigEndian)
+		value = (uint32(b[0]) << 24) | (uint32(b[1]) << 16) | (uint32(b[2]) << 8) | uint32(b[3]);
+	else
+		value = (uint32(b[3]) << 24) | (uint32(b[2]) << 16) | (uint32(b[1]) << 8) | uint32(b[0]);
+	return true;
+}
+
+
+bool Viewer::SkipFileString(FILE* file, int& length)
+{
+	// Reads up to and including the null terminator. Exr names are limited to 255 chars.
+	length = 0;
+	for (;;)
+	{
+		int ch = fgetc(file);
+		if (ch == EOF)
+			return false;
+		if (ch == 0)
+			return true;
+		if (++length > 255)
+			return false;
+	}
+}
+
+
+int Viewer::GetNumFileParts(const tString& filename, tFileType fileType)
+{
+	switch (fileType)
+	{
+		case tFileType::EXR:	return GetNumEXRParts(filename);
+		case tFileType::TIFF:	return GetNumTIFFPages(filename);
+	}
+
+	return 0;
+}
+
+
+int Viewer::GetNumEXRParts(const tString& filename)
+{
+	FILE* file = fopen(filename.Chars(), "rb");
+	if (!file)
+		return 0;
+
+	// The version field has the multipart flag in bit 12. Single-part files have exactly one header.
+	uint32 magic = 0, version = 0;
+	int numParts = 0;
+	if (ReadFileU32(file, magic, false) && (magic == 20000630) && ReadFileU32(file, version, false))
+	{
+		if (!(version & 0x00001000))
+		{
+			numParts = 1;
+		}
+		else
+		{
+			// Multipart files have a sequence of headers, each a list of attributes terminated by a null byte. The
+			// sequence itself ends with an empty header (just a null byte).
+			bool ok = true;
+			while (ok && (numParts <= MaxFileParts))
+			{
+				int numAttributes = 0;
+				for (;;)
+				{
+					int nameLen = 0, typeLen = 0;
+					uint32 size = 0;
+					ok = SkipFileString(file, nameLen);
+					if (!ok || (nameLen == 0))
+						break;
+
+					ok = SkipFileString(file, typeLen) && ReadFileU32(file, size, false) && (fseek(file, long(size), SEEK_CUR) == 0);
+					if (!ok)
+						break;
+					numAttributes++;
+				}
+
+				if (!ok || (numAttributes == 0))
+					break;
+				numParts++;
+			}
+
+			if (!ok || (numParts > MaxFileParts))
+				numParts = 0;
+		}
+	}
+
+	fclose(file);
+	return numParts;
+}
+
+
+int Viewer::GetNumTIFFPages(const tString& filename)
+{
+	FILE* file = fopen(filename.Chars(), "rb");
+	if (!file)
+		return 0;
+
+	// Classic tiff only. BigTiff (version 43) uses 64 bit offsets and we let the probing path deal with it.
+	uint8 order[2];
+	uint16 version = 0;
+	uint32 ifdOffset = 0;
+	int numPages = 0;
+	bool bigEndian = false;
+	bool ok = ReadFileBytes(file, order, 2);
+	if (ok)
+	{
+		bigEndian = (order[0] == 'M') && (order[1] == 'M');
+		ok = (bigEndian || ((order[0] == 'I') && (order[1] == 'I'))) && ReadFileU16(file, version, bigEndian) && (version == 42);
+	}
+	ok = ok && ReadFileU32(file, ifdOffset, bigEndian);
+
+	// Walk the IFD chain. Each IFD is a 16 bit entry count, 12 bytes per entry, then the offset of the next IFD.
+	// A corrupt chain could loop forever. The page limit takes care of that.
+	uint32 prevOffset = 0;
+	while (ok && (ifdOffset != 0) && (ifdOffset != prevOffset) && (numPages < MaxFileParts))
+	{
+		uint16 numEntries = 0;
+		ok = (fseek(file, long(ifdOffset), SEEK_SET) == 0) && ReadFileU16(file, numEntries, bigEndian);
+		ok = ok && (fseek(file, long(numEntries)*12, SEEK_CUR) == 0);
+		if (!ok)
+			break;
+
+		numPages++;
+		prevOffset = ifdOffset;
+		if (!ReadFileU32(file, ifdOffset, bigEndian))
+			break;
+	}
+
+	fclose(file);
+	return (ok && (numPages < MaxFileParts)) ? numPages : 0;
+}
+
+
+bool Viewer::GetAnimFrameInfo(const tString& filename, tFileType fileType, int& width, int& height, int& numFrames)
+{
+	width = height = numFrames = 0;
+	switch (fileType)
+	{
+		case tFileType::WEBP:	return GetWEBPFrameInfo(filename, width, height, numFrames);
+		case tFileType::APNG:	return GetAPNGFrameInfo(filename, width, height, numFrames);
+	}
+
+	return false;
+}
+
+
+bool Viewer::GetWEBPFrameInfo(const tString& filename, int& width, int& height, int& numFrames)
+{
+	width = height = numFrames = 0;
+	FILE* file = fopen(filename.Chars(), "rb");
+	if (!file)
+		return false;
+
+	// A riff header then chunks of a fourcc, a little-endian size, and the data padded to an even length. Animations
+	// start with a VP8X chunk holding the canvas size and have one ANMF chunk per frame.
+	uint8 fourcc[4];
+	uint32 riffSize = 0;
+	bool ok =
+		ReadFileBytes(file, fourcc, 4) && !memcmp(fourcc, "RIFF", 4) && ReadFileU32(file, riffSize, false) &&
+		ReadFileBytes(file, fourcc, 4) && !memcmp(fourcc, "WEBP", 4);
+
+	bool first = true;
+	uint32 chunkSize = 0;
+	while (ok && ReadFileBytes(file, fourcc, 4) && ReadFileU32(file, chunkSize, false))
+	{
+		long skip = long(chunkSize + (chunkSize & 1));
+		if (first && !memcmp(fourcc, "VP8X", 4))
+		{
+			uint8 header[10];
+			ok = (chunkSize >= 10) && ReadFileBytes(file, header, 10);
+			if (ok)
+			{
+				width = 1 + (header[4] | (header[5] << 8) | (header[6] << 16));
+				height = 1 + (header[7] | (header[8] << 8) | (header[9] << 16));
+			}
+			skip -= 10;
+		}
+		else if (!memcmp(fourcc, "ANMF", 4))
+		{
+			numFrames++;
+		}
+		first = false;
+		ok = ok && (numFrames <= MaxFileFrames) && (fseek(file, skip, SEEK_CUR) == 0);
+	}
+
+	fclose(file);
+	if (!ok || (numFrames > MaxFileFrames))
+	{
+		width = height = numFrames = 0;
+		return false;
+	}
+
+	// Anything without frame chunks is a single still image.
+	numFrames = tMath::tMax(numFrames, 1);
+	return true;
+}
+
+
+bool Viewer::GetAPNGFrameInfo(const tString& filename, int& width, int& height, int& numFrames)
+{
+	width = height = numFrames = 0;
+	FILE* file = fopen(filename.Chars(), "rb");
+	if (!file)
+		return false;
+
+	// The signature then chunks of a big-endian size, a fourcc, the data and a crc. IHDR comes first and the acTL
+	// chunk with the frame count must come before the image data.
+	const uint8 signature[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n' };
+	uint8 header[8];
+	bool ok = ReadFileBytes(file, header, 8) && !memcmp(header, signature, 8);
+
+	uint8 fourcc[4];
+	uint32 chunkSize = 0;
+	while (ok && ReadFileU32(file, chunkSize, true) && ReadFileBytes(file, fourcc, 4))
+	{
+		if (!memcmp(fourcc, "IDAT", 4))
+			break;
+
+		long skip = long(chunkSize) + 4;
+		if (!memcmp(fourcc, "IHDR", 4) || !memcmp(fourcc, "acTL", 4))
+		{
+			uint32 a = 0, b = 0;
+			ok = (chunkSize >= 8) && ReadFileU32(file, a, true) && ReadFileU32(file, b, true);
+			if (fourcc[0] == 'I')
+			{
+				width = int(tMath::tMin(a, uint32(0x7FFFFFFF)));
+				height = int(tMath::tMin(b, uint32(0x7FFFFFFF)));
+			}
+			else
+			{
+				numFrames = int(tMath::tMin(a, uint32(0x7FFFFFFF)));
+			}
+			skip -= 8;
+		}
+		ok = ok && (fseek(file, skip, SEEK_CUR) == 0);
+	}
+
+	fclose(file);
+	if (!ok || (width <= 0) || (height <= 0))
+	{
+		width = height = numFrames = 0;
+		return false;
+	}
+
+	// Without an acTL chunk it's a plain png.
+	numFrames = tMath::tMax(numFrames, 1);
+	return true;
+}
@@ -0,0 +1,43 @@
+// MultiPart.h
+//
+// Functions to inspect image files that may contain more than one image (part). Only the file headers are read so
+// the parts can be enumerated without decoding anything.
+//
+// Copyright (c) 2020 Tristan Grimmer.
+// Permission to use, copy, modify, and/or distribute this software for any purpose with or without fee is hereby
+// granted, provided that the above copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+// INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN
+// AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+// PERFORMANCE OF THIS SOFTWARE.
+
+#pragma once
+#include <cstdio>
+#include <Foundation/tString.h>
+#include <System/tFile.h>
+
+
+namespace Viewer
+{
+	// Returns the number of parts in an exr (multi-part) or tiff (multi-page) file. Returns 0 if the file type is not
+	// supported or the header could not be parsed, in which case the caller should fall back to probing.
+	int GetNumFileParts(const tString& filename, tSystem::tFileType);
+
+	int GetNumEXRParts(const tString& filename);
+	int GetNumTIFFPages(const tString& filename);
+
+	// Reads the canvas size and frame count of an animated webp or apng from its chunks without decoding anything.
+	// The size is 0 by 0 for still webps, which don't need it. Returns false if the file type is not supported or the
+	// header could not be parsed.
+	bool GetAnimFrameInfo(const tString& filename, tSystem::tFileType, int& width, int& height, int& numFrames);
+
+	bool GetWEBPFrameInfo(const tString& filename, int& width, int& height, int& numFrames);
+	bool GetAPNGFrameInfo(const tString& filename, int& width, int& height, int& numFrames);
+
+	// Minimal little/big-endian readers over a stdio file. They return false on a short read.
+	bool ReadFileBytes(FILE*, void* dest, int numBytes);
+	bool ReadFileU16(FILE*, uint16&, bool bigEndian);
+	bool ReadFileU32(FILE*, uint32&, bool bigEndian);
+}
@@ -0,0 +1,462 @@
+// PackedImage.cpp
+//
+// A compressed copy of the pictures of an image that has been unloaded. Going back to it only needs a decompress
+// instead of decoding the file again, which for exr, hdr and big png files is a lot slower. The compression is a
+// simple byte oriented lz77 in the style of lz4 so both ways run at memory speeds. Each picture is split into bands of
+// rows that are packed and unpacked in parallel.
+//
+// Copyright (c) 2020 Tristan Grimmer.
+// Permission to use, copy, modify, and/or distribute this software for any purpose with or without fee is hereby
+// granted, provided that the above copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+// INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN
+// AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+// PERFORMANCE OF THIS SOFTWARE.
+
+#include <thread>
+#include <atomic>
+#include <cstring>
+#include <Foundation/tStandard.h>
+#include <Foundation/tFundamentals.h>
+#include <System/tMachine.h>
+#include "PackedImage.h"
+
+// Putting the channels back together is done 16 pixels at a time when SSE2 is available.
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && (_M_IX86_FP >= 2))
+#define PACKEDIMAGE_SSE2
+#include <emmintrin.h>
+#endif
+using namespace tImage;
+
+
+namespace
+{
+	// A plane stored as-is because it didn't compress has this bit set in its size.
+	const uint32 RawPlaneBit = 0x80000000;
+
+	const int HashBits = 12;
+	const int MinMatch = 4;
+	const int MaxOffset = 0xFFFF;
+
+	inline uint32 Read32(const uint8* p)																				{ uint32 v; memcpy(&v, p, 4); return v; }
+
+	// Writes a length that didn't fit in its token nibble as a run of 255s and a remainder.
+	inline bool WriteLength(uint8*& op, const uint8* oend, int length)
+	{
+		for (; length >= 255; length -= 255)
+		{
+			if (op >= oend)
+				return false;
+			*op++ = 255;
+		}
+		if (op >= oend)
+			return false;
+		*op++ = uint8(length);
+		return true;
+	}
+
+	inline bool ReadLength(const uint8*& ip, const uint8* iend, int& length)
+	{
+		uint8 b;
+		do
+		{
+			if (ip >= iend)
+				return false;
+			b = *ip++;
+			length += b;
+		} while (b == 255);
+		return true;
+	}
+
+	// A sequence is a token holding the literal and match lengths, the literals, then the match offset. The last
+	// sequence has no match.
+	bool WriteSequence(uint8*& op, const uint8* oend, const uint8* literals, int numLiterals, int offset, int matchLen)
+	{
+		if (op >= oend)
+			return false;
+
+		int matchCode = matchLen ? matchLen - MinMatch : 0;
+		uint8* token = op++;
+		*token = uint8((tMath::tMin(numLiterals, 15) << 4) | tMath::tMin(matchCode, 15));
+		if ((numLiterals >= 15) && !WriteLength(op, oend, numLiterals - 15))
+			return false;
+
+		if (numLiterals > oend - op)
+			return false;
+		memcpy(op, literals, numLiterals);
+		op += numLiterals;
+
+		if (!matchLen)
+			return true;
+
+		if (oend - op < 2)
+			return false;
+		*op++ = uint8(offset & 0xFF);
+		*op++ = uint8(offset >> 8);
+		if ((matchCode >= 15) && !WriteLength(op, oend, matchCode - 15))
+			return false;
+
+		return true;
+	}
+
+	// Returns the compressed size or -1 if it doesn't fit in dstCap bytes.
+	int Compress(const uint8* src, int srcSize, uint8* dst, int dstCap)
+	{
+		int table[1 << HashBits];
+		memset(table, 0, sizeof(table));
+
+		uint8* op = dst;
+		const uint8* oend = dst + dstCap;
+		int anchor = 0;
+		int pos = 0;
+		int misses = 0;
+
+		// Data that doesn't compress is skipped over faster and faster.
+		while (pos + MinMatch < srcSize)
+		{
+			uint32 seq = Read32(src + pos);
+			uint32 hash = (seq * 2654435761u) >> (32 - HashBits);
+			int candidate = table[hash] - 1;
+			table[hash] = pos + 1;
+			if ((candidate < 0) || (pos - candidate > MaxOffset) || (Read32(src + candidate) != seq))
+			{
+				pos += 1 + (misses++ >> 6);
+				continue;
+			}
+
+			int matchLen = MinMatch;
+			while ((pos + matchLen < srcSize) && (src[candidate + matchLen] == src[pos + matchLen]))
+				matchLen++;
+
+			if (!WriteSequence(op, oend, src + anchor, pos - anchor, pos - candidate, matchLen))
+				return -1;
+
+			pos += matchLen;
+			anchor = pos;
+			misses = 0;
+		}
+
+		if (!WriteSequence(op, oend, src + anchor, srcSize - anchor, 0, 0))
+			return -1;
+
+		return int(op - dst);
+	}
+
+	bool Decompress(const uint8* src, int srcSize, uint8* dst, int dstSize)
+	{
+		const uint8* ip = src;
+		const uint8* iend = src + srcSize;
+		uint8* op = dst;
+		uint8* oend = dst + dstSize;
+		while (ip < iend)
+		{
+			uint8 token = *ip++;
+			int numLiterals = token >> 4;
+			if ((numLiterals == 15) && !ReadLength(ip, iend, numLiterals))
+				return false;
+
+			if ((numLiterals > oend - op) || (numLiterals > iend - ip))
+				return false;
+			memcpy(op, ip, numLiterals);
+			op += numLiterals;
+			ip += numLiterals;
+
+			// The last sequence ends after its literals.
+			if (ip >= iend)
+				break;
+
+			if (iend - ip < 2)
+				return false;
+			int offset = ip[0] | (ip[1] << 8);
+			ip += 2;
+			int matchLen = token & 0x0F;
+			if ((matchLen == 15) && !ReadLength(ip, iend, matchLen))
+				return false;
+			matchLen += MinMatch;
+
+			if ((offset == 0) || (offset > op - dst) || (matchLen > oend - op))
+				return false;
+
+			// Matches may overlap what they are writing which repeats the pattern.
+			const uint8* match = op - offset;
+			if (offset >= matchLen)
+			{
+				memcpy(op, match, matchLen);
+				op += matchLen;
+			}
+			else
+			{
+				for (int m = 0; m < matchLen; m++)
+					*op++ = *match++;
+			}
+		}
+
+		return op == oend;
+	}
+
+	void Interleave(tPixel* dest, const uint8* r, const uint8* g, const uint8* b, const uint8* a, int numPixels)
+	{
+		int i = 0;
+		#ifdef PACKEDIMAGE_SSE2
+		for (; i + 16 <= numPixels; i += 16)
+		{
+			__m128i vr = _mm_loadu_si128((const __m128i*)(r + i));
+			__m128i vg = _mm_loadu_si128((const __m128i*)(g + i));
+			__m128i vb = _mm_loadu_si128((const __m128i*)(b + i));
+			__m128i va = _mm_loadu_si128((const __m128i*)(a + i));
+			__m128i rgLo = _mm_unpacklo_epi8(vr, vg);
+			__m128i rgHi = _mm_unpackhi_epi8(vr, vg);
+			__m128i baLo = _mm_unpacklo_epi8(vb, va);
+			__m128i baHi = _mm_unpackhi_epi8(vb, va);
+			__m128i* out = (__m128i*)(dest + i);
+			_mm_storeu_si128(out + 0, _mm_unpacklo_epi16(rgLo, baLo));
+			_mm_storeu_si128(out + 1, _mm_unpackhi_epi16(rgLo, baLo));
+			_mm_storeu_si128(out + 2, _mm_unpacklo_epi16(rgHi, baHi));
+			_mm_storeu_si128(out + 3, _mm_unpackhi_epi16(rgHi, baHi));
+		}
+		#endif
+
+		for (; i < numPixels; i++)
+		{
+			dest[i].R = r[i];
+			dest[i].G = g[i];
+			dest[i].B = b[i];
+			dest[i].A = a[i];
+		}
+	}
+
+	// Runs numJobs jobs on as many cores as there are. The calling thread is one of the workers.
+	template<typename Fn> void RunJobs(int numJobs, Fn fn)
+	{
+		std::atomic<int> nextJob(0);
+		auto worker = [numJobs, &fn, &nextJob]()
+		{
+			for (int j = nextJob++; j < numJobs; j = nextJob++)
+				fn(j);
+		};
+
+		int numHelpers = tMath::tClamp(tSystem::tGetNumCores(), 1, tMath::tMax(numJobs, 1)) - 1;
+		std::thread* helpers = numHelpers ? new std::thread[numHelpers] : nullptr;
+		for (int h = 0; h < numHelpers; h++)
+			helpers[h] = std::thread(worker);
+		worker();
+		for (int h = 0; h < numHelpers; h++)
+			helpers[h].join();
+
+		delete[] helpers;
+	}
+}
+
+
+Viewer::PackedImage::PackedImage(const tList<tPicture>& pictures)
+{
+	int numParts = pictures.Count();
+	if (numParts <= 0)
+		return;
+
+	Parts = new Part[numParts];
+	const tPixel** pixels = new const tPixel*[numParts];
+	int p = 0;
+	for (tPicture* picture = pictures.First(); picture; picture = picture->Next(), p++)
+	{
+		Part& part = Parts[p];
+		part.Width = picture->GetWidth();
+		part.Height = picture->GetHeight();
+		part.Duration = picture->Duration;
+		part.NumBands = (part.Height + BandRows - 1) / BandRows;
+		part.Bands = new uint8*[part.NumBands];
+		for (int b = 0; b < part.NumBands; b++)
+			part.Bands[b] = nullptr;
+		pixels[p] = picture->GetPixelPointer();
+	}
+	NumParts = numParts;
+
+	Job* jobs = nullptr;
+	int numJobs = MakeJobs(jobs);
+	RunJobs(numJobs, [this, jobs, pixels](int j) { PackBand(pixels[jobs[j].Part], jobs[j].Part, jobs[j].Band); });
+	delete[] jobs;
+	delete[] pixels;
+
+	NumBytes = int64(sizeof(PackedImage)) + int64(NumParts) * int64(sizeof(Part));
+	for (int q = 0; q < NumParts; q++)
+	{
+		for (int b = 0; b < Parts[q].NumBands; b++)
+		{
+			uint32 sizes[4];
+			memcpy(sizes, Parts[q].Bands[b], sizeof(sizes));
+			NumBytes += sizeof(sizes);
+			for (int c = 0; c < 4; c++)
+				NumBytes += sizes[c] & ~RawPlaneBit;
+		}
+	}
+}
+
+
+Viewer::PackedImage::~PackedImage()
+{
+	for (int p = 0; p < NumParts; p++)
+	{
+		for (int b = 0; b < Parts[p].NumBands; b++)
+			delete[] Parts[p].Bands[b];
+		delete[] Parts[p].Bands;
+	}
+	delete[] Parts;
+}
+
+
+int Viewer::PackedImage::MakeJobs(Job*& jobs) const
+{
+	int numJobs = 0;
+	for (int p = 0; p < NumParts; p++)
+		numJobs += Parts[p].NumBands;
+
+	jobs = new Job[numJobs];
+	int j = 0;
+	for (int p = 0; p < NumParts; p++)
+		for (int b = 0; b < Parts[p].NumBands; b++)
+			jobs[j++] = { p, b };
+
+	return numJobs;
+}
+
+
+void Viewer::PackedImage::PackBand(const tPixel* pixels, int p, int band)
+{
+	const Part& part = Parts[p];
+	int firstRow = band*BandRows;
+	int numPixels = part.Width * tMath::tMin(BandRows, part.Height - firstRow);
+	int numBytes = 0;
+	Parts[p].Bands[band] = PackPixels(pixels + int64(firstRow) * int64(part.Width), numPixels, numBytes);
+}
+
+
+bool Viewer::PackedImage::UnpackBand(tPixel* pixels, int p, int band) const
+{
+	const Part& part = Parts[p];
+	int firstRow = band*BandRows;
+	int numPixels = part.Width * tMath::tMin(BandRows, part.Height - firstRow);
+	const uint8* data = part.Bands[band];
+
+	// Bands are only ever made by PackPixels so the size comes from the band itself.
+	uint32 sizes[4];
+	memcpy(sizes, data, sizeof(sizes));
+	int numBytes = sizeof(sizes);
+	for (int c = 0; c < 4; c++)
+		numBytes += int(sizes[c] & ~RawPlaneBit);
+
+	return UnpackPixels(pixels + int64(firstRow) * int64(part.Width), numPixels, data, numBytes);
+}
+
+
+uint8* Viewer::PackPixels(const tPixel* src, int numPixels, int& numBytes)
+{
+	// Splitting the channels up means an opaque alpha channel packs down to almost nothing, and flat areas in one
+	// channel pack well even when the others are busy.
+	uint8* planes = new uint8[numPixels*4];
+	for (int i = 0; i < numPixels; i++)
+	{
+		planes[i]				= src[i].R;
+		planes[numPixels+i]		= src[i].G;
+		planes[numPixels*2+i]	= src[i].B;
+		planes[numPixels*3+i]	= src[i].A;
+	}
+
+	uint8* packed = new uint8[numPixels*4];
+	uint32 sizes[4];
+	int total = sizeof(sizes);
+	for (int c = 0; c < 4; c++)
+	{
+		int size = Compress(planes + numPixels*c, numPixels, packed + numPixels*c, numPixels - 1);
+		sizes[c] = (size < 0) ? (uint32(numPixels) | RawPlaneBit) : uint32(size);
+		total += (size < 0) ? numPixels : size;
+	}
+
+	uint8* data = new uint8[total];
+	memcpy(data, sizes, sizeof(sizes));
+	uint8* dest = data + sizeof(sizes);
+	for (int c = 0; c < 4; c++)
+	{
+		const uint8* plane = (sizes[c] & RawPlaneBit) ? (planes + numPixels*c) : (packed + numPixels*c);
+		int size = int(sizes[c] & ~RawPlaneBit);
+		memcpy(dest, plane, size);
+		dest += size;
+	}
+
+	delete[] packed;
+	delete[] planes;
+	numBytes = total;
+	return data;
+}
+
+
+bool Viewer::UnpackPixels(tPixel* dest, int numPixels, const uint8* data, int numBytes)
+{
+	uint32 sizes[4];
+	if (numBytes < int(sizeof(sizes)))
+		return false;
+	memcpy(sizes, data, sizeof(sizes));
+	const uint8* src = data + sizeof(sizes);
+	const uint8* end = data + numBytes;
+
+	// Raw planes are used where they are. Only the packed ones need somewhere to go.
+	uint8* scratch = new uint8[numPixels*4];
+	const uint8* planes[4];
+	bool ok = true;
+	for (int c = 0; (c < 4) && ok; c++)
+	{
+		int size = int(sizes[c] & ~RawPlaneBit);
+		ok = (size <= end - src);
+		if (ok && (sizes[c] & RawPlaneBit))
+		{
+			ok = (size == numPixels);
+			planes[c] = src;
+		}
+		else if (ok)
+		{
+			ok = Decompress(src, size, scratch + numPixels*c, numPixels);
+			planes[c] = scratch + numPixels*c;
+		}
+		src += size;
+	}
+
+	if (ok)
+		Interleave(dest, planes[0], planes[1], planes[2], planes[3], numPixels);
+
+	delete[] scratch;
+	return ok;
+}
+
+
+bool Viewer::PackedImage::Unpack(tList<tPicture>& pictures) const
+{
+	if (!IsValid())
+		return false;
+
+	tPixel** pixels = new tPixel*[NumParts];
+	for (int p = 0; p < NumParts; p++)
+		pixels[p] = new tPixel[int64(Parts[p].Width) * int64(Parts[p].Height)];
+
+	Job* jobs = nullptr;
+	int numJobs = MakeJobs(jobs);
+	std::atomic<bool> ok(true);
+	RunJobs(numJobs, [this, jobs, pixels, &ok](int j) { if (!UnpackBand(pixels[jobs[j].Part], jobs[j].Part, jobs[j].Band)) ok = false; });
+	delete[] jobs;
+
+	for (int p = 0; p < NumParts; p++)
+	{
+		if (!ok)
+		{
+			delete[] pixels[p];
+			continue;
+		}
+
+		tPicture* picture = new tPicture(Parts[p].Width, Parts[p].Height, pixels[p], false);
+		picture->Duration = Parts[p].Duration;
+		pictures.Append(picture);
+	}
+
+	delete[] pixels;
+	return ok;
+}
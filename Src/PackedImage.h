@@ -0,0 +1,80 @@
+// PackedImage.h
+//
+// A compressed copy of the pictures of an image that has been unloaded. Going back to it only needs a decompress
+// instead of decoding the file again, which for exr, hdr and big png files is a lot slower. The compression is a
+// simple byte oriented lz77 in the style of lz4 so both ways run at memory speeds. Each picture is split into bands of
+// rows that are packed and unpacked in parallel.
+//
+// Copyright (c) 2020 Tristan Grimmer.
+// Permission to use, copy, modify, and/or distribute this software for any purpose with or without fee is hereby
+// granted, provided that the above copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+// INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN
+// AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+// PERFORMANCE OF THIS SOFTWARE.
+
+#pragma once
+#include <Foundation/tList.h>
+#include <Image/tPicture.h>
+#include <Image/tPixelFormat.h>
+namespace Viewer
+{
+
+
+// Single threaded lossless packing of a run of pixels. The channels are split into planes and each is compressed on
+// its own. This is the format PackedImage uses for each band. The caller must delete[] the returned data.
+uint8* PackPixels(const tPixel* pixels, int numPixels, int& numBytes);
+
+// Returns false if the data is corrupt or does not hold exactly numPixels pixels.
+bool UnpackPixels(tPixel* dest, int numPixels, const uint8* data, int numBytes);
+
+
+class PackedImage
+{
+public:
+	// All pictures must be valid and hold pixels.
+	PackedImage(const tList<tImage::tPicture>& pictures);
+	~PackedImage();
+
+	bool IsValid() const																								{ return NumParts > 0; }
+	int GetNumParts() const																								{ return NumParts; }
+
+	// Appends a new picture for every part. Durations are restored too. Returns false if the data is corrupt, in which
+	// case nothing is appended.
+	bool Unpack(tList<tImage::tPicture>& pictures) const;
+
+	int64 GetNumBytes() const																							{ return NumBytes; }
+	tImage::tPixelFormat SrcPixelFormat = tImage::tPixelFormat::Invalid;
+
+	// Rows per band. Bands are the unit of work for the threads.
+	static const int BandRows = 64;
+
+private:
+	struct Part
+	{
+		int Width;
+		int Height;
+		float Duration;
+		int NumBands;
+		uint8** Bands;				// Each band is four plane sizes followed by the planes.
+	};
+
+	struct Job
+	{
+		int Part;
+		int Band;
+	};
+
+	int MakeJobs(Job*&) const;
+	void PackBand(const tPixel* pixels, int part, int band);
+	bool UnpackBand(tPixel* pixels, int part, int band) const;
+
+	Part* Parts			= nullptr;
+	int NumParts		= 0;
+	int64 NumBytes		= 0;
+};
+
+
+}
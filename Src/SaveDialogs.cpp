@@ -15,6 +15,7 @@
 #include "imgui.h"
 #include "SaveDialogs.h"
 #include "Image.h"
+#include "ImageCache.h"
 #include "TacentView.h"
 using namespace tStd;
 using namespace tSystem;
@@ -90,16 +91,18 @@ bool Viewer::SaveImageAs(Image& img, const tString& outFile, int width, int heig
 	if (!imageLoaded)
 		img.Load();
 
+	// Dds images only decode to RGBA when asked. Reduced jpgs are reloaded at full size.
+	img.RequireFullResolution();
 	tPicture* currPic = img.GetCurrentPic();
-	if (!currPic)
+	if (!currPic || !currPic->IsValid())
 		return false;
 
 	// Make a temp copy we can safely resize.
 	tImage::tPicture outPic;
 	outPic.Set(*currPic);
 
-	// Restore loadedness.
-	if (!imageLoaded)
+	// Restore loadedness. An image that had been spilled goes back to its spill file since its edits aren't saved yet.
+	if (!imageLoaded && !(img.IsDirty() && img.UnloadSpilled()))
 		img.Unload();
 
 	int outW = outPic.GetWidth();
@@ -155,6 +158,7 @@ bool Viewer::SaveImageAs(Image& img, const tString& outFile, int width, int heig
 void Viewer::DoSaveAsModalDialog(bool justOpened)
 {
 	tAssert(CurrImage);
+	CurrImage->RequireFullResolution();
 	tPicture* picture = CurrImage->GetCurrentPic();
 	tAssert(picture);
 
@@ -555,7 +559,8 @@ void Viewer::AddSavedImageIfNecessary(const tString& savedFile)
 		// Add to list. It's still unloaded.
 		Image* newImg = new Image(savedFile);
 		Images.Append(newImg);
-		ImagesLoadTimeSorted.Append(newImg);
+		ImagesCache.Add(newImg);
+		ImagesVersion++;
 	}
 }
 
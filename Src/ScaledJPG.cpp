@@ -0,0 +1,231 @@
+// ScaledJPG.cpp
+//
+// Reduced resolution jpg decoding. libjpeg-turbo can scale by 1/2, 1/4 or 1/8 while doing the inverse DCT which is a
+// lot faster than decoding the full image and resampling it afterwards.
+//
+// Copyright (c) 2020 Tristan Grimmer.
+// Permission to use, copy, modify, and/or distribute this software for any purpose with or without fee is hereby
+// granted, provided that the above copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+// INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN
+// AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+// PERFORMANCE OF THIS SOFTWARE.
+
+#include <climits>
+#include <System/tFile.h>
+#ifdef VIEWER_TURBOJPEG
+#include <turbojpeg.h>
+#endif
+#include "ScaledJPG.h"
+#include "MappedFile.h"
+
+
+namespace
+{
+	// Jpgs can be up to 65535 on a side. Anything bigger than this is left to the regular loader.
+	const int64 MaxScaledPixels = int64(1) << 28;
+}
+
+
+tPixel* Viewer::LoadScaledJPG(const tString& filename, int minWidth, int minHeight, int& width, int& height, int& scaleDenom, bool strict)
+{
+	width = height = 0;
+	scaleDenom = 1;
+
+	#ifdef VIEWER_TURBOJPEG
+	MappedFile file(filename);
+	if (!file.IsValid())
+		return nullptr;
+
+	return DecodeScaledJPG(file.GetData(), file.GetSize(), minWidth, minHeight, width, height, scaleDenom, strict);
+
+	#else
+	return nullptr;
+	#endif
+}
+
+
+tPixel* Viewer::LoadJPG(const tString& filename, int& width, int& height, bool strict)
+{
+	// No reduced size is ever big enough so the scale stays at 1.
+	int scaleDenom = 1;
+	return LoadScaledJPG(filename, INT_MAX, INT_MAX, width, height, scaleDenom, strict);
+}
+
+
+tPixel* Viewer::DecodeScaledJPG(const uint8* jpgData, int numBytes, int minWidth, int minHeight, int& width, int& height, int& scaleDenom, bool strict)
+{
+	width = height = 0;
+	scaleDenom = 1;
+
+	#ifdef VIEWER_TURBOJPEG
+	if (!jpgData || (numBytes <= 0))
+		return nullptr;
+
+	tjhandle decompressor = tjInitDecompress();
+	if (!decompressor)
+		return nullptr;
+
+	int srcWidth = 0, srcHeight = 0, subsamp = 0, colourspace = 0;
+	if (tjDecompressHeader3(decompressor, jpgData, numBytes, &srcWidth, &srcHeight, &subsamp, &colourspace) < 0)
+	{
+		tjDestroy(decompressor);
+		return nullptr;
+	}
+
+	// Largest reduction first. The scaled size rounds up so a denominator only counts if both sides stay big enough.
+	for (int denom = 8; denom > 1; denom >>= 1)
+	{
+		tjscalingfactor factor = { 1, denom };
+		if ((TJSCALED(srcWidth, factor) >= minWidth) && (TJSCALED(srcHeight, factor) >= minHeight))
+		{
+			scaleDenom = denom;
+			break;
+		}
+	}
+
+	tjscalingfactor factor = { 1, scaleDenom };
+	width = TJSCALED(srcWidth, factor);
+	height = TJSCALED(srcHeight, factor);
+	int64 numPixels = int64(width) * int64(height);
+	if ((numPixels <= 0) || (numPixels > MaxScaledPixels))
+	{
+		tjDestroy(decompressor);
+		width = height = 0;
+		scaleDenom = 1;
+		return nullptr;
+	}
+	tPixel* pixels = new tPixel[numPixels];
+
+	// Like the regular loader, warnings about damaged data only stop the decode when loading strictly.
+	int flags = TJFLAG_BOTTOMUP | (strict ? TJFLAG_STOPONWARNING : 0);
+	int result = tjDecompress2(decompressor, jpgData, numBytes, (uint8*)pixels, width, 0, height, TJPF_RGBA, flags);
+	bool ok = (result == 0) || (!strict && (tjGetErrorCode(decompressor) == TJERR_WARNING));
+
+	tjDestroy(decompressor);
+	if (ok)
+		return pixels;
+
+	delete[] pixels;
+	#endif
+
+	width = height = 0;
+	scaleDenom = 1;
+	return nullptr;
+}
+
+
+uint8* Viewer::EncodeJPG(const tPixel* pixels, int width, int height, int quality, int& numBytes)
+{
+	numBytes = 0;
+
+	#ifdef VIEWER_TURBOJPEG
+	if (!pixels || (width <= 0) || (height <= 0))
+		return nullptr;
+
+	tjhandle compressor = tjInitCompress();
+	if (!compressor)
+		return nullptr;
+
+	// No chroma subsampling. These are used for small images where colour edges show.
+	unsigned long bufSize = tjBufSize(width, height, TJSAMP_444);
+	uint8* jpgData = new uint8[bufSize];
+	unsigned long jpgSize = bufSize;
+	int flags = TJFLAG_BOTTOMUP | TJFLAG_NOREALLOC;
+	int result = tjCompress2(compressor, (const uint8*)pixels, width, 0, height, TJPF_RGBA, &jpgData, &jpgSize, TJSAMP_444, quality, flags);
+	tjDestroy(compressor);
+	if (result == 0)
+	{
+		numBytes = int(jpgSize);
+		return jpgData;
+	}
+
+	delete[] jpgData;
+	#endif
+
+	return nullptr;
+}
+
+
+bool Viewer::CanEncodeJPG()
+{
+	#ifdef VIEWER_TURBOJPEG
+	return true;
+	#else
+	return false;
+	#endif
+}
+
+
+bool Viewer::DecodeJPG(tPixel* dest, int width, int height, const uint8* jpgData, int numBytes)
+{
+	#ifdef VIEWER_TURBOJPEG
+	int srcWidth = 0, srcHeight = 0;
+	if (!dest || !GetJPGSize(jpgData, numBytes, srcWidth, srcHeight) || (srcWidth != width) || (srcHeight != height))
+		return false;
+
+	tjhandle decompressor = tjInitDecompress();
+	if (!decompressor)
+		return false;
+
+	int result = tjDecompress2(decompressor, jpgData, numBytes, (uint8*)dest, width, 0, height, TJPF_RGBA, TJFLAG_BOTTOMUP);
+	tjDestroy(decompressor);
+	return result == 0;
+
+	#else
+	return false;
+	#endif
+}
+
+
+bool Viewer::IsJPGFrameMarker(int marker)
+{
+	// SOF0 to SOF15 except DHT (C4), JPG (C8) and DAC (CC), which share the range.
+	return (marker >= 0xC0) && (marker <= 0xCF) && (marker != 0xC4) && (marker != 0xC8) && (marker != 0xCC);
+}
+
+
+bool Viewer::GetJPGSize(const uint8* jpgData, int numBytes, int& width, int& height)
+{
+	width = height = 0;
+	if (!jpgData || (numBytes < 4) || (jpgData[0] != 0xFF) || (jpgData[1] != 0xD8))
+		return false;
+
+	int pos = 2;
+	while (pos + 4 <= numBytes)
+	{
+		if (jpgData[pos] != 0xFF)
+			return false;
+
+		// Markers may be preceded by any number of fill bytes.
+		int marker = jpgData[pos+1];
+		if (marker == 0xFF)
+		{
+			pos++;
+			continue;
+		}
+
+		// The frame header always comes before the first scan.
+		if ((marker == 0xDA) || (marker == 0xD9))
+			return false;
+
+		int length = (jpgData[pos+2] << 8) | jpgData[pos+3];
+		if (IsJPGFrameMarker(marker))
+		{
+			if (pos + 9 > numBytes)
+				return false;
+
+			height = (jpgData[pos+5] << 8) | jpgData[pos+6];
+			width = (jpgData[pos+7] << 8) | jpgData[pos+8];
+			return (width > 0) && (height > 0);
+		}
+
+		if (length < 2)
+			return false;
+		pos += 2 + length;
+	}
+
+	return false;
+}
@@ -0,0 +1,46 @@
+// ScaledJPG.h
+//
+// Reduced resolution jpg decoding. libjpeg-turbo can scale by 1/2, 1/4 or 1/8 while doing the inverse DCT which is a
+// lot faster than decoding the full image and resampling it afterwards.
+//
+// Copyright (c) 2020 Tristan Grimmer.
+// Permission to use, copy, modify, and/or distribute this software for any purpose with or without fee is hereby
+// granted, provided that the above copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+// INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN
+// AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+// PERFORMANCE OF THIS SOFTWARE.
+
+#pragma once
+#include <Foundation/tString.h>
+#include <Math/tColour.h>
+
+
+namespace Viewer
+{
+	// Decodes the jpg at the smallest scale that is still at least minWidth by minHeight. scaleDenom is set to 1, 2, 4
+	// or 8. The returned pixels are in tPicture (bottom-up) row order and the caller must delete[] them. Returns nullptr
+	// if the file could not be decoded or if the build has no direct access to libjpeg-turbo, in which case the caller
+	// should use the regular full size loader.
+	tPixel* LoadScaledJPG(const tString& filename, int minWidth, int minHeight, int& width, int& height, int& scaleDenom, bool strict);
+
+	// Decodes the jpg at full size straight from the mapped file. Returns nullptr in the same cases as LoadScaledJPG.
+	tPixel* LoadJPG(const tString& filename, int& width, int& height, bool strict);
+
+	// Same as LoadScaledJPG but for a jpg already in memory.
+	tPixel* DecodeScaledJPG(const uint8* jpgData, int numBytes, int minWidth, int minHeight, int& width, int& height, int& scaleDenom, bool strict);
+
+	// Compresses the pixels, which are in tPicture row order, to a jpg in memory. Alpha is ignored. The caller must
+	// delete[] the returned data. Returns nullptr if the build has no direct access to libjpeg-turbo.
+	uint8* EncodeJPG(const tPixel* pixels, int width, int height, int quality, int& numBytes);
+	bool CanEncodeJPG();
+
+	// Decodes a jpg at full size into dest, which must hold exactly width*height pixels. Alpha is set to 255.
+	bool DecodeJPG(tPixel* dest, int width, int height, const uint8* jpgData, int numBytes);
+
+	// Reads the image size from the frame header. Only the markers are parsed so this works without libjpeg-turbo.
+	bool GetJPGSize(const uint8* jpgData, int numBytes, int& width, int& height);
+	bool IsJPGFrameMarker(int marker);
+}
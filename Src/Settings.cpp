@@ -51,10 +51,20 @@ void Viewer::Settings::ResetBehaviourSettings()
 	SaveFileTargaRLE			= false;
 	SaveFileJpegQuality			= 95;
 	SaveAllSizeMode				= 0;
+	AutoImageMem				= false;
 	MaxImageMemMB				= 1024;
-	MaxCacheFiles				= 7000;
+	MaxVRAMMB					= 1024;
+	MaxThumbVRAMMB				= 256;
+	MaxPackedMemMB				= 512;
+	GPUResident					= false;
+	PrefetchAhead				= 3;
+	MaxThumbMemMB				= 256;
+	MaxThumbCacheMB				= 512;
+	DecodedCache				= false;
+	MaxDecodedCacheMB			= 8192;
 	StrictLoading				= false;
 	DetectAPNGInsidePNG			= true;
+	ReducedJPGLoad				= true;
 	AutoPropertyWindow			= true;
 	AutoPlayAnimatedImages		= true;
 	MonitorGamma				= tMath::DefaultGamma;
@@ -120,10 +130,20 @@ void Viewer::Settings::Load(const tString& filename, int screenW, int screenH)
 				ReadItem(SaveFileTargaRLE);
 				ReadItem(SaveFileJpegQuality);
 				ReadItem(SaveAllSizeMode);
+				ReadItem(AutoImageMem);
 				ReadItem(MaxImageMemMB);
-				ReadItem(MaxCacheFiles);
+				ReadItem(MaxVRAMMB);
+				ReadItem(MaxThumbVRAMMB);
+				ReadItem(MaxPackedMemMB);
+				ReadItem(GPUResident);
+				ReadItem(PrefetchAhead);
+				ReadItem(MaxThumbMemMB);
+				ReadItem(MaxThumbCacheMB);
+				ReadItem(DecodedCache);
+				ReadItem(MaxDecodedCacheMB);
 				ReadItem(StrictLoading);
 				ReadItem(DetectAPNGInsidePNG);
+				ReadItem(ReducedJPGLoad);
 				ReadItem(AutoPropertyWindow);
 				ReadItem(AutoPlayAnimatedImages);
 				ReadItem(MonitorGamma);
@@ -142,7 +162,13 @@ void Viewer::Settings::Load(const tString& filename, int screenW, int screenH)
 	tiClamp(ThumbnailWidth, float(Image::ThumbMinDispWidth), float(Image::ThumbWidth));
 	tiClamp(SortKey, 0, 3);
 	tiClampMin(MaxImageMemMB, 256);
-	tiClampMin(MaxCacheFiles, 200);
+	tiClampMin(MaxVRAMMB, 128);
+	tiClamp(MaxThumbVRAMMB, 32, 4096);
+	tiClamp(MaxPackedMemMB, 0, 65536);
+	tiClamp(PrefetchAhead, 0, 8);
+	tiClamp(MaxThumbMemMB, 32, 16384);
+	tiClamp(MaxThumbCacheMB, 16, 65536);
+	tiClamp(MaxDecodedCacheMB, 256, 1048576);
 	tiClamp(SaveAllSizeMode, 0, 3);
 	tiClamp(SaveFileJpegQuality, 1, 100);
 }
@@ -181,10 +207,20 @@ bool Viewer::Settings::Save(const tString& filename)
 	WriteItem(SaveFileTargaRLE);
 	WriteItem(SaveFileJpegQuality);
 	WriteItem(SaveAllSizeMode);
+	WriteItem(AutoImageMem);
 	WriteItem(MaxImageMemMB);
-	WriteItem(MaxCacheFiles);
+	WriteItem(MaxVRAMMB);
+	WriteItem(MaxThumbVRAMMB);
+	WriteItem(MaxPackedMemMB);
+	WriteItem(GPUResident);
+	WriteItem(PrefetchAhead);
+	WriteItem(MaxThumbMemMB);
+	WriteItem(MaxThumbCacheMB);
+	WriteItem(DecodedCache);
+	WriteItem(MaxDecodedCacheMB);
 	WriteItem(StrictLoading);
 	WriteItem(DetectAPNGInsidePNG);
+	WriteItem(ReducedJPGLoad);
 	WriteItem(AutoPropertyWindow);
 	WriteItem(AutoPlayAnimatedImages);
 	WriteItem(MonitorGamma);
@@ -73,10 +73,20 @@ namespace Viewer
 			SetHeightRetainAspect
 		};
 		int SaveAllSizeMode;
-		int MaxImageMemMB;					// Max image mem before unloading images.
-		int MaxCacheFiles;					// Max number of cache files before removing oldest.
+		bool AutoImageMem;					// Work out the max image mem from free system and container memory.
+		int MaxImageMemMB;					// Max image mem before unloading images. Not used in auto mode.
+		int MaxVRAMMB;						// Max texture mem before least recently drawn textures are freed.
+		int MaxThumbVRAMMB;					// Part of MaxVRAMMB for the thumbnail atlas. At most half of it is used.
+		int MaxPackedMemMB;					// Max mem for compressed copies of unloaded images. 0 disables.
+		bool GPUResident;					// Free the pixels of an image once it is in VRAM and read back when needed.
+		int PrefetchAhead;					// Num images to decode ahead in the direction of travel. 0 disables.
+		int MaxThumbMemMB;					// Max mem for thumbnail pixels before those furthest from view are freed.
+		int MaxThumbCacheMB;				// Max disk space for cached thumbnails before removing least recently used.
+		bool DecodedCache;					// Keep decoded exr, hdr and tiff pictures on disk for faster loading.
+		int MaxDecodedCacheMB;				// Max disk space for decoded pictures before removing least recently used.
 		bool StrictLoading;					// No attempt to display ill-formed images.
 		bool DetectAPNGInsidePNG;			// Look for APNG data (animated) hidden inside a regular PNG file.
+		bool ReducedJPGLoad;				// Decode jpgs at a reduced size when they are fit to the screen.
 		bool AutoPropertyWindow;			// Auto display property editor window for supported file types.
 		bool AutoPlayAnimatedImages;		// Automatically play animated gifs, apngs, and WebPs.
 		float MonitorGamma;					// Used when displaying HDR formats to do gamma correction.
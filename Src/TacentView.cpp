@@ -40,6 +40,14 @@
 #include "imgui_internal.h"			// For ProgressArc.
 #include "TacentView.h"
 #include "Image.h"
+#include "ImageCache.h"
+#include "ThumbnailCache.h"
+#include "MemoryBudget.h"
+#include "DecodedCache.h"
+#include "TextureCache.h"
+#include "TextureReadback.h"
+#include "ThumbnailAtlas.h"
+#include "ThumbnailResidency.h"
 #include "Dialogs.h"
 #include "ContactSheet.h"
 #include "ContentView.h"
@@ -59,9 +67,22 @@ namespace Viewer
 	tString ImagesDir;
 	tList<tStringItem> ImagesSubDirs;
 	tList<Image> Images;
-	tItList<Image> ImagesLoadTimeSorted(tListMode::External);		// We don't need static here cuz the list is only used after main().
+	ImageCache ImagesCache;
+	TextureCache TexturesCache;
+	ThumbnailAtlas ThumbnailsAtlas;
+	ThumbnailResidency ThumbnailsResidency;
 	tuint256 ImagesHash												= 0;
+	uint ImagesVersion												= 0;
 	Image* CurrImage												= nullptr;
+	Image* PendingLoadImage											= nullptr;	// The current image if it is loading asynchronously.
+	Image* FullResImage												= nullptr;	// The current image if it is being reloaded at full resolution.
+	int FullResScale												= 1;		// The reduction it had before the reload.
+
+	// Images, other than the current one, with an outstanding asynchronous load. This includes prefetches and images
+	// we navigated away from before they finished loading. We poll them so the workers get joined.
+	const int MaxBackgroundLoads									= 16;
+	Image* BackgroundLoads[MaxBackgroundLoads]						= { };
+	int NavDirection												= 1;		// 1 is forwards. -1 is backwards.
 	
 	void LoadAppImages(const tString& dataDir);
 	void UnloadAppImages();
@@ -164,13 +185,6 @@ namespace Viewer
 
 	// When compare functions are used to sort, they result in ascending order if they return a < b.
 	bool Compare_AlphabeticalAscending(const tStringItem& a, const tStringItem& b)										{ return tStricmp(a.Chars(), b.Chars()) < 0; }
-	bool Compare_FileCreationTimeAscending(const tStringItem& a, const tStringItem& b)
-	{
-		tFileInfo ia; tGetFileInfo(ia, a);
-		tFileInfo ib; tGetFileInfo(ib, b);
-		return ia.CreationTime < ib.CreationTime;
-	}
-	bool Compare_ImageLoadTimeAscending(const Image& a, const Image& b)													{ return a.GetLoadedTime() < b.GetLoadedTime(); }
 	bool Compare_ImageFileNameAscending(const Image& a, const Image& b)													{ return tStricmp(a.Filename.Chars(), b.Filename.Chars()) < 0; }
 	bool Compare_ImageFileNameDescending(const Image& a, const Image& b)												{ return tStricmp(a.Filename.Chars(), b.Filename.Chars()) > 0; }
 	bool Compare_ImageFileTypeAscending(const Image& a, const Image& b)													{ return int(a.Filetype) < int(b.Filetype); }
@@ -187,13 +201,26 @@ namespace Viewer
 	void OnNextPart();
 	bool OnSkipBegin();
 	bool OnSkipEnd();
+	void CurrImageLoaded(bool justLoaded);
+	void UpdatePendingLoad();
+	bool AddBackgroundLoad(Image*);
+	int GetNumBackgroundLoads();
+	void UpdateBackgroundLoads();
+	void PrefetchNeighbours();
+	void PinWorkingSet();
+	void SetReducedLoadSize(Image*);
+	void UpdateFullResolution();
+	Image* GetNeighbour(Image*, int direction);
+	int64 GetUsedImageMem(int64& avgImageMem);
+	void EnforceImageMemBudget();
 	void ResetPan(bool resetX = true, bool resetY = true);
 	void ApplyZoomDelta(float zoomDelta, float roundTo, bool correctPan);
 	void SetBasicViewAndBehaviour();
 	bool IsBasicViewAndBehaviour();
 	tString FindImageFilesInCurrentFolder(tList<tStringItem>& foundFiles);	// Returns the image folder.
 	tuint256 ComputeImagesHash(const tList<tStringItem>& files);
-	int RemoveOldCacheFiles(const tString& cacheDir);						// Returns num removed.
+	int RemoveLegacyCacheFiles(const tString& cacheDir);					// Returns num removed.
+	int RemoveOldSpillFiles(const tString& spillDir);						// Returns num removed.
 
 	void Update(GLFWwindow* window, double dt, bool dopoll = true);
 	void WindowRefreshFun(GLFWwindow* window)																			{ Update(window, 0.0, false); }
@@ -309,8 +336,10 @@ void Viewer::PopulateImagesSubDirs()
 
 void Viewer::PopulateImages()
 {
+	PendingLoadImage = nullptr;
+	for (int b = 0; b < MaxBackgroundLoads; b++)
+		BackgroundLoads[b] = nullptr;
 	Images.Clear();
-	ImagesLoadTimeSorted.Clear();
 
 	tList<tStringItem> foundFiles;
 	ImagesDir = FindImageFilesInCurrentFolder(foundFiles);
@@ -325,8 +354,9 @@ void Viewer::PopulateImages()
 		// It is important we don't call Load after newing. We save memory by not having all images loaded.
 		Image* newImg = new Image(*filename);
 		Images.Append(newImg);
-		ImagesLoadTimeSorted.Append(newImg);
+		ImagesCache.Add(newImg);
 	}
+	ImagesVersion++;
 
 	SortImages(Settings::SortKeyEnum(Config.SortKey), Config.SortAscending);
 	CurrImage = nullptr;
@@ -356,6 +386,7 @@ void Viewer::SortImages(Settings::SortKeyEnum key, bool ascending)
 	}
 
 	Images.Sort(sortFn);
+	ImagesVersion++;
 }
 
 
@@ -409,10 +440,59 @@ void Viewer::SetCurrentImage(const tString& currFilename)
 void Viewer::LoadCurrImage()
 {
 	tAssert(CurrImage);
-	bool imgJustLoaded = false;
+
+	// If we navigated away from an image that is still decoding we no longer need it. It stays in the background
+	// list so its worker gets joined. If it is a neighbour the prefetcher will un-cancel it.
+	if (PendingLoadImage && (PendingLoadImage != CurrImage))
+	{
+		PendingLoadImage->CancelLoad();
+		AddBackgroundLoad(PendingLoadImage);
+	}
+	PendingLoadImage = nullptr;
+	FullResImage = nullptr;
+	ImagesCache.Access(CurrImage);
+
+	SetWindowTitle();
+	ResetPan();
+
+	// Large files can take seconds to decode so we do it on a worker thread. Until it is done the thumbnail is
+	// displayed if it can be had cheaply from the cache. The rest happens in CurrImageLoaded once loading completes.
 	if (!CurrImage->IsLoaded())
-		imgJustLoaded = CurrImage->Load();
+	{
+		if (CurrImage->IsThumbnailCached())
+			CurrImage->RequestThumbnail();
+
+		SetReducedLoadSize(CurrImage);
+		if (CurrImage->RequestLoad())
+		{
+			PendingLoadImage = CurrImage;
+			UpdatePendingLoad();
+			return;
+		}
+	}
+
+	CurrImageLoaded(false);
+}
+
+
+void Viewer::UpdatePendingLoad()
+{
+	if (!PendingLoadImage)
+		return;
 
+	PendingLoadImage->CompleteLoad();
+	if (PendingLoadImage->IsLoading())
+		return;
+
+	tAssert(PendingLoadImage == CurrImage);
+	bool loaded = PendingLoadImage->IsLoaded();
+	PendingLoadImage = nullptr;
+	CurrImageLoaded(loaded);
+}
+
+
+void Viewer::CurrImageLoaded(bool imgJustLoaded)
+{
 	if (Config.AutoPropertyWindow)
 		PropEditorWindow = (CurrImage->TypeSupportsProperties() || (CurrImage->GetNumParts() > 1));
 
@@ -430,50 +510,268 @@ void Viewer::LoadCurrImage()
 		CurrImage->Play();
 	}
 
-	SetWindowTitle();
-	ResetPan();
-
 	// We only need to consider unloading an image when a new one is loaded... in this function.
 	// We currently do not allow unloading when in slideshow and the frame duration is small.
 	bool slideshowSmallDuration = SlideshowPlaying && (Config.SlidehowFrameDuration < 0.5f);
 	if (imgJustLoaded && !slideshowSmallDuration)
+		EnforceImageMemBudget();
+
+	// Thumbnails made from an embedded preview are quick but not always as good. Once an image has been looked at we
+	// make its thumbnail from the image itself.
+	if (imgJustLoaded && CurrImage->IsThumbnailFromPreview())
+		CurrImage->RequestFullThumbnail();
+
+	// Now that the current image is in we can start decoding the ones we're likely to go to next.
+	PrefetchNeighbours();
+}
+
+
+int64 Viewer::GetUsedImageMem(int64& avgImageMem)
+{
+	avgImageMem = ImagesCache.GetAverageBytes();
+	return ImagesCache.GetUsedBytes();
+}
+
+
+void Viewer::EnforceImageMemBudget()
+{
+	int64 allowedMem = GetImageMemBudget();
+	if (ImagesCache.GetUsedBytes() <= allowedMem)
+		return;
+
+	// Never unload the current image or the neighbours we prefetched for it. When they are all that's loaded nothing
+	// can go, and since the auto budget checks every memory sample that is only worth saying when something went.
+	PinWorkingSet();
+	int64 usedMem = ImagesCache.GetUsedBytes();
+	int64 allowedPackedMem = int64(Config.MaxPackedMemMB) * 1024 * 1024;
+	if (ImagesCache.Evict(allowedMem, allowedPackedMem) == 0)
+		return;
+
+	tPrintf("Used image mem (%|64d) was bigger than max (%|64d). Unloaded.\n", usedMem, allowedMem);
+	tPrintf
+	(
+		"Used mem %|64dB out of max %|64dB. Hits %d Misses %d Evictions %d.\n", ImagesCache.GetUsedBytes(), allowedMem,
+		ImagesCache.GetNumHits(), ImagesCache.GetNumMisses(), ImagesCache.GetNumEvictions()
+	);
+	if (allowedPackedMem > 0)
+	{
+		tPrintf
+		(
+			"Packed mem %|64dB out of max %|64dB. Packed %d Packed Hits %d.\n", ImagesCache.GetPackedBytes(),
+			allowedPackedMem, ImagesCache.GetNumPacked(), ImagesCache.GetNumPackedHits()
+		);
+	}
+}
+
+
+Viewer::Image* Viewer::GetNeighbour(Image* img, int direction)
+{
+	bool circ = SlideshowPlaying && Config.SlideshowLooping;
+	if (direction > 0)
+		return circ ? Images.NextCirc(img) : img->Next();
+
+	return circ ? Images.PrevCirc(img) : img->Prev();
+}
+
+
+void Viewer::PinWorkingSet()
+{
+	// The prefetch window is at most 8 ahead and 2 behind. We prefetch more images in the direction of travel.
+	const int maxPinned = 16;
+	Image* pinned[maxPinned];
+	int numPinned = 0;
+	if (CurrImage)
+		pinned[numPinned++] = CurrImage;
+
+	int numBehind = tClampMin(Config.PrefetchAhead/3, 1);
+	for (int dir = -1; CurrImage && (Config.PrefetchAhead > 0) && (dir <= 1); dir += 2)
 	{
-		ImagesLoadTimeSorted.Sort(Compare_ImageLoadTimeAscending);
+		int count = (dir == NavDirection) ? Config.PrefetchAhead : numBehind;
+		Image* neighbour = CurrImage;
+		for (int n = 0; (n < count) && (numPinned < maxPinned); n++)
+		{
+			neighbour = GetNeighbour(neighbour, dir);
+			if (!neighbour || (neighbour == CurrImage))
+				break;
+
+			pinned[numPinned++] = neighbour;
+		}
+	}
+
+	ImagesCache.SetPinned(pinned, numPinned);
+}
+
 
-		int64 usedMem = 0;
-		for (tItList<Image>::Iter iter = ImagesLoadTimeSorted.First(); iter; iter++)
-			usedMem += int64((*iter).Info.MemSizeBytes);
+void Viewer::PrefetchNeighbours()
+{
+	if (!CurrImage || PendingLoadImage || (Config.PrefetchAhead <= 0))
+		return;
 
-		int64 allowedMem = int64(Config.MaxImageMemMB) * 1024 * 1024;
-		if (usedMem > allowedMem)
+	// Ahead first, nearest first, then behind.
+	int numBehind = tClampMin(Config.PrefetchAhead/3, 1);
+	int directions[2] = { NavDirection, -NavDirection };
+	for (int dir : directions)
+	{
+		int count = (dir == NavDirection) ? Config.PrefetchAhead : numBehind;
+		Image* neighbour = CurrImage;
+		for (int n = 0; n < count; n++)
 		{
-			tPrintf("Used image mem (%|64d) bigger than max (%|64d). Unloading.\n", usedMem, allowedMem);
-			for (tItList<Image>::Iter iter = ImagesLoadTimeSorted.First(); iter; iter++)
-			{
-				Image* i = iter.GetObject();
+			neighbour = GetNeighbour(neighbour, dir);
+			if (!neighbour || (neighbour == CurrImage))
+				break;
 
-				// Never unload the current image.
-				if (i->IsLoaded() && (i != CurrImage))
-				{
-					tPrintf("Unloading %s freeing %d Bytes\n", tSystem::tGetFileName(i->Filename).Chars(), i->Info.MemSizeBytes);
-					usedMem -= i->Info.MemSizeBytes;
-					i->Unload();
-					if (usedMem < allowedMem)
-						break;
-				}
-			}
-			tPrintf("Used mem %|64dB out of max %|64dB.\n", usedMem, allowedMem);
+			if (!RequestPrefetch(neighbour))
+				return;
+		}
+	}
+}
+
+
+bool Viewer::RequestPrefetch(Image* img)
+{
+	if (!img || img->IsLoaded())
+		return true;
+
+	// Already going. This un-cancels it if it was cancelled.
+	if (img->IsLoading())
+		return img->RequestLoad();
+
+	// Leave cores for the main thread and the thumbnail workers.
+	int maxWorkers = tClamp(tSystem::tGetNumCores() - 2, 1, 4);
+	if (GetNumBackgroundLoads() >= maxWorkers)
+		return false;
+
+	// We don't know how big an image is until it's decoded. The average of what's loaded is our best guess. We only
+	// prefetch if it would fit without having to evict anything.
+	int64 avgImageMem = 0;
+	int64 usedMem = GetUsedImageMem(avgImageMem);
+	int64 allowedMem = GetImageMemBudget();
+	if ((usedMem + avgImageMem) > allowedMem)
+		return false;
+
+	SetReducedLoadSize(img);
+	if (!img->RequestLoad())
+		return true;
+
+	AddBackgroundLoad(img);
+	return true;
+}
+
+
+void Viewer::SetReducedLoadSize(Image* img)
+{
+	// When the image is fit to the screen a jpg only needs to be decoded big enough to fill it.
+	bool fitting = (CurrZoomMode == ZoomMode::Fit) || (CurrZoomMode == ZoomMode::DownscaleOnly);
+	if (Config.ReducedJPGLoad && fitting)
+		img->SetReducedLoadSize(Dispw, Disph);
+	else
+		img->SetReducedLoadSize(0, 0);
+}
+
+
+void Viewer::UpdateFullResolution()
+{
+	// When a full resolution reload finishes the image gets bigger. A user zoom is scaled down so it looks the same.
+	if (FullResImage && ((FullResImage != CurrImage) || !FullResImage->IsLoading()))
+	{
+		if ((FullResImage == CurrImage) && CurrImage->IsLoaded() && (CurrZoomMode == ZoomMode::User))
+			ZoomPercent /= float(FullResScale);
+		FullResImage = nullptr;
+	}
+
+	int scale = CurrImage->GetLoadScale();
+	if (scale <= 1)
+		return;
+
+	// Cropping works in image pixels so the full image is needed right away.
+	if (CropMode)
+	{
+		CurrImage->RequireFullResolution();
+		if (CurrZoomMode == ZoomMode::User)
+			ZoomPercent /= float(scale);
+		return;
+	}
+
+	// Otherwise the reduced image is fine until it is drawn bigger than it was decoded, or shown 1:1.
+	if ((ZoomPercent > 100.0f) || (CurrZoomMode == ZoomMode::OneToOne))
+	{
+		if (CurrImage->RequestFullResolution())
+		{
+			FullResImage = CurrImage;
+			FullResScale = scale;
 		}
 	}
 }
 
 
+bool Viewer::AddBackgroundLoad(Image* img)
+{
+	int freeSlot = -1;
+	for (int b = 0; b < MaxBackgroundLoads; b++)
+	{
+		if (BackgroundLoads[b] == img)
+			return true;
+
+		if (!BackgroundLoads[b] && (freeSlot == -1))
+			freeSlot = b;
+	}
+
+	if (freeSlot == -1)
+		return false;
+
+	BackgroundLoads[freeSlot] = img;
+	return true;
+}
+
+
+int Viewer::GetNumBackgroundLoads()
+{
+	int count = 0;
+	for (int b = 0; b < MaxBackgroundLoads; b++)
+		if (BackgroundLoads[b])
+			count++;
+
+	return count;
+}
+
+
+void Viewer::UpdateBackgroundLoads()
+{
+	bool anyCompleted = false;
+	bool anyLoaded = false;
+	for (int b = 0; b < MaxBackgroundLoads; b++)
+	{
+		Image* img = BackgroundLoads[b];
+		if (!img)
+			continue;
+
+		// The current image is handled by UpdatePendingLoad. Calling CompleteLoad here is fine either way.
+		img->CompleteLoad();
+		if (img->IsLoading())
+			continue;
+
+		BackgroundLoads[b] = nullptr;
+		anyCompleted = true;
+		if (img->IsLoaded() && (img != CurrImage))
+			anyLoaded = true;
+	}
+
+	if (anyLoaded)
+		EnforceImageMemBudget();
+
+	// A worker freed up so there may be more neighbours to fetch.
+	if (anyCompleted)
+		PrefetchNeighbours();
+}
+
+
 bool Viewer::OnPrevious()
 {
 	bool circ = SlideshowPlaying && Config.SlideshowLooping;
 	if (!CurrImage || (!circ && !CurrImage->Prev()))
 		return false;
 
+	NavDirection = -1;
 	if (SlideshowPlaying)
 		SlideshowCountdown = Config.SlidehowFrameDuration;
 
@@ -489,6 +787,7 @@ bool Viewer::OnNext()
 	if (!CurrImage || (!circ && !CurrImage->Next()))
 		return false;
 
+	NavDirection = 1;
 	if (SlideshowPlaying)
 		SlideshowCountdown = Config.SlidehowFrameDuration;
 
@@ -521,6 +820,7 @@ bool Viewer::OnSkipBegin()
 	if (!CurrImage || !Images.First())
 		return false;
 
+	NavDirection = 1;
 	CurrImage = Images.First();
 	LoadCurrImage();
 	return true;
@@ -532,6 +832,7 @@ bool Viewer::OnSkipEnd()
 	if (!CurrImage || !Images.Last())
 		return false;
 
+	NavDirection = -1;
 	CurrImage = Images.Last();
 	LoadCurrImage();
 	return true;
@@ -800,6 +1101,21 @@ void Viewer::Update(GLFWwindow* window, double dt, bool dopoll)
 	else
 		glClearColor(ColourClear.x, ColourClear.y, ColourClear.z, ColourClear.w);
 	glClear(GL_COLOR_BUFFER_BIT);
+
+	// Everything bound last frame has been drawn so this is when textures over the budget can go. The thumbnail atlas
+	// has its own budget of up to half the total, as do the tiles of the image being shown. The rest is left for the
+	// textures.
+	int64 maxVRAM = int64(Config.MaxVRAMMB) * 1024 * 1024;
+	ThumbnailsAtlas.NewFrame(tMath::tMin(int64(Config.MaxThumbVRAMMB) * 1024 * 1024, maxVRAM / 2));
+	TexturesCache.NewFrame(maxVRAM - ThumbnailsAtlas.GetUsedBytes() - Image::GetTileVRAMBytes());
+	ThumbnailsResidency.Evict(int64(Config.MaxThumbMemMB) * 1024 * 1024);
+	Image::ThumbCache.SetMaxBytes(int64(Config.MaxThumbCacheMB) * 1024 * 1024);
+	ImagesCache.CompletePacking();
+
+	// The auto budget follows the memory samples so it can drop while nothing is loading.
+	if (Config.AutoImageMem && UpdateAutoImageMemBudget(ImagesCache.GetUsedBytes()))
+		EnforceImageMemBudget();
+
 	int bottomUIHeight	= GetNavBarHeight();
 	int topUIHeight		= (FullscreenMode || !Config.ShowMenuBar) ? 0 : MenuBarHeight;
 
@@ -849,9 +1165,12 @@ void Viewer::Update(GLFWwindow* window, double dt, bool dopoll)
 	int mouseXi = int(mouseX);
 	int mouseYi = int(mouseY);
 
+	UpdatePendingLoad();
+	UpdateBackgroundLoads();
 	if (CurrImage)
 	{
 		CurrImage->UpdatePlaying(float(dt));
+		UpdateFullResolution();
 
 		iw = float(CurrImage->GetWidth());
 		ih = float(CurrImage->GetHeight());
@@ -879,13 +1198,14 @@ void Viewer::Update(GLFWwindow* window, double dt, bool dopoll)
 		b = tMath::tRound(vmargin);
 		t = tMath::tRound(vmargin+drawh);
 
-		if (CurrZoomMode == ZoomMode::DownscaleOnly)
+		// While loading, the placeholder thumbnail is small so we scale it up to fit.
+		if ((CurrZoomMode == ZoomMode::DownscaleOnly) && !CurrImage->IsLoading())
 		{
 			ZoomPercent = 100.0f;
 			if (draww < iw)
 				ZoomPercent = 100.0f * draww / iw;
 		}
-		else if (CurrZoomMode == ZoomMode::Fit)
+		else if ((CurrZoomMode == ZoomMode::Fit) || (CurrZoomMode == ZoomMode::DownscaleOnly))
 		{
 			ZoomPercent = 100.0f * draww / iw;
 		}
@@ -946,28 +1266,40 @@ void Viewer::Update(GLFWwindow* window, double dt, bool dopoll)
 		else
 			DrawBackground(l, b, r-l, t-b);
 
+		// Bind may return 0 if the image is still loading and there is no thumbnail yet. We just show the background.
+		// Tiled images only draw what is inside the quad. The quad's uv range tells us where the image origin is.
 		glColor4f(1.0f, 1.0f, 1.0f, 1.0f);
-		CurrImage->Bind();
-		glEnable(GL_TEXTURE_2D);
-
-		glBegin(GL_QUADS);
-		if (!Config.Tile)
+		if (CurrImage->IsTiled() && !Config.Tile)
 		{
-			glTexCoord2f(0.0f + uvUMarg + uvUOff, 0.0f + uvVMarg + uvVOff); glVertex2f(l, b);
-			glTexCoord2f(0.0f + uvUMarg + uvUOff, 1.0f - uvVMarg + uvVOff); glVertex2f(l, t);
-			glTexCoord2f(1.0f - uvUMarg + uvUOff, 1.0f - uvVMarg + uvVOff); glVertex2f(r, t);
-			glTexCoord2f(1.0f - uvUMarg + uvUOff, 0.0f + uvVMarg + uvVOff); glVertex2f(r, b);
+			float scaleX = (r-l) / ((1.0f - 2.0f*uvUMarg) * iw);
+			float scaleY = (t-b) / ((1.0f - 2.0f*uvVMarg) * ih);
+			float originX = l - (uvUMarg + uvUOff) * iw * scaleX;
+			float originY = b - (uvVMarg + uvVOff) * ih * scaleY;
+			glEnable(GL_TEXTURE_2D);
+			CurrImage->DrawTiled(originX, originY, scaleX, l, r, b, t);
 		}
-		else
+		else if (CurrImage->Bind())
 		{
-			float repU = draww/(r-l);	float offU = (1.0f-repU)/2.0f;
-			float repV = drawh/(t-b);	float offV = (1.0f-repV)/2.0f;
-			glTexCoord2f(offU + 0.0f + uvUMarg + uvUOff,	offV + 0.0f + uvVMarg + uvVOff);	glVertex2f(hmargin,			vmargin);
-			glTexCoord2f(offU + 0.0f + uvUMarg + uvUOff,	offV + repV - uvVMarg + uvVOff);	glVertex2f(hmargin,			vmargin+drawh);
-			glTexCoord2f(offU + repU - uvUMarg + uvUOff,	offV + repV - uvVMarg + uvVOff);	glVertex2f(hmargin+draww,	vmargin+drawh);
-			glTexCoord2f(offU + repU - uvUMarg + uvUOff,	offV + 0.0f + uvVMarg + uvVOff);	glVertex2f(hmargin+draww,	vmargin);
+			glEnable(GL_TEXTURE_2D);
+			glBegin(GL_QUADS);
+			if (!Config.Tile)
+			{
+				glTexCoord2f(0.0f + uvUMarg + uvUOff, 0.0f + uvVMarg + uvVOff); glVertex2f(l, b);
+				glTexCoord2f(0.0f + uvUMarg + uvUOff, 1.0f - uvVMarg + uvVOff); glVertex2f(l, t);
+				glTexCoord2f(1.0f - uvUMarg + uvUOff, 1.0f - uvVMarg + uvVOff); glVertex2f(r, t);
+				glTexCoord2f(1.0f - uvUMarg + uvUOff, 0.0f + uvVMarg + uvVOff); glVertex2f(r, b);
+			}
+			else
+			{
+				float repU = draww/(r-l);	float offU = (1.0f-repU)/2.0f;
+				float repV = drawh/(t-b);	float offV = (1.0f-repV)/2.0f;
+				glTexCoord2f(offU + 0.0f + uvUMarg + uvUOff,	offV + 0.0f + uvVMarg + uvVOff);	glVertex2f(hmargin,			vmargin);
+				glTexCoord2f(offU + 0.0f + uvUMarg + uvUOff,	offV + repV - uvVMarg + uvVOff);	glVertex2f(hmargin,			vmargin+drawh);
+				glTexCoord2f(offU + repU - uvUMarg + uvUOff,	offV + repV - uvVMarg + uvVOff);	glVertex2f(hmargin+draww,	vmargin+drawh);
+				glTexCoord2f(offU + repU - uvUMarg + uvUOff,	offV + 0.0f + uvVMarg + uvVOff);	glVertex2f(hmargin+draww,	vmargin);
+			}
+			glEnd();
 		}
-		glEnd();
 
 		// Get the colour under the reticle.
 		tVector2 scrCursorPos(ReticleX, ReticleY);
@@ -1613,6 +1945,8 @@ void Viewer::Update(GLFWwindow* window, double dt, bool dopoll)
 
 	if (Config.ContentViewShow)
 		ShowContentViewDialog(&Config.ContentViewShow);
+	else
+		HideContentViewDialog();
 
 	if (ShowCheatSheet)
 		ShowCheatSheetPopup(&ShowCheatSheet);
@@ -2154,27 +2488,31 @@ void Viewer::IconifyCallback(GLFWwindow* window, int iconified)
 }
 
 
-int Viewer::RemoveOldCacheFiles(const tString& cacheDir)
+int Viewer::RemoveLegacyCacheFiles(const tString& cacheDir)
 {
+	// Thumbnails used to be cached one bin file each. They are all in the thumbnail store now.
 	tList<tStringItem> cacheFiles;
 	tSystem::tFindFiles(cacheFiles, cacheDir, "bin");
-	int numFiles = cacheFiles.NumItems();
-	if (numFiles <= Config.MaxCacheFiles)
-		return 0;
+	int deletedCount = 0;
+	for (tStringItem* file = cacheFiles.First(); file; file = file->Next())
+		if (tDeleteFile(*file))
+			deletedCount++;
+
+	return deletedCount;
+}
 
-	cacheFiles.Sort(Compare_FileCreationTimeAscending);
-	int targetCount = tClampMin(Config.MaxCacheFiles - 100, 0);
 
-	int numToRemove = numFiles - targetCount;
-	tAssert(numToRemove >= 0);
+int Viewer::RemoveOldSpillFiles(const tString& spillDir)
+{
+	tList<tStringItem> spillFiles;
+	tSystem::tFindFiles(spillFiles, spillDir, "raw");
+	std::time_t oldest = std::time(nullptr) - 24*60*60;
 	int deletedCount = 0;
-	while (numToRemove)
+	for (tStringItem* file = spillFiles.First(); file; file = file->Next())
 	{
-		tStringItem* head = cacheFiles.Remove();
-		if (tDeleteFile(*head))
+		tFileInfo info;
+		if (tGetFileInfo(info, *file) && (info.ModificationTime < oldest) && tDeleteFile(*file))
 			deletedCount++;
-		delete head;
-		numToRemove--;
 	}
 
 	return deletedCount;
@@ -2329,8 +2667,23 @@ int main(int argc, char** argv)
 
 	if (!tSystem::tDirExists(Viewer::Image::ThumbCacheDir))
 		tSystem::tCreateDir(Viewer::Image::ThumbCacheDir);
+	Viewer::RemoveLegacyCacheFiles(Viewer::Image::ThumbCacheDir);
+
+	// Decoded pictures are kept apart from the thumbnail store as plain files that are trimmed on exit.
+	Viewer::Image::DecodedCacheDir = Viewer::Image::ThumbCacheDir + "Decoded/";
+	if (!tSystem::tDirExists(Viewer::Image::DecodedCacheDir))
+		tSystem::tCreateDir(Viewer::Image::DecodedCacheDir);
+
+	// Edited images spill here when memory runs short. Images delete their own spill files so anything older than a
+	// day was left by a crash. Newer ones may belong to another instance.
+	Viewer::Image::SpillDir = Viewer::Image::ThumbCacheDir + "Spill/";
+	if (!tSystem::tDirExists(Viewer::Image::SpillDir))
+		tSystem::tCreateDir(Viewer::Image::SpillDir);
+	Viewer::RemoveOldSpillFiles(Viewer::Image::SpillDir);
 	
 	Viewer::Config.Load(cfgFile, mode->width, mode->height);
+	Viewer::StartMemoryMonitor();
+	Viewer::Image::ThumbCache.Open(Viewer::Image::ThumbCacheDir, int64(Viewer::Config.MaxThumbCacheMB) * 1024 * 1024);
 	Viewer::PendingTransparentWorkArea = Viewer::Config.TransparentWorkArea;
 
 	// We start with window invisible. For windows DwmSetWindowAttribute won't redraw properly otherwise.
@@ -2407,6 +2760,9 @@ int main(int argc, char** argv)
 		return 10;
     }
 	tPrintf("GLAD V %s\n", glGetString(GL_VERSION));
+	glGetIntegerv(GL_MAX_TEXTURE_SIZE, &Viewer::Image::MaxTextureSize);
+	if (!Viewer::InitTextureReadback((GLADloadproc)glfwGetProcAddress))
+		tPrintf("No framebuffer objects. GPU resident images are disabled.\n");
 
 	glfwSwapInterval(1); // Enable vsync
 	glfwSetWindowRefreshCallback(Viewer::Window, Viewer::WindowRefreshFun);
@@ -2485,9 +2841,10 @@ int main(int argc, char** argv)
 		lastUpdateTime = currUpdateTime;
 	}
 
-	// This is important. We need the destructors to run BEFORE we shutdown GLFW. Deconstructing the images may block for a bit while shutting
-	// down worker threads. We could show a 'shutting down' popup here if we wanted -- if Image::ThumbnailNumThreadsRunning is > 0.
+	// This is important. We need the destructors to run BEFORE we shutdown GLFW. Deconstructing the images may block for a bit while
+	// thumbnails being made finish. Queued ones are dropped.
 	Viewer::Images.Clear();	
+	Viewer::Image::StopThumbnailWorkers();
 	Viewer::UnloadAppImages();
 
 	// Get current window geometry and set in config file if we're not in fullscreen mode and not iconified.
@@ -2499,6 +2856,7 @@ int main(int argc, char** argv)
 
 	Viewer::Config.TransparentWorkArea = Viewer::PendingTransparentWorkArea;
 	Viewer::Config.Save(cfgFile);
+	Viewer::StopMemoryMonitor();
 
 	// Cleanup.
 	ImGui_ImplOpenGL2_Shutdown();
@@ -2507,11 +2865,20 @@ int main(int argc, char** argv)
 
 	glfwDestroyWindow(Viewer::Window);
 	glfwTerminate();
+	Viewer::FreeContentViewItems();
 
 	// Before we go, lets clear out any old cache files.
 	if (Viewer::DeleteAllCacheFilesOnExit)
+	{
+		Viewer::Image::ThumbCache.Close();
 		tSystem::tDeleteDir(Viewer::Image::ThumbCacheDir);
+	}
 	else
-		Viewer::RemoveOldCacheFiles(Viewer::Image::ThumbCacheDir);
+	{
+		// Turning the decoded cache off clears it so it doesn't sit on the disk unused.
+		int64 maxDecodedBytes = Viewer::Config.DecodedCache ? int64(Viewer::Config.MaxDecodedCacheMB) * 1024 * 1024 : 0;
+		Viewer::Image::ThumbCache.Close();
+		Viewer::RemoveOldDecodedFiles(Viewer::Image::DecodedCacheDir, maxDecodedBytes);
+	}
 	return 0;
 }
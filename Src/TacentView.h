@@ -17,7 +17,7 @@
 #include <Math/tVector4.h>
 #include <System/tCommand.h>
 #include "Settings.h"
-namespace Viewer { class Image; }
+namespace Viewer { class Image; class ImageCache; }
 class tColouri;
 
 
@@ -28,7 +28,8 @@ namespace Viewer
 	extern tString ImagesDir;
 	extern tList<tStringItem> ImagesSubDirs;
 	extern tList<Viewer::Image> Images;
-	extern tItList<Viewer::Image> ImagesLoadTimeSorted;
+	extern uint ImagesVersion;				// Changes whenever Images is added to, cleared or reordered.
+	extern ImageCache ImagesCache;
 	extern tCommand::tParam ImageFileParam;
 	extern tColouri PixelColour;
 	extern Viewer::Image DefaultThumbnailImage;
@@ -67,6 +68,11 @@ namespace Viewer
 	Image* FindImage(const tString& filename);
 	void SetCurrentImage(const tString& currFilename = tString());
 	void LoadCurrImage();
+
+	// Starts an asynchronous load of an image we're likely to display soon. Respects the image memory budget and
+	// limits the number of workers. Returns false if it couldn't be started for either of those reasons.
+	bool RequestPrefetch(Image*);
+
 	bool ChangeScreenMode(bool fullscreeen, bool force = false);
 	void SortImages(Settings::SortKeyEnum, bool ascending);
 	bool DeleteImageFile(const tString& imgFile, bool tryUseRecycleBin);
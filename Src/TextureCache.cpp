@@ -0,0 +1,161 @@
+// TextureCache.cpp
+//
+// Keeps the textures the images upload within a video memory budget. Every texture an image creates is tracked along
+// with its size. Once over budget the least recently bound ones are deleted and their ids zeroed, which is how the
+// images know to upload them again the next time they are bound. This is independent of whether the image is loaded.
+//
+// Copyright (c) 2020 Tristan Grimmer.
+// Permission to use, copy, modify, and/or distribute this software for any purpose with or without fee is hereby
+// granted, provided that the above copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+// INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN
+// AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+// PERFORMANCE OF THIS SOFTWARE.
+
+#include <glad/glad.h>
+#include "TextureCache.h"
+#include "Image.h"
+using namespace Viewer;
+
+
+TextureCache::~TextureCache()
+{
+	// The OpenGL context and probably the images are gone by now so only the entries are freed.
+	while (Oldest)
+	{
+		TextureEntry* next = Oldest->Next;
+		delete Oldest;
+		Oldest = next;
+	}
+}
+
+
+void TextureCache::Add(Image* owner, uint* texID, int64 numBytes)
+{
+	if (!owner || !texID || !*texID || Find(owner, texID))
+		return;
+
+	TextureEntry* entry = new TextureEntry;
+	entry->Owner = owner;
+	entry->TexID = texID;
+	entry->NumBytes = numBytes;
+	entry->LastBoundFrame = Frame;
+	entry->Pinned = false;
+	entry->OwnerNext = owner->TexEntries;
+	owner->TexEntries = entry;
+	Link(entry);
+
+	UsedBytes += numBytes;
+	NumTextures++;
+}
+
+
+void TextureCache::Remove(Image* owner, uint* texID)
+{
+	TextureEntry* entry = Find(owner, texID);
+	if (entry)
+		Release(entry);
+}
+
+
+void TextureCache::Touch(Image* owner, uint* texID)
+{
+	TextureEntry* entry = Find(owner, texID);
+	if (!entry)
+		return;
+
+	entry->LastBoundFrame = Frame;
+	if (entry != Newest)
+	{
+		Unlink(entry);
+		Link(entry);
+	}
+}
+
+
+void TextureCache::SetPinned(Image* owner, uint* texID, bool pinned)
+{
+	TextureEntry* entry = Find(owner, texID);
+	if (entry)
+		entry->Pinned = pinned;
+}
+
+
+void TextureCache::NewFrame(int64 maxBytes)
+{
+	Frame++;
+	TextureEntry* entry = Oldest;
+	while ((UsedBytes > maxBytes) && entry && (entry->LastBoundFrame < Frame-1))
+	{
+		TextureEntry* next = entry->Next;
+		if (!entry->Pinned)
+		{
+			uint* texID = entry->TexID;
+			glDeleteTextures(1, texID);
+			*texID = 0;
+
+			Release(entry);
+			NumEvictions++;
+		}
+		entry = next;
+	}
+}
+
+
+TextureEntry* TextureCache::Find(Image* owner, uint* texID) const
+{
+	// Images only have a handful of textures. Even every frame of an animation is a short walk.
+	for (TextureEntry* entry = owner ? owner->TexEntries : nullptr; entry; entry = entry->OwnerNext)
+		if (entry->TexID == texID)
+			return entry;
+
+	return nullptr;
+}
+
+
+void TextureCache::Link(TextureEntry* entry)
+{
+	entry->Prev = Newest;
+	entry->Next = nullptr;
+	if (Newest)
+		Newest->Next = entry;
+	else
+		Oldest = entry;
+	Newest = entry;
+}
+
+
+void TextureCache::Unlink(TextureEntry* entry)
+{
+	if (entry->Prev)
+		entry->Prev->Next = entry->Next;
+	else
+		Oldest = entry->Next;
+
+	if (entry->Next)
+		entry->Next->Prev = entry->Prev;
+	else
+		Newest = entry->Prev;
+
+	entry->Prev = entry->Next = nullptr;
+}
+
+
+void TextureCache::Release(TextureEntry* entry)
+{
+	Unlink(entry);
+	for (TextureEntry** link = &entry->Owner->TexEntries; *link; link = &(*link)->OwnerNext)
+	{
+		if (*link == entry)
+		{
+			*link = entry->OwnerNext;
+			break;
+		}
+	}
+
+	UsedBytes -= entry->NumBytes;
+	NumTextures--;
+	delete entry;
+}
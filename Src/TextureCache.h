@@ -0,0 +1,82 @@
+// TextureCache.h
+//
+// Keeps the textures the images upload within a video memory budget. Every texture an image creates is tracked along
+// with its size. Once over budget the least recently bound ones are deleted and their ids zeroed, which is how the
+// images know to upload them again the next time they are bound. This is independent of whether the image is loaded.
+//
+// Copyright (c) 2020 Tristan Grimmer.
+// Permission to use, copy, modify, and/or distribute this software for any purpose with or without fee is hereby
+// granted, provided that the above copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+// INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN
+// AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+// PERFORMANCE OF THIS SOFTWARE.
+
+#pragma once
+#include <Foundation/tStandard.h>
+namespace Viewer { class Image; }
+namespace Viewer
+{
+
+
+// One per tracked texture. Entries are in least to most recently bound order, and each image also keeps a list of its
+// own so it can find them.
+struct TextureEntry
+{
+	Image* Owner;
+	uint* TexID;					// Where the owner keeps the id.
+	int64 NumBytes;
+	int64 LastBoundFrame;
+	bool Pinned;					// Pinned textures hold the only copy of their pixels and are never evicted.
+	TextureEntry* Prev;
+	TextureEntry* Next;
+	TextureEntry* OwnerNext;
+};
+
+
+class TextureCache
+{
+public:
+	TextureCache()																										{ }
+	~TextureCache();
+
+	// Starts tracking a texture the owner just created. The id is read through the pointer so it must stay where it
+	// is until the texture is removed. The new texture counts as bound this frame.
+	void Add(Image* owner, uint* texID, int64 numBytes);
+
+	// Stops tracking the texture. It is not deleted.
+	void Remove(Image* owner, uint* texID);
+
+	// Call whenever a tracked texture is bound.
+	void Touch(Image* owner, uint* texID);
+
+	// Pinned textures still count towards the budget but are skipped over when evicting.
+	void SetPinned(Image* owner, uint* texID, bool pinned);
+
+	// Call once at the start of every frame, before anything is bound. Textures bound in this frame or the last one
+	// are never evicted since ImGui may still be drawing with them. This means a view that needs more than the budget
+	// still draws properly, it just goes over for a while.
+	void NewFrame(int64 maxBytes);
+
+	int64 GetUsedBytes() const																							{ return UsedBytes; }
+	int GetNumTextures() const																							{ return NumTextures; }
+	int GetNumEvictions() const																							{ return NumEvictions; }
+
+private:
+	TextureEntry* Find(Image* owner, uint* texID) const;
+	void Unlink(TextureEntry*);
+	void Link(TextureEntry*);
+	void Release(TextureEntry*);		// Unlinks from both lists and deletes the entry.
+
+	TextureEntry* Oldest	= nullptr;
+	TextureEntry* Newest	= nullptr;
+	int64 Frame				= 0;
+	int64 UsedBytes			= 0;
+	int NumTextures			= 0;
+	int NumEvictions		= 0;
+};
+
+
+}
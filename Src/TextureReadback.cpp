@@ -0,0 +1,149 @@
+// TextureReadback.cpp
+//
+// Reading pixels back out of textures. A whole texture can always be read. Reading part of one goes through a
+// framebuffer object, which OpenGL 2.1 only has as an extension, so the entry points are looked up at startup.
+//
+// Copyright (c) 2020 Tristan Grimmer.
+// Permission to use, copy, modify, and/or distribute this software for any purpose with or without fee is hereby
+// granted, provided that the above copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+// INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN
+// AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+// PERFORMANCE OF THIS SOFTWARE.
+
+#include <cstdio>
+#include <cstring>
+#include "TextureReadback.h"
+
+
+// The ARB and EXT versions of framebuffer objects use the same values.
+#ifndef GL_FRAMEBUFFER
+#define GL_FRAMEBUFFER 0x8D40
+#endif
+#ifndef GL_FRAMEBUFFER_BINDING
+#define GL_FRAMEBUFFER_BINDING 0x8CA6
+#endif
+#ifndef GL_COLOR_ATTACHMENT0
+#define GL_COLOR_ATTACHMENT0 0x8CE0
+#endif
+#ifndef GL_FRAMEBUFFER_COMPLETE
+#define GL_FRAMEBUFFER_COMPLETE 0x8CD5
+#endif
+
+
+namespace
+{
+	typedef void (APIENTRYP GenFramebuffersProc)(GLsizei n, GLuint* framebuffers);
+	typedef void (APIENTRYP BindFramebufferProc)(GLenum target, GLuint framebuffer);
+	typedef void (APIENTRYP FramebufferTexture2DProc)(GLenum target, GLenum attachment, GLenum textarget, GLuint texture, GLint level);
+	typedef GLenum (APIENTRYP CheckFramebufferStatusProc)(GLenum target);
+
+	GenFramebuffersProc GenFramebuffers = nullptr;
+	BindFramebufferProc BindFramebuffer = nullptr;
+	FramebufferTexture2DProc FramebufferTexture2D = nullptr;
+	CheckFramebufferStatusProc CheckFramebufferStatus = nullptr;
+
+	// Made on first use and kept for the life of the context.
+	GLuint ReadFramebuffer = 0;
+
+	// Error flags stay set until read, so one left over from earlier in the frame would make a good read look failed.
+	// Each call returns one flag. The count is bounded since a lost context can keep reporting an error.
+	void ClearGLErrors()
+	{
+		for (int e = 0; (e < 32) && (glGetError() != GL_NO_ERROR); e++) { }
+	}
+}
+
+
+bool Viewer::InitTextureReadback(GLADloadproc getProc)
+{
+	const char* suffix = nullptr;
+	if (HasGLExtension("GL_ARB_framebuffer_object"))
+		suffix = "";
+	else if (HasGLExtension("GL_EXT_framebuffer_object"))
+		suffix = "EXT";
+	if (!suffix || !getProc)
+		return false;
+
+	char name[64];
+	snprintf(name, sizeof(name), "glGenFramebuffers%s", suffix);			GenFramebuffers = (GenFramebuffersProc)getProc(name);
+	snprintf(name, sizeof(name), "glBindFramebuffer%s", suffix);			BindFramebuffer = (BindFramebufferProc)getProc(name);
+	snprintf(name, sizeof(name), "glFramebufferTexture2D%s", suffix);		FramebufferTexture2D = (FramebufferTexture2DProc)getProc(name);
+	snprintf(name, sizeof(name), "glCheckFramebufferStatus%s", suffix);		CheckFramebufferStatus = (CheckFramebufferStatusProc)getProc(name);
+	return IsTextureReadbackSupported();
+}
+
+
+bool Viewer::IsTextureReadbackSupported()
+{
+	return GenFramebuffers && BindFramebuffer && FramebufferTexture2D && CheckFramebufferStatus;
+}
+
+
+bool Viewer::ReadTextureRect(tPixel* dest, uint texID, int x, int y, int width, int height)
+{
+	if (!dest || !texID || !IsTextureReadbackSupported())
+		return false;
+
+	if (!ReadFramebuffer)
+		GenFramebuffers(1, &ReadFramebuffer);
+	if (!ReadFramebuffer)
+		return false;
+
+	// Whatever was being drawn to is put back afterwards.
+	GLint prevFramebuffer = 0;
+	glGetIntegerv(GL_FRAMEBUFFER_BINDING, &prevFramebuffer);
+	BindFramebuffer(GL_FRAMEBUFFER, ReadFramebuffer);
+	FramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, texID, 0);
+
+	bool ok = (CheckFramebufferStatus(GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE);
+	if (ok)
+	{
+		glPixelStorei(GL_PACK_ALIGNMENT, 1);
+		ClearGLErrors();
+		glReadPixels(x, y, width, height, GL_RGBA, GL_UNSIGNED_BYTE, dest);
+		ok = (glGetError() == GL_NO_ERROR);
+	}
+
+	FramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, 0, 0);
+	BindFramebuffer(GL_FRAMEBUFFER, GLuint(prevFramebuffer));
+	return ok;
+}
+
+
+bool Viewer::ReadTexture(tPixel* dest, uint texID)
+{
+	if (!dest || !texID)
+		return false;
+
+	GLint prevTexture = 0;
+	glGetIntegerv(GL_TEXTURE_BINDING_2D, &prevTexture);
+	glBindTexture(GL_TEXTURE_2D, texID);
+	glPixelStorei(GL_PACK_ALIGNMENT, 1);
+	ClearGLErrors();
+	glGetTexImage(GL_TEXTURE_2D, 0, GL_RGBA, GL_UNSIGNED_BYTE, dest);
+	bool ok = (glGetError() == GL_NO_ERROR);
+	glBindTexture(GL_TEXTURE_2D, GLuint(prevTexture));
+	return ok;
+}
+
+
+bool Viewer::HasGLExtension(const char* name)
+{
+	const char* extensions = (const char*)glGetString(GL_EXTENSIONS);
+	if (!extensions)
+		return false;
+
+	// The name must match a whole space separated token, not just a prefix of a longer one.
+	int nameLen = int(strlen(name));
+	for (const char* found = strstr(extensions, name); found; found = strstr(found + nameLen, name))
+	{
+		bool startOk = (found == extensions) || (found[-1] == ' ');
+		bool endOk = (found[nameLen] == ' ') || (found[nameLen] == '\0');
+		if (startOk && endOk)
+			return true;
+	}
+	return false;
+}
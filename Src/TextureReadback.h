@@ -0,0 +1,37 @@
+// TextureReadback.h
+//
+// Reading pixels back out of textures. A whole texture can always be read. Reading part of one goes through a
+// framebuffer object, which OpenGL 2.1 only has as an extension, so the entry points are looked up at startup.
+//
+// Copyright (c) 2020 Tristan Grimmer.
+// Permission to use, copy, modify, and/or distribute this software for any purpose with or without fee is hereby
+// granted, provided that the above copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+// INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN
+// AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+// PERFORMANCE OF THIS SOFTWARE.
+
+#pragma once
+#include <glad/glad.h>
+#include <Math/tColour.h>
+
+
+namespace Viewer
+{
+	// Looks up the framebuffer object entry points. Call once the OpenGL context is current. Returns false if the
+	// driver has no way to read back part of a texture.
+	bool InitTextureReadback(GLADloadproc);
+	bool IsTextureReadbackSupported();
+
+	// Reads a rectangle of the top level of an RGBA texture into dest, which must hold width*height pixels. Row 0 is
+	// the first row uploaded, so for a texture made from a tPicture the coordinates are the picture's.
+	bool ReadTextureRect(tPixel* dest, uint texID, int x, int y, int width, int height);
+
+	// Reads the whole top level. Does not need framebuffer objects.
+	bool ReadTexture(tPixel* dest, uint texID);
+
+	// True if the current context lists the extension. Needs a current context.
+	bool HasGLExtension(const char* name);
+}
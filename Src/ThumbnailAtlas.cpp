@@ -0,0 +1,225 @@
+// ThumbnailAtlas.cpp
+//
+// Packs thumbnails into a few large textures so the content view can draw hundreds of them without switching textures.
+// Each page holds cells of one size, one for each thumbnail level. Once the pages are at their budget the least
+// recently drawn cell of the right size is handed to the new thumbnail, and its previous owner uploads it again the
+// next time it is drawn.
+//
+// Copyright (c) 2020 Tristan Grimmer.
+// Permission to use, copy, modify, and/or distribute this software for any purpose with or without fee is hereby
+// granted, provided that the above copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+// INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN
+// AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+// PERFORMANCE OF THIS SOFTWARE.
+
+#include <cstring>
+#include <glad/glad.h>
+#include "ThumbnailAtlas.h"
+#include "Image.h"
+using namespace Viewer;
+using namespace tMath;
+using namespace tImage;
+
+
+ThumbnailAtlas::~ThumbnailAtlas()
+{
+	// The OpenGL context is gone by now so the pages aren't deleted.
+	delete[] Pages;
+	delete[] Cells;
+	Pages = nullptr;
+	Cells = nullptr;
+	NumPages = NumCells = 0;
+}
+
+
+void ThumbnailAtlas::NewFrame(int64 maxBytes)
+{
+	Frame++;
+	MaxBytes = maxBytes;
+}
+
+
+int ThumbnailAtlas::Add(Image* owner, int level, const tPicture& picture)
+{
+	if (!owner || (level < 0) || (level >= MaxLevels) || !picture.IsValid())
+		return -1;
+
+	LevelInfo& info = Levels[level];
+	int width = picture.GetWidth();
+	int height = picture.GetHeight();
+	if (info.CellW && ((width != info.CellW) || (height != info.CellH)))
+		return -1;
+
+	if ((info.FreeHead < 0) && (!info.CellW || (GetUsedBytes() + PageBytes <= MaxBytes)))
+		AddPage(level, width, height);
+
+	int cell = info.FreeHead;
+	if (cell >= 0)
+	{
+		info.FreeHead = Cells[cell].Next;
+	}
+	else
+	{
+		// ImGui may still draw with anything drawn this frame or the last, so those cells are left alone.
+		cell = info.Oldest;
+		if ((cell < 0) || (Cells[cell].LastUsedFrame >= Frame-1))
+			return -1;
+
+		Unlink(cell);
+		Cells[cell].Owner->ThumbnailAtlasCell = -1;
+	}
+
+	Cell& c = Cells[cell];
+	c.Owner = owner;
+	c.LastUsedFrame = Frame;
+	Link(cell);
+
+	glBindTexture(GL_TEXTURE_2D, Pages[c.Page].TexID);
+	glTexSubImage2D(GL_TEXTURE_2D, 0, c.X, c.Y, width, height, GL_RGBA, GL_UNSIGNED_BYTE, picture.GetPixelPointer());
+	return cell;
+}
+
+
+void ThumbnailAtlas::Remove(int cell)
+{
+	if ((cell < 0) || (cell >= NumCells) || !Cells[cell].Owner)
+		return;
+
+	Unlink(cell);
+	Cell& c = Cells[cell];
+	c.Owner = nullptr;
+	c.Next = Levels[c.Level].FreeHead;
+	Levels[c.Level].FreeHead = cell;
+}
+
+
+uint ThumbnailAtlas::Touch(int cell, tVector2& uv0, tVector2& uv1)
+{
+	Cell& c = Cells[cell];
+	c.LastUsedFrame = Frame;
+	if (cell != Levels[c.Level].Newest)
+	{
+		Unlink(cell);
+		Link(cell);
+	}
+
+	const LevelInfo& info = Levels[c.Level];
+	float scale = 1.0f / float(PageSize);
+	uv0 = tVector2(float(c.X) * scale, float(c.Y + info.CellH) * scale);
+	uv1 = tVector2(float(c.X + info.CellW) * scale, float(c.Y) * scale);
+	return Pages[c.Page].TexID;
+}
+
+
+int ThumbnailAtlas::GetLevel(int cell) const
+{
+	return ((cell >= 0) && (cell < NumCells)) ? Cells[cell].Level : -1;
+}
+
+
+bool ThumbnailAtlas::AddPage(int level, int cellW, int cellH)
+{
+	int strideW = cellW + 2;
+	int strideH = cellH + 2;
+	int numX = PageSize / strideW;
+	int numY = PageSize / strideH;
+	if (!numX || !numY)
+		return false;
+
+	uint texID = 0;
+	glGenTextures(1, &texID);
+	if (!texID)
+		return false;
+
+	// The page starts out fully transparent so the cell borders are too.
+	glBindTexture(GL_TEXTURE_2D, texID);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+	uint8* clear = new uint8[PageBytes];
+	memset(clear, 0, PageBytes);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, PageSize, PageSize, 0, GL_RGBA, GL_UNSIGNED_BYTE, clear);
+	delete[] clear;
+
+	if (NumPages == MaxPages)
+	{
+		MaxPages = MaxPages ? MaxPages*2 : 8;
+		Page* pages = new Page[MaxPages];
+		if (NumPages)
+			memcpy(pages, Pages, NumPages*sizeof(Page));
+		delete[] Pages;
+		Pages = pages;
+	}
+
+	int numNew = numX*numY;
+	if (NumCells + numNew > MaxCells)
+	{
+		while (NumCells + numNew > MaxCells)
+			MaxCells = MaxCells ? MaxCells*2 : 1024;
+		Cell* cells = new Cell[MaxCells];
+		if (NumCells)
+			memcpy(cells, Cells, NumCells*sizeof(Cell));
+		delete[] Cells;
+		Cells = cells;
+	}
+
+	int page = NumPages++;
+	Pages[page].TexID = texID;
+	Pages[page].Level = level;
+
+	// Pushed in reverse so cells are handed out from the top left.
+	LevelInfo& info = Levels[level];
+	info.CellW = cellW;
+	info.CellH = cellH;
+	for (int n = numNew-1; n >= 0; n--)
+	{
+		int cell = NumCells + n;
+		Cell& c = Cells[cell];
+		c.Owner = nullptr;
+		c.Page = page;
+		c.Level = level;
+		c.X = (n % numX)*strideW + 1;
+		c.Y = (n / numX)*strideH + 1;
+		c.LastUsedFrame = 0;
+		c.Prev = -1;
+		c.Next = info.FreeHead;
+		info.FreeHead = cell;
+	}
+	NumCells += numNew;
+	return true;
+}
+
+
+void ThumbnailAtlas::Link(int cell)
+{
+	LevelInfo& info = Levels[Cells[cell].Level];
+	Cells[cell].Prev = info.Newest;
+	Cells[cell].Next = -1;
+	if (info.Newest >= 0)
+		Cells[info.Newest].Next = cell;
+	else
+		info.Oldest = cell;
+	info.Newest = cell;
+}
+
+
+void ThumbnailAtlas::Unlink(int cell)
+{
+	LevelInfo& info = Levels[Cells[cell].Level];
+	Cell& c = Cells[cell];
+	if (c.Prev >= 0)
+		Cells[c.Prev].Next = c.Next;
+	else
+		info.Oldest = c.Next;
+
+	if (c.Next >= 0)
+		Cells[c.Next].Prev = c.Prev;
+	else
+		info.Newest = c.Prev;
+
+	c.Prev = c.Next = -1;
+}
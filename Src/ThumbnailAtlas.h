@@ -0,0 +1,102 @@
+// ThumbnailAtlas.h
+//
+// Packs thumbnails into a few large textures so the content view can draw hundreds of them without switching textures.
+// Each page holds cells of one size, one for each thumbnail level. Once the pages are at their budget the least
+// recently drawn cell of the right size is handed to the new thumbnail, and its previous owner uploads it again the
+// next time it is drawn.
+//
+// Copyright (c) 2020 Tristan Grimmer.
+// Permission to use, copy, modify, and/or distribute this software for any purpose with or without fee is hereby
+// granted, provided that the above copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+// INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN
+// AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+// PERFORMANCE OF THIS SOFTWARE.
+
+#pragma once
+#include <Foundation/tStandard.h>
+#include <Math/tVector2.h>
+#include <Image/tPicture.h>
+namespace Viewer { class Image; }
+namespace Viewer
+{
+
+
+class ThumbnailAtlas
+{
+public:
+	ThumbnailAtlas()																									{ }
+	~ThumbnailAtlas();
+
+	// Call once at the start of every frame, before anything is drawn. New pages are only made while the pages use less
+	// than maxBytes. There is always at least one page per level.
+	void NewFrame(int64 maxBytes);
+
+	// Uploads the thumbnail into a free cell and returns the cell, or -1 if every cell of that size was drawn this
+	// frame or the last. All thumbnails of one level must be the same size. The owner's ThumbnailAtlasCell is set back
+	// to -1 if the cell is later given to another thumbnail.
+	int Add(Image* owner, int level, const tImage::tPicture&);
+	void Remove(int cell);
+
+	// Call whenever the cell is drawn. Returns the page texture and the cell's texture coordinates, flipped for the
+	// bottom-up row order of tPicture.
+	uint Touch(int cell, tMath::tVector2& uv0, tMath::tVector2& uv1);
+	int GetLevel(int cell) const;
+
+	int64 GetUsedBytes() const																							{ return int64(NumPages) * PageBytes; }
+	int GetNumPages() const																								{ return NumPages; }
+
+	static const int MaxLevels = 4;
+	static const int PageSize = 2048;
+	static const int64 PageBytes = int64(PageSize) * PageSize * 4;
+
+private:
+	ThumbnailAtlas(const ThumbnailAtlas&) = delete;
+	ThumbnailAtlas& operator=(const ThumbnailAtlas&) = delete;
+
+	bool AddPage(int level, int cellW, int cellH);
+	void Link(int cell);
+	void Unlink(int cell);
+
+	struct Page
+	{
+		uint TexID;
+		int Level;
+	};
+
+	// Free cells are kept in a singly linked list through Next. Used cells are in least to most recently drawn order.
+	// Cells have a transparent border of one texel so filtering doesn't pick up the neighbours.
+	struct Cell
+	{
+		Image* Owner;				// Null if free.
+		int Page;
+		int Level;
+		int X, Y;					// Of the thumbnail inside the border.
+		int64 LastUsedFrame;
+		int Prev, Next;
+	};
+
+	struct LevelInfo
+	{
+		int CellW		= 0;
+		int CellH		= 0;
+		int FreeHead	= -1;
+		int Oldest		= -1;
+		int Newest		= -1;
+	};
+
+	Page* Pages			= nullptr;
+	int NumPages		= 0;
+	int MaxPages		= 0;
+	Cell* Cells			= nullptr;
+	int NumCells		= 0;
+	int MaxCells		= 0;
+	LevelInfo Levels[MaxLevels];
+	int64 Frame			= 0;
+	int64 MaxBytes		= 0;
+};
+
+
+}
@@ -0,0 +1,1044 @@
+// ThumbnailCache.cpp
+//
+// All cached thumbnails live in one append-only data file with a hash index beside it. A lookup is a single probe of
+// the in-memory index and a copy out of the mapped data file, so no file is opened or stat'd per thumbnail. Replaced
+// and removed thumbnails leave dead space behind. A background thread keeps the store under a byte budget by removing
+// the least recently used thumbnails, and compacts the data file when much of it is dead. Thumbnails are stored
+// compressed, lossy for opaque ones and lossless otherwise. Only one instance of the viewer may write to the store. Any
+// other instance opens it read-only.
+//
+// Copyright (c) 2020 Tristan Grimmer.
+// Permission to use, copy, modify, and/or distribute this software for any purpose with or without fee is hereby
+// granted, provided that the above copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+// INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN
+// AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+// PERFORMANCE OF THIS SOFTWARE.
+
+#ifdef PLATFORM_WINDOWS
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/file.h>
+#endif
+#include <algorithm>
+#include <climits>
+#include <cstring>
+#include <ctime>
+#include <System/tFile.h>
+#include <System/tTime.h>
+#include <System/tPrint.h>
+#include "ThumbnailCache.h"
+#include "PackedImage.h"
+#include "ScaledJPG.h"
+using namespace tSystem;
+using namespace tImage;
+using namespace tMath;
+
+
+namespace
+{
+	struct DataHeader
+	{
+		char Magic[4];
+		int32 Version;
+		uint64 DataID;
+	};
+
+	// Every record in the data file starts with one of these so the index can be rebuilt from the data alone.
+	struct RecordHeader
+	{
+		Viewer::ThumbnailKey Key;
+		Viewer::ThumbnailKind Kind;
+		uint32 Codec;
+		int32 Width;
+		int32 Height;
+		int32 NumBytes;
+		char Magic[4];
+	};
+
+	struct IndexHeader
+	{
+		char Magic[4];
+		int32 Version;
+		uint64 DataID;
+		int64 DataSize;				// How much of the data file the index covers.
+		int32 NumSlots;
+		uint32 Clock;
+	};
+
+	const char DataMagic[4]		= { 'T', 'V', 'T', 'D' };
+	const char RecordMagic[4]	= { 'T', 'V', 'T', 'R' };
+	const char IndexMagic[4]	= { 'T', 'V', 'T', 'I' };
+	const int32 Version			= 2;
+	const int MinSlots			= 1024;
+	const int MaxThumbDim		= 0xFFFF;
+	const int JPGQuality		= 90;
+
+	// The maintenance thread wakes every MaintainIntervalMS. Eviction brings the live bytes down to a fraction of the
+	// budget so it isn't run again for every new thumbnail. The data file is rewritten when more of it is dead than
+	// live, but not for small amounts, and before it gets close to what can be mapped.
+	const int MaintainIntervalMS	= 2000;
+	const int SaveIndexIntervalMS	= 30000;
+	const int64 EvictToPercent		= 90;
+	const int64 MinCompactBytes		= 64*1024*1024;
+	const int64 MaxDataSize			= int64(INT_MAX)/4*3;
+
+	int64 GetRecordBytes(int numBytes)
+	{
+		return int64(sizeof(RecordHeader)) + int64(numBytes);
+	}
+
+	uint64 NewDataID()
+	{
+		return (uint64(std::time(nullptr)) << 32) ^ tGetHardwareTimerCount();
+	}
+
+	bool ReplaceFile(const tString& tempFile, const tString& file)
+	{
+		tDeleteFile(file);
+		return tRenameFile(tGetDir(tempFile), tGetFileName(tempFile), tGetFileName(file));
+	}
+
+	// Where the next append will go. Returns -1 on failure.
+	int64 GetAppendOffset(FILE* file)
+	{
+		#ifdef PLATFORM_WINDOWS
+		return int64(_ftelli64(file));
+		#else
+		return int64(ftello(file));
+		#endif
+	}
+}
+
+
+bool Viewer::ThumbnailCache::Open(const tString& dir, int64 maxBytes)
+{
+	Close();
+	MaintainStop = false;
+	MaxBytes = maxBytes;
+	IndexFile = dir + "Thumbnails.idx";
+	DataFile = dir + "Thumbnails.dat";
+
+	// Another instance writing the data file at the same time, or compacting it away, would leave our index pointing
+	// at the wrong records. The one without the lock only reads what was there when it opened.
+	ReadOnly = !LockStore(dir + "Thumbnails.lock");
+	if (ReadOnly)
+	{
+		tPrintf("Thumbnail cache %s is in use by another instance. Opening it read-only.\n", DataFile.Chars());
+		return OpenReadOnly();
+	}
+
+	// A compaction that went down between removing the old data file and renaming the new one leaves only the new one.
+	tString tempData = DataFile + ".tmp";
+	if (tFileExists(tempData))
+	{
+		if (!tFileExists(DataFile))
+			ReplaceFile(tempData, DataFile);
+		else
+			tDeleteFile(tempData);
+	}
+
+	bool haveData = false;
+	DataHeader header;
+	if (DataMap.Open(DataFile, MappedFile::Access::Persistent) && (DataMap.GetSize() >= int(sizeof(DataHeader))))
+	{
+		memcpy(&header, DataMap.GetData(), sizeof(header));
+		haveData = !memcmp(header.Magic, DataMagic, sizeof(DataMagic)) && (header.Version == Version);
+	}
+
+	if (haveData)
+	{
+		DataID = header.DataID;
+		DataSize = DataMap.GetSize();
+	}
+	else
+	{
+		DataMap.Close();
+		if (!CreateData(DataFile, NewDataID()))
+		{
+			tPrintf("Warning: Could not create thumbnail cache %s\n", DataFile.Chars());
+			return false;
+		}
+		DataMap.Open(DataFile, MappedFile::Access::Persistent);
+	}
+
+	int64 indexed = LoadIndex() ? DataSize : int64(sizeof(DataHeader));
+	if (indexed == int64(sizeof(DataHeader)))
+	{
+		delete[] Slots;
+		NumSlots = MinSlots;
+		Slots = new Slot[NumSlots];
+		memset(Slots, 0, NumSlots*sizeof(Slot));
+		NumUsed = NumRemoved = 0;
+		LiveBytes = 0;
+	}
+
+	// The data file can be longer than the index says if we didn't get to write the index last time. It can also
+	// end in a partial record. That is cut off by rewriting the file. If that fails nothing is appended this session
+	// since new records would land after the partial one.
+	DataSize = DataMap.GetSize();
+	if (ScanData(indexed) || Compact())
+	{
+		if (!DataHandle)
+			DataHandle = fopen(DataFile.Chars(), "ab");
+		WriteFailed = !DataHandle;
+	}
+	else
+	{
+		WriteFailed = true;
+	}
+
+	Maintainer = std::thread(&ThumbnailCache::MaintainLoop, this);
+	return true;
+}
+
+
+bool Viewer::ThumbnailCache::OpenReadOnly()
+{
+	// Records the other instance is appending may not be complete yet so the scan just stops at them.
+	WriteFailed = true;
+	DataHeader header;
+	bool ok = DataMap.Open(DataFile, MappedFile::Access::Persistent) && (DataMap.GetSize() >= int(sizeof(DataHeader)));
+	if (ok)
+	{
+		memcpy(&header, DataMap.GetData(), sizeof(header));
+		ok = !memcmp(header.Magic, DataMagic, sizeof(DataMagic)) && (header.Version == Version);
+	}
+	if (!ok)
+	{
+		DataMap.Close();
+		UnlockStore();
+		return false;
+	}
+
+	DataID = header.DataID;
+	DataSize = DataMap.GetSize();
+	int64 indexed = LoadIndex() ? DataSize : int64(sizeof(DataHeader));
+	if (indexed == int64(sizeof(DataHeader)))
+	{
+		delete[] Slots;
+		NumSlots = MinSlots;
+		Slots = new Slot[NumSlots];
+		memset(Slots, 0, NumSlots*sizeof(Slot));
+		NumUsed = NumRemoved = 0;
+		LiveBytes = 0;
+	}
+
+	DataSize = DataMap.GetSize();
+	ScanData(indexed);
+	return true;
+}
+
+
+void Viewer::ThumbnailCache::Close()
+{
+	// A compaction in progress gives up when asked to stop and leaves the data file as it was.
+	MaintainStop = true;
+	if (Maintainer.joinable())
+		Maintainer.join();
+
+	if (!Slots)
+	{
+		UnlockStore();
+		return;
+	}
+
+	if (DataHandle)
+		fclose(DataHandle);
+	DataHandle = nullptr;
+	DataMap.Close();
+
+	if (!WriteFailed)
+		SaveIndex();
+
+	delete[] Slots;
+	Slots = nullptr;
+	NumSlots = NumUsed = NumRemoved = 0;
+	DataSize = LiveBytes = 0;
+	DataID = 0;
+	Clock = 0;
+	NumHits = NumMisses = 0;
+	IndexDirty = false;
+	WriteFailed = false;
+	UnlockStore();
+}
+
+
+bool Viewer::ThumbnailCache::LockStore(const tString& lockFile)
+{
+	// The lock goes with the handle so it is released even if we go down without closing.
+	#ifdef PLATFORM_WINDOWS
+	HANDLE file = CreateFileA
+	(
+		lockFile.Chars(), GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_WRITE, nullptr, OPEN_ALWAYS,
+		FILE_ATTRIBUTE_NORMAL, nullptr
+	);
+	if (file == INVALID_HANDLE_VALUE)
+		return false;
+
+	OVERLAPPED overlapped;
+	memset(&overlapped, 0, sizeof(overlapped));
+	if (!LockFileEx(file, LOCKFILE_EXCLUSIVE_LOCK | LOCKFILE_FAIL_IMMEDIATELY, 0, 1, 0, &overlapped))
+	{
+		CloseHandle(file);
+		return false;
+	}
+	LockHandle = file;
+
+	#else
+	int fd = open(lockFile.Chars(), O_RDWR | O_CREAT, 0644);
+	if (fd == -1)
+		return false;
+
+	if (flock(fd, LOCK_EX | LOCK_NB) != 0)
+	{
+		close(fd);
+		return false;
+	}
+	LockHandle = fd;
+	#endif
+
+	return true;
+}
+
+
+void Viewer::ThumbnailCache::UnlockStore()
+{
+	// Closing the handle releases the lock. The lock file itself is left for next time.
+	#ifdef PLATFORM_WINDOWS
+	if (LockHandle)
+		CloseHandle(LockHandle);
+	LockHandle = nullptr;
+	#else
+	if (LockHandle != -1)
+		close(LockHandle);
+	LockHandle = -1;
+	#endif
+}
+
+
+bool Viewer::ThumbnailCache::Contains(const ThumbnailKey& key, ThumbnailKind kind)
+{
+	std::lock_guard<std::mutex> lock(Mutex);
+	return FindSlot(key, kind) >= 0;
+}
+
+
+bool Viewer::ThumbnailCache::Read(tPicture& picture, const ThumbnailKey& key, ThumbnailKind kind)
+{
+	// The compressed bytes are copied out so the mapping may be replaced while we decode.
+	uint8* data = nullptr;
+	int numBytes = 0, width = 0, height = 0;
+	Codec codec = Codec::Raw;
+	{
+		std::lock_guard<std::mutex> lock(Mutex);
+		int s = FindSlot(key, kind);
+		if ((s < 0) || (Slots[s].Width == 0) || (Slots[s].Height == 0))
+			return false;
+
+		Slot& slot = Slots[s];
+		if (!RemapData(slot.Offset + slot.NumBytes))
+			return false;
+
+		// The record must be the one the slot says it is. If not the slot is wrong and is dropped so it isn't saved.
+		RecordHeader header;
+		memcpy(&header, DataMap.GetData() + slot.Offset - int64(sizeof(RecordHeader)), sizeof(header));
+		bool match =
+			!memcmp(header.Magic, RecordMagic, sizeof(RecordMagic)) && !memcmp(&header.Key, &key, sizeof(ThumbnailKey)) &&
+			(header.Kind == kind) && (header.Codec == uint32(slot.Format)) && (header.Width == slot.Width) &&
+			(header.Height == slot.Height) && (header.NumBytes == slot.NumBytes);
+		if (!match)
+		{
+			RemoveSlot(s);
+			return false;
+		}
+
+		numBytes = slot.NumBytes;
+		width = slot.Width;
+		height = slot.Height;
+		codec = slot.Format;
+		data = new uint8[numBytes];
+		memcpy(data, DataMap.GetData() + slot.Offset, numBytes);
+		slot.LastUsed = ++Clock;
+		IndexDirty = true;
+		NumHits++;
+	}
+
+	tPixel* pixels = new tPixel[width*height];
+	bool ok = Decode(pixels, width, height, codec, data, numBytes);
+	delete[] data;
+	if (!ok)
+	{
+		delete[] pixels;
+		return false;
+	}
+
+	picture.Set(width, height, pixels, false);
+	return true;
+}
+
+
+bool Viewer::ThumbnailCache::Write(const ThumbnailKey& key, ThumbnailKind kind, const tPixel* pixels, int width, int height)
+{
+	if ((width < 0) || (width > MaxThumbDim) || (height < 0) || (height > MaxThumbDim))
+		return false;
+
+	Codec codec = Codec::Raw;
+	int numBytes = 0;
+	uint8* data = (width && height) ? Encode(pixels, width, height, codec, numBytes) : nullptr;
+
+	std::lock_guard<std::mutex> lock(Mutex);
+	if (!DataHandle || WriteFailed)
+	{
+		delete[] data;
+		return false;
+	}
+
+	// The data file is mapped and addressed with an int. The maintenance thread compacts it well before this.
+	int64 recordBytes = GetRecordBytes(numBytes);
+	if (DataSize + recordBytes > INT_MAX)
+	{
+		delete[] data;
+		return false;
+	}
+
+	RecordHeader header;
+	memset(&header, 0, sizeof(header));
+	header.Key = key;
+	header.Kind = kind;
+	header.Codec = uint32(codec);
+	header.Width = width;
+	header.Height = height;
+	header.NumBytes = numBytes;
+	memcpy(header.Magic, RecordMagic, sizeof(RecordMagic));
+
+	bool ok = fwrite(&header, sizeof(header), 1, DataHandle) == 1;
+	if (ok && numBytes)
+		ok = fwrite(data, numBytes, 1, DataHandle) == 1;
+	ok = ok && (fflush(DataHandle) == 0);
+	delete[] data;
+
+	// The offset comes from where the record actually went, not from where we think the end of the file is.
+	int64 dataEnd = ok ? GetAppendOffset(DataHandle) : -1;
+	ok = ok && (dataEnd >= DataSize + recordBytes);
+
+	// We no longer know where the end of the data is. The index on disk is left as it was and the partial record is
+	// dropped the next time the store is opened.
+	if (!ok)
+	{
+		tPrintf("Warning: Could not write to thumbnail cache %s\n", DataFile.Chars());
+		WriteFailed = true;
+		return false;
+	}
+
+	Slot slot;
+	slot.Key = key;
+	slot.Offset = dataEnd - int64(numBytes);
+	slot.NumBytes = numBytes;
+	slot.Width = uint16(width);
+	slot.Height = uint16(height);
+	slot.Kind = kind;
+	slot.State = SlotState::Used;
+	slot.LastUsed = ++Clock;
+	slot.Format = codec;
+	Insert(slot);
+	DataSize = dataEnd;
+	IndexDirty = true;
+	if (kind != ThumbnailKind::Failed)
+		NumMisses++;
+	return true;
+}
+
+
+void Viewer::ThumbnailCache::Remove(const ThumbnailKey& key, ThumbnailKind kind)
+{
+	std::lock_guard<std::mutex> lock(Mutex);
+	int s = FindSlot(key, kind);
+	if (s >= 0)
+		RemoveSlot(s);
+}
+
+
+void Viewer::ThumbnailCache::GetStats(Stats& stats)
+{
+	std::lock_guard<std::mutex> lock(Mutex);
+	stats.NumEntries = NumUsed;
+	stats.LiveBytes = LiveBytes;
+	stats.FileBytes = DataSize;
+	stats.MaxBytes = MaxBytes;
+	stats.NumHits = NumHits;
+	stats.NumMisses = NumMisses;
+}
+
+
+namespace
+{
+	int GetHomeSlot(const Viewer::ThumbnailKey& key, Viewer::ThumbnailKind kind, int numSlots)
+	{
+		// The key is already a good hash. The kind is mixed in so the variants of one thumbnail don't share a home.
+		uint64 hash = key.W[0] ^ (uint64(kind) * 0x9E3779B97F4A7C15ull);
+		return int(hash & uint64(numSlots-1));
+	}
+}
+
+
+int Viewer::ThumbnailCache::FindSlot(const ThumbnailKey& key, ThumbnailKind kind) const
+{
+	if (!Slots)
+		return -1;
+
+	int mask = NumSlots-1;
+	for (int s = GetHomeSlot(key, kind, NumSlots); Slots[s].State != SlotState::Empty; s = (s+1) & mask)
+	{
+		const Slot& slot = Slots[s];
+		if ((slot.State == SlotState::Used) && (slot.Kind == kind) && !memcmp(&slot.Key, &key, sizeof(ThumbnailKey)))
+			return s;
+	}
+
+	return -1;
+}
+
+
+void Viewer::ThumbnailCache::Insert(const Slot& newSlot)
+{
+	// Removed slots count towards the load since probes have to step over them.
+	if ((NumUsed + NumRemoved + 1)*2 > NumSlots)
+		Grow();
+
+	int existing = FindSlot(newSlot.Key, newSlot.Kind);
+	LiveBytes += GetRecordBytes(newSlot.NumBytes);
+	if (existing >= 0)
+	{
+		LiveBytes -= GetRecordBytes(Slots[existing].NumBytes);
+		Slots[existing] = newSlot;
+		return;
+	}
+
+	int mask = NumSlots-1;
+	int s = GetHomeSlot(newSlot.Key, newSlot.Kind, NumSlots);
+	while (Slots[s].State == SlotState::Used)
+		s = (s+1) & mask;
+
+	if (Slots[s].State == SlotState::Removed)
+		NumRemoved--;
+	Slots[s] = newSlot;
+	NumUsed++;
+}
+
+
+void Viewer::ThumbnailCache::RemoveSlot(int s)
+{
+	LiveBytes -= GetRecordBytes(Slots[s].NumBytes);
+	Slots[s].State = SlotState::Removed;
+	NumUsed--;
+	NumRemoved++;
+	IndexDirty = true;
+}
+
+
+void Viewer::ThumbnailCache::Grow()
+{
+	// Rehashing also gets rid of removed slots so the table may not need to get any bigger.
+	int newNumSlots = MinSlots;
+	while ((NumUsed+1)*4 > newNumSlots)
+		newNumSlots *= 2;
+
+	Slot* oldSlots = Slots;
+	int oldNumSlots = NumSlots;
+	Slots = new Slot[newNumSlots];
+	memset(Slots, 0, newNumSlots*sizeof(Slot));
+	NumSlots = newNumSlots;
+	NumRemoved = 0;
+
+	int mask = NumSlots-1;
+	for (int o = 0; o < oldNumSlots; o++)
+	{
+		if (oldSlots[o].State != SlotState::Used)
+			continue;
+
+		int s = GetHomeSlot(oldSlots[o].Key, oldSlots[o].Kind, NumSlots);
+		while (Slots[s].State != SlotState::Empty)
+			s = (s+1) & mask;
+		Slots[s] = oldSlots[o];
+	}
+
+	delete[] oldSlots;
+}
+
+
+bool Viewer::ThumbnailCache::LoadIndex()
+{
+	// The index is read in one go. It is small compared to the data and the workers update it all the time.
+	MappedFile file;
+	if (!file.Open(IndexFile, MappedFile::Access::Sequential) || (file.GetSize() < int(sizeof(IndexHeader))))
+		return false;
+
+	IndexHeader header;
+	memcpy(&header, file.GetData(), sizeof(header));
+	if
+	(
+		memcmp(header.Magic, IndexMagic, sizeof(IndexMagic)) || (header.Version != Version) ||
+		(header.DataID != DataID) || (header.DataSize < int64(sizeof(DataHeader))) || (header.DataSize > DataSize) ||
+		(header.NumSlots < MinSlots) || (header.NumSlots & (header.NumSlots-1)) ||
+		(int64(file.GetSize()) != int64(sizeof(IndexHeader)) + int64(header.NumSlots)*int64(sizeof(Slot)))
+	)
+		return false;
+
+	Slot* slots = new Slot[header.NumSlots];
+	memcpy(slots, file.GetData() + sizeof(IndexHeader), header.NumSlots*sizeof(Slot));
+
+	int numUsed = 0, numRemoved = 0;
+	int64 liveBytes = 0;
+	for (int s = 0; s < header.NumSlots; s++)
+	{
+		const Slot& slot = slots[s];
+		if (slot.State == SlotState::Removed)
+			numRemoved++;
+		if (slot.State != SlotState::Used)
+			continue;
+
+		int64 recordBytes = GetRecordBytes(slot.NumBytes);
+		bool valid =
+			(slot.NumBytes >= 0) && (slot.Format <= Codec::JPG) &&
+			(slot.Offset >= int64(sizeof(DataHeader) + sizeof(RecordHeader))) &&
+			(slot.Offset - int64(sizeof(RecordHeader)) + recordBytes <= header.DataSize);
+		if (!valid)
+		{
+			delete[] slots;
+			return false;
+		}
+		numUsed++;
+		liveBytes += recordBytes;
+	}
+
+	delete[] Slots;
+	Slots = slots;
+	NumSlots = header.NumSlots;
+	NumUsed = numUsed;
+	NumRemoved = numRemoved;
+	Clock = header.Clock;
+	DataSize = header.DataSize;
+	LiveBytes = liveBytes;
+	return true;
+}
+
+
+bool Viewer::ThumbnailCache::SaveIndex()
+{
+	// The table is copied so the workers aren't held up while it is written. Only the maintenance thread, or Open and
+	// Close while it isn't running, write the index.
+	IndexHeader header;
+	Slot* slots = nullptr;
+	{
+		std::lock_guard<std::mutex> lock(Mutex);
+		if (!Slots)
+			return false;
+
+		memcpy(header.Magic, IndexMagic, sizeof(IndexMagic));
+		header.Version = Version;
+		header.DataID = DataID;
+		header.DataSize = DataSize;
+		header.NumSlots = NumSlots;
+		header.Clock = Clock;
+		slots = new Slot[NumSlots];
+		memcpy(slots, Slots, NumSlots*sizeof(Slot));
+		IndexDirty = false;
+	}
+
+	tString tempFile = IndexFile + ".tmp";
+	FILE* file = fopen(tempFile.Chars(), "wb");
+	bool ok = (file != nullptr);
+	ok = ok && (fwrite(&header, sizeof(header), 1, file) == 1);
+	ok = ok && (fwrite(slots, sizeof(Slot), header.NumSlots, file) == size_t(header.NumSlots));
+	if (file)
+		ok = (fclose(file) == 0) && ok;
+	delete[] slots;
+
+	ok = ok && ReplaceFile(tempFile, IndexFile);
+	if (!ok)
+	{
+		tPrintf("Warning: Could not write thumbnail index %s\n", IndexFile.Chars());
+		tDeleteFile(tempFile);
+	}
+	return ok;
+}
+
+
+bool Viewer::ThumbnailCache::CreateData(const tString& filename, uint64 dataID)
+{
+	FILE* file = fopen(filename.Chars(), "wb");
+	if (!file)
+		return false;
+
+	DataHeader header;
+	memcpy(header.Magic, DataMagic, sizeof(DataMagic));
+	header.Version = Version;
+	header.DataID = dataID;
+	bool ok = fwrite(&header, sizeof(header), 1, file) == 1;
+	ok = (fclose(file) == 0) && ok;
+	if (!ok)
+		return false;
+
+	DataID = dataID;
+	DataSize = sizeof(DataHeader);
+	LiveBytes = 0;
+	return true;
+}
+
+
+bool Viewer::ThumbnailCache::ScanData(int64 from)
+{
+	const uint8* data = DataMap.GetData();
+	int64 offset = from;
+	while (data && (offset + int64(sizeof(RecordHeader)) <= DataSize))
+	{
+		RecordHeader header;
+		memcpy(&header, data + offset, sizeof(header));
+		bool valid =
+			!memcmp(header.Magic, RecordMagic, sizeof(RecordMagic)) && (header.Kind <= ThumbnailKind::Failed) &&
+			(header.Codec <= uint32(Codec::JPG)) && (header.NumBytes >= 0) &&
+			(header.Width >= 0) && (header.Width <= MaxThumbDim) && (header.Height >= 0) && (header.Height <= MaxThumbDim);
+
+		int64 recordBytes = GetRecordBytes(header.NumBytes);
+		if (!valid || (offset + recordBytes > DataSize))
+			break;
+
+		Slot slot;
+		slot.Key = header.Key;
+		slot.Offset = offset + int64(sizeof(RecordHeader));
+		slot.NumBytes = header.NumBytes;
+		slot.Width = uint16(header.Width);
+		slot.Height = uint16(header.Height);
+		slot.Kind = header.Kind;
+		slot.State = SlotState::Used;
+		slot.LastUsed = ++Clock;
+		slot.Format = Codec(header.Codec);
+		Insert(slot);
+		offset += recordBytes;
+	}
+
+	bool clean = (offset == DataSize);
+	if (!clean && !ReadOnly)
+	{
+		DataSize = offset;
+		tPrintf("Warning: Thumbnail cache %s ends in a partial record. Rewriting it.\n", DataFile.Chars());
+	}
+	return clean;
+}
+
+
+bool Viewer::ThumbnailCache::Evict(int64 maxBytes)
+{
+	std::lock_guard<std::mutex> lock(Mutex);
+	if ((maxBytes <= 0) || (LiveBytes <= maxBytes) || !NumUsed)
+		return false;
+
+	// Least recently used first.
+	int* order = new int[NumUsed];
+	int numLive = 0;
+	for (int s = 0; s < NumSlots; s++)
+		if (Slots[s].State == SlotState::Used)
+			order[numLive++] = s;
+	std::sort(order, order + numLive, [this](int a, int b) { return Slots[a].LastUsed < Slots[b].LastUsed; });
+
+	int64 targetBytes = maxBytes*EvictToPercent/100;
+	for (int k = 0; (k < numLive) && (LiveBytes > targetBytes); k++)
+		RemoveSlot(order[k]);
+	delete[] order;
+	return true;
+}
+
+
+namespace
+{
+	struct MovedRecord
+	{
+		int64 OldOffset;
+		int64 NewOffset;
+	};
+}
+
+
+bool Viewer::ThumbnailCache::Compact()
+{
+	// The live records as they are now. Records appended while the copy is made are carried over verbatim at the end.
+	// Records removed or replaced while it is made are copied anyway and become dead space in the new file.
+	Slot* snapshot = nullptr;
+	int numLive = 0;
+	int64 snapshotSize = 0;
+	{
+		std::lock_guard<std::mutex> lock(Mutex);
+		if (!Slots)
+			return false;
+
+		snapshot = new Slot[tMax(NumUsed, 1)];
+		for (int s = 0; s < NumSlots; s++)
+			if (Slots[s].State == SlotState::Used)
+				snapshot[numLive++] = Slots[s];
+		snapshotSize = DataSize;
+	}
+	std::sort(snapshot, snapshot + numLive, [](const Slot& a, const Slot& b) { return a.Offset < b.Offset; });
+
+	// The copy is made from a mapping of our own so the workers keep reading and writing while it runs.
+	MappedFile src;
+	bool ok = src.Open(DataFile, MappedFile::Access::Persistent) && (int64(src.GetSize()) >= snapshotSize);
+
+	tString tempFile = DataFile + ".tmp";
+	uint64 newDataID = NewDataID();
+	FILE* file = ok ? fopen(tempFile.Chars(), "wb") : nullptr;
+	ok = ok && (file != nullptr);
+
+	DataHeader dataHeader;
+	memcpy(dataHeader.Magic, DataMagic, sizeof(DataMagic));
+	dataHeader.Version = Version;
+	dataHeader.DataID = newDataID;
+	ok = ok && (fwrite(&dataHeader, sizeof(dataHeader), 1, file) == 1);
+
+	MovedRecord* moved = new MovedRecord[tMax(numLive, 1)];
+	int64 newDataSize = sizeof(DataHeader);
+	for (int k = 0; (k < numLive) && ok; k++)
+	{
+		const Slot& slot = snapshot[k];
+		int64 recordBytes = GetRecordBytes(slot.NumBytes);
+		const uint8* record = src.GetData() + slot.Offset - int64(sizeof(RecordHeader));
+		ok = !MaintainStop && (fwrite(record, size_t(recordBytes), 1, file) == 1);
+
+		moved[k].OldOffset = slot.Offset;
+		moved[k].NewOffset = newDataSize + int64(sizeof(RecordHeader));
+		newDataSize += recordBytes;
+	}
+	delete[] snapshot;
+	src.Close();
+
+	std::lock_guard<std::mutex> lock(Mutex);
+	int64 tailBytes = DataSize - snapshotSize;
+	if (ok && tailBytes)
+	{
+		ok = RemapData(DataSize) && (fwrite(DataMap.GetData() + snapshotSize, size_t(tailBytes), 1, file) == 1);
+		ok = ok && (newDataSize + tailBytes <= INT_MAX);
+	}
+	if (file)
+		ok = (fclose(file) == 0) && ok;
+
+	// Nothing may have the old data file open when it is replaced.
+	bool hadHandle = (DataHandle != nullptr);
+	if (ok)
+	{
+		if (DataHandle)
+			fclose(DataHandle);
+		DataHandle = nullptr;
+		DataMap.Close();
+		ok = ReplaceFile(tempFile, DataFile);
+	}
+
+	// If the old file is already gone the new one is left for Open to pick up.
+	if (!ok)
+	{
+		if (!MaintainStop)
+			tPrintf("Warning: Could not compact thumbnail cache %s\n", DataFile.Chars());
+		if (tFileExists(DataFile))
+			tDeleteFile(tempFile);
+		delete[] moved;
+		if (!DataMap.IsValid())
+			DataMap.Open(DataFile, MappedFile::Access::Persistent);
+		if (hadHandle && !DataHandle)
+		{
+			DataHandle = fopen(DataFile.Chars(), "ab");
+			WriteFailed = WriteFailed || !DataHandle;
+		}
+		return false;
+	}
+
+	// Slots may have moved around the table since the snapshot so they are matched up by offset.
+	for (int s = 0; s < NumSlots; s++)
+	{
+		Slot& slot = Slots[s];
+		if (slot.State != SlotState::Used)
+			continue;
+
+		if (slot.Offset >= snapshotSize)
+		{
+			slot.Offset += newDataSize - snapshotSize;
+			continue;
+		}
+
+		const MovedRecord* found = std::lower_bound
+		(
+			moved, moved + numLive, slot.Offset,
+			[](const MovedRecord& m, int64 offset) { return m.OldOffset < offset; }
+		);
+		tAssert((found != moved + numLive) && (found->OldOffset == slot.Offset));
+		slot.Offset = found->NewOffset;
+	}
+	delete[] moved;
+
+	DataID = newDataID;
+	DataSize = newDataSize + tailBytes;
+	DataMap.Open(DataFile, MappedFile::Access::Persistent);
+	DataHandle = fopen(DataFile.Chars(), "ab");
+	WriteFailed = !DataHandle;
+	IndexDirty = true;
+	return true;
+}
+
+
+void Viewer::ThumbnailCache::MaintainLoop()
+{
+	int sinceSaveMS = 0;
+	bool compactFailed = false;
+	while (!MaintainStop)
+	{
+		for (int ms = 0; (ms < MaintainIntervalMS) && !MaintainStop; ms += 100)
+			tSleep(100);
+		if (MaintainStop)
+			break;
+		sinceSaveMS += MaintainIntervalMS;
+
+		Evict(MaxBytes);
+
+		int64 dataSize = 0, liveBytes = 0;
+		bool indexDirty = false;
+		{
+			std::lock_guard<std::mutex> lock(Mutex);
+			dataSize = DataSize;
+			liveBytes = LiveBytes;
+			indexDirty = IndexDirty;
+		}
+
+		// A failed compaction isn't retried this session. It would most likely fail again after copying everything.
+		int64 deadBytes = dataSize - int64(sizeof(DataHeader)) - liveBytes;
+		bool compact = ((deadBytes > liveBytes) && (deadBytes > MinCompactBytes)) || (dataSize > MaxDataSize);
+		if (compact && !compactFailed)
+		{
+			compactFailed = !Compact();
+			indexDirty = indexDirty || !compactFailed;
+			if (!compactFailed)
+				sinceSaveMS = SaveIndexIntervalMS;
+		}
+
+		// The index is written soon after a compaction since until then it refers to a data file that is gone.
+		if (indexDirty && (sinceSaveMS >= SaveIndexIntervalMS) && !MaintainStop)
+		{
+			SaveIndex();
+			sinceSaveMS = 0;
+		}
+	}
+}
+
+
+uint8* Viewer::ThumbnailCache::Encode(const tPixel* pixels, int width, int height, Codec& codec, int& numBytes)
+{
+	// Find the rectangle holding everything that isn't fully transparent. If it is all opaque it can go lossy.
+	int numPixels = width*height;
+	int minX = width, minY = height, maxX = -1, maxY = -1;
+	for (int y = 0; y < height; y++)
+	{
+		for (int x = 0; x < width; x++)
+		{
+			if (!pixels[y*width + x].A)
+				continue;
+			minX = tMin(minX, x);	maxX = tMax(maxX, x);
+			minY = tMin(minY, y);	maxY = tMax(maxY, y);
+		}
+	}
+
+	bool opaqueRect = (maxX >= 0) && CanEncodeJPG();
+	for (int y = minY; (y <= maxY) && opaqueRect; y++)
+		for (int x = minX; (x <= maxX) && opaqueRect; x++)
+			opaqueRect = (pixels[y*width + x].A == 255);
+
+	if (opaqueRect)
+	{
+		int rectW = maxX - minX + 1;
+		int rectH = maxY - minY + 1;
+		tPixel* rect = new tPixel[rectW*rectH];
+		for (int y = 0; y < rectH; y++)
+			memcpy(rect + y*rectW, pixels + (minY+y)*width + minX, rectW*sizeof(tPixel));
+
+		int jpgBytes = 0;
+		uint8* jpg = EncodeJPG(rect, rectW, rectH, JPGQuality, jpgBytes);
+		delete[] rect;
+		if (jpg)
+		{
+			uint16 rectInfo[4] = { uint16(minX), uint16(minY), uint16(rectW), uint16(rectH) };
+			numBytes = int(sizeof(rectInfo)) + jpgBytes;
+			uint8* data = new uint8[numBytes];
+			memcpy(data, rectInfo, sizeof(rectInfo));
+			memcpy(data + sizeof(rectInfo), jpg, jpgBytes);
+			delete[] jpg;
+			codec = Codec::JPG;
+			return data;
+		}
+	}
+
+	uint8* packed = PackPixels(pixels, numPixels, numBytes);
+	if (numBytes < numPixels*int(sizeof(tPixel)))
+	{
+		codec = Codec::Packed;
+		return packed;
+	}
+
+	delete[] packed;
+	numBytes = numPixels*sizeof(tPixel);
+	uint8* data = new uint8[numBytes];
+	memcpy(data, pixels, numBytes);
+	codec = Codec::Raw;
+	return data;
+}
+
+
+bool Viewer::ThumbnailCache::Decode(tPixel* dest, int width, int height, Codec codec, const uint8* data, int numBytes)
+{
+	int numPixels = width*height;
+	switch (codec)
+	{
+		case Codec::Raw:
+			if (numBytes != numPixels*int(sizeof(tPixel)))
+				return false;
+			memcpy(dest, data, numBytes);
+			return true;
+
+		case Codec::Packed:
+			return UnpackPixels(dest, numPixels, data, numBytes);
+
+		case Codec::JPG:
+		{
+			uint16 rectInfo[4];
+			if (numBytes < int(sizeof(rectInfo)))
+				return false;
+			memcpy(rectInfo, data, sizeof(rectInfo));
+			int rectX = rectInfo[0], rectY = rectInfo[1], rectW = rectInfo[2], rectH = rectInfo[3];
+			if ((rectW <= 0) || (rectH <= 0) || (rectX + rectW > width) || (rectY + rectH > height))
+				return false;
+
+			tPixel* rect = ((rectW == width) && (rectH == height)) ? dest : new tPixel[rectW*rectH];
+			bool ok = DecodeJPG(rect, rectW, rectH, data + sizeof(rectInfo), numBytes - int(sizeof(rectInfo)));
+			if (ok && (rect != dest))
+			{
+				memset(dest, 0, numPixels*sizeof(tPixel));
+				for (int y = 0; y < rectH; y++)
+					memcpy(dest + (rectY+y)*width + rectX, rect + y*rectW, rectW*sizeof(tPixel));
+			}
+			if (rect != dest)
+				delete[] rect;
+			return ok;
+		}
+	}
+
+	return false;
+}
+
+
+bool Viewer::ThumbnailCache::RemapData(int64 requiredSize)
+{
+	if (DataMap.IsValid() && (int64(DataMap.GetSize()) >= requiredSize))
+		return true;
+
+	// Appends go through the file handle and are flushed, so a new mapping sees them.
+	DataMap.Close();
+	return DataMap.Open(DataFile, MappedFile::Access::Persistent) && (int64(DataMap.GetSize()) >= requiredSize);
+}
@@ -0,0 +1,168 @@
+// ThumbnailCache.h
+//
+// All cached thumbnails live in one append-only data file with a hash index beside it. A lookup is a single probe of
+// the in-memory index and a copy out of the mapped data file, so no file is opened or stat'd per thumbnail. Replaced
+// and removed thumbnails leave dead space behind. A background thread keeps the store under a byte budget by removing
+// the least recently used thumbnails, and compacts the data file when much of it is dead. Thumbnails are stored
+// compressed, lossy for opaque ones and lossless otherwise. Only one instance of the viewer may write to the store. Any
+// other instance opens it read-only.
+//
+// Copyright (c) 2020 Tristan Grimmer.
+// Permission to use, copy, modify, and/or distribute this software for any purpose with or without fee is hereby
+// granted, provided that the above copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+// INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN
+// AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+// PERFORMANCE OF THIS SOFTWARE.
+
+#pragma once
+#include <cstdio>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <Foundation/tString.h>
+#include <Math/tColour.h>
+#include <Image/tPicture.h>
+#include "MappedFile.h"
+namespace Viewer
+{
+
+
+// A 256 bit hash of everything that identifies the thumbnail.
+struct ThumbnailKey
+{
+	uint64 W[4];
+};
+
+
+enum class ThumbnailKind : uint32
+{
+	Full,
+	Preview,				// Made from the preview embedded in the file.
+	Failed					// No pixels. Remembers that the file could not be decoded.
+};
+
+
+class ThumbnailCache
+{
+public:
+	ThumbnailCache()																									{ }
+	~ThumbnailCache()																									{ Close(); }
+
+	// Opens or creates the store in dir and starts the maintenance thread. Thumbnails appended after the index was
+	// last written, for example before a crash, are recovered by scanning the end of the data file. The store is
+	// locked while open. If another instance already has it locked it is opened read-only. Nothing is written and
+	// there is no maintenance thread. Returns false if there is no store to read.
+	bool Open(const tString& dir, int64 maxBytes);
+
+	// Stops the maintenance thread and writes the index. This is quick. Nothing is compacted on the way out.
+	void Close();
+	bool IsOpen() const																									{ return Slots != nullptr; }
+	bool IsReadOnly() const																								{ return ReadOnly; }
+
+	// The budget for thumbnails still in use. Dead space in the data file doesn't count. May be changed at any time.
+	void SetMaxBytes(int64 maxBytes)																					{ MaxBytes = maxBytes; }
+
+	// These may be called from any thread. Compressing and decompressing is done by the calling thread outside the lock
+	// so the thumbnail workers share the work.
+	bool Contains(const ThumbnailKey&, ThumbnailKind);
+	bool Read(tImage::tPicture&, const ThumbnailKey&, ThumbnailKind);
+	bool Write(const ThumbnailKey&, ThumbnailKind, const tPixel* pixels, int width, int height);
+	void Remove(const ThumbnailKey&, ThumbnailKind);
+
+	struct Stats
+	{
+		int NumEntries;
+		int64 LiveBytes;		// Held by thumbnails still in use.
+		int64 FileBytes;		// Size of the data file including dead space.
+		int64 MaxBytes;
+		int64 NumHits;			// Thumbnails read from the store this session.
+		int64 NumMisses;		// Thumbnails that had to be made and were added this session.
+	};
+	void GetStats(Stats&);
+
+private:
+	ThumbnailCache(const ThumbnailCache&) = delete;
+	ThumbnailCache& operator=(const ThumbnailCache&) = delete;
+
+	enum class SlotState : uint32 { Empty, Used, Removed };
+
+	enum class Codec : uint32
+	{
+		Raw,
+		Packed,					// Lossless. See PackPixels.
+		JPG						// An opaque rectangle stored as a jpg with everything outside it fully transparent.
+								// Covers opaque thumbnails and the padding that centre cropping adds.
+	};
+
+	// Slots are 64 bytes and are written to the index file as-is.
+	struct Slot
+	{
+		ThumbnailKey Key;
+		int64 Offset;			// Of the stored bytes in the data file.
+		int32 NumBytes;
+		uint16 Width;
+		uint16 Height;
+		ThumbnailKind Kind;
+		SlotState State;
+		uint32 LastUsed;		// Clock value when last read or written.
+		Codec Format;
+	};
+
+	static uint8* Encode(const tPixel* pixels, int width, int height, Codec&, int& numBytes);
+	static bool Decode(tPixel* dest, int width, int height, Codec, const uint8* data, int numBytes);
+
+	int FindSlot(const ThumbnailKey&, ThumbnailKind) const;		// Returns -1 if not found.
+	void Insert(const Slot&);
+	void Grow();
+	bool LoadIndex();
+	bool SaveIndex();
+	bool CreateData(const tString& filename, uint64 dataID);
+	bool ScanData(int64 from);
+	void RemoveSlot(int slot);
+	bool Evict(int64 maxBytes);
+	bool Compact();
+	bool RemapData(int64 requiredSize);
+	void MaintainLoop();
+	bool OpenReadOnly();
+	bool LockStore(const tString& lockFile);
+	void UnlockStore();
+
+	tString IndexFile;
+	tString DataFile;
+	bool ReadOnly		= false;
+
+	// Held for as long as the store is open.
+	#ifdef PLATFORM_WINDOWS
+	void* LockHandle	= nullptr;
+	#else
+	int LockHandle		= -1;
+	#endif
+
+	// Everything below is protected by the mutex.
+	std::mutex Mutex;
+	Slot* Slots			= nullptr;
+	int NumSlots		= 0;				// Always a power of 2.
+	int NumUsed			= 0;
+	int NumRemoved		= 0;
+	uint32 Clock		= 0;
+
+	uint64 DataID		= 0;				// Ties the index to the data file it was written for.
+	int64 DataSize		= 0;
+	int64 LiveBytes		= 0;				// Everything else in the data file is dead.
+	FILE* DataHandle	= nullptr;			// Opened for append.
+	bool WriteFailed	= false;			// Set if an append may have left a partial record.
+	bool IndexDirty		= false;
+	int64 NumHits		= 0;
+	int64 NumMisses		= 0;
+	MappedFile DataMap;
+
+	std::thread Maintainer;
+	std::atomic<bool> MaintainStop { false };
+	std::atomic<int64> MaxBytes { 0 };
+};
+
+
+}
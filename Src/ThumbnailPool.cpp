@@ -0,0 +1,206 @@
+// ThumbnailPool.cpp
+//
+// A fixed set of worker threads that make thumbnails. Requests wait in a queue and the one with the lowest priority
+// value is made next. Requests may be re-prioritised or cancelled until a worker picks them up.
+//
+// Copyright (c) 2020 Tristan Grimmer.
+// Permission to use, copy, modify, and/or distribute this software for any purpose with or without fee is hereby
+// granted, provided that the above copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+// INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN
+// AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+// PERFORMANCE OF THIS SOFTWARE.
+
+#include <System/tMachine.h>
+#include "ThumbnailPool.h"
+#include "Image.h"
+using namespace tMath;
+namespace Viewer
+{
+
+
+void ThumbnailPool::Start(int numWorkers)
+{
+	if (NumWorkers > 0)
+		return;
+
+	// Leave two cores free unless we are on a three core or lower machine, in which case we always use a min of 2 threads.
+	if (numWorkers <= 0)
+		numWorkers = tClampMin(tSystem::tGetNumCores() - 2, 2);
+
+	Stopping = false;
+	NumWorkers = numWorkers;
+	Working = new Image*[NumWorkers];
+	for (int w = 0; w < NumWorkers; w++)
+		Working[w] = nullptr;
+
+	Workers = new std::thread[NumWorkers];
+	for (int w = 0; w < NumWorkers; w++)
+		Workers[w] = std::thread(&ThumbnailPool::WorkerLoop, this, w);
+}
+
+
+void ThumbnailPool::Stop()
+{
+	if (NumWorkers == 0)
+		return;
+
+	{
+		std::lock_guard<std::mutex> lock(Mutex);
+		Stopping = true;
+		for (int q = 0; q < NumQueued; q++)
+			Requests[q].Img->ThumbnailQueueIndex = -1;
+		NumQueued = 0;
+	}
+	WorkReady.notify_all();
+
+	for (int w = 0; w < NumWorkers; w++)
+		Workers[w].join();
+
+	delete[] Workers;
+	delete[] Working;
+	delete[] Requests;
+	Workers = nullptr;
+	Working = nullptr;
+	Requests = nullptr;
+	MaxQueued = 0;
+	NumWorkers = 0;
+}
+
+
+void ThumbnailPool::Queue(Image* img, float priority)
+{
+	Start();
+	{
+		std::lock_guard<std::mutex> lock(Mutex);
+		if (img->ThumbnailQueueIndex >= 0)
+		{
+			Requests[img->ThumbnailQueueIndex].Priority = priority;
+			Requests[img->ThumbnailQueueIndex].Pass = Pass;
+			return;
+		}
+
+		if (NumQueued == MaxQueued)
+		{
+			MaxQueued = tClampMin(MaxQueued*2, 256);
+			Request* requests = new Request[MaxQueued];
+			for (int q = 0; q < NumQueued; q++)
+				requests[q] = Requests[q];
+			delete[] Requests;
+			Requests = requests;
+		}
+
+		img->ThumbnailQueueIndex = NumQueued;
+		Requests[NumQueued].Img = img;
+		Requests[NumQueued].Priority = priority;
+		Requests[NumQueued].Pass = Pass;
+		NumQueued++;
+	}
+	WorkReady.notify_one();
+}
+
+
+void ThumbnailPool::Reprioritise(Image* img, float priority)
+{
+	std::lock_guard<std::mutex> lock(Mutex);
+	if (img->ThumbnailQueueIndex >= 0)
+	{
+		Requests[img->ThumbnailQueueIndex].Priority = priority;
+		Requests[img->ThumbnailQueueIndex].Pass = Pass;
+	}
+}
+
+
+bool ThumbnailPool::Cancel(Image* img)
+{
+	std::lock_guard<std::mutex> lock(Mutex);
+	if (img->ThumbnailQueueIndex < 0)
+		return false;
+
+	RemoveQueued(img->ThumbnailQueueIndex);
+	return true;
+}
+
+
+void ThumbnailPool::Wait(Image* img)
+{
+	std::unique_lock<std::mutex> lock(Mutex);
+	WorkDone.wait
+	(
+		lock, [this, img]
+		{
+			for (int w = 0; w < NumWorkers; w++)
+				if (Working[w] == img)
+					return false;
+			return true;
+		}
+	);
+}
+
+
+void ThumbnailPool::DropStale()
+{
+	std::lock_guard<std::mutex> lock(Mutex);
+	for (int q = 0; q < NumQueued;)
+	{
+		if (Requests[q].Pass == Pass)
+		{
+			q++;
+			continue;
+		}
+
+		// The last request is moved into q so it is looked at next.
+		Image* img = Requests[q].Img;
+		RemoveQueued(q);
+		img->ThumbnailCancelled();
+	}
+	Pass++;
+}
+
+
+void ThumbnailPool::RemoveQueued(int index)
+{
+	// Order in the array doesn't matter so the last request fills the hole.
+	Requests[index].Img->ThumbnailQueueIndex = -1;
+	NumQueued--;
+	if (index != NumQueued)
+	{
+		Requests[index] = Requests[NumQueued];
+		Requests[index].Img->ThumbnailQueueIndex = index;
+	}
+}
+
+
+void ThumbnailPool::WorkerLoop(int worker)
+{
+	std::unique_lock<std::mutex> lock(Mutex);
+	while (true)
+	{
+		WorkReady.wait(lock, [this] { return Stopping || (NumQueued > 0); });
+		if (Stopping)
+			break;
+
+		int best = 0;
+		for (int q = 1; q < NumQueued; q++)
+			if (Requests[q].Priority < Requests[best].Priority)
+				best = q;
+
+		Image* img = Requests[best].Img;
+		RemoveQueued(best);
+		Working[worker] = img;
+		lock.unlock();
+
+		img->GenerateThumbnail();
+
+		// The flag is cleared while holding the lock so once Wait returns the worker is completely done with the image.
+		lock.lock();
+		img->ThumbnailThreadFlag.clear();
+		Working[worker] = nullptr;
+		WorkDone.notify_all();
+	}
+}
+
+
+}
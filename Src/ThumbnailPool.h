@@ -0,0 +1,88 @@
+// ThumbnailPool.h
+//
+// A fixed set of worker threads that make thumbnails. Requests wait in a queue and the one with the lowest priority
+// value is made next. Requests may be re-prioritised or cancelled until a worker picks them up.
+//
+// Copyright (c) 2020 Tristan Grimmer.
+// Permission to use, copy, modify, and/or distribute this software for any purpose with or without fee is hereby
+// granted, provided that the above copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+// INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN
+// AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+// PERFORMANCE OF THIS SOFTWARE.
+
+#pragma once
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <Foundation/tStandard.h>
+namespace Viewer { class Image; }
+namespace Viewer
+{
+
+
+class ThumbnailPool
+{
+public:
+	ThumbnailPool()																										{ }
+	~ThumbnailPool()																									{ Stop(); }
+
+	// Starts the workers if they aren't already going. Queue calls this so it only needs calling to pick the number
+	// of workers. 0 leaves two cores free with a minimum of two workers.
+	void Start(int numWorkers = 0);
+
+	// Waits for the thumbnails being made to finish. Anything still queued is dropped.
+	void Stop();
+
+	// Adds the image to the queue, or updates its priority if it's already there. Lower values are made first.
+	void Queue(Image*, float priority);
+
+	// Updates the priority if the image is still queued. Does nothing once a worker has it.
+	void Reprioritise(Image*, float priority);
+
+	// Removes the image from the queue. Returns false if it wasn't queued, which includes it being worked on now.
+	bool Cancel(Image*);
+
+	// Blocks until no worker is making a thumbnail for the image.
+	void Wait(Image*);
+
+	// Removes every request that hasn't been queued or re-prioritised since the last call. Call it from the thread
+	// that queues, once it has requested everything it still wants. Images that are no longer wanted then don't need to
+	// be visited to be cancelled.
+	void DropStale();
+
+	int GetNumQueued() const																							{ return NumQueued; }
+	int GetNumWorkers() const																							{ return NumWorkers; }
+
+private:
+	void WorkerLoop(int worker);
+	void RemoveQueued(int index);
+
+	struct Request
+	{
+		Image* Img;
+		float Priority;
+		uint Pass;				// The DropStale pass it was last requested in.
+	};
+
+	// Everything below is protected by the mutex. Each image remembers its slot in the queue so finding it again to
+	// re-prioritise or cancel is cheap. Picking the next request is a linear scan, but only visible items and a few
+	// rows around them are ever queued.
+	std::mutex Mutex;
+	std::condition_variable WorkReady;
+	std::condition_variable WorkDone;
+	Request* Requests	= nullptr;
+	int NumQueued		= 0;
+	int MaxQueued		= 0;
+	uint Pass			= 0;
+
+	std::thread* Workers	= nullptr;
+	Image** Working			= nullptr;		// What each worker is making. Null if idle.
+	int NumWorkers			= 0;
+	bool Stopping			= false;
+};
+
+
+}
@@ -0,0 +1,110 @@
+// ThumbnailResidency.cpp
+//
+// Keeps the thumbnail pixels held in memory within a budget. Images join the list whenever their thumbnail is
+// requested, so the items around the viewport are always the most recent. Once over budget the least recently
+// requested lose their pixels. The textures made from them are left alone since the texture cache and the thumbnail
+// atlas have budgets of their own. An evicted thumbnail that is wanted again is read back from the thumbnail cache by
+// the thumbnail workers, and whatever is still in video memory is drawn until it arrives.
+//
+// Copyright (c) 2020 Tristan Grimmer.
+// Permission to use, copy, modify, and/or distribute this software for any purpose with or without fee is hereby
+// granted, provided that the above copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+// INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN
+// AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+// PERFORMANCE OF THIS SOFTWARE.
+
+#include "ThumbnailResidency.h"
+#include "Image.h"
+using namespace Viewer;
+
+
+void ThumbnailResidency::Touch(Image* img)
+{
+	if (!img)
+		return;
+
+	img->ThumbTouchFrame = Frame;
+	if (img->ThumbResident)
+	{
+		if (img == Newest)
+			return;
+		Unlink(img);
+	}
+	Link(img);
+}
+
+
+void ThumbnailResidency::Remove(Image* img)
+{
+	if (img && img->ThumbResident)
+		Unlink(img);
+}
+
+
+void ThumbnailResidency::Clear()
+{
+	while (Oldest)
+		Unlink(Oldest);
+}
+
+
+int ThumbnailResidency::Evict(int64 maxBytes)
+{
+	Frame++;
+	int numEvicted = 0;
+	Image* img = Oldest;
+	while ((UsedBytes > maxBytes) && img && (img->ThumbTouchFrame < Frame-1))
+	{
+		// The worker owns the thumbnail pixels while it is queued or running.
+		Image* next = img->ThumbNext;
+		if (!img->ThumbnailThreadRunning)
+		{
+			Unlink(img);
+			img->ThumbnailEvicted();
+			numEvicted++;
+		}
+		img = next;
+	}
+
+	NumEvictions += numEvicted;
+	return numEvicted;
+}
+
+
+void ThumbnailResidency::Link(Image* img)
+{
+	img->ThumbPrev = Newest;
+	img->ThumbNext = nullptr;
+	if (Newest)
+		Newest->ThumbNext = img;
+	else
+		Oldest = img;
+	Newest = img;
+
+	// Every thumbnail is the same size so what it will hold is counted from the time it is requested.
+	img->ThumbResident = true;
+	UsedBytes += Image::GetThumbnailMemSize();
+	NumResident++;
+}
+
+
+void ThumbnailResidency::Unlink(Image* img)
+{
+	if (img->ThumbPrev)
+		img->ThumbPrev->ThumbNext = img->ThumbNext;
+	else
+		Oldest = img->ThumbNext;
+
+	if (img->ThumbNext)
+		img->ThumbNext->ThumbPrev = img->ThumbPrev;
+	else
+		Newest = img->ThumbPrev;
+
+	img->ThumbPrev = img->ThumbNext = nullptr;
+	img->ThumbResident = false;
+	UsedBytes -= Image::GetThumbnailMemSize();
+	NumResident--;
+}
@@ -0,0 +1,60 @@
+// ThumbnailResidency.h
+//
+// Keeps the thumbnail pixels held in memory within a budget. Images join the list whenever their thumbnail is
+// requested, so the items around the viewport are always the most recent. Once over budget the least recently
+// requested lose their pixels. The textures made from them are left alone since the texture cache and the thumbnail
+// atlas have budgets of their own. An evicted thumbnail that is wanted again is read back from the thumbnail cache by
+// the thumbnail workers, and whatever is still in video memory is drawn until it arrives.
+//
+// Copyright (c) 2020 Tristan Grimmer.
+// Permission to use, copy, modify, and/or distribute this software for any purpose with or without fee is hereby
+// granted, provided that the above copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+// INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN
+// AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+// PERFORMANCE OF THIS SOFTWARE.
+
+#pragma once
+#include <Foundation/tStandard.h>
+namespace Viewer { class Image; }
+namespace Viewer
+{
+
+
+class ThumbnailResidency
+{
+public:
+	ThumbnailResidency()																								{ }
+	~ThumbnailResidency()																								{ Clear(); }
+
+	// All functions must be called from the main thread. Touch adds the image if it isn't in the list and makes it the
+	// most recently used. An image removes itself when it is deleted.
+	void Touch(Image*);
+	void Remove(Image*);
+	void Clear();
+
+	// Call once a frame. Frees the thumbnail pixels of the least recently used images until no more than maxBytes are
+	// counted. Images touched this frame or the last, and images whose thumbnail is being made, are skipped. Returns
+	// the number of thumbnails freed.
+	int Evict(int64 maxBytes);
+
+	int64 GetUsedBytes() const																							{ return UsedBytes; }
+	int GetNumResident() const																							{ return NumResident; }
+	int GetNumEvictions() const																							{ return NumEvictions; }
+
+private:
+	void Link(Image*);				// Appends as most recently used.
+	void Unlink(Image*);
+
+	Image* Oldest			= nullptr;
+	Image* Newest			= nullptr;
+	int NumResident			= 0;
+	int64 UsedBytes			= 0;
+	int64 Frame				= 0;
+	int NumEvictions		= 0;
+};
+
+
+}
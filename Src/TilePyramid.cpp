@@ -0,0 +1,350 @@
+// TilePyramid.cpp
+//
+// Displays images that are too big for a single texture. The picture is split into square tiles at successive
+// power-of-two reductions. Only the tiles that are on screen at the level matching the zoom get uploaded, and tiles
+// that haven't been drawn for a while are released when the VRAM budget is exceeded.
+//
+// Copyright (c) 2020 Tristan Grimmer.
+// Permission to use, copy, modify, and/or distribute this software for any purpose with or without fee is hereby
+// granted, provided that the above copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+// INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN
+// AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+// PERFORMANCE OF THIS SOFTWARE.
+
+#include <thread>
+#include <atomic>
+#include <glad/glad.h>
+#include <Foundation/tStandard.h>
+#include <Foundation/tFundamentals.h>
+#include <System/tMachine.h>
+#include "TilePyramid.h"
+using namespace tMath;
+
+
+namespace
+{
+	// Pictures with more pixels than this are tiled even if they fit in a texture.
+	const int64 MinTiledPixels = int64(64)*1024*1024;
+
+	// Rows of the reduced level made by each job when building.
+	const int JobRows = 64;
+}
+
+
+Viewer::TilePyramid::TilePyramid(const tPixel* pixels, int width, int height, int overviewSize)
+{
+	overviewSize = tMax(overviewSize, TileSize);
+	NumLevels = 1;
+	for (int w = width, h = height; (w > overviewSize) || (h > overviewSize); w = (w+1)/2, h = (h+1)/2)
+		NumLevels++;
+
+	Levels = new Level[NumLevels];
+	for (int l = 0; l < NumLevels; l++)
+	{
+		Level& level = Levels[l];
+		level.Width = l ? (Levels[l-1].Width + 1) / 2 : width;
+		level.Height = l ? (Levels[l-1].Height + 1) / 2 : height;
+
+		// The overview is drawn as a single texture so it has no tiles.
+		bool overview = (l == NumLevels-1);
+		level.NumTilesX = overview ? 0 : (level.Width + TileSize - 1) / TileSize;
+		level.NumTilesY = overview ? 0 : (level.Height + TileSize - 1) / TileSize;
+		int numTiles = level.NumTilesX * level.NumTilesY;
+		level.Tiles = numTiles ? new Tile[numTiles] : nullptr;
+		for (int t = 0; t < numTiles; t++)
+			level.Tiles[t] = { 0, -1 };
+
+		if (l == 0)
+		{
+			level.Pixels = (tPixel*)pixels;
+		}
+		else
+		{
+			level.Pixels = new tPixel[int64(level.Width) * int64(level.Height)];
+			BuildLevel(l);
+		}
+	}
+}
+
+
+Viewer::TilePyramid::~TilePyramid()
+{
+	for (int l = 0; l < NumLevels; l++)
+	{
+		if (l > 0)
+			delete[] Levels[l].Pixels;
+		delete[] Levels[l].Tiles;
+	}
+	delete[] Levels;
+}
+
+
+bool Viewer::TilePyramid::IsNeeded(int width, int height, int maxTextureSize)
+{
+	return (width > maxTextureSize) || (height > maxTextureSize) || (int64(width)*int64(height) > MinTiledPixels);
+}
+
+
+void Viewer::TilePyramid::BuildLevel(int l)
+{
+	const Level& src = Levels[l-1];
+	Level& dst = Levels[l];
+	int numJobs = (dst.Height + JobRows - 1) / JobRows;
+
+	// Each pixel is the average of the 2x2 block above it. An odd last row or column is reused.
+	std::atomic<int> nextJob(0);
+	auto buildJobs = [&src, &dst, numJobs, &nextJob]()
+	{
+		for (int j = nextJob++; j < numJobs; j = nextJob++)
+		{
+			int lastRow = tMin((j+1)*JobRows, dst.Height);
+			for (int y = j*JobRows; y < lastRow; y++)
+			{
+				const tPixel* row0 = src.Pixels + int64(2*y) * int64(src.Width);
+				const tPixel* row1 = src.Pixels + int64(tMin(2*y+1, src.Height-1)) * int64(src.Width);
+				tPixel* dest = dst.Pixels + int64(y) * int64(dst.Width);
+				for (int x = 0; x < dst.Width; x++)
+				{
+					int x0 = 2*x;
+					int x1 = tMin(2*x+1, src.Width-1);
+					dest[x].R = uint8((row0[x0].R + row0[x1].R + row1[x0].R + row1[x1].R + 2) >> 2);
+					dest[x].G = uint8((row0[x0].G + row0[x1].G + row1[x0].G + row1[x1].G + 2) >> 2);
+					dest[x].B = uint8((row0[x0].B + row0[x1].B + row1[x0].B + row1[x1].B + 2) >> 2);
+					dest[x].A = uint8((row0[x0].A + row0[x1].A + row1[x0].A + row1[x1].A + 2) >> 2);
+				}
+			}
+		}
+	};
+
+	int numThreads = tClamp(tSystem::tGetNumCores(), 1, numJobs);
+	int numHelpers = numThreads - 1;
+	std::thread* helpers = numHelpers ? new std::thread[numHelpers] : nullptr;
+	for (int h = 0; h < numHelpers; h++)
+		helpers[h] = std::thread(buildJobs);
+	buildJobs();
+	for (int h = 0; h < numHelpers; h++)
+		helpers[h].join();
+
+	delete[] helpers;
+}
+
+
+void Viewer::TilePyramid::BindOverview(uint texID) const
+{
+	const Level& overview = Levels[NumLevels-1];
+	glBindTexture(GL_TEXTURE_2D, texID);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, overview.Width, overview.Height, 0, GL_RGBA, GL_UNSIGNED_BYTE, overview.Pixels);
+}
+
+
+void Viewer::TilePyramid::GetTileTexRect(int l, int tileX, int tileY, int& texX, int& texY, int& texW, int& texH) const
+{
+	const Level& level = Levels[l];
+	texX = tMax(tileX*TileSize - 1, 0);
+	texY = tMax(tileY*TileSize - 1, 0);
+	texW = tMin((tileX+1)*TileSize + 1, level.Width) - texX;
+	texH = tMin((tileY+1)*TileSize + 1, level.Height) - texY;
+}
+
+
+void Viewer::TilePyramid::UploadTile(int l, int tileX, int tileY)
+{
+	const Level& level = Levels[l];
+	Tile& tile = level.Tiles[tileY*level.NumTilesX + tileX];
+	int texX, texY, texW, texH;
+	GetTileTexRect(l, tileX, tileY, texX, texY, texW, texH);
+
+	glGenTextures(1, &tile.TexID);
+	if (!tile.TexID)
+		return;
+
+	glBindTexture(GL_TEXTURE_2D, tile.TexID);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+
+	// The start pointer is offset here rather than with the skip pixel state since the offset into a big level does
+	// not fit in a GLint.
+	const tPixel* start = level.Pixels + int64(texY) * int64(level.Width) + texX;
+	glPixelStorei(GL_UNPACK_ROW_LENGTH, level.Width);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, texW, texH, 0, GL_RGBA, GL_UNSIGNED_BYTE, start);
+	glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+
+	VRAMBytes += int64(texW) * int64(texH) * int64(sizeof(tPixel));
+}
+
+
+void Viewer::TilePyramid::DrawRect(uint texID, int l, int texX, int texY, int texW, int texH, float x0, float y0, float x1, float y1, float originX, float originY, float scale) const
+{
+	// Level pixels are not exactly a power of two of the source since odd sizes round up.
+	const Level& level = Levels[l];
+	float levelX = float(level.Width) / float(Levels[0].Width);
+	float levelY = float(level.Height) / float(Levels[0].Height);
+	float u0 = (x0*levelX - float(texX)) / float(texW);
+	float u1 = (x1*levelX - float(texX)) / float(texW);
+	float v0 = (y0*levelY - float(texY)) / float(texH);
+	float v1 = (y1*levelY - float(texY)) / float(texH);
+
+	float l0 = originX + x0*scale;	float r0 = originX + x1*scale;
+	float b0 = originY + y0*scale;	float t0 = originY + y1*scale;
+
+	glBindTexture(GL_TEXTURE_2D, texID);
+	glBegin(GL_QUADS);
+	glTexCoord2f(u0, v0); glVertex2f(l0, b0);
+	glTexCoord2f(u0, v1); glVertex2f(l0, t0);
+	glTexCoord2f(u1, v1); glVertex2f(r0, t0);
+	glTexCoord2f(u1, v0); glVertex2f(r0, b0);
+	glEnd();
+}
+
+
+void Viewer::TilePyramid::Draw(float originX, float originY, float scale, float clipL, float clipR, float clipB, float clipT, uint overviewTexID)
+{
+	DrawCount++;
+	if (scale <= 0.0f)
+		return;
+
+	// The visible part of the image in source pixels.
+	float width = float(Levels[0].Width);
+	float height = float(Levels[0].Height);
+	float visX0 = tClamp((clipL - originX) / scale, 0.0f, width);
+	float visX1 = tClamp((clipR - originX) / scale, 0.0f, width);
+	float visY0 = tClamp((clipB - originY) / scale, 0.0f, height);
+	float visY1 = tClamp((clipT - originY) / scale, 0.0f, height);
+	if ((visX1 <= visX0) || (visY1 <= visY0))
+		return;
+
+	const Level& overview = Levels[NumLevels-1];
+	if (overviewTexID)
+		DrawRect(overviewTexID, NumLevels-1, 0, 0, overview.Width, overview.Height, visX0, visY0, visX1, visY1, originX, originY, scale);
+
+	// The coarsest level that still has at least one texel per screen pixel.
+	int l = 0;
+	for (float s = scale; (s <= 0.5f) && (l < NumLevels-1); s *= 2.0f)
+		l++;
+
+	if (l == NumLevels-1)
+	{
+		EvictTiles();
+		return;
+	}
+
+	const Level& level = Levels[l];
+	float levelX = float(level.Width) / width;
+	float levelY = float(level.Height) / height;
+	int firstX = tClamp(int(visX0*levelX) / TileSize, 0, level.NumTilesX-1);
+	int lastX = tClamp(int(visX1*levelX) / TileSize, 0, level.NumTilesX-1);
+	int firstY = tClamp(int(visY0*levelY) / TileSize, 0, level.NumTilesY-1);
+	int lastY = tClamp(int(visY1*levelY) / TileSize, 0, level.NumTilesY-1);
+
+	int numUploads = 0;
+	for (int ty = firstY; ty <= lastY; ty++)
+	{
+		for (int tx = firstX; tx <= lastX; tx++)
+		{
+			Tile& tile = level.Tiles[ty*level.NumTilesX + tx];
+			if (!tile.TexID && (numUploads < MaxUploadsPerDraw))
+			{
+				UploadTile(l, tx, ty);
+				numUploads++;
+			}
+
+			// Until it is uploaded the overview shows through.
+			if (!tile.TexID)
+				continue;
+
+			tile.LastDrawn = DrawCount;
+			float x0 = tMax(float(tx*TileSize) / levelX, visX0);
+			float x1 = tMin(float(tMin((tx+1)*TileSize, level.Width)) / levelX, visX1);
+			float y0 = tMax(float(ty*TileSize) / levelY, visY0);
+			float y1 = tMin(float(tMin((ty+1)*TileSize, level.Height)) / levelY, visY1);
+			if ((x1 <= x0) || (y1 <= y0))
+				continue;
+
+			int texX, texY, texW, texH;
+			GetTileTexRect(l, tx, ty, texX, texY, texW, texH);
+			DrawRect(tile.TexID, l, texX, texY, texW, texH, x0, y0, x1, y1, originX, originY, scale);
+		}
+	}
+
+	EvictTiles();
+}
+
+
+void Viewer::TilePyramid::EvictTiles()
+{
+	// Least recently drawn first. Tiles drawn this time round are never evicted so a view that needs more than the
+	// budget still draws properly.
+	while (VRAMBytes > VRAMBudget)
+	{
+		Tile* oldest = nullptr;
+		int oldestLevel = 0;
+		int oldestIndex = 0;
+		for (int l = 0; l < NumLevels; l++)
+		{
+			int numTiles = Levels[l].NumTilesX * Levels[l].NumTilesY;
+			for (int t = 0; t < numTiles; t++)
+			{
+				Tile& tile = Levels[l].Tiles[t];
+				if (tile.TexID && (tile.LastDrawn < DrawCount) && (!oldest || (tile.LastDrawn < oldest->LastDrawn)))
+				{
+					oldest = &tile;
+					oldestLevel = l;
+					oldestIndex = t;
+				}
+			}
+		}
+
+		if (!oldest)
+			return;
+
+		int texX, texY, texW, texH;
+		GetTileTexRect(oldestLevel, oldestIndex % Levels[oldestLevel].NumTilesX, oldestIndex / Levels[oldestLevel].NumTilesX, texX, texY, texW, texH);
+		glDeleteTextures(1, &oldest->TexID);
+		oldest->TexID = 0;
+		VRAMBytes -= int64(texW) * int64(texH) * int64(sizeof(tPixel));
+	}
+}
+
+
+void Viewer::TilePyramid::Unbind()
+{
+	for (int l = 0; l < NumLevels; l++)
+	{
+		int numTiles = Levels[l].NumTilesX * Levels[l].NumTilesY;
+		for (int t = 0; t < numTiles; t++)
+		{
+			if (Levels[l].Tiles[t].TexID)
+			{
+				glDeleteTextures(1, &Levels[l].Tiles[t].TexID);
+				Levels[l].Tiles[t].TexID = 0;
+			}
+		}
+	}
+	VRAMBytes = 0;
+}
+
+
+int64 Viewer::TilePyramid::GetOverviewBytes() const
+{
+	const Level& overview = Levels[NumLevels-1];
+	return int64(overview.Width) * int64(overview.Height) * int64(sizeof(tPixel));
+}
+
+
+int64 Viewer::TilePyramid::GetMemSizeBytes() const
+{
+	int64 numBytes = 0;
+	for (int l = 1; l < NumLevels; l++)
+		numBytes += int64(Levels[l].Width) * int64(Levels[l].Height) * int64(sizeof(tPixel));
+
+	return numBytes;
+}
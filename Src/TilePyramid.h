@@ -0,0 +1,95 @@
+// TilePyramid.h
+//
+// Displays images that are too big for a single texture. The picture is split into square tiles at successive
+// power-of-two reductions. Only the tiles that are on screen at the level matching the zoom get uploaded, and tiles
+// that haven't been drawn for a while are released when the VRAM budget is exceeded.
+//
+// Copyright (c) 2020 Tristan Grimmer.
+// Permission to use, copy, modify, and/or distribute this software for any purpose with or without fee is hereby
+// granted, provided that the above copyright notice and this permission notice appear in all copies.
+//
+// THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH REGARD TO THIS SOFTWARE INCLUDING ALL
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+// INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN
+// AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+// PERFORMANCE OF THIS SOFTWARE.
+
+#pragma once
+#include <Math/tColour.h>
+namespace Viewer
+{
+
+
+class TilePyramid
+{
+public:
+	// Building does not touch OpenGL so it may be done on the load worker. The pixels are not copied and must outlive
+	// the pyramid. Rows are bottom-up like tPicture. The reduced levels are made in parallel and stop at the first one
+	// that fits in a single texture of overviewSize.
+	TilePyramid(const tPixel* pixels, int width, int height, int overviewSize);
+
+	// Textures must have been released with Unbind first since the destructor may run on the worker thread.
+	~TilePyramid();
+
+	// Returns true if an image of this size should be tiled. Beyond the max texture size a single upload fails, and
+	// well before that a single upload of a huge picture stalls the frame.
+	static bool IsNeeded(int width, int height, int maxTextureSize);
+
+	// Uploads the overview level to texID. The overview is used for every zoom level it is enough for, and as the
+	// backdrop while the tiles of the finer levels are paged in.
+	void BindOverview(uint texID) const;
+
+	// Draws the part of the image inside the clip rectangle. Image pixel (0,0) lands on screen at (originX, originY)
+	// and each image pixel covers scale screen pixels. The overview texture is drawn first, then any tiles of the
+	// matching level on top. At most MaxUploadsPerDraw new tiles are uploaded per call so panning never stalls.
+	void Draw(float originX, float originY, float scale, float clipL, float clipR, float clipB, float clipT, uint overviewTexID);
+
+	// Deletes all tile textures. Does not include the overview texture which belongs to the caller.
+	void Unbind();
+
+	int64 GetMemSizeBytes() const;																						// Reduced levels only.
+	int64 GetOverviewBytes() const;
+	int64 GetVRAMBytes() const																							{ return VRAMBytes; }
+	void SetVRAMBudget(int64 numBytes)																					{ VRAMBudget = numBytes; }
+
+	static const int TileSize = 512;
+	static const int OverviewSize = 2048;
+	static const int MaxUploadsPerDraw = 8;
+
+private:
+	struct Tile
+	{
+		uint TexID;
+		int64 LastDrawn;			// Value of DrawCount when the tile was last on screen.
+	};
+
+	struct Level
+	{
+		tPixel* Pixels;				// Level 0 points to the source pixels.
+		int Width;
+		int Height;
+		int NumTilesX;
+		int NumTilesY;
+		Tile* Tiles;
+	};
+
+	void BuildLevel(int level);
+
+	// Tiles have a one pixel border taken from their neighbours so bilinear filtering doesn't show the seams. The
+	// returned rect is the part of the level held in the tile's texture, border included.
+	void GetTileTexRect(int level, int tileX, int tileY, int& texX, int& texY, int& texW, int& texH) const;
+	void UploadTile(int level, int tileX, int tileY);
+
+	// Draws the image space rect [x0, x1] x [y0, y1] using a texture holding the given part of a level.
+	void DrawRect(uint texID, int level, int texX, int texY, int texW, int texH, float x0, float y0, float x1, float y1, float originX, float originY, float scale) const;
+	void EvictTiles();
+
+	Level* Levels		= nullptr;
+	int NumLevels		= 0;		// The last level is the overview.
+	int64 DrawCount		= 0;
+	int64 VRAMBytes		= 0;
+	int64 VRAMBudget	= int64(512)*1024*1024;
+};
+
+
+}